@@ -0,0 +1,239 @@
+#include <fstream>
+#include <sstream>
+#include <cstring>
+
+#include "corpus.h"
+#include "../src/utils/kfs.h"
+
+namespace {
+
+bool is_python(const std::string& path) {
+    // Not kfs::path::split_ext, which can't take a name without a dot
+    return path.size() > 3 && path.compare(path.size() - 3, 3, ".py") == 0;
+}
+
+bool looks_like_text(const std::string& data) {
+    return memchr(data.data(), '\0', std::min<std::size_t>(data.size(), 8192)) == nullptr;
+}
+
+class ModuleWriter {
+public:
+    ModuleWriter(std::mt19937& rng):
+        rng_(rng) {}
+
+    std::string module(int lines) {
+        out_.str(std::string());
+        line_count_ = 0;
+
+        out_ << "# -*- coding: utf-8 -*-\n\"\"\"Generated module\n\nNothing here means anything.\n\"\"\"\n";
+        out_ << "import os\nimport sys\nfrom collections import OrderedDict as od\n\n";
+
+        while(line_count_ < lines) {
+            switch(pick(6)) {
+                case 0: constant(0); break;
+                case 1: function(0, 0); break;
+                case 2: case 3: klass(0, 0); break;
+                case 4: decorated(0); break;
+                default: statement(0); break;
+            }
+            line("");
+        }
+
+        return out_.str();
+    }
+
+private:
+    std::mt19937& rng_;
+    std::ostringstream out_;
+    int line_count_ = 0;
+    int names_ = 0;
+
+    int pick(int n) { return std::uniform_int_distribution<int>(0, n - 1)(rng_); }
+
+    std::string name() {
+        static const char* const parts[] = {"data", "item", "value", "node", "self_", "x", "tmp", "result", "key", "count"};
+        return std::string(parts[pick(10)]) + std::to_string(names_++ % 500);
+    }
+
+    void line(const std::string& text, int indent=0) {
+        out_ << std::string(indent * 4, ' ') << text << "\n";
+        ++line_count_;
+    }
+
+    std::string literal() {
+        switch(pick(9)) {
+            case 0: return std::to_string(pick(100000));
+            case 1: return "0x" + std::to_string(pick(9999)) + "L";
+            case 2: return "1.5e-3j";
+            case 3: return "'single \\'quoted\\' " + name() + "'";
+            case 4: return "u\"unicode \\u00e9 " + name() + "\"";
+            case 5: return "r'raw\\d+\\s*(?P<name>\\w+)'";
+            case 6: return "[" + std::to_string(pick(10)) + ", " + name() + ", (1, 2)]";
+            case 7: return "{'a': 1, \"b\": [2, 3], 4: {}}";
+            default: return name() + "(" + name() + ", key=" + std::to_string(pick(10)) + ")";
+        }
+    }
+
+    void constant(int indent) {
+        line(name() + " = " + literal(), indent);
+    }
+
+    void statement(int indent) {
+        switch(pick(8)) {
+            case 0:
+                line(name() + " = " + literal() + "  # trailing comment", indent);
+                break;
+            case 1:
+                // Brackets over several lines
+                line(name() + " = dict(", indent);
+                line("a=" + literal() + ",", indent + 2);
+                line("b=[x for x in range(10) if x % 2],", indent + 2);
+                line(")", indent);
+                break;
+            case 2:
+                line(name() + " = " + literal() + " + \\", indent);
+                line(literal(), indent + 1);
+                break;
+            case 3:
+                line(name() + " = '''triple", indent);
+                line("quoted ' \" text", 0);
+                line("'''", 0);
+                break;
+            case 4:
+                line("if " + name() + " <> " + literal() + " and not " + name() + ":", indent);
+                line(name() + " += 1", indent + 1);
+                line("elif " + name() + ":", indent);
+                line("pass", indent + 1);
+                break;
+            case 5:
+                line("for " + name() + " in " + name() + ".items():", indent);
+                line("print " + name(), indent + 1);
+                break;
+            case 6:
+                line("try:", indent);
+                line(name() + " = lambda a, b=1: a ** b", indent + 1);
+                line("except (ValueError, KeyError), e:", indent);
+                line("raise", indent + 1);
+                break;
+            default:
+                line("return " + literal(), indent);
+                break;
+        }
+    }
+
+    void function(int indent, int depth) {
+        line("def " + name() + "(self, a, b=" + literal() + ", *args, **kwargs):", indent);
+        line("\"\"\"Docstring for a function\"\"\"", indent + 1);
+
+        int statements = 1 + pick(6);
+        for(int i = 0; i < statements; ++i) {
+            if(depth < 3 && !pick(5)) {
+                function(indent + 1, depth + 1);
+            } else {
+                statement(indent + 1);
+            }
+        }
+    }
+
+    void klass(int indent, int depth) {
+        line("class " + name() + "(" + (pick(2) ? "object" : name()) + ", " + name() + "):", indent);
+        constant(indent + 1);
+
+        int methods = 1 + pick(5);
+        for(int i = 0; i < methods; ++i) {
+            line("");
+            if(depth < 2 && !pick(6)) {
+                klass(indent + 1, depth + 1);
+            } else {
+                line("def " + name() + "(self, " + name() + "=None):", indent + 1);
+                line("self." + name() + " = " + literal(), indent + 2);
+                statement(indent + 2);
+            }
+        }
+    }
+
+    void decorated(int indent) {
+        line("@property", indent);
+        line("@" + name() + ".setter(" + literal() + ")", indent);
+        function(indent, 0);
+    }
+};
+
+void add_awkward_files(Corpus& corpus) {
+    std::string deep;
+    for(int i = 0; i < 400; ++i) {
+        deep += std::string(i, ' ') + "def f" + std::to_string(i) + "(a):\n";
+    }
+    deep += std::string(400, ' ') + "x = 1\n";
+    corpus.push_back(CorpusFile({"<deeply nested>", deep, true}));
+
+    std::string long_line = "x = (";
+    for(int i = 0; i < 200000; ++i) {
+        long_line += "a + ";
+    }
+    long_line += "1)\n";
+    corpus.push_back(CorpusFile({"<long line>", long_line, true}));
+
+    std::string huge_string = "x = '''";
+    for(int i = 0; i < 50000; ++i) {
+        huge_string += "text inside a string which never stops ' \" \\' \n";
+    }
+    huge_string += "'''\n";
+    corpus.push_back(CorpusFile({"<huge string>", huge_string, true}));
+
+    std::string brackets;
+    for(int i = 0; i < 20000; ++i) {
+        brackets += "f([{(\n";
+    }
+    corpus.push_back(CorpusFile({"<unclosed brackets>", brackets, true}));
+
+    std::string quotes;
+    for(int i = 0; i < 20000; ++i) {
+        quotes += "x = 'unterminated \" and \"\"\" again\n";
+    }
+    corpus.push_back(CorpusFile({"<unclosed quotes>", quotes, true}));
+
+    std::string continuations;
+    for(int i = 0; i < 50000; ++i) {
+        continuations += "a = b + \\\n";
+    }
+    continuations += "c\n";
+    corpus.push_back(CorpusFile({"<continuations>", continuations, true}));
+}
+
+}
+
+void load_corpus(const std::string& path, Corpus& corpus, bool text_only) {
+    if(kfs::path::is_link(path)) {
+        return;
+    }
+
+    if(kfs::path::is_dir(path)) {
+        for(auto& name: kfs::path::list_dir(path)) {
+            if(!name.empty() && name[0] != '.') {
+                load_corpus(kfs::path::join(path, name), corpus, text_only);
+            }
+        }
+        return;
+    }
+
+    std::ifstream file(path, std::ios::binary);
+    std::stringstream data;
+    data << file.rdbuf();
+
+    CorpusFile entry({path, data.str(), is_python(path)});
+    if(!text_only || looks_like_text(entry.data)) {
+        corpus.push_back(std::move(entry));
+    }
+}
+
+void generate_corpus(int modules, int lines, unsigned seed, Corpus& corpus) {
+    std::mt19937 rng(seed);
+    ModuleWriter writer(rng);
+
+    for(int i = 0; i < modules; ++i) {
+        corpus.push_back(CorpusFile({"<generated " + std::to_string(i) + ">", writer.module(lines), true}));
+    }
+
+    add_awkward_files(corpus);
+}
@@ -0,0 +1,34 @@
+#ifndef BENCHMARKS_CORPUS_H
+#define BENCHMARKS_CORPUS_H
+
+#include <string>
+#include <vector>
+#include <random>
+
+/*
+ *  Files for the parser benchmark and seeds for the fuzzer. A corpus is either read
+ *  from disk (a directory is walked for everything in it, a Python install's standard
+ *  library makes a good one) or generated, which needs nothing outside the tree.
+ */
+
+struct CorpusFile {
+    std::string name;
+    std::string data; // UTF-8
+    bool python;
+};
+
+typedef std::vector<CorpusFile> Corpus;
+
+/* Adds a file, or everything under a directory, skipping anything which isn't text unless told not to */
+void load_corpus(const std::string& path, Corpus& corpus, bool text_only=true);
+
+/*
+ *  Python modules made of the usual things (classes, nested functions, strings of every
+ *  kind, comments, brackets over several lines...), lines long each. Along with them are
+ *  a few which are only there to be awkward: deep nesting, a very long line, a huge
+ *  string, unclosed brackets and quotes, which are where anything which doesn't scale
+ *  with the length of its input shows up.
+ */
+void generate_corpus(int modules, int lines, unsigned seed, Corpus& corpus);
+
+#endif // BENCHMARKS_CORPUS_H
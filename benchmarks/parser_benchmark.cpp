@@ -0,0 +1,252 @@
+/*
+ *  Runs the parsers the indexer uses over a corpus and reports how fast they go:
+ *
+ *      parser_benchmark [--repeat N] [--generate MODULES[:LINES]] [PATH...]
+ *
+ *  PATHs are files or directories (/usr/lib/python2.7 is a good one), with no PATHs a
+ *  corpus is generated. For each stage it prints throughput in MB/s and tokens/s, heap
+ *  allocations per KB of input, and the slowest file: the longest any one took, and the
+ *  lowest throughput any one got, which is where input the parser handles badly shows up
+ *  first. Files which don't tokenize still count, up to where they fail.
+ */
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <iomanip>
+#include <functional>
+#include <new>
+
+#include "corpus.h"
+#include "../src/utils/unicode.h"
+#include "../src/autocomplete/parsers/python.h"
+#include "../src/autocomplete/parsers/plain.h"
+
+namespace {
+
+std::size_t allocations = 0;
+
+}
+
+void* operator new(std::size_t size) {
+    ++allocations;
+    if(void* memory = std::malloc(size ? size : 1)) {
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* memory) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t) noexcept {
+    std::free(memory);
+}
+
+namespace {
+
+using namespace delimit;
+
+struct Input {
+    const CorpusFile* file;
+    unicode text;
+    std::size_t python_tokens = 0;
+    std::size_t words = 0;
+};
+
+struct Stage {
+    std::string name;
+    bool python_only;
+    std::function<std::size_t (const Input&)> run; // Returns how many tokens it went through
+};
+
+struct Result {
+    std::size_t files = 0;
+    std::size_t errors = 0;
+    std::size_t bytes = 0;
+    std::size_t tokens = 0;
+    std::size_t allocations = 0;
+    double seconds = 0;
+
+    double worst_ms = 0;
+    std::string worst_file;
+
+    double slowest_mb_per_s = 0;
+    std::string slowest_file;
+};
+
+unicode decode(const std::string& data) {
+    try {
+        return unicode(data, "utf-8");
+    } catch(std::exception& e) {
+        return unicode(data, "latin-1");
+    }
+}
+
+std::size_t count_python_tokens(const unicode& text) {
+    parser::Tokenizer tokenizer(text);
+    parser::TokenView token;
+    std::size_t count = 0;
+
+    try {
+        while(tokenizer.next(token)) {
+            ++count;
+        }
+    } catch(std::logic_error& e) {
+        // Up to the error
+    }
+    return count;
+}
+
+Result run_stage(const Stage& stage, const std::vector<Input>& inputs, int repeat) {
+    Result result;
+
+    for(auto& input: inputs) {
+        if(stage.python_only && !input.file->python) {
+            continue;
+        }
+
+        // The fastest of the repeats, the others are noise
+        double best = 0;
+        std::size_t tokens = 0;
+        std::size_t allocated = 0;
+        bool failed = false;
+
+        for(int i = 0; i < repeat; ++i) {
+            std::size_t before = allocations;
+            auto start = std::chrono::steady_clock::now();
+
+            try {
+                tokens = stage.run(input);
+            } catch(std::logic_error& e) {
+                tokens = input.python_tokens;
+                failed = true;
+            }
+
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            best = (i == 0) ? seconds : std::min(best, seconds);
+            allocated = allocations - before;
+        }
+
+        std::size_t bytes = input.file->data.size();
+
+        result.files++;
+        result.errors += failed;
+        result.bytes += bytes;
+        result.tokens += tokens;
+        result.allocations += allocated;
+        result.seconds += best;
+
+        if(best * 1000 > result.worst_ms) {
+            result.worst_ms = best * 1000;
+            result.worst_file = input.file->name;
+        }
+
+        // Tiny files are all overhead, their throughput says nothing
+        double mb_per_s = (bytes / 1e6) / std::max(best, 1e-9);
+        if(bytes >= 4096 && (result.slowest_file.empty() || mb_per_s < result.slowest_mb_per_s)) {
+            result.slowest_mb_per_s = mb_per_s;
+            result.slowest_file = input.file->name;
+        }
+    }
+
+    return result;
+}
+
+void print_result(const std::string& name, const Result& result) {
+    double seconds = std::max(result.seconds, 1e-9);
+
+    std::cout << std::left << std::setw(18) << name << std::right << std::fixed
+        << std::setw(7) << result.files
+        << std::setw(7) << result.errors
+        << std::setw(10) << std::setprecision(1) << (result.bytes / 1e6) / seconds
+        << std::setw(12) << std::setprecision(2) << (result.tokens / 1e6) / seconds
+        << std::setw(11) << std::setprecision(1) << result.allocations / std::max(result.bytes / 1024.0, 1.0)
+        << std::setw(10) << std::setprecision(2) << result.worst_ms << "  " << result.worst_file << "\n"
+        << std::setw(75) << std::setprecision(1) << result.slowest_mb_per_s << "  " << result.slowest_file << " (slowest MB/s)\n";
+}
+
+}
+
+int main(int argc, char** argv) {
+    int repeat = 3;
+    int modules = 200;
+    int lines = 2000;
+    bool generate = false;
+    std::vector<std::string> paths;
+
+    for(int i = 1; i < argc; ++i) {
+        if(!strcmp(argv[i], "--repeat") && i + 1 < argc) {
+            repeat = std::max(1, atoi(argv[++i]));
+        } else if(!strcmp(argv[i], "--generate") && i + 1 < argc) {
+            generate = true;
+            std::string spec = argv[++i];
+            auto colon = spec.find(':');
+            modules = atoi(spec.substr(0, colon).c_str());
+            if(colon != std::string::npos) {
+                lines = atoi(spec.substr(colon + 1).c_str());
+            }
+        } else if(argv[i][0] == '-') {
+            std::cerr << "Usage: " << argv[0] << " [--repeat N] [--generate MODULES[:LINES]] [PATH...]" << std::endl;
+            return 1;
+        } else {
+            paths.push_back(argv[i]);
+        }
+    }
+
+    Corpus corpus;
+    for(auto& path: paths) {
+        load_corpus(path, corpus);
+    }
+
+    if(paths.empty() || generate) {
+        generate_corpus(modules, lines, 1, corpus);
+    }
+
+    std::vector<Input> inputs;
+    std::size_t total_bytes = 0;
+
+    for(auto& file: corpus) {
+        Input input;
+        input.file = &file;
+        input.text = decode(file.data);
+        input.python_tokens = (file.python) ? count_python_tokens(input.text) : 0;
+        input.words = parser::Plain().tokenize(input.text).size();
+        inputs.push_back(std::move(input));
+
+        total_bytes += file.data.size();
+    }
+
+    std::cout << corpus.size() << " files, " << std::setprecision(1) << std::fixed << total_bytes / 1e6 << " MB, best of " << repeat << "\n\n";
+
+    std::vector<Stage> stages = {
+        {"python tokenize", true, [](const Input& input) {
+            return parser::Python().tokenize(input.text).size();
+        }},
+        {"python parse", true, [](const Input& input) {
+            parser::Python().parse(input.text, "m");
+            return input.python_tokens;
+        }},
+        {"python buffer", true, [](const Input& input) {
+            parser::PythonBuffer buffer("m");
+            buffer.set_text(input.text);
+            return buffer.tokens().size();
+        }},
+        {"plain parse", false, [](const Input& input) {
+            parser::Plain().parse(input.text, "");
+            return input.words;
+        }}
+    };
+
+    std::cout << std::left << std::setw(18) << "stage" << std::right
+        << std::setw(7) << "files" << std::setw(7) << "errors" << std::setw(10) << "MB/s"
+        << std::setw(12) << "Mtokens/s" << std::setw(11) << "allocs/KB" << std::setw(10) << "worst ms" << "\n";
+
+    for(auto& stage: stages) {
+        print_result(stage.name, run_stage(stage, inputs, repeat));
+    }
+
+    return 0;
+}
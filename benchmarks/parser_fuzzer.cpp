@@ -0,0 +1,181 @@
+/*
+ *  A fuzz target for the parsers. Built with clang it's a libFuzzer target:
+ *
+ *      parser_fuzzer -timeout=2 -max_len=65536 CORPUS_DIR
+ *
+ *  where the timeout is what catches input the parsers take too long over. With any
+ *  other compiler it only runs the files it's given through the same checks (under the
+ *  sanitizers), and with --seed DIR it writes a generated corpus to start fuzzing from.
+ *
+ *  The first byte picks how the rest is read, so that the Python parser sees characters
+ *  outside ASCII as well as plain text. Besides not crashing, a PythonBuffer which is
+ *  edited must end up with the same tokens and scopes as a fresh parse of its text.
+ */
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include "corpus.h"
+#include "../src/utils/unicode.h"
+#include "../src/utils/kfs.h"
+#include "../src/autocomplete/parsers/python.h"
+#include "../src/autocomplete/parsers/plain.h"
+#include "../src/symbols/extractors.h"
+
+namespace {
+
+using namespace delimit;
+
+unicode to_text(const uint8_t* data, std::size_t size, bool wide) {
+    std::u32string text;
+    text.reserve(size);
+
+    for(std::size_t i = 0; i < size; ++i) {
+        char32_t ch = data[i];
+        if(wide && ch >= 0x80 && i + 1 < size) {
+            // Anything up to the end of the BMP
+            ch = ((ch & 0x7f) << 9) | data[++i];
+        }
+        text.push_back(ch);
+    }
+
+    return unicode(text.c_str());
+}
+
+void check(bool condition, const char* what) {
+    if(!condition) {
+        std::cerr << "Check failed: " << what << std::endl;
+        abort();
+    }
+}
+
+void check_buffer(const parser::PythonBuffer& buffer) {
+    parser::Tokenizer tokenizer(buffer.text());
+    parser::TokenView token;
+    std::size_t i = 0;
+
+    try {
+        while(tokenizer.next(token)) {
+            check(i < buffer.tokens().size(), "buffer has every token");
+            auto& kept = buffer.tokens()[i++];
+            check(kept.exact_type == token.exact_type && kept.offset == token.offset && kept.length == token.length, "buffer tokens match");
+        }
+        check(!buffer.has_error() && i == buffer.tokens().size(), "buffer has no extra tokens");
+    } catch(std::logic_error& e) {
+        check(buffer.has_error(), "buffer has the error");
+        return;
+    }
+
+    auto fresh = parser::Python().parse(buffer.text(), "m").first;
+    auto scopes = buffer.scopes();
+
+    check(fresh.size() == scopes.size(), "buffer has every scope");
+    for(std::size_t j = 0; j < fresh.size(); ++j) {
+        check(fresh[j]->path() == scopes[j]->path(), "buffer scope paths match");
+        check(fresh[j]->start_line == scopes[j]->start_line && fresh[j]->end_line == scopes[j]->end_line, "buffer scope lines match");
+        check(fresh[j]->start_col == scopes[j]->start_col && fresh[j]->end_col == scopes[j]->end_col, "buffer scope columns match");
+    }
+}
+
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, std::size_t size) {
+    if(!size) {
+        return 0;
+    }
+
+    uint8_t mode = data[0];
+    ++data;
+    --size;
+
+    unicode text = to_text(data, size, mode & 1);
+
+    try {
+        parser::Python().tokenize(text);
+    } catch(std::logic_error& e) {
+        // Unclosed strings and brackets are errors
+    }
+
+    try {
+        parser::Python().parse(text, "m");
+    } catch(std::logic_error& e) {
+
+    }
+
+    parser::Plain().parse(text, "");
+
+    std::string bytes(reinterpret_cast<const char*>(data), size);
+    javascript_symbols("fuzz.js", bytes);
+    c_symbols("fuzz.cpp", bytes);
+
+    if(mode & 2) {
+        // The second half is typed into the first, a piece at a time, wherever the mode says
+        parser::PythonBuffer buffer("m");
+        std::size_t half = text.length() / 2;
+        buffer.set_text(text.slice(0, half));
+
+        // Small pieces, but no more than 64 of them as each is checked with a full parse
+        std::size_t piece = std::max<std::size_t>(7, (text.length() - half) / 64 + 1);
+
+        int offset = (half) ? (mode >> 2) % (half + 1) : 0;
+        for(std::size_t i = half; i < text.length(); i += piece) {
+            std::size_t end = std::min(text.length(), i + piece);
+            buffer.insert(offset, text.slice(i, end));
+            offset += end - i;
+            check_buffer(buffer);
+        }
+
+        if(half) {
+            buffer.erase(0, std::min<int>(half, buffer.text().length()));
+            check_buffer(buffer);
+        }
+    }
+
+    return 0;
+}
+
+#ifndef DELIMIT_LIBFUZZER
+
+namespace {
+
+void write_seeds(const std::string& directory) {
+    Corpus corpus;
+    generate_corpus(20, 150, 1, corpus);
+
+    kfs::make_dirs(directory);
+
+    int i = 0;
+    for(auto& file: corpus) {
+        // Plain ASCII, edited through a buffer
+        std::ofstream out(kfs::path::join(directory, "seed" + std::to_string(i++)), std::ios::binary);
+        out << char(2) << file.data.substr(0, 65536);
+    }
+}
+
+}
+
+int main(int argc, char** argv) {
+    if(argc == 3 && !strcmp(argv[1], "--seed")) {
+        write_seeds(argv[2]);
+        return 0;
+    }
+
+    Corpus corpus;
+    for(int i = 1; i < argc; ++i) {
+        load_corpus(argv[i], corpus, false); // Crashes are rarely text
+    }
+
+    for(auto& file: corpus) {
+        std::cout << file.name << std::endl;
+        LLVMFuzzerTestOneInput(reinterpret_cast<const uint8_t*>(file.data.data()), file.data.size());
+    }
+
+    return 0;
+}
+
+#endif
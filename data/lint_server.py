@@ -0,0 +1,90 @@
+#!/usr/bin/env python
+"""
+    Checks Python source for Delimit without starting an interpreter each time.
+
+    Delimit starts one of these per project and talks to it over stdin and stdout,
+    one JSON object per line. Each request is
+
+        {"id": 1, "filename": "/path/to/file.py", "source": "import os\\n"}
+
+    and is answered, in order, with
+
+        {"id": 1, "errors": [{"line": 1, "message": "'os' imported but unused"}]}
+
+    or with {"id": 1, "error": "..."} if it couldn't be checked at all. Lines count
+    from 1. The source is what's in the editor, so unsaved changes are checked too.
+"""
+
+import json
+import sys
+
+try:
+    from pyflakes import api as pyflakes_api
+except ImportError:
+    pyflakes_api = None
+
+
+class Reporter(object):
+    """ Collects what pyflakes finds instead of printing it """
+
+    def __init__(self):
+        self.errors = []
+
+    def add(self, line, message):
+        self.errors.append({"line": line or 1, "message": message})
+
+    def unexpectedError(self, filename, message):
+        self.add(1, str(message))
+
+    def syntaxError(self, filename, message, line, offset, text):
+        self.add(line, message)
+
+    def flake(self, message):
+        self.add(message.lineno, message.message % message.message_args)
+
+
+def check(request):
+    if pyflakes_api is None:
+        return {"error": "pyflakes isn't installed"}
+
+    reporter = Reporter()
+
+    # pyflakes warns about some things with print(), which would corrupt the replies
+    stdout = sys.stdout
+    sys.stdout = sys.stderr
+    try:
+        pyflakes_api.check(request["source"], request.get("filename") or "<buffer>", reporter)
+    finally:
+        sys.stdout = stdout
+
+    return {"errors": reporter.errors}
+
+
+def main():
+    stdin = getattr(sys.stdin, "buffer", sys.stdin)
+    stdout = getattr(sys.stdout, "buffer", sys.stdout)
+
+    while True:
+        line = stdin.readline()
+        if not line:
+            break  # Delimit has gone
+
+        try:
+            request = json.loads(line.decode("utf-8", "replace"))
+        except ValueError:
+            sys.stderr.write("Ignoring a request which isn't JSON\n")
+            continue
+
+        try:
+            reply = check(request)
+        except Exception as e:
+            reply = {"error": "Checking failed: %s" % e}
+
+        reply["id"] = request.get("id")
+
+        stdout.write((json.dumps(reply, ensure_ascii=False) + "\n").encode("utf-8"))
+        stdout.flush()
+
+
+if __name__ == "__main__":
+    main()
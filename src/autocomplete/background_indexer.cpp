@@ -0,0 +1,82 @@
+#include <sys/stat.h>
+
+#include "background_indexer.h"
+#include "datastore.h"
+
+#include "../utils/kazlog.h"
+#include "../utils/content_type.h"
+
+namespace delimit {
+
+BackgroundIndexer::BackgroundIndexer(IndexerPtr indexer, const unicode& root, IgnoreTreePtr ignore_tree):
+    indexer_(indexer),
+    root_(root.encode()),
+    ignore_tree_(ignore_tree) {
+
+    thread_ = std::thread(&BackgroundIndexer::run, this);
+}
+
+BackgroundIndexer::~BackgroundIndexer() {
+    cancelled_ = true;
+    queue_.close();
+
+    if(thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+void BackgroundIndexer::rescan() {
+    if(root_.empty() || rescan_queued_.exchange(true)) {
+        return;
+    }
+
+    queue_.push(std::string());
+}
+
+void BackgroundIndexer::update(const std::vector<std::string>& paths) {
+    for(auto& path: paths) {
+        if(!path.empty()) {
+            queue_.push(path);
+        }
+    }
+}
+
+void BackgroundIndexer::apply_delta(const WatchDelta& delta) {
+    // Anything at the directory level is left to a rescan, it only looks at what changed
+    if(delta.overflowed || delta.head_changed || !delta.created_directories.empty() ||
+       !delta.deleted_directories.empty() || !delta.rescan_directories.empty()) {
+        rescan();
+    }
+
+    update(delta.deleted);
+    update(delta.created);
+    update(delta.modified);
+}
+
+void BackgroundIndexer::run() {
+    std::string path;
+    while(queue_.pop(path)) {
+        if(cancelled_) {
+            break;
+        }
+
+        try {
+            if(path.empty()) {
+                rescan_queued_ = false;
+                indexer_->index_directory(root_, 0, &cancelled_, ignore_tree_);
+                continue;
+            }
+
+            struct stat st;
+            if(::stat(path.c_str(), &st) != 0) {
+                indexer_->datastore()->delete_scopes_by_filename(path);
+            } else if(S_ISREG(st.st_mode) && ContentClassifier::instance().is_text(path, st)) {
+                indexer_->index_file(path);
+            }
+        } catch(std::exception& e) {
+            L_WARN(_F("Unable to index {0}: {1}").format((path.empty()) ? root_ : path, e.what()));
+        }
+    }
+}
+
+}
@@ -0,0 +1,54 @@
+#ifndef BACKGROUND_INDEXER_H
+#define BACKGROUND_INDEXER_H
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "indexer.h"
+#include "../utils/blocking_queue.h"
+#include "../utils/project_watcher.h"
+
+namespace delimit {
+
+/*
+ *  Keeps an indexer up to date from a thread of its own, so nothing waits on parsing.
+ *  Work is done in the order it's queued: whole passes over the root directory, which
+ *  are cheap when little has changed, and single files as they're saved or reported
+ *  by a ProjectWatcher. Destroying it cancels whatever is running.
+ */
+class BackgroundIndexer {
+public:
+    BackgroundIndexer(IndexerPtr indexer, const unicode& root=unicode(), IgnoreTreePtr ignore_tree=IgnoreTreePtr());
+    ~BackgroundIndexer();
+
+    /* Queues a pass over the root directory, unless one is already waiting */
+    void rescan();
+
+    /* Queues files to be indexed, or removed from the index if they no longer exist */
+    void update(const std::vector<std::string>& paths);
+
+    void apply_delta(const WatchDelta& delta);
+
+    IndexerPtr indexer() const { return indexer_; }
+
+private:
+    IndexerPtr indexer_;
+    std::string root_;
+    IgnoreTreePtr ignore_tree_; // Shared with the project, so .gitignore edits are seen
+
+    BlockingQueue<std::string> queue_; // An empty path means a rescan
+    std::atomic<bool> rescan_queued_{false};
+    std::atomic<bool> cancelled_{false};
+
+    std::thread thread_;
+
+    void run();
+};
+
+typedef std::shared_ptr<BackgroundIndexer> BackgroundIndexerPtr;
+
+}
+
+#endif // BACKGROUND_INDEXER_H
@@ -8,6 +8,8 @@ Scope::Scope(const unicode& path, std::vector<unicode> inherited_scopes):
     end_line(0),
     start_col(0),
     end_col(0),
+    occurrences(1),
+    kind(KIND_UNKNOWN),
     path_(path),
     inherited_paths_(inherited_scopes) {
 
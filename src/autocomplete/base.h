@@ -20,14 +20,28 @@ typedef std::shared_ptr<Indexer> IndexerPtr;
 
 class FileParser {
 public:
+    virtual ~FileParser() {}
+
     virtual const unicode name() const = 0;
     virtual std::pair<std::vector<ScopePtr>, bool> parse(const unicode& data, const unicode& base_scope) = 0;
     virtual unicode base_scope_from_filename(const unicode& filename) = 0;
     virtual bool supports_nested_lookups() const = 0;
+
+    /* Parsers aren't thread-safe, each indexing thread works with its own copy */
+    virtual FileParserPtr clone() const = 0;
 };
 
 class Scope {
 public:
+    // What declared it, for parsers which can tell
+    enum Kind {
+        KIND_UNKNOWN,
+        KIND_CLASS,
+        KIND_FUNCTION,
+        KIND_ARGUMENT,
+        KIND_VARIABLE
+    };
+
     Scope(const unicode& path, std::vector<unicode> inherited_scopes=std::vector<unicode>());
 
     const unicode path() const { return path_; }
@@ -38,11 +52,30 @@ public:
     int start_col;
     int end_col;
 
+    // How many times it turns up, words which plain parsers find repeatedly are kept once
+    int occurrences;
+
+    Kind kind;
+
 private:
     unicode path_;
     std::vector<unicode> inherited_paths_;
 };
 
+/*
+ *  The difference between two versions of a file's scopes, for when most of the file
+ *  hasn't changed. Applying it removes the removed scopes (which have their old line
+ *  numbers), then moves every start or end line which is on or after from_line by
+ *  line_shift, then adds the added scopes.
+ */
+struct ScopeDelta {
+    std::vector<ScopePtr> removed;
+    std::vector<ScopePtr> added;
+    int from_line = 0;
+    int line_shift = 0;
+
+    bool empty() const { return removed.empty() && added.empty() && !line_shift; }
+};
 
 /**
    USAGE:
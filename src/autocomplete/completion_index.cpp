@@ -0,0 +1,685 @@
+#include <queue>
+#include <climits>
+#include <functional>
+#include <algorithm>
+#include <unordered_set>
+
+#include "completion_index.h"
+
+namespace delimit {
+
+struct RadixTrie::Node {
+    std::string label;
+    std::vector<std::unique_ptr<Node>> children; // Sorted on the first byte of their label
+    uint32_t count = 0; // Non-zero if a key ends here
+    uint32_t max_count = 0; // The highest count here or anywhere below
+    uint64_t mask = 0; // Characters in this label and everything below it
+};
+
+static char lower(char c) {
+    return (c >= 'A' && c <= 'Z') ? char(c - 'A' + 'a') : c;
+}
+
+static uint64_t char_bit(char c) {
+    unsigned char ch = (unsigned char) lower(c);
+
+    if(ch >= 'a' && ch <= 'z') return 1ULL << (ch - 'a');
+    if(ch >= '0' && ch <= '9') return 1ULL << (26 + ch - '0');
+    if(ch == '_') return 1ULL << 36;
+
+    // Everything else shares the remaining bits, which only costs us some pruning
+    return 1ULL << (37 + (ch % 27));
+}
+
+static uint64_t string_mask(const std::string& str, std::size_t start=0) {
+    uint64_t mask = 0;
+    for(std::size_t i = start; i < str.length(); ++i) {
+        mask |= char_bit(str[i]);
+    }
+    return mask;
+}
+
+template<typename NodeType>
+static void recompute_summary(NodeType* node) {
+    /* Rebuilds the mask and max_count from the node's own label and count, and its children */
+    node->mask = string_mask(node->label);
+    node->max_count = node->count;
+    for(auto& child: node->children) {
+        node->mask |= child->mask;
+        node->max_count = std::max(node->max_count, child->max_count);
+    }
+}
+
+template<typename NodeType>
+static typename std::vector<std::unique_ptr<NodeType>>::iterator find_child(NodeType* node, char c) {
+    return std::lower_bound(
+        node->children.begin(), node->children.end(), c,
+        [](const std::unique_ptr<NodeType>& child, char value) { return child->label[0] < value; }
+    );
+}
+
+template<typename NodeType>
+static typename std::vector<std::unique_ptr<NodeType>>::const_iterator find_child(const NodeType* node, char c) {
+    return std::lower_bound(
+        node->children.begin(), node->children.end(), c,
+        [](const std::unique_ptr<NodeType>& child, char value) { return child->label[0] < value; }
+    );
+}
+
+template<typename NodeType>
+static void merge_with_only_child(NodeType* node) {
+    /* Folds a node which no longer ends a key into its single child */
+    std::unique_ptr<NodeType> child = std::move(node->children[0]);
+
+    node->label += child->label;
+    node->count = child->count;
+    node->children = std::move(child->children);
+    recompute_summary(node);
+}
+
+template<typename NodeType>
+static bool erase_from(NodeType* node, const std::string& key, std::size_t pos, uint32_t count, bool& removed_key) {
+    if(pos == key.length()) {
+        if(!node->count) {
+            return false;
+        }
+
+        node->count = (count >= node->count) ? 0 : node->count - count;
+        removed_key = (node->count == 0);
+        recompute_summary(node);
+        return true;
+    }
+
+    auto it = find_child(node, key[pos]);
+    if(it == node->children.end() || (*it)->label[0] != key[pos]) {
+        return false;
+    }
+
+    NodeType* child = it->get();
+    if(key.compare(pos, child->label.length(), child->label) != 0) {
+        return false;
+    }
+
+    if(!erase_from(child, key, pos + child->label.length(), count, removed_key)) {
+        return false;
+    }
+
+    if(removed_key && !child->count) {
+        if(child->children.empty()) {
+            node->children.erase(it);
+        } else if(child->children.size() == 1) {
+            merge_with_only_child(child);
+        }
+    }
+
+    recompute_summary(node);
+    return true;
+}
+
+RadixTrie::RadixTrie():
+    root_(new Node()) {
+
+}
+
+RadixTrie::~RadixTrie() {
+
+}
+
+void RadixTrie::clear() {
+    root_.reset(new Node());
+    size_ = 0;
+}
+
+void RadixTrie::insert(const std::string& key, uint32_t count) {
+    if(!count) {
+        return;
+    }
+
+    // Adding a key only ever adds characters below the nodes on its path
+    std::vector<uint64_t> suffix_masks(key.length() + 1, 0);
+    for(int i = int(key.length()) - 1; i >= 0; --i) {
+        suffix_masks[i] = suffix_masks[i + 1] | char_bit(key[i]);
+    }
+
+    Node* node = root_.get();
+    std::size_t pos = 0;
+
+    std::vector<Node*> path;
+    uint32_t new_count = count;
+
+    while(true) {
+        node->mask |= suffix_masks[pos - node->label.length()];
+        path.push_back(node);
+
+        if(pos == key.length()) {
+            if(!node->count) {
+                ++size_;
+            }
+            node->count += count;
+            new_count = node->count;
+            break;
+        }
+
+        auto it = find_child(node, key[pos]);
+        if(it == node->children.end() || (*it)->label[0] != key[pos]) {
+            std::unique_ptr<Node> leaf(new Node());
+            leaf->label = key.substr(pos);
+            leaf->count = count;
+            recompute_summary(leaf.get());
+
+            node->children.insert(it, std::move(leaf));
+            ++size_;
+            break;
+        }
+
+        Node* child = it->get();
+
+        std::size_t common = 0;
+        std::size_t max_common = std::min(child->label.length(), key.length() - pos);
+        while(common < max_common && child->label[common] == key[pos + common]) {
+            ++common;
+        }
+
+        if(common < child->label.length()) {
+            // Split the edge, the new node takes the shared part of the label
+            std::unique_ptr<Node> middle(new Node());
+            middle->label = child->label.substr(0, common);
+
+            child->label.erase(0, common);
+            recompute_summary(child);
+
+            middle->children.push_back(std::move(*it));
+            *it = std::move(middle);
+            child = it->get();
+            recompute_summary(child);
+        }
+
+        pos += common;
+        node = child;
+    }
+
+    for(auto visited: path) {
+        visited->max_count = std::max(visited->max_count, new_count);
+    }
+}
+
+bool RadixTrie::erase(const std::string& key, uint32_t count) {
+    bool removed_key = false;
+    if(!erase_from(root_.get(), key, 0, count, removed_key)) {
+        return false;
+    }
+
+    if(removed_key) {
+        --size_;
+    }
+    return true;
+}
+
+uint32_t RadixTrie::count(const std::string& key) const {
+    const Node* node = root_.get();
+    std::size_t pos = 0;
+
+    while(pos < key.length()) {
+        auto it = find_child(node, key[pos]);
+        if(it == node->children.end() || (*it)->label[0] != key[pos]) {
+            return 0;
+        }
+
+        node = it->get();
+        if(key.compare(pos, node->label.length(), node->label) != 0) {
+            return 0;
+        }
+        pos += node->label.length();
+    }
+
+    return node->count;
+}
+
+const RadixTrie::Node* RadixTrie::find_prefix(const std::string& prefix, std::string& text) const {
+    /*
+     *  The node whose subtree holds every key starting with the prefix, or nullptr.
+     *  text is set to the key the node ends, which the prefix may stop part way into.
+     */
+    const Node* node = root_.get();
+    std::size_t pos = 0;
+
+    text.clear();
+
+    while(pos < prefix.length()) {
+        auto it = find_child(node, prefix[pos]);
+        if(it == node->children.end() || (*it)->label[0] != prefix[pos]) {
+            return nullptr;
+        }
+
+        node = it->get();
+
+        std::size_t length = std::min(node->label.length(), prefix.length() - pos);
+        if(prefix.compare(pos, length, node->label, 0, length) != 0) {
+            return nullptr;
+        }
+
+        text += node->label;
+        pos += node->label.length();
+    }
+
+    return node;
+}
+
+std::vector<Completion> RadixTrie::prefix_matches(const std::string& prefix, std::size_t limit) const {
+    std::vector<Completion> results;
+    if(!limit) {
+        return results;
+    }
+
+    std::string text;
+    const Node* node = find_prefix(prefix, text);
+    if(!node) {
+        return results;
+    }
+
+    /*
+     *  Expand the subtree shortest key first. Keys come out in length order, so we can
+     *  stop once we have enough and have seen every key as long as the last one (within
+     *  reason, a huge set of same-length keys is cut short). The text of a key is only
+     *  built when it's returned, by following the parent links.
+     */
+    struct Visited {
+        const Node* node;
+        int parent;
+    };
+
+    std::vector<Visited> visited;
+    visited.push_back(Visited{node, -1});
+
+    auto text_of = [&](int index) -> std::string {
+        std::vector<const std::string*> labels;
+        for(; index > 0; index = visited[index].parent) {
+            labels.push_back(&visited[index].node->label);
+        }
+
+        std::string result = text;
+        for(auto it = labels.rbegin(); it != labels.rend(); ++it) {
+            result += **it;
+        }
+        return result;
+    };
+
+    typedef std::pair<std::size_t, int> Entry; // Key length, index into visited
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> queue;
+    queue.push(Entry(text.length(), 0));
+
+    std::size_t last_length = 0;
+    while(!queue.empty()) {
+        Entry entry = queue.top();
+        queue.pop();
+
+        if(results.size() >= limit && (entry.first > last_length || results.size() >= limit * 4)) {
+            break;
+        }
+
+        const Node* current = visited[entry.second].node;
+
+        if(current->count) {
+            Completion completion;
+            completion.text = text_of(entry.second);
+            completion.count = current->count;
+            results.push_back(completion);
+            last_length = entry.first;
+        }
+
+        for(auto& child: current->children) {
+            visited.push_back(Visited{child.get(), entry.second});
+            queue.push(Entry(entry.first + child->label.length(), int(visited.size() - 1)));
+        }
+    }
+
+    std::sort(results.begin(), results.end(), [](const Completion& lhs, const Completion& rhs) {
+        if(lhs.text.length() != rhs.text.length()) return lhs.text.length() < rhs.text.length();
+        if(lhs.count != rhs.count) return lhs.count > rhs.count;
+        return lhs.text < rhs.text;
+    });
+
+    if(results.size() > limit) {
+        results.resize(limit);
+    }
+
+    return results;
+}
+
+std::vector<Completion> RadixTrie::frequent_matches(const std::string& prefix, std::size_t limit) const {
+    std::vector<Completion> results;
+    if(!limit) {
+        return results;
+    }
+
+    std::string text;
+    const Node* node = find_prefix(prefix, text);
+    if(!node) {
+        return results;
+    }
+
+    /*
+     *  Best first on max_count. A subtree's entry is ranked by the highest count inside
+     *  it, and the key at a node gets its own entry ranked by its count, so keys come
+     *  off the queue most common first. Ties go to the shorter key.
+     */
+    struct Visited {
+        const Node* node;
+        int parent;
+    };
+
+    std::vector<Visited> visited;
+    visited.push_back(Visited{node, -1});
+
+    struct Entry {
+        uint32_t priority;
+        std::size_t length;
+        int index;
+        bool is_key; // Otherwise the entry stands for the node's subtree
+
+        bool operator<(const Entry& rhs) const {
+            if(priority != rhs.priority) return priority < rhs.priority;
+            if(length != rhs.length) return length > rhs.length;
+            return is_key < rhs.is_key;
+        }
+    };
+
+    std::priority_queue<Entry> queue;
+    queue.push(Entry{node->max_count, text.length(), 0, false});
+
+    while(!queue.empty() && results.size() < limit) {
+        Entry entry = queue.top();
+        queue.pop();
+
+        const Node* current = visited[entry.index].node;
+
+        if(entry.is_key) {
+            std::vector<const std::string*> labels;
+            for(int index = entry.index; index > 0; index = visited[index].parent) {
+                labels.push_back(&visited[index].node->label);
+            }
+
+            Completion completion;
+            completion.text = text;
+            for(auto it = labels.rbegin(); it != labels.rend(); ++it) {
+                completion.text += **it;
+            }
+            completion.count = current->count;
+            results.push_back(completion);
+            continue;
+        }
+
+        if(current->count) {
+            queue.push(Entry{current->count, entry.length, entry.index, true});
+        }
+
+        for(auto& child: current->children) {
+            visited.push_back(Visited{child.get(), entry.index});
+            queue.push(Entry{child->max_count, entry.length + child->label.length(), int(visited.size() - 1), false});
+        }
+    }
+
+    return results;
+}
+
+static bool is_separator(char c) {
+    return c == ':' || c == '.' || c == '_' || c == '/' || c == '-';
+}
+
+static int fuzzy_score(const std::string& key, const std::string& query, std::vector<int>& previous, std::vector<int>& current) {
+    /*
+     *  The best alignment of the (lower case) query against the key. Matches at the
+     *  start of the key or of a word, and runs of consecutive matches, score highest.
+     */
+    const int START_BONUS = 10;
+    const int WORD_BONUS = 8;
+    const int CONSECUTIVE_BONUS = 6;
+    const int NO_MATCH = INT_MIN / 2;
+
+    auto bonus = [&](std::size_t j) -> int {
+        if(j == 0) return START_BONUS;
+        if(is_separator(key[j - 1])) return WORD_BONUS;
+        if(key[j] >= 'A' && key[j] <= 'Z' && key[j - 1] >= 'a' && key[j - 1] <= 'z') return WORD_BONUS;
+        return 0;
+    };
+
+    // previous[j] is the best score with the last matched query character at key[j]
+    // Passed in so they can be reused between calls
+    previous.assign(key.length(), NO_MATCH);
+    current.assign(key.length(), NO_MATCH);
+
+    for(std::size_t j = 0; j < key.length(); ++j) {
+        if(lower(key[j]) == query[0]) {
+            previous[j] = 1 + bonus(j);
+        }
+    }
+
+    for(std::size_t i = 1; i < query.length(); ++i) {
+        int best_before = NO_MATCH; // Best of previous[0..j-2]
+
+        for(std::size_t j = 0; j < key.length(); ++j) {
+            current[j] = NO_MATCH;
+
+            if(j >= 2) {
+                best_before = std::max(best_before, previous[j - 2]);
+            }
+
+            if(lower(key[j]) != query[i] || j == 0) {
+                continue;
+            }
+
+            int best = NO_MATCH;
+            if(previous[j - 1] != NO_MATCH) {
+                best = previous[j - 1] + CONSECUTIVE_BONUS;
+            }
+            if(best_before != NO_MATCH) {
+                best = std::max(best, best_before + bonus(j));
+            }
+
+            if(best != NO_MATCH) {
+                current[j] = best + 1;
+            }
+        }
+
+        previous.swap(current);
+    }
+
+    int result = NO_MATCH;
+    for(std::size_t j = 0; j < key.length(); ++j) {
+        result = std::max(result, previous[j]);
+    }
+
+    // Between two equally good matches, prefer the shorter key
+    return result - int(key.length() / 8);
+}
+
+std::vector<Completion> RadixTrie::fuzzy_matches(const std::string& query, std::size_t limit) const {
+    std::vector<Completion> results;
+    if(!limit || query.empty()) {
+        return results;
+    }
+
+    std::string lowered(query);
+    std::transform(lowered.begin(), lowered.end(), lowered.begin(), lower);
+
+    // remaining[i] is the mask of the characters still to match after matching i of them
+    std::vector<uint64_t> remaining(lowered.length() + 1, 0);
+    for(int i = int(lowered.length()) - 1; i >= 0; --i) {
+        remaining[i] = remaining[i + 1] | char_bit(lowered[i]);
+    }
+
+    auto better = [](const Completion& lhs, const Completion& rhs) {
+        if(lhs.score != rhs.score) return lhs.score > rhs.score;
+        if(lhs.count != rhs.count) return lhs.count > rhs.count;
+        if(lhs.text.length() != rhs.text.length()) return lhs.text.length() < rhs.text.length();
+        return lhs.text < rhs.text;
+    };
+
+    // The best matches so far, as a heap with the worst of them on top
+    results.reserve(limit + 1);
+
+    std::vector<int> previous, current;
+    std::string text;
+
+    std::function<void (const Node*, std::size_t)> visit = [&](const Node* node, std::size_t matched) {
+        std::size_t length = text.length();
+        text += node->label;
+
+        for(char c: node->label) {
+            if(matched < lowered.length() && lower(c) == lowered[matched]) {
+                ++matched;
+            }
+        }
+
+        if(node->count && matched == lowered.length()) {
+            Completion completion;
+            completion.count = node->count;
+            completion.score = fuzzy_score(text, lowered, previous, current);
+
+            if(results.size() < limit || completion.score >= results.front().score) {
+                completion.text = text;
+                results.push_back(completion);
+                std::push_heap(results.begin(), results.end(), better);
+
+                if(results.size() > limit) {
+                    std::pop_heap(results.begin(), results.end(), better);
+                    results.pop_back();
+                }
+            }
+        }
+
+        for(auto& child: node->children) {
+            if((child->mask & remaining[matched]) == remaining[matched]) {
+                visit(child.get(), matched);
+            }
+        }
+
+        text.resize(length);
+    };
+
+    /*
+     *  The first character of the query has to match the first character of the key,
+     *  as it does in most editors. Without that anchor every lookup would have to walk
+     *  nearly the whole trie.
+     */
+    for(auto& child: root_->children) {
+        if(lower(child->label[0]) == lowered[0] && (child->mask & remaining[0]) == remaining[0]) {
+            visit(child.get(), 0);
+        }
+    }
+
+    std::sort_heap(results.begin(), results.end(), better);
+
+    return results;
+}
+
+void CompletionIndex::add(const std::string& parser, const std::string& text, uint32_t count) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    tries_[parser].insert(text, count);
+}
+
+void CompletionIndex::remove(const std::string& parser, const std::string& text, uint32_t count) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    auto it = tries_.find(parser);
+    if(it != tries_.end()) {
+        it->second.erase(text, count);
+    }
+}
+
+void CompletionIndex::clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    tries_.clear();
+}
+
+std::size_t CompletionIndex::size(const std::string& parser) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    auto it = tries_.find(parser);
+    return (it == tries_.end()) ? 0 : it->second.size();
+}
+
+std::vector<std::string> CompletionIndex::complete(const std::string& parser, const std::string& text, std::size_t limit) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    std::vector<std::string> results;
+
+    auto it = tries_.find(parser);
+    if(it == tries_.end()) {
+        return results;
+    }
+
+    const RadixTrie& trie = it->second;
+
+    std::unordered_set<std::string> seen;
+    for(auto& completion: trie.prefix_matches(text, limit)) {
+        seen.insert(completion.text);
+        results.push_back(completion.text);
+    }
+
+    if(results.size() < limit && !text.empty()) {
+        for(auto& completion: trie.fuzzy_matches(text, limit + results.size())) {
+            if(results.size() == limit) {
+                break;
+            }
+
+            if(!seen.count(completion.text)) {
+                results.push_back(completion.text);
+            }
+        }
+    }
+
+    return results;
+}
+
+void WordIndex::add(const std::string& word, uint32_t count) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    trie_.insert(word, count);
+}
+
+void WordIndex::remove(const std::string& word, uint32_t count) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    trie_.erase(word, count);
+}
+
+void WordIndex::clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    trie_.clear();
+}
+
+std::size_t WordIndex::size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return trie_.size();
+}
+
+std::vector<std::string> WordIndex::complete(const std::string& prefix, std::size_t limit) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    std::vector<std::string> results;
+
+    // The word being typed is already there, so it isn't worth proposing
+    for(auto& completion: trie_.frequent_matches(prefix, limit + 1)) {
+        if(completion.text != prefix && results.size() < limit) {
+            results.push_back(completion.text);
+        }
+    }
+
+    if(results.size() < limit && !prefix.empty()) {
+        std::unordered_set<std::string> seen(results.begin(), results.end());
+        seen.insert(prefix);
+
+        for(auto& completion: trie_.fuzzy_matches(prefix, limit + results.size() + 1)) {
+            if(results.size() == limit) {
+                break;
+            }
+
+            if(!seen.count(completion.text)) {
+                results.push_back(completion.text);
+            }
+        }
+    }
+
+    return results;
+}
+
+}
@@ -0,0 +1,106 @@
+#ifndef COMPLETION_INDEX_H
+#define COMPLETION_INDEX_H
+
+#include <mutex>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+
+namespace delimit {
+
+struct Completion {
+    std::string text;
+    uint32_t count = 0; // How many times the text was indexed
+    int score = 0; // Only meaningful for fuzzy matches
+};
+
+/*
+ *  A compressed radix trie of UTF-8 strings. Each key is reference counted, so the
+ *  same name can be added once per scope that defines it and only disappears when
+ *  the last of them is removed.
+ *
+ *  Every node also stores a bitmask of the characters found anywhere below it, which
+ *  lets a fuzzy search skip whole subtrees that can't contain the query.
+ */
+class RadixTrie {
+public:
+    RadixTrie();
+    ~RadixTrie();
+
+    void insert(const std::string& key, uint32_t count=1);
+
+    /* Returns false if the key wasn't there */
+    bool erase(const std::string& key, uint32_t count=1);
+
+    uint32_t count(const std::string& key) const;
+
+    std::size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    void clear();
+
+    /* Keys starting with prefix, shortest first, then most common, then alphabetical */
+    std::vector<Completion> prefix_matches(const std::string& prefix, std::size_t limit) const;
+
+    /* Keys starting with prefix, most common first, then shortest */
+    std::vector<Completion> frequent_matches(const std::string& prefix, std::size_t limit) const;
+
+    /* Case-insensitive subsequence matches anchored on the first character, best first */
+    std::vector<Completion> fuzzy_matches(const std::string& query, std::size_t limit) const;
+
+private:
+    struct Node;
+
+    std::unique_ptr<Node> root_;
+    std::size_t size_ = 0;
+
+    const Node* find_prefix(const std::string& prefix, std::string& text) const;
+};
+
+/*
+ *  Thread-safe completion lookups, with a separate trie for each parser
+ */
+class CompletionIndex {
+public:
+    void add(const std::string& parser, const std::string& text, uint32_t count=1);
+    void remove(const std::string& parser, const std::string& text, uint32_t count=1);
+    void clear();
+
+    /* Prefix matches, followed by fuzzy matches if there aren't enough of those */
+    std::vector<std::string> complete(const std::string& parser, const std::string& text, std::size_t limit) const;
+
+    std::size_t size(const std::string& parser) const;
+
+private:
+    mutable std::mutex mutex_;
+    std::unordered_map<std::string, RadixTrie> tries_;
+};
+
+typedef std::shared_ptr<CompletionIndex> CompletionIndexPtr;
+
+/*
+ *  Every word in the project, whichever parser found it, counted by how often it
+ *  appears. Thread-safe, and shared by every document's word completion.
+ */
+class WordIndex {
+public:
+    void add(const std::string& word, uint32_t count=1);
+    void remove(const std::string& word, uint32_t count=1);
+    void clear();
+
+    /* The most common words starting with prefix, then fuzzy matches. Never prefix itself. */
+    std::vector<std::string> complete(const std::string& prefix, std::size_t limit) const;
+
+    std::size_t size() const;
+
+private:
+    mutable std::mutex mutex_;
+    RadixTrie trie_;
+};
+
+typedef std::shared_ptr<WordIndex> WordIndexPtr;
+
+}
+
+#endif // COMPLETION_INDEX_H
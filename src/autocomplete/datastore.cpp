@@ -1,51 +1,216 @@
 #include <cassert>
-#include <gtkmm.h>
+#include <cstdio>
+#include <map>
+#include <algorithm>
+#include <unordered_set>
 #include "datastore.h"
 
 #include "../utils/kfs.h"
 #include "../utils/kazlog.h"
+#include "../utils/xxhash.h"
 
 namespace delimit {
 
-std::vector<unicode> INITIAL_DATA_SQL = {
-    "BEGIN",
+static const int MAX_PARAMETERS = 999;
+static const int MAX_ROWS_PER_INSERT = 128;
+static const std::size_t MAX_TASKS_PER_TRANSACTION = 500;
+
+// Writers block once this many tasks are waiting, so bulk indexing can't outrun the disk
+static const std::size_t MAX_QUEUED_WRITES = MAX_TASKS_PER_TRANSACTION * 4;
+
+static const std::vector<std::string> WRITER_PRAGMAS = {
+    "PRAGMA journal_mode=WAL",
+    "PRAGMA synchronous=NORMAL", // Safe with WAL, we only risk the last transactions on power loss
+    "PRAGMA cache_size=-16000", // KiB
+    "PRAGMA temp_store=MEMORY",
+};
+
+static const std::vector<std::string> READER_PRAGMAS = {
+    "PRAGMA cache_size=-8000",
+    "PRAGMA temp_store=MEMORY",
+};
+
+static const int BUSY_TIMEOUT_MS = 5000;
+static const std::size_t MAX_COMPLETIONS = 50;
+static const std::size_t MAX_CACHED_SCOPE_TREES = 256;
+
+/*
+ *  Filenames, scope paths and parser names are each stored once and referred to by id,
+ *  most paths turn up in many files and every scope has a parser. The version stored in
+ *  a database is a hash of this, so any change to it gets picked up on open.
+ */
+static const std::vector<std::string> SCHEMA_SQL = {
     "CREATE TABLE version(version VARCHAR(32) PRIMARY KEY)",
-    "CREATE TABLE scope(id INTEGER PRIMARY KEY, filename VARCHAR(255) NOT NULL, path VARCHAR(1024) NOT NULL, start_line INTEGER NOT NULL, start_col INTEGER NOT NULL, end_line INTEGER NOT NULL, end_col INTEGER NOT NULL, parser VARCHAR(255) NOT NULL, UNIQUE(filename, path, start_line, end_line))",
-    "CREATE INDEX filename_idx ON scope(path)",
-    "CREATE TABLE scope_parent(id INTEGER PRIMARY KEY, path VARCHAR(1024), scope INTEGER, FOREIGN KEY(scope) REFERENCES scope(id))",
-    "COMMIT",
+    "CREATE TABLE file(id INTEGER PRIMARY KEY, name TEXT NOT NULL UNIQUE)",
+    "CREATE TABLE path(id INTEGER PRIMARY KEY, name TEXT NOT NULL UNIQUE)",
+    "CREATE TABLE parser(id INTEGER PRIMARY KEY, name TEXT NOT NULL UNIQUE)",
+    "CREATE TABLE scope(id INTEGER PRIMARY KEY, file INTEGER NOT NULL REFERENCES file(id), path INTEGER NOT NULL REFERENCES path(id), start_line INTEGER NOT NULL, start_col INTEGER NOT NULL, end_line INTEGER NOT NULL, end_col INTEGER NOT NULL, occurrences INTEGER NOT NULL DEFAULT 1, parser INTEGER NOT NULL REFERENCES parser(id), UNIQUE(file, path, start_line, end_line))",
+    "CREATE INDEX scope_parser_path_idx ON scope(parser, path)", // Covers loading the completion index
+    "CREATE TABLE scope_parent(scope INTEGER NOT NULL REFERENCES scope(id), position INTEGER NOT NULL, path INTEGER NOT NULL REFERENCES path(id), PRIMARY KEY(scope, position)) WITHOUT ROWID",
+    "CREATE TABLE file_state(file INTEGER PRIMARY KEY REFERENCES file(id), size INTEGER NOT NULL, mtime_sec INTEGER NOT NULL, mtime_nsec INTEGER NOT NULL, hash INTEGER NOT NULL)",
+};
+
+/*
+ *  Version 1 stored the strings in every row. Its tables are moved out of the way, the
+ *  current schema is created, and then the rows are copied across. Only a database with
+ *  exactly version 1's tables is migrated, anything else calling itself version 1 is
+ *  rebuilt.
+ */
+static const char* V1_VERSION = "1";
+
+static const std::vector<std::string> V1_TABLES = {"scope", "scope_parent", "version"};
+
+static const std::vector<std::string> V1_RENAME_SQL = {
+    "DROP TABLE version",
+    "ALTER TABLE scope RENAME TO v1_scope",
+    "ALTER TABLE scope_parent RENAME TO v1_scope_parent",
 };
 
+static const std::vector<std::string> V1_COPY_SQL = {
+    "INSERT INTO file(name) SELECT DISTINCT filename FROM v1_scope",
+    "INSERT INTO path(name) SELECT path FROM v1_scope UNION SELECT path FROM v1_scope_parent WHERE path IS NOT NULL",
+    "INSERT INTO parser(name) SELECT DISTINCT parser FROM v1_scope",
+    "INSERT INTO scope(id, file, path, start_line, start_col, end_line, end_col, parser) "
+        "SELECT s.id, f.id, p.id, s.start_line, s.start_col, s.end_line, s.end_col, pr.id FROM v1_scope s "
+        "JOIN file f ON f.name = s.filename JOIN path p ON p.name = s.path JOIN parser pr ON pr.name = s.parser",
+    // The old row ids kept the parents in order
+    "INSERT INTO scope_parent(scope, position, path) "
+        "SELECT sp.scope, sp.id, p.id FROM v1_scope_parent sp JOIN scope s ON s.id = sp.scope JOIN path p ON p.name = sp.path",
+    // Occurrences weren't counted, so every file is parsed again. A state no file can have
+    // makes the next crawl do that, and delete the files which have gone since.
+    "INSERT INTO file_state(file, size, mtime_sec, mtime_nsec, hash) SELECT id, -1, 0, 0, 0 FROM file",
+    "DROP TABLE v1_scope_parent",
+    "DROP TABLE v1_scope",
+};
+
+// Interned ids are cached by the writer, this stops the path cache growing forever
+static const std::size_t MAX_CACHED_IDS = 100000;
+
 unicode version() {
-    // FIXME:
-    return "1"; //return hashlib::MD5(_u("\n").join(INITIAL_DATA_SQL).encode()).hex_digest();
+    std::string schema;
+    for(auto& sql: SCHEMA_SQL) {
+        schema += sql;
+        schema += "\n";
+    }
+
+    char hex[17];
+    snprintf(hex, sizeof(hex), "%016llx", (unsigned long long) xxh64(schema));
+    return hex;
 }
 
 Datastore::Datastore(const unicode &path_to_datastore):
-    db_(nullptr) {
+    path_(path_to_datastore.encode()),
+    queue_(MAX_QUEUED_WRITES),
+    completion_index_(std::make_shared<CompletionIndex>()),
+    word_index_(std::make_shared<WordIndex>()) {
+
+    open_and_recreate_if_necessary();
+
+    for(auto& pragma: WRITER_PRAGMAS) {
+        writer_.execute(pragma);
+    }
+
+    // Opened after the schema exists and WAL is enabled, WAL is what lets it read during writes
+    reader_.open(path_, SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX);
+    for(auto& pragma: READER_PRAGMAS) {
+        reader_.execute(pragma);
+    }
+
+    load_completion_index();
+
+    writer_thread_ = std::thread(&Datastore::run_writer, this);
+}
 
-    open_and_recreate_if_necessary(path_to_datastore);
+Datastore::~Datastore() {
+    queue_.close(); // The writer finishes whatever is queued first
+    if(writer_thread_.joinable()) {
+        writer_thread_.join();
+    }
 }
 
-void Datastore::open_and_recreate_if_necessary(const unicode &path_to_datastore) {
-    bool create_tables = !kfs::path::exists(path_to_datastore.encode());
+void Datastore::Connection::open(const std::string& path, int flags) {
+    close();
 
-    int rc = sqlite3_open(path_to_datastore.encode().c_str(), &db_);
-    if(rc) {
-        sqlite3_close(db_);
+    int rc = sqlite3_open_v2(path.c_str(), &db, flags, nullptr);
+    if(rc != SQLITE_OK) {
+        sqlite3_close(db);
+        db = nullptr;
         throw std::runtime_error("Unable to create database");
     }
 
-    if(query_database_version() != version()) {
+    sqlite3_busy_timeout(db, BUSY_TIMEOUT_MS);
+}
+
+void Datastore::Connection::close() {
+    for(auto& pair: statements_) {
+        sqlite3_finalize(pair.second);
+    }
+    statements_.clear();
+
+    if(db) {
+        sqlite3_close(db);
+        db = nullptr;
+    }
+}
+
+sqlite3_stmt* Datastore::Connection::statement(const std::string& sql) {
+    auto it = statements_.find(sql);
+    if(it != statements_.end()) {
+        sqlite3_reset(it->second);
+        sqlite3_clear_bindings(it->second);
+        return it->second;
+    }
+
+    sqlite3_stmt* stmt = nullptr;
+    if(sqlite3_prepare_v2(db, sql.c_str(), sql.length() + 1, &stmt, 0) != SQLITE_OK) {
+        throw std::runtime_error(_u("Unable to prepare statement: {0}").format(sqlite3_errmsg(db)).encode());
+    }
+
+    statements_[sql] = stmt;
+    return stmt;
+}
+
+void Datastore::Connection::execute(const std::string& sql) {
+    sqlite3_stmt* stmt = statement(sql);
+    int ret = sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+
+    if(ret != SQLITE_DONE && ret != SQLITE_ROW) {
+        throw std::runtime_error(_u("Unable to execute '{0}': {1}").format(sql, sqlite3_errmsg(db)).encode());
+    }
+}
+
+void Datastore::open_and_recreate_if_necessary() {
+    const int flags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_NOMUTEX;
+
+    bool create_tables = !kfs::path::exists(path_);
+
+    writer_.open(path_, flags);
+
+    unicode existing_version = query_database_version();
+    if(existing_version == V1_VERSION && has_v1_tables()) {
+        try {
+            migrate_from_v1();
+            existing_version = version();
+        } catch(std::exception& e) {
+            L_WARN(_F("Unable to migrate the datastore, it will be rebuilt: {0}").format(e.what()));
+            sqlite3_exec(writer_.db, "ROLLBACK", 0, 0, 0);
+        }
+    }
+
+    if(existing_version != version()) {
         L_DEBUG("Deleting existing database as version differs");
-        sqlite3_close(db_);
-        kfs::remove(path_to_datastore.encode());
+        writer_.close();
+        kfs::remove(path_);
 
-        rc = sqlite3_open(path_to_datastore.encode().c_str(), &db_);
-        if(rc) {
-            sqlite3_close(db_);
-            throw std::runtime_error("Unable to create database");
+        // Don't let an old WAL get replayed into the new database
+        for(auto suffix: {"-wal", "-shm"}) {
+            if(kfs::path::exists(path_ + suffix)) {
+                kfs::remove(path_ + suffix);
+            }
         }
+
+        writer_.open(path_, flags);
         create_tables = true;
     }
 
@@ -61,7 +226,7 @@ unicode Datastore::query_database_version() {
 
     unicode vers;
 
-    int ret = sqlite3_prepare_v2(db_, sql.encode().c_str(), -1, &stmt, 0);
+    int ret = sqlite3_prepare_v2(writer_.db, sql.encode().c_str(), -1, &stmt, 0);
 
     if(ret == SQLITE_OK) {
         if(sqlite3_step(stmt) == SQLITE_ROW) {
@@ -73,129 +238,1038 @@ unicode Datastore::query_database_version() {
     return vers;
 }
 
-void Datastore::initialize_tables() {
-    std::string final_statement = _u("; ").join(INITIAL_DATA_SQL).encode();
-    int ret = sqlite3_exec(db_, final_statement.c_str(), 0, 0, 0);
-    if(ret) {
-        throw std::runtime_error("Unable to create database tables");
+bool Datastore::has_v1_tables() {
+    std::vector<std::string> tables;
+
+    sqlite3_stmt* stmt = writer_.statement("SELECT name FROM sqlite_master WHERE type = 'table' ORDER BY name");
+    while(sqlite3_step(stmt) == SQLITE_ROW) {
+        tables.push_back((const char*) sqlite3_column_text(stmt, 0));
     }
+    sqlite3_reset(stmt);
+
+    return tables == V1_TABLES;
+}
 
-    unicode version_sql = "INSERT INTO version (version) VALUES (?);";
-    sqlite3_stmt* stmt;
-    ret = sqlite3_prepare(db_, version_sql.encode().c_str(), -1, &stmt, 0);
-    if(ret) {
-        throw std::runtime_error("Unable to prep statement to insert version");
+void Datastore::create_schema() {
+    for(auto& sql: SCHEMA_SQL) {
+        writer_.execute(sql);
     }
 
+    sqlite3_stmt* stmt = writer_.statement("INSERT INTO version (version) VALUES (?)");
+
     std::string vers = version().encode();
     sqlite3_bind_text(stmt, 1, vers.c_str(), vers.length(), SQLITE_TRANSIENT);
 
-    if(sqlite3_step(stmt) != SQLITE_DONE) {
+    int ret = sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+
+    if(ret != SQLITE_DONE) {
         throw std::runtime_error("Unable to insert version");
     }
+}
 
-    sqlite3_finalize(stmt);
+void Datastore::initialize_tables() {
+    try {
+        writer_.execute("BEGIN");
+        create_schema();
+        writer_.execute("COMMIT");
+    } catch(std::exception& e) {
+        sqlite3_exec(writer_.db, "ROLLBACK", 0, 0, 0);
+        throw std::runtime_error(_u("Unable to create database tables: {0}").format(e.what()).encode());
+    }
 }
 
-void Datastore::delete_scopes_by_filename(const unicode& path) {
-    unicode SQL = "DELETE FROM scope WHERE filename = ?";
-
-    sqlite3_stmt* stmt;
-    int ret = sqlite3_prepare(
-        db_,
-        SQL.encode().c_str(),
-        -1,
-        &stmt,
-        0
+void Datastore::migrate_from_v1() {
+    L_DEBUG("Migrating the datastore from version 1");
+
+    writer_.execute("BEGIN");
+
+    for(auto& sql: V1_RENAME_SQL) {
+        writer_.execute(sql);
+    }
+
+    create_schema();
+
+    for(auto& sql: V1_COPY_SQL) {
+        writer_.execute(sql);
+    }
+
+    writer_.execute("COMMIT");
+
+    // Give back the space the strings took up
+    sqlite3_exec(writer_.db, "VACUUM", 0, 0, 0);
+}
+
+static std::string word_of(const std::string& path) {
+    /* The name a scope path ends with, which is the word the word index counts */
+    auto dot = path.rfind('.');
+    return (dot == std::string::npos) ? path : path.substr(dot + 1);
+}
+
+void Datastore::load_completion_index() {
+    sqlite3_stmt* stmt = reader_.statement(
+        "SELECT pr.name, p.name, s.count FROM (SELECT parser, path, SUM(occurrences) AS count FROM scope GROUP BY parser, path) s "
+        "JOIN parser pr ON pr.id = s.parser JOIN path p ON p.id = s.path"
     );
 
-    assert(!ret);
+    int ret;
+    while((ret = sqlite3_step(stmt)) == SQLITE_ROW) {
+        std::string parser((const char*) sqlite3_column_text(stmt, 0), sqlite3_column_bytes(stmt, 0));
+        std::string path((const char*) sqlite3_column_text(stmt, 1), sqlite3_column_bytes(stmt, 1));
+        completion_index_->add(parser, path, sqlite3_column_int(stmt, 2));
+        word_index_->add(word_of(path), sqlite3_column_int(stmt, 2));
+    }
+
+    sqlite3_reset(stmt);
 
-    sqlite3_bind_text(stmt, 1, path.encode().c_str(), path.encode().length(), SQLITE_TRANSIENT);
-    if(sqlite3_step(stmt) != SQLITE_DONE) {
-        throw std::runtime_error(_u("Unable to delete the selected scopes: {0}").format(sqlite3_errmsg(db_)).encode());
+    if(ret != SQLITE_DONE) {
+        L_ERROR(_F("Unable to load the completion index: {0}").format(sqlite3_errmsg(reader_.db)));
     }
-    sqlite3_finalize(stmt);
 }
 
-void Datastore::save_scopes(const unicode &parser_name, const std::vector<ScopePtr>& scopes, const unicode &filename) {
-    const unicode SCOPE_INSERT_SQL = "REPLACE INTO scope (filename, path, start_line, start_col, end_line, end_col, parser) VALUES(?, ?, ?, ?, ?, ?, ?)";
-    const unicode SCOPE_PARENT_SQL = "INSERT INTO scope_parent(scope, path) VALUES(?, ?)";
+void Datastore::run_writer() {
+    /*
+     *  Applies queued writes. Everything which is already waiting when a transaction
+     *  starts goes into it (up to a limit), so bulk indexing commits hundreds of files
+     *  at a time while a single save is still committed straight away.
+     */
+    WriteTask task;
+    while(queue_.pop(task)) {
+        std::vector<WriteTask> batch;
+        batch.push_back(std::move(task));
 
-    sqlite3_exec(db_, "BEGIN;", 0, 0, 0);
-    for(auto scope: scopes) {
-        sqlite3_stmt* stmt = nullptr;
-        int ret = sqlite3_prepare(db_, SCOPE_INSERT_SQL.encode().c_str(), -1, &stmt, 0);
-        assert(!ret);
-        sqlite3_bind_text(stmt, 1, filename.encode().c_str(), filename.encode().length(), SQLITE_TRANSIENT);
-        sqlite3_bind_text(stmt, 2, scope->path().encode().c_str(), scope->path().encode().length(), SQLITE_TRANSIENT);
-        sqlite3_bind_int(stmt, 3, scope->start_line);
-        sqlite3_bind_int(stmt, 4, scope->start_col);
-        sqlite3_bind_int(stmt, 5, scope->end_line);
-        sqlite3_bind_int(stmt, 6, scope->end_col);
-        sqlite3_bind_text(stmt, 7, parser_name.encode().c_str(), parser_name.encode().length(), SQLITE_TRANSIENT);
+        while(batch.size() < MAX_TASKS_PER_TRANSACTION && queue_.try_pop(task)) {
+            batch.push_back(std::move(task));
+        }
 
-        if(sqlite3_step(stmt) != SQLITE_DONE) {
-            throw std::runtime_error("Unable to insert a scope");
+        try {
+            writer_.execute("BEGIN");
+            for(auto& queued: batch) {
+                apply(queued);
+            }
+            writer_.execute("COMMIT");
+
+            for(auto& change: pending_index_changes_) {
+                if(change.added) {
+                    completion_index_->add(change.parser, change.path, change.count);
+                    word_index_->add(word_of(change.path), change.count);
+                } else {
+                    completion_index_->remove(change.parser, change.path, change.count);
+                    word_index_->remove(word_of(change.path), change.count);
+                }
+            }
+
+            if(!pending_scope_tree_invalidations_.empty()) {
+                std::lock_guard<std::mutex> lock(scope_trees_mutex_);
+                for(auto& filename: pending_scope_tree_invalidations_) {
+                    scope_trees_.erase(filename);
+                }
+                ++scope_tree_generation_;
+            }
+        } catch(std::exception& e) {
+            L_ERROR(_F("Unable to commit to the datastore: {0}").format(e.what()));
+            sqlite3_exec(writer_.db, "ROLLBACK", 0, 0, 0);
+            forget_ids();
+        }
+
+        pending_index_changes_.clear();
+        pending_scope_tree_invalidations_.clear();
+
+        // Anyone waiting in flush() is released even if the commit failed
+        for(auto& queued: batch) {
+            if(queued.done) {
+                queued.done->set_value();
+            }
+        }
+    }
+}
+
+void Datastore::apply(const WriteTask& task) {
+    if(!task.func) {
+        return;
+    }
+
+    // A savepoint per task, so one bad file doesn't lose the rest of the transaction
+    std::size_t index_changes = pending_index_changes_.size();
+    std::size_t invalidations = pending_scope_tree_invalidations_.size();
+
+    writer_.execute("SAVEPOINT task");
+    try {
+        task.func();
+        writer_.execute("RELEASE task");
+    } catch(std::exception& e) {
+        L_ERROR(_F("Error writing to the datastore: {0}").format(e.what()));
+        writer_.execute("ROLLBACK TO task");
+        writer_.execute("RELEASE task");
+
+        pending_index_changes_.resize(index_changes);
+        pending_scope_tree_invalidations_.resize(invalidations);
+
+        // Strings interned by the task went with it
+        forget_ids();
+    }
+}
+
+sqlite3_int64 Datastore::find_id(const std::string& table, std::unordered_map<std::string, sqlite3_int64>& ids, const std::string& name) {
+    /* The id of a string in one of the string tables, or 0 if it isn't there */
+    auto it = ids.find(name);
+    if(it != ids.end()) {
+        return it->second;
+    }
+
+    sqlite3_stmt* stmt = writer_.statement("SELECT id FROM " + table + " WHERE name = ?");
+    sqlite3_bind_text(stmt, 1, name.c_str(), name.length(), SQLITE_STATIC);
+
+    sqlite3_int64 id = 0;
+    if(sqlite3_step(stmt) == SQLITE_ROW) {
+        id = sqlite3_column_int64(stmt, 0);
+    }
+    sqlite3_reset(stmt);
+
+    if(id) {
+        if(ids.size() >= MAX_CACHED_IDS) {
+            ids.clear();
+        }
+        ids[name] = id;
+    }
+
+    return id;
+}
+
+sqlite3_int64 Datastore::intern(const std::string& table, std::unordered_map<std::string, sqlite3_int64>& ids, const std::string& name) {
+    /* Like find_id, but adds the string if it isn't there yet */
+    sqlite3_int64 id = find_id(table, ids, name);
+    if(id) {
+        return id;
+    }
+
+    sqlite3_stmt* stmt = writer_.statement("INSERT INTO " + table + " (name) VALUES (?)");
+    sqlite3_bind_text(stmt, 1, name.c_str(), name.length(), SQLITE_STATIC);
+
+    int ret = sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+
+    if(ret != SQLITE_DONE) {
+        throw std::runtime_error(_u("Unable to add to {0}: {1}").format(table, sqlite3_errmsg(writer_.db)).encode());
+    }
+
+    id = sqlite3_last_insert_rowid(writer_.db);
+    ids[name] = id;
+    return id;
+}
+
+void Datastore::forget_ids() {
+    file_ids_.clear();
+    path_ids_.clear();
+    parser_ids_.clear();
+}
+
+void Datastore::flush() {
+    auto done = std::make_shared<std::promise<void>>();
+    auto future = done->get_future();
+
+    WriteTask task;
+    task.done = done;
+    queue_.push(task);
+
+    future.wait();
+}
+
+void Datastore::insert_rows(const std::string& insert_sql, int column_count, std::size_t row_count, std::function<void (sqlite3_stmt*, int, std::size_t)> bind_row) {
+    /*
+     *  Inserts row_count rows, MAX_ROWS_PER_INSERT at a time using a multi-row VALUES
+     *  clause, and then the remainder one by one. Either way the statements come from the
+     *  cache. bind_row is given the statement, the index of the row's first parameter
+     *  and the index of the row to bind.
+     */
+
+    auto values_sql = [&](int rows) -> std::string {
+        std::string row = "(";
+        for(int i = 0; i < column_count; ++i) {
+            row += (i) ? ", ?" : "?";
         }
+        row += ")";
 
-        int pk = sqlite3_last_insert_rowid(db_);
+        std::string sql = insert_sql + " VALUES ";
+        for(int i = 0; i < rows; ++i) {
+            if(i) sql += ", ";
+            sql += row;
+        }
+        return sql;
+    };
+
+    // SQLite only guarantees 999 parameters per statement
+    const int rows_per_insert = std::max(1, std::min(MAX_ROWS_PER_INSERT, MAX_PARAMETERS / column_count));
+
+    std::size_t i = 0;
+
+    if(row_count >= std::size_t(rows_per_insert)) {
+        const std::string batch_sql = values_sql(rows_per_insert);
+
+        for(; row_count - i >= std::size_t(rows_per_insert); ) {
+            sqlite3_stmt* stmt = writer_.statement(batch_sql);
+            for(int row = 0; row < rows_per_insert; ++row, ++i) {
+                bind_row(stmt, (row * column_count) + 1, i);
+            }
 
-        for(auto path: scope->inherited_paths()) {
-            ret = sqlite3_prepare(db_, SCOPE_PARENT_SQL.encode().c_str(), -1, &stmt, 0);
-            assert(!ret);
-            sqlite3_bind_int(stmt, 1, pk);
-            sqlite3_bind_text(stmt, 2, path.encode().c_str(), path.encode().length(), SQLITE_TRANSIENT);
             if(sqlite3_step(stmt) != SQLITE_DONE) {
-                throw std::runtime_error("Unable to insert an inherited scope");
+                throw std::runtime_error(_u("Unable to insert rows: {0}").format(sqlite3_errmsg(writer_.db)).encode());
+            }
+            sqlite3_reset(stmt);
+        }
+    }
+
+    const std::string single_sql = values_sql(1);
+    for(; i < row_count; ++i) {
+        sqlite3_stmt* stmt = writer_.statement(single_sql);
+        bind_row(stmt, 1, i);
+
+        if(sqlite3_step(stmt) != SQLITE_DONE) {
+            throw std::runtime_error(_u("Unable to insert a row: {0}").format(sqlite3_errmsg(writer_.db)).encode());
+        }
+        sqlite3_reset(stmt);
+    }
+}
+
+void Datastore::delete_scopes(const std::string& filename) {
+    pending_scope_tree_invalidations_.push_back(filename);
+
+    sqlite3_int64 file_id = find_id("file", file_ids_, filename);
+    if(!file_id) {
+        return;
+    }
+
+    // Find out what's going, so it can be taken out of the completion index
+    sqlite3_stmt* existing = writer_.statement(
+        "SELECT pr.name, p.name, s.occurrences FROM scope s JOIN parser pr ON pr.id = s.parser JOIN path p ON p.id = s.path WHERE s.file = ?"
+    );
+    sqlite3_bind_int64(existing, 1, file_id);
+
+    while(sqlite3_step(existing) == SQLITE_ROW) {
+        IndexChange change;
+        change.added = false;
+        change.parser.assign((const char*) sqlite3_column_text(existing, 0), sqlite3_column_bytes(existing, 0));
+        change.path.assign((const char*) sqlite3_column_text(existing, 1), sqlite3_column_bytes(existing, 1));
+        change.count = sqlite3_column_int(existing, 2);
+        pending_index_changes_.push_back(change);
+    }
+    sqlite3_reset(existing);
+
+    for(auto sql: {
+        "DELETE FROM scope_parent WHERE scope IN (SELECT id FROM scope WHERE file = ?)",
+        "DELETE FROM scope WHERE file = ?",
+        "DELETE FROM file_state WHERE file = ?",
+        "DELETE FROM file WHERE id = ?"
+    }) {
+        sqlite3_stmt* stmt = writer_.statement(sql);
+        sqlite3_bind_int64(stmt, 1, file_id);
+
+        int ret = sqlite3_step(stmt);
+        sqlite3_reset(stmt);
+
+        if(ret != SQLITE_DONE) {
+            throw std::runtime_error(_u("Unable to delete the selected scopes: {0}").format(sqlite3_errmsg(writer_.db)).encode());
+        }
+    }
+
+    file_ids_.erase(filename);
+}
+
+static std::string unique_key(const std::string& path, int start_line, int end_line) {
+    /* The columns of the scope table's unique constraint (within a file) */
+    return path + '\x1f' + std::to_string(start_line) + '\x1f' + std::to_string(end_line);
+}
+
+static std::string scope_key(const std::string& path, int start_line, int start_col, int end_line, int end_col, int occurrences, const std::string& parser) {
+    /* Everything stored about a scope except its id, parents get appended to this */
+    return unique_key(path, start_line, end_line) + '\x1f' + std::to_string(start_col) + '\x1f' + std::to_string(end_col) +
+        '\x1f' + std::to_string(occurrences) + '\x1f' + parser;
+}
+
+void Datastore::update_scopes(const std::string& parser_name, const std::vector<ScopePtr>& scopes, const std::string& filename) {
+    /*
+     *  Works out which of the file's stored scopes are still there, then deletes the
+     *  ones which aren't and inserts the new ones. Editing one function of a large file
+     *  only touches the rows for that function.
+     */
+
+    pending_scope_tree_invalidations_.push_back(filename);
+
+    sqlite3_int64 file_id = intern("file", file_ids_, filename);
+
+    struct ExistingScope {
+        std::string parser;
+        std::string path;
+        std::string key;
+        int occurrences;
+    };
+
+    std::map<sqlite3_int64, ExistingScope> existing;
+
+    sqlite3_stmt* rows = writer_.statement(
+        "SELECT s.id, p.name, s.start_line, s.start_col, s.end_line, s.end_col, pr.name, s.occurrences FROM scope s "
+        "JOIN path p ON p.id = s.path JOIN parser pr ON pr.id = s.parser WHERE s.file = ?"
+    );
+    sqlite3_bind_int64(rows, 1, file_id);
+
+    while(sqlite3_step(rows) == SQLITE_ROW) {
+        ExistingScope scope;
+        scope.path.assign((const char*) sqlite3_column_text(rows, 1), sqlite3_column_bytes(rows, 1));
+        scope.parser.assign((const char*) sqlite3_column_text(rows, 6), sqlite3_column_bytes(rows, 6));
+        scope.occurrences = sqlite3_column_int(rows, 7);
+        scope.key = scope_key(
+            scope.path,
+            sqlite3_column_int(rows, 2), sqlite3_column_int(rows, 3),
+            sqlite3_column_int(rows, 4), sqlite3_column_int(rows, 5),
+            scope.occurrences, scope.parser
+        );
+        existing[sqlite3_column_int64(rows, 0)] = scope;
+    }
+    sqlite3_reset(rows);
+
+    sqlite3_stmt* parents = writer_.statement(
+        "SELECT sp.scope, p.name FROM scope_parent sp JOIN scope s ON s.id = sp.scope JOIN path p ON p.id = sp.path "
+        "WHERE s.file = ? ORDER BY sp.scope, sp.position"
+    );
+    sqlite3_bind_int64(parents, 1, file_id);
+
+    while(sqlite3_step(parents) == SQLITE_ROW) {
+        auto it = existing.find(sqlite3_column_int64(parents, 0));
+        if(it != existing.end()) {
+            it->second.key += "\x1e";
+            it->second.key.append((const char*) sqlite3_column_text(parents, 1), sqlite3_column_bytes(parents, 1));
+        }
+    }
+    sqlite3_reset(parents);
+
+    std::unordered_map<std::string, std::vector<sqlite3_int64>> ids_by_key;
+    for(auto& pair: existing) {
+        ids_by_key[pair.second.key].push_back(pair.first);
+    }
+
+    /*
+     *  Scopes which clash on the table's unique constraint would have been one row, so
+     *  only the last of them is compared, as only it would be inserted.
+     */
+    std::vector<std::string> paths;
+    paths.reserve(scopes.size());
+    for(auto& scope: scopes) {
+        paths.push_back(scope->path().encode());
+    }
+
+    std::unordered_map<std::string, std::size_t> last_of_unique;
+    for(std::size_t i = 0; i < scopes.size(); ++i) {
+        auto& scope = scopes[i];
+        last_of_unique[unique_key(paths[i], scope->start_line, scope->end_line)] = i;
+    }
+
+    std::vector<ScopePtr> added;
+    for(std::size_t i = 0; i < scopes.size(); ++i) {
+        auto& scope = scopes[i];
+
+        if(last_of_unique.at(unique_key(paths[i], scope->start_line, scope->end_line)) != i) {
+            continue;
+        }
+
+        std::string key = scope_key(paths[i], scope->start_line, scope->start_col, scope->end_line, scope->end_col, scope->occurrences, parser_name);
+        for(auto& inherited: scope->inherited_paths()) {
+            key += "\x1e";
+            key += inherited.encode();
+        }
+
+        auto it = ids_by_key.find(key);
+        if(it != ids_by_key.end() && !it->second.empty()) {
+            existing.erase(it->second.back()); // Unchanged, leave it alone
+            it->second.pop_back();
+        } else {
+            added.push_back(scope);
+        }
+    }
+
+    // Whatever is left in existing has gone from the file
+    for(auto& pair: existing) {
+        for(auto sql: {"DELETE FROM scope_parent WHERE scope = ?", "DELETE FROM scope WHERE id = ?"}) {
+            sqlite3_stmt* stmt = writer_.statement(sql);
+            sqlite3_bind_int64(stmt, 1, pair.first);
+
+            int ret = sqlite3_step(stmt);
+            sqlite3_reset(stmt);
+
+            if(ret != SQLITE_DONE) {
+                throw std::runtime_error(_u("Unable to delete a scope: {0}").format(sqlite3_errmsg(writer_.db)).encode());
+            }
+        }
+
+        IndexChange change;
+        change.added = false;
+        change.parser = pair.second.parser;
+        change.path = pair.second.path;
+        change.count = pair.second.occurrences;
+        pending_index_changes_.push_back(change);
+    }
+
+    insert_scopes(parser_name, added, filename);
+}
+
+void Datastore::delete_scope(sqlite3_int64 file_id, const std::string& path, int start_line, int end_line) {
+    /* Deletes the scope with this key in the table's unique constraint, if there is one */
+    sqlite3_int64 path_id = find_id("path", path_ids_, path);
+    if(!path_id) {
+        return;
+    }
+
+    sqlite3_stmt* row = writer_.statement(
+        "SELECT id FROM scope WHERE file = ? AND path = ? AND start_line = ? AND end_line = ?"
+    );
+    sqlite3_bind_int64(row, 1, file_id);
+    sqlite3_bind_int64(row, 2, path_id);
+    sqlite3_bind_int(row, 3, start_line);
+    sqlite3_bind_int(row, 4, end_line);
+
+    sqlite3_int64 id = 0;
+    if(sqlite3_step(row) == SQLITE_ROW) {
+        id = sqlite3_column_int64(row, 0);
+    }
+    sqlite3_reset(row);
+
+    if(id) {
+        delete_scope(id);
+    }
+}
+
+void Datastore::delete_scope(sqlite3_int64 id) {
+    /* Deletes a scope and its parents, and takes it out of the completion index */
+    sqlite3_stmt* row = writer_.statement(
+        "SELECT pr.name, p.name, s.occurrences FROM scope s JOIN parser pr ON pr.id = s.parser JOIN path p ON p.id = s.path "
+        "WHERE s.id = ?"
+    );
+    sqlite3_bind_int64(row, 1, id);
+
+    IndexChange change;
+    change.added = false;
+
+    bool found = false;
+    if(sqlite3_step(row) == SQLITE_ROW) {
+        change.parser.assign((const char*) sqlite3_column_text(row, 0), sqlite3_column_bytes(row, 0));
+        change.path.assign((const char*) sqlite3_column_text(row, 1), sqlite3_column_bytes(row, 1));
+        change.count = sqlite3_column_int(row, 2);
+        found = true;
+    }
+    sqlite3_reset(row);
+
+    if(!found) {
+        return;
+    }
+
+    for(auto sql: {"DELETE FROM scope_parent WHERE scope = ?", "DELETE FROM scope WHERE id = ?"}) {
+        sqlite3_stmt* stmt = writer_.statement(sql);
+        sqlite3_bind_int64(stmt, 1, id);
+
+        int ret = sqlite3_step(stmt);
+        sqlite3_reset(stmt);
+
+        if(ret != SQLITE_DONE) {
+            throw std::runtime_error(_u("Unable to delete a scope: {0}").format(sqlite3_errmsg(writer_.db)).encode());
+        }
+    }
+
+    pending_index_changes_.push_back(change);
+}
+
+void Datastore::apply_delta(const std::string& parser_name, const ScopeDelta& delta, const std::string& filename) {
+    /*
+     *  Only the scopes around an edit are deleted and inserted, everything after it
+     *  has its lines moved in place. The file's rows are expected to be what the
+     *  buffer which made the delta had before the edit.
+     */
+    pending_scope_tree_invalidations_.push_back(filename);
+
+    sqlite3_int64 file_id = intern("file", file_ids_, filename);
+
+    for(auto& scope: delta.removed) {
+        delete_scope(file_id, scope->path().encode(), scope->start_line, scope->end_line);
+    }
+
+    if(delta.line_shift) {
+        move_lines(file_id, delta.from_line, delta.line_shift);
+    }
+
+    insert_scopes(parser_name, delta.added, filename);
+
+    // The rows no longer match what's on disk
+    forget_file_state(filename);
+}
+
+void Datastore::move_lines(sqlite3_int64 file_id, int from_line, int line_shift) {
+    /*
+     *  Moving lines one row at a time could clash with a row which hasn't moved yet,
+     *  so the lines which move are first parked on negative numbers.
+     */
+    sqlite3_stmt* park = writer_.statement(
+        "UPDATE scope SET "
+        "start_line = CASE WHEN start_line >= ?1 THEN -(start_line + ?2) - 1 ELSE start_line END, "
+        "end_line = CASE WHEN end_line >= ?1 THEN -(end_line + ?2) - 1 ELSE end_line END "
+        "WHERE file = ?3 AND (start_line >= ?1 OR end_line >= ?1)"
+    );
+    sqlite3_bind_int(park, 1, from_line);
+    sqlite3_bind_int(park, 2, line_shift);
+    sqlite3_bind_int64(park, 3, file_id);
+
+    int ret = sqlite3_step(park);
+    sqlite3_reset(park);
+
+    if(ret != SQLITE_DONE) {
+        throw std::runtime_error(_u("Unable to move scopes: {0}").format(sqlite3_errmsg(writer_.db)).encode());
+    }
+
+    /*
+     *  Rows which end up the same would have been one row if the file was parsed again.
+     *  A moved row is kept over one which stayed put, it's later in the file, and of two
+     *  moved rows the newer is kept. The others are deleted like any other scope.
+     */
+    sqlite3_stmt* clashes = writer_.statement(
+        "WITH moved AS ("
+        "SELECT id, path, "
+        "CASE WHEN start_line < 0 THEN -start_line - 1 ELSE start_line END AS start_line, "
+        "CASE WHEN end_line < 0 THEN -end_line - 1 ELSE end_line END AS end_line, "
+        "(start_line < 0 OR end_line < 0) AS parked FROM scope WHERE file = ?) "
+        "SELECT DISTINCT a.id FROM moved a JOIN moved b ON b.path = a.path AND b.start_line = a.start_line AND b.end_line = a.end_line "
+        "WHERE b.parked AND b.id != a.id AND (NOT a.parked OR b.id > a.id)"
+    );
+    sqlite3_bind_int64(clashes, 1, file_id);
+
+    std::vector<sqlite3_int64> clashing;
+    while(sqlite3_step(clashes) == SQLITE_ROW) {
+        clashing.push_back(sqlite3_column_int64(clashes, 0));
+    }
+    sqlite3_reset(clashes);
+
+    for(auto id: clashing) {
+        delete_scope(id);
+    }
+
+    sqlite3_stmt* unpark = writer_.statement(
+        "UPDATE scope SET "
+        "start_line = CASE WHEN start_line < 0 THEN -start_line - 1 ELSE start_line END, "
+        "end_line = CASE WHEN end_line < 0 THEN -end_line - 1 ELSE end_line END "
+        "WHERE file = ? AND (start_line < 0 OR end_line < 0)"
+    );
+    sqlite3_bind_int64(unpark, 1, file_id);
+
+    ret = sqlite3_step(unpark);
+    sqlite3_reset(unpark);
+
+    if(ret != SQLITE_DONE) {
+        throw std::runtime_error(_u("Unable to move scopes: {0}").format(sqlite3_errmsg(writer_.db)).encode());
+    }
+}
+
+void Datastore::write_file_state(const std::string& filename, const FileState& state) {
+    sqlite3_stmt* stmt = writer_.statement(
+        "REPLACE INTO file_state (file, size, mtime_sec, mtime_nsec, hash) VALUES (?, ?, ?, ?, ?)"
+    );
+
+    sqlite3_bind_int64(stmt, 1, intern("file", file_ids_, filename));
+    sqlite3_bind_int64(stmt, 2, state.size);
+    sqlite3_bind_int64(stmt, 3, state.mtime_sec);
+    sqlite3_bind_int64(stmt, 4, state.mtime_nsec);
+    sqlite3_bind_int64(stmt, 5, sqlite3_int64(state.hash));
+
+    int ret = sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+
+    if(ret != SQLITE_DONE) {
+        throw std::runtime_error(_u("Unable to save the file state: {0}").format(sqlite3_errmsg(writer_.db)).encode());
+    }
+}
+
+void Datastore::forget_file_state(const std::string& filename) {
+    sqlite3_stmt* stmt = writer_.statement("DELETE FROM file_state WHERE file = ?");
+    sqlite3_bind_int64(stmt, 1, intern("file", file_ids_, filename));
+    sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+}
+
+void Datastore::insert_scopes(const std::string& parser_name, const std::vector<ScopePtr>& all_scopes, const std::string& filename) {
+    if(all_scopes.empty()) {
+        return;
+    }
+
+    pending_scope_tree_invalidations_.push_back(filename);
+
+    sqlite3_int64 file_id = intern("file", file_ids_, filename);
+    sqlite3_int64 parser_id = intern("parser", parser_ids_, parser_name);
+
+    /*
+     *  Scopes which clash on the table's unique constraint would have been one row, so
+     *  only the last of them is inserted. A row already stored with the same key is
+     *  deleted first, so it leaves the completion index.
+     */
+    std::vector<std::string> all_paths;
+    all_paths.reserve(all_scopes.size());
+    std::unordered_map<std::string, std::size_t> last_of_unique;
+    for(std::size_t i = 0; i < all_scopes.size(); ++i) {
+        auto& scope = all_scopes[i];
+        all_paths.push_back(scope->path().encode());
+        last_of_unique[unique_key(all_paths[i], scope->start_line, scope->end_line)] = i;
+    }
+
+    sqlite3_stmt* any = writer_.statement("SELECT 1 FROM scope WHERE file = ? LIMIT 1");
+    sqlite3_bind_int64(any, 1, file_id);
+    bool file_has_scopes = sqlite3_step(any) == SQLITE_ROW;
+    sqlite3_reset(any);
+
+    std::vector<ScopePtr> scopes;
+    std::vector<std::string> paths;
+    scopes.reserve(last_of_unique.size());
+    paths.reserve(last_of_unique.size());
+
+    for(std::size_t i = 0; i < all_scopes.size(); ++i) {
+        auto& scope = all_scopes[i];
+        if(last_of_unique.at(unique_key(all_paths[i], scope->start_line, scope->end_line)) != i) {
+            continue;
+        }
+
+        if(file_has_scopes) {
+            delete_scope(file_id, all_paths[i], scope->start_line, scope->end_line);
+        }
+
+        scopes.push_back(scope);
+        paths.push_back(all_paths[i]);
+    }
+
+    /*
+     *  Multi-row inserts don't tell us the rowid of each row, so we pick the ids
+     *  ourselves. This must be called inside a transaction.
+     */
+    sqlite3_int64 first_id = 1;
+    sqlite3_stmt* max_stmt = writer_.statement("SELECT COALESCE(MAX(id), 0) FROM scope");
+    if(sqlite3_step(max_stmt) == SQLITE_ROW) {
+        first_id = sqlite3_column_int64(max_stmt, 0) + 1;
+    }
+    sqlite3_reset(max_stmt);
+
+    std::vector<sqlite3_int64> path_ids;
+    path_ids.reserve(scopes.size());
+
+    struct Parent {
+        sqlite3_int64 scope;
+        int position;
+        sqlite3_int64 path;
+    };
+
+    std::vector<Parent> parents;
+
+    for(std::size_t i = 0; i < scopes.size(); ++i) {
+        path_ids.push_back(intern("path", path_ids_, paths[i]));
+
+        int position = 0;
+        for(auto& inherited: scopes[i]->inherited_paths()) {
+            parents.push_back(Parent{first_id + sqlite3_int64(i), position++, intern("path", path_ids_, inherited.encode())});
+        }
+    }
+
+    insert_rows(
+        "INSERT INTO scope (id, file, path, start_line, start_col, end_line, end_col, occurrences, parser)", 9, scopes.size(),
+        [&](sqlite3_stmt* stmt, int column, std::size_t i) {
+            auto& scope = scopes[i];
+            sqlite3_bind_int64(stmt, column, first_id + i);
+            sqlite3_bind_int64(stmt, column + 1, file_id);
+            sqlite3_bind_int64(stmt, column + 2, path_ids[i]);
+            sqlite3_bind_int(stmt, column + 3, scope->start_line);
+            sqlite3_bind_int(stmt, column + 4, scope->start_col);
+            sqlite3_bind_int(stmt, column + 5, scope->end_line);
+            sqlite3_bind_int(stmt, column + 6, scope->end_col);
+            sqlite3_bind_int(stmt, column + 7, scope->occurrences);
+            sqlite3_bind_int64(stmt, column + 8, parser_id);
+        }
+    );
+
+    for(std::size_t i = 0; i < scopes.size(); ++i) {
+        IndexChange change;
+        change.added = true;
+        change.parser = parser_name;
+        change.path = paths[i];
+        change.count = scopes[i]->occurrences;
+        pending_index_changes_.push_back(change);
+    }
+
+    // The ids are new, but parents of a deleted scope which had one of them may be left over
+    sqlite3_stmt* stale = writer_.statement("DELETE FROM scope_parent WHERE scope >= ?");
+    sqlite3_bind_int64(stale, 1, first_id);
+    int ret = sqlite3_step(stale);
+    sqlite3_reset(stale);
+
+    if(ret != SQLITE_DONE) {
+        throw std::runtime_error(_u("Unable to delete old parents: {0}").format(sqlite3_errmsg(writer_.db)).encode());
+    }
+
+    insert_rows(
+        "INSERT INTO scope_parent (scope, position, path)", 3, parents.size(),
+        [&](sqlite3_stmt* stmt, int column, std::size_t i) {
+            sqlite3_bind_int64(stmt, column, parents[i].scope);
+            sqlite3_bind_int(stmt, column + 1, parents[i].position);
+            sqlite3_bind_int64(stmt, column + 2, parents[i].path);
+        }
+    );
+}
+
+void Datastore::delete_scopes_by_filename(const unicode& path) {
+    std::string filename = path.encode();
+
+    WriteTask task;
+    task.func = [this, filename]() {
+        if(open_buffers_.count(filename)) {
+            return;
+        }
+
+        delete_scopes(filename);
+    };
+    queue_.push(task);
+}
+
+void Datastore::replace_scopes(const unicode& parser_name, const std::vector<ScopePtr>& scopes, const unicode& filename) {
+    std::string encoded_parser = parser_name.encode();
+    std::string encoded_filename = filename.encode();
+
+    WriteTask task;
+    task.func = [this, encoded_parser, scopes, encoded_filename]() {
+        update_scopes(encoded_parser, scopes, encoded_filename);
+
+        // These scopes might not match what's on disk, so don't trust the old state
+        forget_file_state(encoded_filename);
+    };
+    queue_.push(task);
+}
+
+void Datastore::replace_scopes(const unicode& parser_name, const std::vector<ScopePtr>& scopes, const unicode& filename, const FileState& state) {
+    std::string encoded_parser = parser_name.encode();
+    std::string encoded_filename = filename.encode();
+
+    WriteTask task;
+    task.func = [this, encoded_parser, scopes, encoded_filename, state]() {
+        if(open_buffers_.count(encoded_filename)) {
+            return; // The buffer knows better than the disk
+        }
+
+        update_scopes(encoded_parser, scopes, encoded_filename);
+        write_file_state(encoded_filename, state);
+    };
+    queue_.push(task);
+}
+
+void Datastore::touch_file(const unicode& filename, const FileState& state) {
+    std::string encoded_filename = filename.encode();
+
+    WriteTask task;
+    task.func = [this, encoded_filename, state]() {
+        if(open_buffers_.count(encoded_filename)) {
+            return;
+        }
+
+        write_file_state(encoded_filename, state);
+    };
+    queue_.push(task);
+}
+
+void Datastore::open_buffer(const unicode& parser_name, const std::vector<ScopePtr>& scopes, const unicode& filename) {
+    std::string encoded_parser = parser_name.encode();
+    std::string encoded_filename = filename.encode();
+
+    WriteTask task;
+    task.func = [this, encoded_parser, scopes, encoded_filename]() {
+        open_buffers_.insert(encoded_filename);
+
+        update_scopes(encoded_parser, scopes, encoded_filename);
+        forget_file_state(encoded_filename);
+    };
+    queue_.push(task);
+}
+
+void Datastore::apply_scope_delta(const unicode& parser_name, const ScopeDelta& delta, const unicode& filename) {
+    std::string encoded_parser = parser_name.encode();
+    std::string encoded_filename = filename.encode();
+
+    WriteTask task;
+    task.func = [this, encoded_parser, delta, encoded_filename]() {
+        apply_delta(encoded_parser, delta, encoded_filename);
+    };
+    queue_.push(task);
+}
+
+void Datastore::close_buffer(const unicode& filename) {
+    std::string encoded_filename = filename.encode();
+
+    WriteTask task;
+    task.func = [this, encoded_filename]() {
+        open_buffers_.erase(encoded_filename);
+    };
+    queue_.push(task);
+}
+
+static FileState file_state_from_row(sqlite3_stmt* stmt, int first_column) {
+    FileState state;
+    state.size = sqlite3_column_int64(stmt, first_column);
+    state.mtime_sec = sqlite3_column_int64(stmt, first_column + 1);
+    state.mtime_nsec = sqlite3_column_int64(stmt, first_column + 2);
+    state.hash = uint64_t(sqlite3_column_int64(stmt, first_column + 3));
+    return state;
+}
+
+bool Datastore::file_state(const unicode& filename, FileState& out) {
+    std::string encoded_filename = filename.encode();
+
+    std::lock_guard<std::mutex> lock(reader_mutex_);
+
+    sqlite3_stmt* stmt = reader_.statement(
+        "SELECT fs.size, fs.mtime_sec, fs.mtime_nsec, fs.hash FROM file_state fs JOIN file f ON f.id = fs.file WHERE f.name = ?"
+    );
+    sqlite3_bind_text(stmt, 1, encoded_filename.c_str(), encoded_filename.length(), SQLITE_STATIC);
+
+    bool found = false;
+    if(sqlite3_step(stmt) == SQLITE_ROW) {
+        out = file_state_from_row(stmt, 0);
+        found = true;
+    }
+    sqlite3_reset(stmt);
+
+    return found;
+}
+
+FileStateMap Datastore::file_states(const unicode& directory) {
+    // A range over the file names, '0' is the character after '/'
+    std::string low = directory.encode();
+    while(!low.empty() && low.back() == '/') {
+        low.pop_back();
+    }
+    std::string high = (low.empty()) ? std::string("\xff") : low + "0";
+    low += "/";
+
+    FileStateMap result;
+
+    std::lock_guard<std::mutex> lock(reader_mutex_);
+
+    sqlite3_stmt* stmt = reader_.statement(
+        "SELECT f.name, fs.size, fs.mtime_sec, fs.mtime_nsec, fs.hash FROM file f JOIN file_state fs ON fs.file = f.id "
+        "WHERE f.name >= ? AND f.name < ?"
+    );
+    sqlite3_bind_text(stmt, 1, low.c_str(), low.length(), SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, high.c_str(), high.length(), SQLITE_STATIC);
+
+    while(sqlite3_step(stmt) == SQLITE_ROW) {
+        std::string filename((const char*) sqlite3_column_text(stmt, 0), sqlite3_column_bytes(stmt, 0));
+        result[filename] = file_state_from_row(stmt, 1);
+    }
+    sqlite3_reset(stmt);
+
+    return result;
+}
+
+ScopeTreePtr Datastore::scope_tree(const unicode& parser, const unicode& filename) {
+    std::string encoded_parser = parser.encode();
+    std::string encoded_filename = filename.encode();
+
+    uint64_t generation;
+    {
+        std::lock_guard<std::mutex> lock(scope_trees_mutex_);
+
+        auto file_it = scope_trees_.find(encoded_filename);
+        if(file_it != scope_trees_.end()) {
+            auto it = file_it->second.find(encoded_parser);
+            if(it != file_it->second.end()) {
+                return it->second;
             }
         }
 
-        //Keep the window responsive
-        while(Gtk::Main::events_pending()) {
-            Gtk::Main::iteration();
+        generation = scope_tree_generation_;
+    }
+
+    std::vector<ScopeRange> ranges;
+    {
+        std::lock_guard<std::mutex> lock(reader_mutex_);
+
+        // The unary + keeps SQLite on the file's rows rather than every row of the parser
+        sqlite3_stmt* stmt = reader_.statement(
+            "SELECT p.name, s.start_line, s.start_col, s.end_line, s.end_col FROM scope s JOIN path p ON p.id = s.path "
+            "WHERE s.file = (SELECT id FROM file WHERE name = ?) AND +s.parser = (SELECT id FROM parser WHERE name = ?)"
+        );
+        sqlite3_bind_text(stmt, 1, encoded_filename.c_str(), encoded_filename.length(), SQLITE_STATIC);
+        sqlite3_bind_text(stmt, 2, encoded_parser.c_str(), encoded_parser.length(), SQLITE_STATIC);
+
+        while(sqlite3_step(stmt) == SQLITE_ROW) {
+            ScopeRange range;
+            range.path.assign((const char*) sqlite3_column_text(stmt, 0), sqlite3_column_bytes(stmt, 0));
+            range.start_line = sqlite3_column_int(stmt, 1);
+            range.start_col = sqlite3_column_int(stmt, 2);
+            range.end_line = sqlite3_column_int(stmt, 3);
+            range.end_col = sqlite3_column_int(stmt, 4);
+            ranges.push_back(range);
+        }
+        sqlite3_reset(stmt);
+    }
+
+    if(ranges.empty()) {
+        return ScopeTreePtr();
+    }
+
+    auto tree = std::make_shared<const ScopeTree>(std::move(ranges));
+
+    std::lock_guard<std::mutex> lock(scope_trees_mutex_);
+    if(generation == scope_tree_generation_) {
+        if(scope_trees_.size() >= MAX_CACHED_SCOPE_TREES) {
+            scope_trees_.erase(scope_trees_.begin());
         }
-        sqlite3_finalize(stmt);
+        scope_trees_[encoded_filename][encoded_parser] = tree;
     }
-    sqlite3_exec(db_, "COMMIT;", 0, 0, 0);
+
+    return tree;
 }
 
 unicode Datastore::query_scope_at(const unicode& parser, const unicode &filename, int line_number, int col_number) {
-    return "";
+    auto tree = scope_tree(parser, filename);
+    if(!tree) {
+        return "";
+    }
+
+    auto scope = tree->innermost(line_number, col_number);
+    return (scope) ? unicode(scope->path) : unicode("");
 }
 
 std::vector<unicode> Datastore::query_completions(const unicode& parser, const unicode &filename, int line_number, int col_number, const unicode &string_to_complete, bool word_completion_only) {
-    //FIXME: Must take into account scope! This only works for the PLAIN parser search not more complex lookups
-
     unicode final = string_to_complete;
     if(word_completion_only) {
         final = string_to_complete.split(".").back();
     }
 
-    std::cout << parser << ": " << string_to_complete << std::endl;
+    std::string prefix = final.encode();
 
-    unicode sql = "SELECT DISTINCT path FROM scope WHERE parser = ? AND path LIKE ? ORDER BY path;";
+    std::vector<unicode> results;
+    std::unordered_set<std::string> seen;
 
-    sqlite3_stmt* stmt = nullptr;
+    // Names visible from the cursor come first, innermost scope first
+    auto tree = (filename.empty()) ? ScopeTreePtr() : scope_tree(parser, filename);
+    if(tree) {
+        for(auto& name: tree->visible_names(line_number, col_number)) {
+            if(results.size() == MAX_COMPLETIONS) {
+                break;
+            }
 
-    int ret = sqlite3_prepare_v2(db_, sql.encode().c_str(), -1, &stmt, 0);
-    if(ret != SQLITE_OK) {
-        return std::vector<unicode>();
+            if(name.compare(0, prefix.length(), prefix) == 0 && seen.insert(name).second) {
+                results.push_back(name);
+            }
+        }
     }
 
-    std::string like = _u("{0}%").format(final).encode();
-    std::string par = parser.encode();
-
-    sqlite3_bind_text(stmt, 1, par.c_str(), par.length(), SQLITE_TRANSIENT);
-    sqlite3_bind_text(stmt, 2, like.c_str(), like.length(), SQLITE_TRANSIENT);
+    for(auto& completion: completion_index_->complete(parser.encode(), prefix, MAX_COMPLETIONS)) {
+        if(results.size() == MAX_COMPLETIONS) {
+            break;
+        }
 
-    std::vector<unicode> results;
-    while(sqlite3_step(stmt) == SQLITE_ROW) {
-        unicode path = (char*) sqlite3_column_text(stmt, 0);
-        results.push_back(path);
+        if(seen.insert(completion).second) {
+            results.push_back(completion);
+        }
     }
 
-    sqlite3_finalize(stmt);
     return results;
 }
 
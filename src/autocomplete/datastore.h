@@ -1,18 +1,78 @@
 #ifndef DATASTORE_H
 #define DATASTORE_H
 
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <future>
+#include <string>
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
 #include <sqlite3.h>
 
 #include "./base.h"
+#include "./completion_index.h"
+#include "./scope_tree.h"
+#include "../utils/blocking_queue.h"
 
 namespace delimit {
 
+/* What a file looked like when it was last indexed */
+struct FileState {
+    int64_t size = 0;
+    int64_t mtime_sec = 0;
+    int64_t mtime_nsec = 0;
+    uint64_t hash = 0; // xxh64 of the contents
+};
+
+typedef std::unordered_map<std::string, FileState> FileStateMap;
+
+/*
+ *  The completion database. All writes are queued and applied by a dedicated writer
+ *  thread which owns the write connection and commits many files per transaction.
+ *  Queries go through a separate read-only connection, and the database runs in WAL
+ *  mode, so completions never wait on indexing.
+ *
+ *  Completions themselves are answered from an in-memory CompletionIndex (and words
+ *  from a WordIndex), which are loaded from the database on startup and updated as
+ *  each write commits. Scope lookups use a ScopeTree per file, loaded when first
+ *  needed and dropped whenever the file is written.
+ */
 class Datastore {
 public:
     Datastore(const unicode& path_to_datastore);
+    ~Datastore();
 
     void delete_scopes_by_filename(const unicode& path);
-    void save_scopes(const unicode& parser_name, const std::vector<ScopePtr>& scopes, const unicode& filename);
+
+    /*
+     *  Replaces the scopes of a file atomically. Only scopes which have actually changed
+     *  are deleted or inserted. The second version also records the file's state.
+     */
+    void replace_scopes(const unicode& parser_name, const std::vector<ScopePtr>& scopes, const unicode& filename);
+    void replace_scopes(const unicode& parser_name, const std::vector<ScopePtr>& scopes, const unicode& filename, const FileState& state);
+
+    /*
+     *  While a file is open in the editor its scopes come from the editor's buffer.
+     *  open_buffer replaces them with the buffer's, apply_scope_delta follows each edit
+     *  and, until close_buffer, whatever is indexed from disk for the file is ignored.
+     *  The file's state is forgotten, so it's indexed from disk again once it's closed.
+     */
+    void open_buffer(const unicode& parser_name, const std::vector<ScopePtr>& scopes, const unicode& filename);
+    void apply_scope_delta(const unicode& parser_name, const ScopeDelta& delta, const unicode& filename);
+    void close_buffer(const unicode& filename);
+
+    /* Records a new state for a file whose contents haven't changed */
+    void touch_file(const unicode& filename, const FileState& state);
+
+    bool file_state(const unicode& filename, FileState& out);
+
+    /* The state of every indexed file, or just those below a directory */
+    FileStateMap file_states(const unicode& directory=unicode());
+
+    /* Blocks until everything queued so far has been committed */
+    void flush();
 
     std::vector<unicode> query_completions(const unicode &parser,
         const unicode& filename,
@@ -22,11 +82,106 @@ public:
     , bool word_completion_only=false);
 
     unicode query_scope_at(const unicode &parser, const unicode& filename, int line_number, int col_number);
+
+    /* The scopes of a file, nullptr if it hasn't been indexed */
+    ScopeTreePtr scope_tree(const unicode& parser, const unicode& filename);
+
+    CompletionIndexPtr completion_index() const { return completion_index_; }
+
+    /* The last part of every scope path, from every parser */
+    WordIndexPtr word_index() const { return word_index_; }
 private:
-    sqlite3* db_;
+    /*
+     *  A connection and its prepared statements, keyed on their SQL. Statements handed
+     *  out by statement() have been reset and had their bindings cleared, they stay
+     *  owned by the connection.
+     */
+    class Connection {
+    public:
+        ~Connection() { close(); }
+
+        void open(const std::string& path, int flags);
+        void close();
+
+        sqlite3_stmt* statement(const std::string& sql);
+        void execute(const std::string& sql);
+
+        sqlite3* db = nullptr;
+
+    private:
+        std::unordered_map<std::string, sqlite3_stmt*> statements_;
+    };
+
+    struct WriteTask {
+        std::function<void ()> func;
+        std::shared_ptr<std::promise<void>> done;
+    };
+
+    std::string path_;
+
+    Connection writer_; // Only touched by the writer thread once it has started
+    Connection reader_;
+    std::mutex reader_mutex_;
+
+    BlockingQueue<WriteTask> queue_;
+    std::thread writer_thread_;
+
+    struct IndexChange {
+        bool added;
+        std::string parser;
+        std::string path;
+        uint32_t count = 1; // The scope's occurrences
+    };
+
+    CompletionIndexPtr completion_index_;
+    WordIndexPtr word_index_;
+
+    // Changes made by the current transaction, applied to the index once it commits
+    std::vector<IndexChange> pending_index_changes_;
+
+    // Keyed on filename, then parser
+    std::unordered_map<std::string, std::unordered_map<std::string, ScopeTreePtr>> scope_trees_;
+    std::mutex scope_trees_mutex_;
+
+    // Bumped whenever trees are dropped, so a tree read before a commit isn't cached after it
+    std::atomic<uint64_t> scope_tree_generation_{0};
+
+    std::vector<std::string> pending_scope_tree_invalidations_;
+
+    // Files whose scopes come from an open buffer, only used by the writer thread
+    std::unordered_set<std::string> open_buffers_;
+
+    void load_completion_index();
+
+    void run_writer();
+    void apply(const WriteTask& task);
+
+    void insert_rows(const std::string& insert_sql, int column_count, std::size_t row_count, std::function<void (sqlite3_stmt*, int, std::size_t)> bind_row);
+
+    void delete_scopes(const std::string& filename);
+    void update_scopes(const std::string& parser_name, const std::vector<ScopePtr>& scopes, const std::string& filename);
+    void delete_scope(sqlite3_int64 file_id, const std::string& path, int start_line, int end_line);
+    void delete_scope(sqlite3_int64 id);
+    void apply_delta(const std::string& parser_name, const ScopeDelta& delta, const std::string& filename);
+    void move_lines(sqlite3_int64 file_id, int from_line, int line_shift);
+    void write_file_state(const std::string& filename, const FileState& state);
+    void forget_file_state(const std::string& filename);
+    void insert_scopes(const std::string& parser_name, const std::vector<ScopePtr>& scopes, const std::string& filename);
+
+    // Ids of interned strings, only used by the writer thread
+    std::unordered_map<std::string, sqlite3_int64> file_ids_;
+    std::unordered_map<std::string, sqlite3_int64> path_ids_;
+    std::unordered_map<std::string, sqlite3_int64> parser_ids_;
+
+    sqlite3_int64 find_id(const std::string& table, std::unordered_map<std::string, sqlite3_int64>& ids, const std::string& name);
+    sqlite3_int64 intern(const std::string& table, std::unordered_map<std::string, sqlite3_int64>& ids, const std::string& name);
+    void forget_ids();
 
+    void create_schema();
     void initialize_tables();
-    void open_and_recreate_if_necessary(const unicode& path_to_datastore);
+    bool has_v1_tables();
+    void migrate_from_v1();
+    void open_and_recreate_if_necessary();
 
     unicode query_database_version();
 };
@@ -1,8 +1,16 @@
+#include <thread>
+#include <unordered_set>
+#include <dirent.h>
+#include <sys/stat.h>
+
 #include "indexer.h"
 #include "datastore.h"
 
 #include "../utils/kfs.h"
 #include "../utils/files.h"
+#include "../utils/kazlog.h"
+#include "../utils/content_type.h"
+#include "../utils/xxhash.h"
 
 namespace delimit {
 
@@ -27,8 +35,15 @@ unicode Indexer::guess_type(const unicode& filename) {
      *  loading file data twice.
      */
 
-    auto ext = kfs::path::split_ext(filename.encode()).second;
-    auto it = MIMETYPES.find(ext);
+    // Not split_ext, which doesn't cope with names that have no extension
+    std::string path = filename.encode();
+    auto dot = path.rfind('.');
+    auto slash = path.rfind('/');
+    if(dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+        return "text/plain";
+    }
+
+    auto it = MIMETYPES.find(path.substr(dot));
     if(it == MIMETYPES.end()) {
         return "text/plain";
     }
@@ -37,6 +52,10 @@ unicode Indexer::guess_type(const unicode& filename) {
 }
 
 FileParserPtr Indexer::detect_parser(const unicode& filename) {
+    return detect_parser(filename, parsers_);
+}
+
+FileParserPtr Indexer::detect_parser(const unicode& filename, const ParserMap& parsers) {
     /*
      *  Given a filename, this method returns a matching parser,
      *  if one could not be found, it defaults to the text/plain
@@ -44,24 +63,26 @@ FileParserPtr Indexer::detect_parser(const unicode& filename) {
      */
 
     unicode mime = guess_type(filename);
-    auto parser = parsers_.find(mime);
+    auto parser = parsers.find(mime);
 
-    if(parser == parsers_.end()) {
-        return parsers_.at("text/plain");
+    if(parser == parsers.end()) {
+        return parsers.at("text/plain");
     } else {
         return (*parser).second;
     }
 }
 
 std::vector<ScopePtr> Indexer::index_file(const unicode& filename, const unicode& data) {
-    auto parser = detect_parser(filename);
+    std::lock_guard<std::mutex> lock(parsers_mutex_);
+    return index_file(filename, data, detect_parser(filename));
+}
 
+std::vector<ScopePtr> Indexer::index_file(const unicode& filename, const unicode& data, FileParserPtr parser) {
     auto base_scope = parser->base_scope_from_filename(filename);
     auto scopes_and_success = parser->parse(data, base_scope);
 
     if(scopes_and_success.second) {
-        datastore_->delete_scopes_by_filename(filename);
-        datastore_->save_scopes(parser->name(), scopes_and_success.first, filename);
+        datastore_->replace_scopes(parser->name(), scopes_and_success.first, filename);
     }
     return scopes_and_success.first;
 }
@@ -69,27 +90,172 @@ std::vector<ScopePtr> Indexer::index_file(const unicode& filename, const unicode
 std::vector<ScopePtr> Indexer::index_file(const unicode &path) {
     /*
      *  Indexes a file by running a parser over it and storing the
-     *  resulting scopes in the database
+     *  resulting scopes in the database. Returns nothing if the file
+     *  hasn't changed since it was last indexed.
      */
 
-    return index_file(path, read_file_contents(path));
+    FileState previous;
+    bool known = datastore_->file_state(path, previous);
+
+    std::lock_guard<std::mutex> lock(parsers_mutex_);
+    return index_path(path.encode(), parsers_, (known) ? &previous : nullptr);
 }
 
-void Indexer::index_directory(const unicode &dir_path) {
-    /*
-     *  Recursively indexes the files in a directory
-     */
+std::vector<ScopePtr> Indexer::index_path(const std::string& path, const ParserMap& parsers, const FileState* previous) {
+    struct stat st;
+    if(::stat(path.c_str(), &st) != 0) {
+        throw std::runtime_error("Unable to stat file");
+    }
+
+    FileState state;
+    state.size = st.st_size;
+    state.mtime_sec = st.st_mtim.tv_sec;
+    state.mtime_nsec = st.st_mtim.tv_nsec;
+
+    if(previous && previous->size == state.size &&
+       previous->mtime_sec == state.mtime_sec && previous->mtime_nsec == state.mtime_nsec) {
+        return std::vector<ScopePtr>();
+    }
+
+    std::string bytes = read_file_bytes(path);
+    state.hash = xxh64(bytes);
+
+    // Touched but not changed (a checkout, a save without edits...)
+    if(previous && previous->hash == state.hash && previous->size == state.size) {
+        datastore_->touch_file(path, state);
+        return std::vector<ScopePtr>();
+    }
+
+    auto parser = detect_parser(path, parsers);
+
+    auto data = decode_file_contents(bytes);
+
+    auto scopes_and_success = parser->parse(data, parser->base_scope_from_filename(path));
+    if(scopes_and_success.second) {
+        datastore_->replace_scopes(parser->name(), scopes_and_success.first, path, state);
+    }
+    return scopes_and_success.first;
+}
+
+void Indexer::index_directory(const unicode &dir_path, uint32_t thread_count, const std::atomic<bool>* cancelled, IgnoreTreePtr ignore_tree) {
+    if(!thread_count) {
+        thread_count = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    if(!ignore_tree) {
+        ignore_tree = std::make_shared<IgnoreTree>(dir_path.encode());
+    }
+
+    // Read once up front, the workers only ever look things up in it
+    const FileStateMap previous_states = datastore_->file_states(dir_path);
+
+    BlockingQueue<std::string> paths;
+    std::unordered_set<std::string> seen;
 
-    for(auto file: kfs::path::list_dir(dir_path.encode())) {
-        auto full_path = kfs::path::join(dir_path.encode(), file);
+    std::thread crawler([&]() {
+        crawl(dir_path.encode(), *ignore_tree, paths, seen, cancelled);
+        paths.close();
+    });
 
-        if(kfs::path::is_dir(full_path)) {
-            index_directory(full_path);
-        } else {
-            index_file(full_path);
+    std::vector<std::thread> workers;
+    for(uint32_t i = 0; i < thread_count; ++i) {
+        workers.push_back(std::thread([&]() {
+            ParserMap parsers;
+            {
+                std::lock_guard<std::mutex> lock(parsers_mutex_);
+                for(auto& pair: parsers_) {
+                    parsers.insert(std::make_pair(pair.first, pair.second->clone()));
+                }
+            }
+
+            std::string path;
+            while(paths.pop(path)) {
+                if(cancelled && *cancelled) {
+                    continue; // Drain the queue so the crawler isn't left blocked
+                }
+
+                auto it = previous_states.find(path);
+
+                try {
+                    index_path(path, parsers, (it == previous_states.end()) ? nullptr : &it->second);
+                } catch(std::exception& e) {
+                    L_WARN(_F("Unable to index {0}: {1}").format(path, e.what()));
+                }
+            }
+        }));
+    }
+
+    crawler.join();
+    for(auto& worker: workers) {
+        worker.join();
+    }
+
+    // Files we didn't get to aren't necessarily gone
+    if(cancelled && *cancelled) {
+        datastore_->flush();
+        return;
+    }
+
+    for(auto& pair: previous_states) {
+        if(!seen.count(pair.first)) {
+            datastore_->delete_scopes_by_filename(pair.first);
         }
     }
+
+    datastore_->flush();
 }
 
+void Indexer::crawl(const std::string& dir_path, IgnoreTree& ignore_tree, BlockingQueue<std::string>& output, std::unordered_set<std::string>& seen, const std::atomic<bool>* cancelled) {
+    DIR* dir = opendir(dir_path.c_str());
+    if(!dir) {
+        return;
+    }
+
+    std::vector<std::string> subdirectories;
+
+    while(dirent* entry = readdir(dir)) {
+        if(cancelled && *cancelled) {
+            break;
+        }
+
+        std::string name = entry->d_name;
+        if(name == "." || name == "..") {
+            continue;
+        }
+
+        std::string full_path = kfs::path::join(dir_path, name);
+
+        struct stat st;
+        if(::stat(full_path.c_str(), &st) != 0) {
+            continue; // Broken symlink, or it's already gone
+        }
+
+        bool is_dir = S_ISDIR(st.st_mode);
+        if(ignore_tree.is_ignored(full_path, is_dir)) {
+            continue;
+        }
+
+        if(is_dir) {
+            // Symlinked directories aren't followed, they can loop
+            if(entry->d_type != DT_LNK) {
+                subdirectories.push_back(full_path);
+            }
+        } else if(S_ISREG(st.st_mode) && ContentClassifier::instance().is_text(full_path, st)) {
+            seen.insert(full_path);
+            output.push(full_path);
+        }
+    }
+
+    closedir(dir);
+
+    // Finish this directory's files before going deeper, so there's work for the parsers sooner
+    for(auto& subdirectory: subdirectories) {
+        if(cancelled && *cancelled) {
+            break;
+        }
+
+        crawl(subdirectory, ignore_tree, output, seen, cancelled);
+    }
+}
 
 }
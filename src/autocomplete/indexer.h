@@ -2,17 +2,40 @@
 #define INDEXER_H
 
 #include <map>
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <unordered_set>
 
 #include "base.h"
+#include "../utils/gitignore.h"
+#include "../utils/blocking_queue.h"
 
 namespace delimit {
 
+struct FileState;
+
 class Indexer {
 public:
     Indexer(const unicode& path_to_datastore);
 
     void register_parser(const unicode& mimetype, FileParserPtr parser);
-    void index_directory(const unicode& dir_path);
+
+    /*
+     *  Indexes every text file below dir_path which isn't ignored. One thread crawls,
+     *  thread_count threads (one per core if zero) parse with their own copies of the
+     *  parsers, and the datastore's writer thread saves the results in batches. Returns
+     *  once everything has been written.
+     *
+     *  Files which haven't changed since they were last indexed are skipped, and files
+     *  which have gone are removed from the index. Setting cancelled stops the crawl
+     *  early, whatever was already indexed is kept.
+     *
+     *  ignore_tree should be rooted at the project root, so that its .gitignore (and any
+     *  in between) apply when dir_path is below it. Without one dir_path is the root.
+     */
+    void index_directory(const unicode& dir_path, uint32_t thread_count=0, const std::atomic<bool>* cancelled=nullptr, IgnoreTreePtr ignore_tree=IgnoreTreePtr());
+
     std::vector<ScopePtr> index_file(const unicode& path);
     std::vector<ScopePtr> index_file(const unicode& filename, const unicode& data);
 
@@ -22,11 +45,19 @@ public:
 
     FileParserPtr parser(const unicode& name) { return parsers_by_name_.at(name); }
 private:
+    typedef std::map<unicode, FileParserPtr> ParserMap;
+
+    void crawl(const std::string& dir_path, IgnoreTree& ignore_tree, BlockingQueue<std::string>& output, std::unordered_set<std::string>& seen, const std::atomic<bool>* cancelled);
+    std::vector<ScopePtr> index_file(const unicode& filename, const unicode& data, FileParserPtr parser);
+    std::vector<ScopePtr> index_path(const std::string& path, const ParserMap& parsers, const FileState* previous);
+
     FileParserPtr detect_parser(const unicode& filename);
+    FileParserPtr detect_parser(const unicode& filename, const ParserMap& parsers);
     unicode guess_type(const unicode& filename);
 
-    std::map<unicode, FileParserPtr> parsers_;
+    ParserMap parsers_;
     std::map<unicode, FileParserPtr> parsers_by_name_;
+    std::mutex parsers_mutex_; // Parsers aren't thread-safe, index_directory uses copies
     DatastorePtr datastore_;
 };
 
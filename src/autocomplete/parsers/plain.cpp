@@ -1,3 +1,9 @@
+#include <cwctype>
+#include <unordered_map>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "plain.h"
 #include "../base.h"
@@ -5,6 +11,85 @@
 namespace delimit {
 namespace parser {
 
+namespace {
+
+const char* SEPARATORS = "().|\n\t /\\!#=+-{}%\"\':,[]";
+
+struct CharTable {
+    /* Whether each ASCII character splits words, the separators plus whatever strip() would remove */
+    bool separator[128];
+
+    CharTable() {
+        for(int c = 0; c < 128; ++c) {
+            separator[c] = (c <= ' ' || c == 127);
+        }
+
+        for(const char* c = SEPARATORS; *c; ++c) {
+            separator[int(*c)] = true;
+        }
+    }
+};
+
+const CharTable TABLE;
+
+inline bool is_separator(char32_t c) {
+    if(c < 128) {
+        return TABLE.separator[c];
+    }
+
+    // Rare enough that asking the C library is fine
+    return std::iswspace(c) || std::iswcntrl(c);
+}
+
+std::size_t skip_word(const char32_t* data, std::size_t i, std::size_t length) {
+    /* Returns the index of the first separator at or after i */
+#ifdef __SSE2__
+    /*
+     *  Most words are runs of ASCII letters, digits and underscores, which are
+     *  checked four characters at a time. Anything else goes through the table.
+     */
+    const __m128i lower_start = _mm_set1_epi32('a' - 1), lower_end = _mm_set1_epi32('z' + 1);
+    const __m128i upper_start = _mm_set1_epi32('A' - 1), upper_end = _mm_set1_epi32('Z' + 1);
+    const __m128i digit_start = _mm_set1_epi32('0' - 1), digit_end = _mm_set1_epi32('9' + 1);
+    const __m128i underscore = _mm_set1_epi32('_');
+
+    while(i + 4 <= length) {
+        __m128i chars = _mm_loadu_si128((const __m128i*) (data + i));
+
+        __m128i word = _mm_or_si128(
+            _mm_or_si128(
+                _mm_and_si128(_mm_cmpgt_epi32(chars, lower_start), _mm_cmplt_epi32(chars, lower_end)),
+                _mm_and_si128(_mm_cmpgt_epi32(chars, upper_start), _mm_cmplt_epi32(chars, upper_end))
+            ),
+            _mm_or_si128(
+                _mm_and_si128(_mm_cmpgt_epi32(chars, digit_start), _mm_cmplt_epi32(chars, digit_end)),
+                _mm_cmpeq_epi32(chars, underscore)
+            )
+        );
+
+        int mask = _mm_movemask_epi8(word);
+        if(mask == 0xFFFF) {
+            i += 4;
+            continue;
+        }
+
+        // Four mask bits per character, the first clear one is the character to look at
+        i += __builtin_ctz(~mask) / 4;
+        if(is_separator(data[i])) {
+            return i;
+        }
+        ++i;
+    }
+#endif
+
+    while(i < length && !is_separator(data[i])) {
+        ++i;
+    }
+    return i;
+}
+
+}
+
 std::pair<std::vector<ScopePtr>, bool> Plain::parse(const unicode& data, const unicode& base_scope) {
     std::vector<ScopePtr> scopes;
 
@@ -12,7 +97,19 @@ std::pair<std::vector<ScopePtr>, bool> Plain::parse(const unicode& data, const u
     int end_line = lines.size();
     int end_col = lines.back().length();
 
-    for(unicode word: tokenize(data)) {
+    /*
+     *  Every word covers the whole file, so each one is stored once however often it
+     *  turns up, with the number of times it did.
+     */
+    std::unordered_map<unicode, ScopePtr> seen;
+
+    for(unicode& word: tokenize(data)) {
+        auto it = seen.find(word);
+        if(it != seen.end()) {
+            ++it->second->occurrences;
+            continue;
+        }
+
         auto new_scope = std::make_shared<Scope>(word);
 
         new_scope->start_line = 0;
@@ -20,6 +117,7 @@ std::pair<std::vector<ScopePtr>, bool> Plain::parse(const unicode& data, const u
         new_scope->end_line = end_line;
         new_scope->end_col = end_col;
 
+        seen.insert(std::make_pair(std::move(word), new_scope));
         scopes.push_back(new_scope);
     }
 
@@ -31,19 +129,25 @@ unicode Plain::base_scope_from_filename(const unicode &filename) {
 }
 
 std::vector<unicode> Plain::tokenize(const unicode& data) {
-    std::vector<char32_t> buffer;
     std::vector<unicode> result;
 
-    for(auto x: data) {
-        if(unicode("().|\n\t /\\!#=+-{}%\"\':,[]").contains(unicode(1, x))) {
-            auto word = unicode(buffer.begin(), buffer.end()).strip();
-            if(!word.empty()) {
-                result.push_back(word);
-            }
-            buffer.clear();
-        } else {
-            buffer.push_back(x);
+    if(data.empty()) {
+        return result;
+    }
+
+    const char32_t* text = &*data.begin();
+    const std::size_t length = data.length();
+
+    std::size_t i = 0;
+    while(i < length) {
+        if(is_separator(text[i])) {
+            ++i;
+            continue;
         }
+
+        std::size_t end = skip_word(text, i, length);
+        result.push_back(unicode(text + i, text + end));
+        i = end;
     }
     return result;
 }
@@ -14,6 +14,7 @@ public:
     std::vector<unicode> tokenize(const unicode& data);
 
     bool supports_nested_lookups() const { return false; }
+    FileParserPtr clone() const { return std::make_shared<Plain>(*this); }
 };
 
 }
@@ -1,8 +1,5 @@
-#include <cassert>
-
-#include <set>
-#include <map>
-#include <regex>
+#include <algorithm>
+#include <stdexcept>
 
 #include "python.h"
 #include "../../utils/kazlog.h"
@@ -11,141 +8,18 @@
 namespace delimit {
 namespace parser {
 
-std::string group(const std::vector<std::string>& choices) {
-    return _F("({0})").format(_u("|").join(choices));
-}
-
-std::string any(const std::vector<std::string>& choices) {
-    return group(choices) + "*";
-}
-
-std::string maybe(const std::vector<std::string>& choices) {
-    return group(choices) + "?";
-}
-
-const std::string Whitespace = R"([ \f\t]*)";
-const std::string Comment = R"(#[^\r\n]*)";
-const std::string Ignore = Whitespace + any({R"(\\\r?\n)" + Whitespace}) + maybe({Comment});
-const std::string Name = R"([a-zA-Z_]\w*)";
-
-const std::string Hexnumber = R"(0[xX][\da-fA-F]+[lL]?)";
-const std::string Octnumber = R"((0[oO][0-7]+)|(0[0-7]*)[lL]?)";
-const std::string Binnumber = R"(0[bB][01]+[lL]?)";
-const std::string Decnumber = R"([1-9]\d*[lL]?)";
-const std::string Intnumber = group({Hexnumber, Binnumber, Octnumber, Decnumber});
-const std::string Exponent = R"([eE][-+]?\d+)";
-const std::string Pointfloat = group({R"(\d+\.\d*)", R"(\.\d+)"}) + maybe({Exponent});
-const std::string Expfloat = R"(\d+)" + Exponent;
-const std::string Floatnumber = group({Pointfloat, Expfloat});
-const std::string Imagnumber = group({R"(\d+[jJ])", Floatnumber + R"([jJ])"});
-const std::string Number = group({Imagnumber, Floatnumber, Intnumber});
-
-//Tail end of ' string.
-const std::string Single = R"([^'\\]*(?:\\.[^'\\]*)*')";
-//Tail end of " string.
-const std::string Double = R"([^"\\]*(?:\\.[^"\\]*)*")";
-//Tail end of ''' string.
-const std::string Single3 = R"([^'\\]*(?:(?:\\.|'(?!''))[^'\\]*)*''')";
-//Tail end of """ string.
-const std::string Double3 = R"([^"\\]*(?:(?:\\.|"(?!""))[^"\\]*)*""")";
-const std::string Triple = group({R"([uUbB]?[rR]?''')", R"([uUbB]?[rR]?""")"});
-//Single-line ' or " string.
-const std::string String = group({R"([uUbB]?[rR]?'[^\n'\\]*(?:\\.[^\n'\\]*)*')",
-               R"([uUbB]?[rR]?"[^\n"\\]*(?:\\.[^\n"\\]*)*")"});
-
-/*Because of leftmost-then-longest match semantics, be sure to put the
-longest operators first (e.g., if = came before ==, == would get
-recognized as two instances of =).*/
-const std::string Operator = group({
-    R"(\*\*=?)", R"(>>=?)", R"(<<=?)", R"(<>)", R"(!=)",
-    R"(//=?)", R"([+\-*/%&|^=<>]=?)", R"(~)"
-});
-
-const std::string Bracket = R"([][(){}])";
-const std::string Special = group({R"(\r?\n)", R"([:;.,`@])"});
-const std::string Funny = group({Operator, Bracket, Special});
-
-const std::string PlainToken = group({Number, Funny, String, Name});
-const std::string TokenRE = Ignore + PlainToken;
-
-// First (or only) line of ' or " string.
-const std::string ContStr = group({
-    R"([uUbB]?[rR]?'[^\n'\\]*(?:\\.[^\n'\\]*)*)" +
-    group({"'", R"(\\\r?\n)"}),
-    R"([uUbB]?[rR]?"[^\n"\\]*(?:\\.[^\n"\\]*)*)" +
-    group({'"', R"(\\\r?\n)"})
-});
-const std::string PseudoExtras = group({R"(\\\r?\n|\Z)", Comment, Triple});
-const std::string PseudoToken = Whitespace + group({PseudoExtras, Number, Funny, ContStr, Name});
-
-/*int print() {
-    std::cout << PseudoToken << std::endl;
-    return 0;
-}
-int i = print();*/
-
-const std::regex tokenprog = std::regex(TokenRE);
-const std::regex pseudoprog = std::regex(PseudoToken);
-const std::regex single3prog = std::regex(Single3);
-const std::regex double3prog = std::regex(Double3);
-
-const std::map<std::string, std::regex> endprogs = {
-    {"'", std::regex(Single)},
-    {"\"", std::regex(Double)},
-    {"'''", single3prog},
-    {"\"\"\"", double3prog},
-    {"r'''", single3prog},
-    {"r\"\"\"", double3prog},
-    {"u'''", single3prog},
-    {"u\"\"\"", double3prog},
-    {"ur'''", single3prog},
-    {"ur\"\"\"", double3prog},
-    {"R'''", single3prog},
-    {"R\"\"\"", double3prog},
-    {"U'''", single3prog},
-    {"U\"\"\"", double3prog},
-    {"uR'''", single3prog},
-    {"uR\"\"\"", double3prog},
-    {"Ur'''", single3prog},
-    {"Ur\"\"\"", double3prog},
-    {"UR'''", single3prog},
-    {"UR\"\"\"", double3prog},
-    {"b'''", single3prog},
-    {"b\"\"\"", double3prog},
-    {"br'''", single3prog},
-    {"br\"\"\"", double3prog},
-    {"B'''", single3prog},
-    {"B\"\"\"", double3prog},
-    {"bR'''", single3prog},
-    {"bR\"\"\"", double3prog},
-    {"Br'''", single3prog},
-    {"Br\"\"\"", double3prog},
-    {"BR'''", single3prog},
-    {"BR\"\"\"", double3prog}
-};
-
-const std::set<std::string> triple_quoted = {
-    "'''", "\"\"\"",
-  "r'''", "r\"\"\"", "R'''", "R\"\"\"",
-  "u'''", "u\"\"\"", "U'''", "U\"\"\"",
-  "ur'''", "ur\"\"\"", "Ur'''", "Ur\"\"\"",
-  "uR'''", "uR\"\"\"", "UR'''", "UR\"\"\"",
-  "b'''", "b\"\"\"", "B'''", "B\"\"\"",
-  "br'''", "br\"\"\"", "Br'''", "Br\"\"\"",
-  "bR'''", "bR\"\"\"", "BR'''", "BR\"\"\""
-};
-
-const std::set<std::string> single_quoted = {
-    "'", "\"",
-    "r'", "r\"", "R'", "R\"",
-    "u'", "u\"", "U'", "U\"",
-    "ur'", "ur\"", "Ur'", "Ur\"",
-    "uR'", "uR\"", "UR'", "UR\"",
-    "b'", "b\"", "B'", "B\"",
-    "br'", "br\"", "Br'", "Br\"",
-    "bR'", "bR\"", "BR'", "BR\""
-};
-
+/*
+ *  A hand written version of the tokenizer in CPython 2.7's tokenize.py. That module is
+ *  built from a handful of regular expressions (pseudoprog, endprogs, ...), each matcher
+ *  below is one of them turned into a loop over the line. Alternatives are tried in the
+ *  same order as the regular expressions so the two always agree on where a token ends,
+ *  including the odd cases like "0x" (a NUMBER then a NAME) or an unterminated string
+ *  (an ERRORTOKEN for the quote). Like the regular expressions, \d and \w only match
+ *  ASCII.
+ *
+ *  Tokens are views into the data and pending tokens live in a buffer which is reused,
+ *  so nothing is allocated per token.
+ */
 
 const int tabsize = 8;
 
@@ -155,360 +29,794 @@ public:
         std::logic_error(what.encode()) {}
 };
 
-void handle_newline(const unicode& line, int lnum, uint32_t pos, std::vector<Token>& result) {
-    if(line[pos] == '#') {
-        auto comment_token = line.slice(pos, nullptr).rstrip("\r\n");
-        auto nl_pos = pos + comment_token.length();
-        result.push_back(
-            Token({
-                TokenType::COMMENT,
-                comment_token,
-                std::make_pair(lnum, pos),
-                std::make_pair(lnum, pos + comment_token.length())
-            })
-        );
+namespace {
+
+enum PseudoKind {
+    PSEUDO_NOTHING, // \Z, or trailing whitespace
+    PSEUDO_CONTINUATION,
+    PSEUDO_COMMENT,
+    PSEUDO_TRIPLE,
+    PSEUDO_NUMBER,
+    PSEUDO_NEWLINE,
+    PSEUDO_OP,
+    PSEUDO_STRING,
+    PSEUDO_NAME
+};
 
-        result.push_back(
-            Token({
-                TokenType::NL,
-                line.slice(nl_pos, nullptr),
-                std::make_pair(lnum, nl_pos),
-                std::make_pair(lnum, line.length())
-            })
-        );
-    } else {
-        auto res = line[pos] == '#';
-
-        result.push_back(
-            Token({
-                (res) ? TokenType::COMMENT : TokenType::NL,
-                line.slice(pos, nullptr),
-                std::make_pair(lnum, (int)pos),
-                std::make_pair(lnum, (int)line.length())
-            })
-        );
+inline bool is_digit(char32_t c) { return c >= '0' && c <= '9'; }
+inline bool is_alpha(char32_t c) { return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'); }
+inline bool is_name_start(char32_t c) { return is_alpha(c) || c == '_'; }
+inline bool is_name_char(char32_t c) { return is_name_start(c) || is_digit(c); }
+inline bool is_quote(char32_t c) { return c == '\'' || c == '"'; }
+
+inline bool is_hex_digit(char32_t c) {
+    return is_digit(c) || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+}
+
+/* The line being tokenized, indexes are columns */
+struct Line {
+    const char32_t* text;
+    int max;
+
+    char32_t operator[](int i) const { return text[i]; }
+    bool at(int i, char32_t c) const { return i < max && text[i] == c; }
+    unicode slice(int start, int end) const { return unicode(text + start, text + end); }
+};
+
+int skip_digits(const Line& line, int i) {
+    while(i < line.max && is_digit(line[i])) {
+        ++i;
     }
+    return i;
 }
 
-std::vector<Token> Python::tokenize(const unicode& data) {
-    int lnum = 0, parentlev = 0, continued = 0;
-    unicode namechars = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_";
-    unicode numchars = "0123456789";
+int skip_suffix(const Line& line, int i, char32_t lower, char32_t upper) {
+    return (line.at(i, lower) || line.at(i, upper)) ? i + 1 : i;
+}
+
+/* Exponent: [eE][-+]?\d+ */
+int match_exponent(const Line& line, int i) {
+    if(!line.at(i, 'e') && !line.at(i, 'E')) {
+        return -1;
+    }
+
+    int j = i + 1;
+    if(line.at(j, '-') || line.at(j, '+')) {
+        ++j;
+    }
+
+    int end = skip_digits(line, j);
+    return (end > j) ? end : -1;
+}
+
+/* Floatnumber: Pointfloat (\d+\.\d*|\.\d+)(Exponent)? or Expfloat \d+Exponent */
+int match_float(const Line& line, int i) {
+    if(is_digit(line[i])) {
+        int digits_end = skip_digits(line, i);
+        if(line.at(digits_end, '.')) {
+            int end = skip_digits(line, digits_end + 1);
+            int exponent_end = match_exponent(line, end);
+            return (exponent_end < 0) ? end : exponent_end;
+        }
+        return match_exponent(line, digits_end);
+    } else if(line[i] == '.') {
+        int end = skip_digits(line, i + 1);
+        if(end == i + 1) {
+            return -1;
+        }
+        int exponent_end = match_exponent(line, end);
+        return (exponent_end < 0) ? end : exponent_end;
+    }
 
-    unicode contstr = "";
-    int needcont = 0;
+    return -1;
+}
 
-    unicode contline = "";
-    std::vector<int> indents = { 0 };
+/* Number: Imagnumber, Floatnumber then Intnumber, the first to match wins */
+int match_number(const Line& line, int i) {
+    if(is_digit(line[i])) {
+        int digits_end = skip_digits(line, i);
+        if(line.at(digits_end, 'j') || line.at(digits_end, 'J')) {
+            return digits_end + 1;
+        }
+    }
 
-    std::vector<unicode> lines = data.split("\n");
-    for(uint32_t i = 0; i < lines.size(); ++i) {
-        lines[i] = lines[i] + "\n";
+    int float_end = match_float(line, i);
+    if(float_end >= 0) {
+        if(line.at(float_end, 'j') || line.at(float_end, 'J')) {
+            return float_end + 1;
+        }
+        return float_end;
     }
 
-    int tabsize = 0;
+    if(line[i] == '0') {
+        int j = i + 1;
+        if((line.at(j, 'x') || line.at(j, 'X')) && j + 1 < line.max && is_hex_digit(line[j + 1])) {
+            j += 1;
+            while(j < line.max && is_hex_digit(line[j])) {
+                ++j;
+            }
+            return skip_suffix(line, j, 'l', 'L');
+        }
 
-    std::regex endprog;
+        if((line.at(j, 'b') || line.at(j, 'B')) && (line.at(j + 1, '0') || line.at(j + 1, '1'))) {
+            j += 1;
+            while(line.at(j, '0') || line.at(j, '1')) {
+                ++j;
+            }
+            return skip_suffix(line, j, 'l', 'L');
+        }
 
-    std::vector<Token> result;
-    std::pair<int, int> strstart;
-    int start = 0, end = 0;
+        // 0[oO][0-7]+ has no long suffix, 0[0-7]* does
+        bool is_octal = line.at(j, 'o') || line.at(j, 'O');
+        if(is_octal && j + 1 < line.max && line[j + 1] >= '0' && line[j + 1] <= '7') {
+            j += 1;
+        } else {
+            is_octal = false;
+        }
 
-    while(true) {
-        unicode line;
-        if(lnum < (int) lines.size()) {
-            line = lines.at(lnum);
+        while(j < line.max && line[j] >= '0' && line[j] <= '7') {
+            ++j;
         }
+        return (is_octal) ? j : skip_suffix(line, j, 'l', 'L');
+    } else if(line[i] >= '1' && line[i] <= '9') {
+        return skip_suffix(line, skip_digits(line, i), 'l', 'L');
+    }
 
-        //std::cout << line << std::endl;
+    return -1;
+}
 
-        lnum += 1; //Increment the line counter
-        int32_t pos = 0, max = line.length(); //Store the line boundaries
-        if(!contstr.empty()) {
-            if(line.empty()) {
-                throw TokenizationError("EOF in multiline string");
+/* Funny: Operator, Bracket or Special (other than newlines) */
+int match_operator(const Line& line, int i) {
+    char32_t c = line[i];
+    auto maybe_equal = [&](int end) { return line.at(end, '=') ? end + 1 : end; };
+
+    switch(c) {
+        case '*':
+        case '>':
+        case '/':
+            return maybe_equal(line.at(i + 1, c) ? i + 2 : i + 1);
+        case '<':
+            if(line.at(i + 1, '>')) {
+                return i + 2;
             }
+            return maybe_equal(line.at(i + 1, '<') ? i + 2 : i + 1);
+        case '!':
+            return line.at(i + 1, '=') ? i + 2 : -1;
+        case '+': case '-': case '%': case '&': case '|': case '^': case '=':
+            return maybe_equal(i + 1);
+        case '~':
+        case '[': case ']': case '(': case ')': case '{': case '}':
+        case ':': case ';': case '.': case ',': case '`': case '@':
+            return i + 1;
+        default:
+            return -1;
+    }
+}
 
-            std::smatch endmatch;
-            auto partial = line.encode();
-            if(std::regex_match(partial, endmatch, endprog)) {
-                //Continue
-                pos = end = endmatch.position() + endmatch.length();
-              //  std::cout << "Found STRING token: " << contstr + line.slice(nullptr, end) << std::endl;
-                result.push_back(Token({TokenType::STRING, contstr + line.slice(nullptr, end), strstart, std::make_pair(lnum, end)}));
-                contstr = "";
-                needcont = 0;
-                contline = "";
-            } else if(needcont && line.slice(-2, nullptr) != "\n" && line.slice(-3, nullptr) != "\r\n") {
-                result.push_back(Token({TokenType::ERRORTOKEN, contstr + line, strstart, std::make_pair(lnum, line.length())}));
-                contstr = "";
-                contline = "";
-                continue;
+/* [uUbB]?[rR]? */
+int skip_string_prefix(const Line& line, int i) {
+    if(i < line.max && (line[i] == 'u' || line[i] == 'U' || line[i] == 'b' || line[i] == 'B')) {
+        ++i;
+    }
+    return skip_suffix(line, i, 'r', 'R');
+}
+
+/*
+ *  ContStr: the first line of a ' or " string, from the opening quote. Returns the end
+ *  of the string, or the end of a backslash-newline if it carries on to the next line.
+ */
+int match_contstr(const Line& line, int quote_pos) {
+    char32_t quote = line[quote_pos];
+    int i = quote_pos + 1;
+    while(i < line.max) {
+        char32_t c = line[i];
+        if(c == quote) {
+            return i + 1;
+        } else if(c == '\n') {
+            return -1;
+        } else if(c == '\\') {
+            if(line.at(i + 1, '\n')) {
+                return i + 2;
+            } else if(line.at(i + 1, '\r') && line.at(i + 2, '\n')) {
+                return i + 3;
+            } else if(i + 1 < line.max) {
+                i += 2;
             } else {
-                contstr = contstr + line;
-                contline = contline + line;
-                continue;
+                return -1;
             }
-        } else if(parentlev == 0 && !continued) {
-            if(line.empty()) {
-              //  std::cout << "Breaking loop because the line is empty" << std::endl;
-                break;
+        } else {
+            ++i;
+        }
+    }
+    return -1;
+}
+
+/*
+ *  The endprogs: the tail end of a string (Single, Double, Single3 and Double3). Unlike
+ *  ContStr these run over newlines, but not a backslash-newline.
+ */
+int match_string_end(const Line& line, int i, char32_t quote, bool triple) {
+    while(i < line.max) {
+        char32_t c = line[i];
+        if(c == quote) {
+            if(!triple) {
+                return i + 1;
+            } else if(line.at(i + 1, quote) && line.at(i + 2, quote)) {
+                return i + 3;
             }
-            int column = 0;
-            while(pos < max) {
-                if(line[pos] == ' ') {
-                    column += 1;
-                } else if(line[pos] == '\t') {
-                    column = (column / (tabsize + 1)) * tabsize;
-                } else if(line[pos] == '\f') {
-                    column = 0;
-                } else {
-                    break;
-                }
-                pos += 1;
+            ++i;
+        } else if(c == '\\') {
+            if(i + 1 >= line.max || line[i + 1] == '\n') {
+                return -1;
             }
+            i += 2;
+        } else {
+            ++i;
+        }
+    }
+    return -1;
+}
 
-            if(pos == max) {
-                break;
-            }
+/*
+ *  PseudoToken: whitespace, then whichever of PseudoExtras, Number, Funny, ContStr or
+ *  Name matches first. Fills in the span of the token (without the whitespace).
+ */
+bool match_pseudo_token(const Line& line, int pos, int& start, int& end, PseudoKind& kind) {
+    int i = pos;
+    while(i < line.max && (line[i] == ' ' || line[i] == '\f' || line[i] == '\t')) {
+        ++i;
+    }
 
-            if(_u("#\r\n").contains(_u(1, line[pos]))) {
-              //  std::cout << "Handling newline" << std::endl;
-                handle_newline(line, lnum, pos, result);
-                continue;
-            }
+    start = end = i;
+    if(i == line.max) {
+        kind = PSEUDO_NOTHING;
+        return true;
+    }
 
-            if(column > indents.back()) {
-                indents.push_back(column);
-              //  std::cout << "INDENT" << std::endl;
-                result.push_back(
-                    Token({
-                        TokenType::INDENT,
-                        line.slice(nullptr, pos),
-                        std::make_pair(lnum, 0),
-                        std::make_pair(lnum, line.length())
-                    })
-                );
-            }
+    char32_t c = line[i];
 
-       //     std::cout << column << "====" << indents.back() << std::endl;
-            while(column < indents.back()) {
-                if(std::find(indents.begin(), indents.end(), column) == indents.end()) {
-                    throw TokenizationError("Unindent doesn't match outer indent level");
-                }
-                indents.pop_back();
-                result.push_back(
-                    Token({
-                        TokenType::DEDENT,
-                        "",
-                        std::make_pair(lnum, pos),
-                        std::make_pair(lnum, pos)
-                    })
-                );
-
-       //         std::cout << "DEDENT" << std::endl;
-            }
+    if(c == '\\') {
+        if(line.at(i + 1, '\n')) {
+            end = i + 2;
+        } else if(line.at(i + 1, '\r') && line.at(i + 2, '\n')) {
+            end = i + 3;
         } else {
-            if(line.empty()) {
-                throw TokenizationError("EOF in multi-line statement");
-            }
-            continued = 0;
+            return false;
         }
+        kind = PSEUDO_CONTINUATION;
+        return true;
+    }
 
-        unicode token;
-        std::pair<int, int> spos;
-        std::pair<int, int> epos;
-        while(pos < max) {
-            auto partial = line.slice(pos, nullptr).encode();
-            std::smatch pseudomatch;
-            if(std::regex_match(partial, pseudomatch, pseudoprog)) {
-                std::pair<int, int> start_end = std::make_pair(
-                    pos + pseudomatch.position(),
-                    pos + pseudomatch.position() + pseudomatch.length()
-                );
-
-                start = start_end.first;
-                end = start_end.second;
-                spos = std::make_pair(lnum, start);
-                epos = std::make_pair(lnum, end);
-                pos = end;
-                if(start == end) {
-                    continue;
-                }
+    if(c == '#') {
+        while(end < line.max && line[end] != '\r' && line[end] != '\n') {
+            ++end;
+        }
+        kind = PSEUDO_COMMENT;
+        return true;
+    }
 
-                token = line.slice(start, end);
-                auto initial = _u(1, line[start]);
+    int quote_pos = skip_string_prefix(line, i);
+    if(quote_pos < line.max && is_quote(line[quote_pos])) {
+        char32_t quote = line[quote_pos];
+        if(line.at(quote_pos + 1, quote) && line.at(quote_pos + 2, quote)) {
+            end = quote_pos + 3;
+            kind = PSEUDO_TRIPLE;
+            return true;
+        }
+    }
 
-                if(numchars.contains(initial) || (initial == "." && token != ".")) {
-                    //We have a number
-                    //std::cout << "Found NUMBER token: " << token << std::endl;
-                    result.push_back(Token({TokenType::NUMBER, token, spos, epos}));
-                } else if(_u("\r\n").contains(initial)) {
-                    if(parentlev > 0) {
-                        result.push_back(Token({TokenType::NL, token, spos, epos}));
-                    } else {
-                        result.push_back(Token({TokenType::NEWLINE, token, spos, epos}));
-                    }
-                } else if(initial == _u("#")) {
-                    assert(!token.ends_with("\n"));
-                    result.push_back(Token({TokenType::COMMENT, token, spos, epos}));
-                } else if(triple_quoted.count(token.encode())) {
-                    auto tok_str = token.encode();
-                    endprog = endprogs.at(tok_str);
-
-                    auto partial = line.slice(pos, nullptr).encode();
-                    std::smatch endmatch;
-                    if(std::regex_match(partial, endmatch, endprog)) {
-                        pos = pos + endmatch.position() + endmatch.length();
-                        token = line.slice(start, pos);
-                        result.push_back(Token({TokenType::STRING, token, spos, std::make_pair(lnum, pos)}));
-                    } else {
-                        strstart = std::make_pair(lnum, start);
-                        contstr = line.slice(start, nullptr);
-                        contline = line;
-                        break;
-                    }
-                } else if(
-                    single_quoted.count(token.encode()) ||
-                    single_quoted.count(token.slice(nullptr, 2).encode()) ||
-                    single_quoted.count(token.slice(nullptr, 3).encode())) {
-
-                    if(token[token.length() - 1] == '\n') {
-                        strstart = std::make_pair(lnum, start);
-
-                        bool break_outer = false;
-                        for(unicode tok: { initial, _u(1, token[1]), _u(1, token[2])}) {
-                            if(endprogs.count(tok.encode())) {
-                                endprog = endprogs.at(tok.encode());
-                                contstr = line.slice(start, nullptr);
-                                needcont = 1;
-                                contline = line;
-                                break_outer = true;
-                                break;
-                            }
-                        }
+    int number_end = match_number(line, i);
+    if(number_end >= 0) {
+        end = number_end;
+        kind = PSEUDO_NUMBER;
+        return true;
+    }
 
-                        if(break_outer) {
-                            break;
-                        }
-                    } else {
-                        result.push_back(Token({TokenType::STRING, token, spos, epos}));
-                    }
-                } else if(namechars.contains(initial)) {
-                   // std::cout << "Found name token: " << token << std::endl;
-                    result.push_back(Token({TokenType::NAME, token, spos, epos}));
-                } else if(initial == "\\") {
-                    continued = 1;
-                } else {
-                    if(_u("([{").contains(initial)) {
-                        parentlev += 1;
-                    } else if(_u(")]}").contains(initial)) {
-                        parentlev -= 1;
-                    }
-                   // std::cout << "Found OP token: " << token << std::endl;
-                    result.push_back(Token({TokenType::OP, token, spos, epos}));
-                }
-            } else {
-                result.push_back(Token({TokenType::ERRORTOKEN, token, spos, epos}));
-                pos += 1;
+    if(c == '\n' || (c == '\r' && line.at(i + 1, '\n'))) {
+        end = (c == '\n') ? i + 1 : i + 2;
+        kind = PSEUDO_NEWLINE;
+        return true;
+    }
+
+    int operator_end = match_operator(line, i);
+    if(operator_end >= 0) {
+        end = operator_end;
+        kind = PSEUDO_OP;
+        return true;
+    }
+
+    if(quote_pos < line.max && is_quote(line[quote_pos])) {
+        int string_end = match_contstr(line, quote_pos);
+        if(string_end >= 0) {
+            end = string_end;
+            kind = PSEUDO_STRING;
+            return true;
+        }
+    }
+
+    if(is_name_start(c)) {
+        end = i + 1;
+        while(end < line.max && is_name_char(line[end])) {
+            ++end;
+        }
+        kind = PSEUDO_NAME;
+        return true;
+    }
+
+    return false;
+}
+
+TokenType operator_type(const Line& line, int start, int end) {
+    char32_t c = line[start];
+    char32_t second = (end - start > 1) ? line[start + 1] : 0;
+
+    if(end - start == 1) {
+        switch(c) {
+            case '(': return LPAR;
+            case ')': return RPAR;
+            case '[': return LSQB;
+            case ']': return RSQB;
+            case ':': return COLON;
+            case ',': return COMMA;
+            case ';': return SEMI;
+            case '+': return PLUS;
+            case '-': return MINUS;
+            case '*': return STAR;
+            case '/': return SLASH;
+            case '|': return VBAR;
+            case '&': return AMPER;
+            case '<': return LESS;
+            case '>': return GREATER;
+            case '=': return EQUAL;
+            case '.': return DOT;
+            case '%': return PERCENT;
+            case '`': return BACKQUOTE;
+            case '{': return LBRACE;
+            case '}': return RBRACE;
+            case '~': return TILDE;
+            case '^': return CIRCUMFLEX;
+            case '@': return AT;
+            default: return OP;
+        }
+    } else if(end - start == 2) {
+        if(second == '=') {
+            switch(c) {
+                case '=': return EQEQUAL;
+                case '!': return NOTEQUAL;
+                case '<': return LESSEQUAL;
+                case '>': return GREATEREQUAL;
+                case '+': return PLUSEQUAL;
+                case '-': return MINEQUAL;
+                case '*': return STAREQUAL;
+                case '/': return SLASHEQUAL;
+                case '%': return PERCENTEQUAL;
+                case '&': return AMPEREQUAL;
+                case '|': return VBAREQUAL;
+                case '^': return CIRCUMFLEXEQUAL;
+                default: return OP;
             }
         }
+
+        switch(c) {
+            case '<': return (second == '>') ? NOTEQUAL : LEFTSHIFT;
+            case '>': return RIGHTSHIFT;
+            case '*': return DOUBLESTAR;
+            case '/': return DOUBLESLASH;
+            default: return OP;
+        }
     }
 
-    for(uint32_t i = 1; i < indents.size(); ++i) {
-        //std::cout << "DEDENT" << std::endl;
-        result.push_back(Token({TokenType::DEDENT, "", std::make_pair(lnum, 0), std::make_pair(lnum, 0)}));
+    switch(c) {
+        case '<': return LEFTSHIFTEQUAL;
+        case '>': return RIGHTSHIFTEQUAL;
+        case '*': return DOUBLESTAREQUAL;
+        case '/': return DOUBLESLASHEQUAL;
+        default: return OP;
     }
-    result.push_back(Token({TokenType::ENDMARKER, "", std::make_pair(lnum, 0), std::make_pair(lnum, 0)}));
-    return result;
 }
 
-bool is_python_builtin(const unicode& name) {
-    const std::vector<unicode> builtins = {
-        "ArithmeticError", "AssertionError", "AttributeError", "BaseException",
-        "BufferError", "BytesWarning", "DeprecationWarning", "EOFError",
-        "Ellipsis", "EnvironmentError", "Exception", "False", "FloatingPointError",
-        "FutureWarning", "GeneratorExit", "IOError", "ImportError", "ImportWarning",
-        "IndentationError", "IndexError", "KeyError", "KeyboardInterrupt",
-        "LookupError", "MemoryError", "NameError", "None", "NotImplemented",
-        "NotImplementedError", "OSError", "OverflowError", "PendingDeprecationWarning",
-        "ReferenceError", "RuntimeError", "RuntimeWarning", "StandardError",
-        "StopIteration", "SyntaxError", "SyntaxWarning", "SystemError", "SystemExit",
-        "TabError", "True", "TypeError", "UnboundLocalError", "UnicodeDecodeError",
-        "UnicodeEncodeError", "UnicodeError", "UnicodeTranslateError", "UnicodeWarning",
-        "UserWarning", "ValueError", "Warning", "ZeroDivisionError", "_", "__debug__",
-        "__doc__", "__import__", "__name__", "__package__", "abs", "all", "any", "apply",
-        "basestring", "bin", "bool", "buffer", "bytearray", "bytes", "callable", "chr",
-        "classmethod", "cmp", "coerce", "compile", "complex", "copyright", "credits",
-        "delattr", "dict", "dir", "divmod", "enumerate", "eval", "execfile", "exit",
-        "file", "filter", "float", "format", "frozenset", "getattr", "globals",
-        "hasattr", "hash", "help", "hex", "id", "input", "int", "intern", "isinstance",
-        "issubclass", "iter", "len", "license", "list", "locals", "long", "map", "max",
-        "memoryview", "min", "next", "object", "oct", "open", "ord", "pow", "print",
-        "property", "quit", "range", "raw_input", "reduce", "reload", "repr", "reversed",
-        "round", "set", "setattr", "slice", "sorted", "staticmethod", "str", "sum", "super",
-        "tuple", "type", "unichr", "unicode", "vars", "xrange", "zip"
-    };
+int compare_text(const char32_t* text, const TokenView& token, const char* ascii) {
+    const char32_t* it = text + token.offset;
+    const char32_t* end = it + token.length;
+
+    for(; it != end && *ascii; ++it, ++ascii) {
+        if(*it != (unsigned char) *ascii) {
+            return (*it < (unsigned char) *ascii) ? -1 : 1;
+        }
+    }
 
-    return std::find(builtins.begin(), builtins.end(), name) != builtins.end();
+    if(it != end) {
+        return 1;
+    }
+    return (*ascii) ? -1 : 0;
 }
 
-std::pair<bool, std::vector<Token>> find_tokens_till_next(const unicode& what, const std::vector<Token>& all_tokens, const int start) {
-    bool complete = false;
-    int lookahead = start;
-    std::vector<Token> result;
+}
+
+Tokenizer::Tokenizer(const unicode& data):
+    text_((data.empty()) ? U"" : &data[0]),
+    length_(data.length()),
+    indents_({0}) {
+
+    pending_.reserve(16);
+}
+
+Tokenizer::Tokenizer(const unicode& data, int offset, int line, const LineState& state):
+    Tokenizer(data) {
+
+    lnum_ = line - 1;
+    next_line_ = offset;
+
+    parenlev_ = state.parenlev;
+    continued_ = state.continued;
+    in_string_ = state.in_string;
+    contstr_start_ = state.contstr_start;
+    contstr_quote_ = state.contstr_quote;
+    contstr_triple_ = state.contstr_triple;
+    needcont_ = state.needcont;
+    strstart_ = state.strstart;
+    indents_ = state.indents;
+}
+
+Tokenizer::LineState Tokenizer::state() const {
+    LineState state;
+    state.parenlev = parenlev_;
+    state.continued = continued_;
+    state.in_string = in_string_;
+    state.contstr_start = contstr_start_;
+    state.contstr_quote = contstr_quote_;
+    state.contstr_triple = contstr_triple_;
+    state.needcont = needcont_;
+    state.strstart = strstart_;
+    state.indents = indents_;
+    return state;
+}
+
+bool Tokenizer::next_line(std::vector<TokenView>& tokens) {
+    if(finished_) {
+        return false;
+    }
+
+    read_line();
+
+    if(at_eof_) {
+        TokenView token;
+        while(next(token)) {
+            tokens.push_back(token);
+        }
+        return true;
+    }
+
+    tokens.insert(tokens.end(), pending_.begin(), pending_.end());
+    pending_.clear();
+
+    TokenView token;
+    while(in_line_ && scan_token(token)) {
+        tokens.push_back(token);
+    }
+    return true;
+}
+
+unicode Tokenizer::str(const TokenView& token) const {
+    return unicode(text_ + token.offset, text_ + token.offset + token.length);
+}
+
+int Tokenizer::compare(const TokenView& token, const char* ascii) const {
+    return compare_text(text_, token, ascii);
+}
+
+void Tokenizer::push_pending(TokenType type, int start, int end) {
+    pending_.push_back(TokenView({
+        type, type, uint32_t(line_start_ + start), uint32_t(end - start),
+        std::make_pair(lnum_, start), std::make_pair(lnum_, end)
+    }));
+}
+
+bool Tokenizer::next(TokenView& token) {
     while(true) {
-        if(uint32_t(lookahead) > all_tokens.size() - 1) {
-            break;
+        if(pending_pos_ < pending_.size()) {
+            token = pending_[pending_pos_++];
+            if(pending_pos_ == pending_.size()) {
+                pending_.clear();
+                pending_pos_ = 0;
+            }
+            return true;
         }
 
-        const Token& lookahead_tok = all_tokens.at(lookahead);
-        if(lookahead_tok.str == what) {
-            complete = true;
-            break;
+        if(finished_) {
+            return false;
+        }
+
+        if(at_eof_) {
+            // Pop any remaining indent levels, then finish
+            TokenType type = ENDMARKER;
+            if(indents_.size() > 1) {
+                indents_.pop_back();
+                type = DEDENT;
+            } else {
+                finished_ = true;
+            }
+
+            token = TokenView({
+                type, type, uint32_t(length_), 0, std::make_pair(lnum_, 0), std::make_pair(lnum_, 0)
+            });
+            return true;
+        }
+
+        if(in_line_) {
+            if(scan_token(token)) {
+                return true;
+            }
+        } else {
+            read_line();
+        }
+    }
+}
+
+void Tokenizer::read_line() {
+    // readline(), which returns an empty line once the data runs out
+    line_start_ = next_line_;
+    while(next_line_ < length_ && text_[next_line_++] != '\n') {}
+
+    Line line = { text_ + line_start_, next_line_ - line_start_ };
+    line_max_ = line.max;
+
+    lnum_ += 1;
+    int pos = 0, max = line.max;
+
+    if(in_string_) {
+        if(!max) {
+            throw TokenizationError("EOF in multi-line string");
+        }
+
+        int end = match_string_end(line, 0, contstr_quote_, contstr_triple_);
+        if(end >= 0) {
+            pos = end;
+            pending_.push_back(TokenView({
+                STRING, STRING,
+                uint32_t(contstr_start_), uint32_t(line_start_ + end - contstr_start_),
+                strstart_, std::make_pair(lnum_, end)
+            }));
+            in_string_ = false;
+            needcont_ = false;
+        } else if(needcont_ && !(max >= 2 && line[max - 2] == '\\' && line[max - 1] == '\n') &&
+                  !(max >= 3 && line[max - 3] == '\\' && line[max - 2] == '\r' && line[max - 1] == '\n')) {
+            pending_.push_back(TokenView({
+                ERRORTOKEN, ERRORTOKEN,
+                uint32_t(contstr_start_), uint32_t(line_start_ + max - contstr_start_),
+                strstart_, std::make_pair(lnum_, max)
+            }));
+            in_string_ = false;
+            return;
+        } else {
+            return;
+        }
+    } else if(parenlev_ == 0 && !continued_) {
+        if(!max) {
+            at_eof_ = true;
+            return;
+        }
+
+        int column = 0;
+        while(pos < max) {
+            if(line[pos] == ' ') {
+                column += 1;
+            } else if(line[pos] == '\t') {
+                column = (column / tabsize + 1) * tabsize;
+            } else if(line[pos] == '\f') {
+                column = 0;
+            } else {
+                break;
+            }
+            pos += 1;
+        }
+
+        if(pos == max) {
+            at_eof_ = true;
+            return;
+        }
+
+        // Skip comments and blank lines
+        if(line[pos] == '#') {
+            int nl_pos = max;
+            while(nl_pos > pos && (line[nl_pos - 1] == '\r' || line[nl_pos - 1] == '\n')) {
+                --nl_pos;
+            }
+
+            push_pending(COMMENT, pos, nl_pos);
+            push_pending(NL, nl_pos, max);
+            return;
+        } else if(line[pos] == '\r' || line[pos] == '\n') {
+            push_pending(NL, pos, max);
+            return;
         }
 
-        result.push_back(lookahead_tok);
+        if(column > indents_.back()) {
+            indents_.push_back(column);
+            push_pending(INDENT, 0, pos);
+        }
 
-        lookahead += 1;
+        while(column < indents_.back()) {
+            if(std::find(indents_.begin(), indents_.end(), column) == indents_.end()) {
+                throw TokenizationError("unindent does not match any outer indentation level");
+            }
+            indents_.pop_back();
+            push_pending(DEDENT, pos, pos);
+        }
+    } else {
+        if(!max) {
+            throw TokenizationError("EOF in multi-line statement");
+        }
+        continued_ = false;
     }
 
-    return std::make_pair(complete, result);
+    pos_ = pos;
+    in_line_ = true;
 }
 
-unicode guess_scope_from_assigned_token(const Token& tok) {
-    if(tok.type == OP) {
-        if(tok.str == "[") {
-            return "list";
-        } else if(tok.str == "{") {
-            //FIXME: Could be a set, we should look for a ":" before a closing }
-            return "dict";
-        } else if(tok.str.starts_with("'") || tok.str.starts_with("\"")) {
-            return "str";
+bool Tokenizer::scan_token(TokenView& token) {
+    Line line = { text_ + line_start_, line_max_ };
+
+    while(pos_ < line.max) {
+        int start, end;
+        PseudoKind kind;
+
+        if(!match_pseudo_token(line, pos_, start, end, kind)) {
+            start = pos_;
+            end = pos_ += 1;
+            token.type = token.exact_type = ERRORTOKEN;
         } else {
-            std::cout << "Unhandled OP: " << tok.str << std::endl;
+            pos_ = end;
+
+            switch(kind) {
+                case PSEUDO_NOTHING:
+                case PSEUDO_CONTINUATION:
+                    // No token, just whitespace or a backslash-newline
+                    continued_ = continued_ || kind == PSEUDO_CONTINUATION;
+                    continue;
+                case PSEUDO_NUMBER:
+                    token.type = token.exact_type = NUMBER;
+                    break;
+                case PSEUDO_NEWLINE:
+                    token.type = token.exact_type = (parenlev_ > 0) ? NL : NEWLINE;
+                    break;
+                case PSEUDO_COMMENT:
+                    token.type = token.exact_type = COMMENT;
+                    break;
+                case PSEUDO_TRIPLE: {
+                    char32_t quote = line[end - 1];
+                    int string_end = match_string_end(line, pos_, quote, true);
+                    if(string_end < 0) {
+                        // The rest of the line is in the string
+                        strstart_ = std::make_pair(lnum_, start);
+                        in_string_ = true;
+                        contstr_start_ = line_start_ + start;
+                        contstr_quote_ = quote;
+                        contstr_triple_ = true;
+                        pos_ = line.max;
+                        continue;
+                    }
+
+                    pos_ = end = string_end;
+                    token.type = token.exact_type = STRING;
+                } break;
+                case PSEUDO_STRING:
+                    if(line[end - 1] == '\n') {
+                        strstart_ = std::make_pair(lnum_, start);
+                        in_string_ = true;
+                        contstr_start_ = line_start_ + start;
+                        contstr_quote_ = line[skip_string_prefix(line, start)];
+                        contstr_triple_ = false;
+                        needcont_ = true;
+                        pos_ = line.max;
+                        continue;
+                    }
+                    token.type = token.exact_type = STRING;
+                    break;
+                case PSEUDO_NAME:
+                    token.type = token.exact_type = NAME;
+                    break;
+                case PSEUDO_OP:
+                    if(line[start] == '(' || line[start] == '[' || line[start] == '{') {
+                        parenlev_ += 1;
+                    } else if(line[start] == ')' || line[start] == ']' || line[start] == '}') {
+                        parenlev_ -= 1;
+                    }
+                    token.type = OP;
+                    token.exact_type = operator_type(line, start, end);
+                    break;
+            }
         }
+
+        token.offset = line_start_ + start;
+        token.length = end - start;
+        token.start_pos = std::make_pair(lnum_, start);
+        token.end_pos = std::make_pair(lnum_, end);
+        return true;
+    }
+
+    in_line_ = false;
+    return false;
+}
+
+std::vector<Token> Python::tokenize(const unicode& data) {
+    std::vector<Token> result;
+
+    Tokenizer tokenizer(data);
+    TokenView token;
+    while(tokenizer.next(token)) {
+        result.push_back(Token({token.type, tokenizer.str(token), token.start_pos, token.end_pos}));
+    }
+
+    return result;
+}
+
+// Sorted, for a binary search
+const char* const PYTHON_BUILTINS[] = {
+    "ArithmeticError", "AssertionError", "AttributeError", "BaseException",
+    "BufferError", "BytesWarning", "DeprecationWarning", "EOFError",
+    "Ellipsis", "EnvironmentError", "Exception", "False", "FloatingPointError",
+    "FutureWarning", "GeneratorExit", "IOError", "ImportError", "ImportWarning",
+    "IndentationError", "IndexError", "KeyError", "KeyboardInterrupt",
+    "LookupError", "MemoryError", "NameError", "None", "NotImplemented",
+    "NotImplementedError", "OSError", "OverflowError", "PendingDeprecationWarning",
+    "ReferenceError", "RuntimeError", "RuntimeWarning", "StandardError",
+    "StopIteration", "SyntaxError", "SyntaxWarning", "SystemError", "SystemExit",
+    "TabError", "True", "TypeError", "UnboundLocalError", "UnicodeDecodeError",
+    "UnicodeEncodeError", "UnicodeError", "UnicodeTranslateError", "UnicodeWarning",
+    "UserWarning", "ValueError", "Warning", "ZeroDivisionError", "_", "__debug__",
+    "__doc__", "__import__", "__name__", "__package__", "abs", "all", "any", "apply",
+    "basestring", "bin", "bool", "buffer", "bytearray", "bytes", "callable", "chr",
+    "classmethod", "cmp", "coerce", "compile", "complex", "copyright", "credits",
+    "delattr", "dict", "dir", "divmod", "enumerate", "eval", "execfile", "exit",
+    "file", "filter", "float", "format", "frozenset", "getattr", "globals",
+    "hasattr", "hash", "help", "hex", "id", "input", "int", "intern", "isinstance",
+    "issubclass", "iter", "len", "license", "list", "locals", "long", "map", "max",
+    "memoryview", "min", "next", "object", "oct", "open", "ord", "pow", "print",
+    "property", "quit", "range", "raw_input", "reduce", "reload", "repr", "reversed",
+    "round", "set", "setattr", "slice", "sorted", "staticmethod", "str", "sum", "super",
+    "tuple", "type", "unichr", "unicode", "vars", "xrange", "zip"
+};
+
+template<typename Source>
+bool is_python_builtin(const Source& source, const TokenView& token) {
+    auto begin = std::begin(PYTHON_BUILTINS);
+    auto end = std::end(PYTHON_BUILTINS);
+
+    auto it = std::lower_bound(begin, end, token, [&](const char* builtin, const TokenView& token) {
+        return source.compare(token, builtin) > 0;
+    });
+
+    return it != end && source.equals(token, *it);
+}
+
+template<typename Source>
+unicode guess_scope_from_assigned_token(const Source& source, const TokenView& tok) {
+    if(tok.exact_type == LSQB) {
+        return "list";
+    } else if(tok.exact_type == LBRACE) {
+        //FIXME: Could be a set, we should look for a ":" before a closing }
+        return "dict";
+    } else if(tok.type == TokenType::STRING) {
+        return "str";
     } else if(tok.type == TokenType::NUMBER) {
-        if(tok.str.contains(".")) {
+        unicode number = source.str(tok);
+        if(number.contains(".")) {
             return "float";
-        } else if(tok.str.ends_with("L")) {
+        } else if(number.ends_with("L")) {
             return "long";
         } else {
             return "int";
         }
     } else if(tok.type == TokenType::NAME) {
-        if(is_python_builtin(tok.str)) {
-            return tok.str;
+        if(is_python_builtin(source, tok)) {
+            return source.str(tok);
         } else {
             //??? We need to look back up the scope tree from the current scope to
             // find a matching scope with this name... e.g. if we are doing a = A() we
             // need to go through the scopes and find the deepest scope where the last part of the path
             // is 'A'
-            std::cout << "Unhandled assignment: " << tok.type << " - " << tok.str << std::endl;
         }
-
-    } else {
-        std::cout << "Unhandled assignment: " << tok.type << " - " << tok.str << std::endl;
     }
 
     return "";
@@ -541,179 +849,728 @@ unicode Python::base_scope_from_filename(const unicode &filename) {
     throw std::runtime_error("Wat?");
 }
 
-std::pair<std::vector<ScopePtr>, bool> Python::parse(const unicode& data, const unicode& base_scope)  {
-    auto tokens = tokenize(data);
+namespace {
 
-    std::vector<ScopePtr> scopes;
+/* Tokens which have already been lexed, handed out one at a time like a Tokenizer does */
+class TokenList {
+public:
+    TokenList(const unicode& data, const std::vector<TokenView>& tokens, std::size_t start):
+        text_((data.empty()) ? U"" : &data[0]),
+        tokens_(tokens),
+        pos_(start) {}
+
+    bool next(TokenView& token) {
+        if(pos_ == tokens_.size()) {
+            return false;
+        }
+        token = tokens_[pos_++];
+        return true;
+    }
+
+    unicode str(const TokenView& token) const {
+        return unicode(text_ + token.offset, text_ + token.offset + token.length);
+    }
 
-    std::shared_ptr<Token> last_token;
-    std::shared_ptr<Token> next_token;
+    int compare(const TokenView& token, const char* ascii) const { return compare_text(text_, token, ascii); }
+    bool equals(const TokenView& token, const char* ascii) const { return compare(token, ascii) == 0; }
 
-    unicode current_path = base_scope;
+private:
+    const char32_t* text_;
+    const std::vector<TokenView>& tokens_;
+    std::size_t pos_;
+};
+
+/* The token being looked at and the two after it, refilled from the source as it moves */
+template<typename Source>
+class TokenWindow {
+public:
+    TokenWindow(Source& source):
+        source_(source) {
+        fill();
+    }
 
-    std::vector<ScopePtr> open_scopes;
+    bool empty() const { return size_ == 0; }
 
-    bool inside_class = false;
+    /* The token n places ahead, or nullptr if the data ran out first */
+    const TokenView* peek(int n) const {
+        return (n < size_) ? &tokens_[n] : nullptr;
+    }
 
-    for(uint32_t i = 0; i < tokens.size(); ++i) {
-        if(i > 0) {
-            last_token = std::make_shared<Token>(tokens[i - 1]);
+    void advance(int count=1) {
+        count = std::min(count, size_);
+        for(int i = count; i < size_; ++i) {
+            tokens_[i - count] = tokens_[i];
         }
+        size_ -= count;
+        position_ += count;
+        fill();
+    }
 
-        if(i < tokens.size() - 1) {
-            next_token = std::make_shared<Token>(tokens[i + 1]);
-        } else {
-            next_token.reset();
+    /* How many tokens have been moved past */
+    std::size_t position() const { return position_; }
+
+private:
+    Source& source_;
+    TokenView tokens_[3];
+    int size_ = 0;
+    std::size_t position_ = 0;
+
+    void fill() {
+        while(size_ < 3 && source_.next(tokens_[size_])) {
+            ++size_;
         }
+    }
+};
 
-        Token& this_token = tokens.at(i);
+bool is_opening_bracket(const TokenView& tok) {
+    return tok.exact_type == LPAR || tok.exact_type == LSQB || tok.exact_type == LBRACE;
+}
 
+bool is_closing_bracket(const TokenView& tok) {
+    return tok.exact_type == RPAR || tok.exact_type == RSQB || tok.exact_type == RBRACE;
+}
 
-        if(this_token.type == TokenType::NAME) {
-            //If this token is the class keyword, and we have the next token, then
-            //process a class
-            if(this_token.str == "class" && next_token && next_token->type == TokenType::NAME) {
-                unicode new_scope_path = _u(".").join(std::vector<unicode>({current_path, next_token->str}));
+unicode join_path(const unicode& parent, const unicode& name) {
+    unicode path = parent;
+    path.push_back('.');
+    path += name;
+    return path;
+}
 
-                std::vector<unicode> inherited_paths;
-                auto search = find_tokens_till_next(")", tokens, i + 2);
+void end_scope(std::vector<ScopePtr>& scopes, std::size_t index, const std::pair<int, int>& position) {
+    scopes[index]->end_line = position.first;
+    scopes[index]->end_col = position.second;
+}
 
-                for(auto lookahead_tok: search.second) {
-                    if(lookahead_tok.type == TokenType::NAME) {
-                        //FIXME: If an import or other thing further up overrides a global, we should prefer that
-                        // e.g. if someone overrides "object"
+/* Ends the scope a block is the body of, and the variables assigned in it */
+void end_block(const ScopeState::Block& block, std::vector<ScopePtr>& scopes, const std::pair<int, int>& position) {
+    if(block.scope == std::string::npos) {
+        return;
+    }
 
-                        //If this is a Python builtin, then we don't include the current path when
-                        //adding to the inherited scopes
-                        if(is_python_builtin(lookahead_tok.str)) {
-                            inherited_paths.push_back(lookahead_tok.str);
-                        } else {
-                            inherited_paths.push_back(_u(".").join(std::vector<unicode>({current_path, lookahead_tok.str})));
-                        }
-                    }
+    end_scope(scopes, block.scope, position);
+    for(auto index: block.variables) {
+        end_scope(scopes, index, position);
+    }
+}
 
-                }
+/* A class or def which never got a body ends where it was given up on, along with a def's arguments */
+void end_header(ScopeState& state, std::vector<ScopePtr>& scopes, const std::pair<int, int>& position) {
+    for(std::size_t index = state.header; index < scopes.size(); ++index) {
+        end_scope(scopes, index, position);
+    }
+    state.header = std::string::npos;
+    state.body_next = false;
+}
 
-                ScopePtr new_scope = std::make_shared<Scope>(new_scope_path, inherited_paths);
-                new_scope->start_line = this_token.start_pos.first;
-                new_scope->start_col = this_token.start_pos.second;
-                scopes.push_back(new_scope);
-                open_scopes.push_back(new_scope);
+/* The body of the class or def waiting for one starts, at its INDENT or straight after its colon */
+void open_body(ScopeState& state, std::vector<ScopePtr>& scopes, bool inline_body) {
+    const ScopePtr& scope = scopes[state.header];
 
-                current_path = new_scope_path;
-                inside_class = true;
-            } else if(this_token.str == "def" && next_token && next_token->type == TokenType::NAME) {
-                //We've found a function or method
-                unicode new_scope_path = _u(".").join(std::vector<unicode>({current_path, next_token->str}));
-                std::vector<unicode> inherited_scopes;
-                if(inside_class) {
-                    inherited_scopes.push_back("instancemethod");
-                } else {
-                    inherited_scopes.push_back("function");
-                }
-                ScopePtr new_scope = std::make_shared<Scope>(new_scope_path, inherited_scopes);
-                new_scope->start_line = this_token.start_pos.first;
-                new_scope->start_col = this_token.end_pos.second; //Start the scope at the end of the method name
-
-
-                std::vector<ScopePtr> args;
-
-                auto search = find_tokens_till_next(")", tokens, i + 3);
-
-                //bool next_token_is_assignment = false;
-                bool next_name_is_args = false;
-                bool next_name_is_kwargs = false;
-                for(uint32_t i = 0; i < search.second.size(); ++i) {
-                    auto& lookahead_tok = search.second.at(i);
-
-                    if(lookahead_tok.type == TokenType::NAME) {
-                        Token* next_token = (i + 1 < search.second.size()) ? &search.second.at(i+1) : nullptr;
-                        Token* next_next_token = (i + 2 < search.second.size()) ? &search.second.at(i+2) : nullptr;
-
-                        std::vector<unicode> inherited_scopes;
-                        if(next_token && next_token->type == TokenType::OP) {
-                            if(next_token->str == "=") {
-                                if(next_next_token) {
-                                    unicode guessed = guess_scope_from_assigned_token(*next_next_token);
-                                    if(!guessed.empty()) {
-                                        inherited_scopes.push_back(guessed);
-                                    }
-                                    i++;
-                                }
-                            }
-                            i++;
-                        } else if(next_name_is_args) {
-                            inherited_scopes.push_back("tuple");
-                            next_name_is_args = false;
-                        } else if(next_name_is_kwargs) {
-                            inherited_scopes.push_back("dict");
-                            next_name_is_kwargs = false;
-                        }
+    ScopeState::Block block({state.header, state.blocks.size(), scope->path(), scope->kind == Scope::KIND_CLASS, inline_body, {}});
 
+    // A def's arguments come straight after it, and end with its body
+    for(std::size_t index = state.header + 1; index < scopes.size(); ++index) {
+        block.variables.push_back(index);
+    }
 
-                        unicode arg_scope_path = _u(".").join(std::vector<unicode>({new_scope_path, lookahead_tok.str}));
-                        ScopePtr new_arg = std::make_shared<Scope>(arg_scope_path, inherited_scopes);
-                        new_arg->start_line = this_token.start_pos.first;
-                        new_arg->start_col = this_token.end_pos.second; //Inherit function scope boundaries
-                        args.push_back(new_arg);
-
-                    } else if(lookahead_tok.type == TokenType::OP) {
-                        if(lookahead_tok.str == ",") {
-                            continue;
-                        } else if(lookahead_tok.str == "*") {
-                            next_name_is_args = true;
-                        } else if(lookahead_tok.str == "**") {
-                            next_name_is_kwargs = true;
-                        } else {
-                            std::cout << "Unexpected token during function definition: " << lookahead_tok.str << std::endl;
-                        }
+    state.blocks.push_back(std::move(block));
+    state.header = std::string::npos;
+    state.body_next = false;
+}
+
+/*
+ *  Handles the token at the front of the window, along with any after it which go with
+ *  it (a class's bases, a function's arguments), and moves past them. Any scopes found
+ *  are added to scopes. A class or def's scope ends along with its body, at the DEDENT
+ *  which closes the block its INDENT opened (or at the end of the line, for a body on
+ *  the same line as the colon).
+ */
+template<typename Source>
+void parse_token(const Source& source, TokenWindow<Source>& window, ScopeState& state, std::vector<ScopePtr>& scopes) {
+    const TokenView& this_token = *window.peek(0);
+    const TokenView* next_token = window.peek(1);
+    const TokenView* after_next = window.peek(2);
+
+    if(state.body_next && this_token.type != NEWLINE && this_token.type != NL && this_token.type != COMMENT && this_token.type != INDENT) {
+        end_header(state, scopes, this_token.start_pos);
+    }
+
+    if(this_token.type == TokenType::NAME) {
+        bool is_class = source.equals(this_token, "class");
+        bool is_def = !is_class && source.equals(this_token, "def");
+
+        if((is_class || is_def) && state.header != std::string::npos) {
+            end_header(state, scopes, this_token.start_pos); // Its colon never came
+        }
+
+        const ScopeState::Block& body = state.body();
+
+        //If this token is the class keyword, and we have the next token, then
+        //process a class
+        if(next_token && next_token->type == TokenType::NAME && is_class) {
+            unicode new_scope_path = join_path(body.path, source.str(*next_token));
+            auto start_pos = this_token.start_pos;
+
+            std::vector<unicode> inherited_paths;
+
+            bool has_bases = after_next && after_next->exact_type == LPAR;
+            window.advance((has_bases) ? 3 : 2);
+
+            // Every name up to the closing bracket is a base class
+            int depth = (has_bases) ? 1 : 0;
+            for(; depth > 0 && !window.empty(); window.advance()) {
+                const TokenView& tok = *window.peek(0);
+
+                if(is_opening_bracket(tok)) {
+                    ++depth;
+                } else if(is_closing_bracket(tok)) {
+                    --depth;
+                } else if(tok.type == TokenType::NEWLINE) {
+                    break;
+                } else if(tok.type == TokenType::NAME) {
+                    //FIXME: If an import or other thing further up overrides a global, we should prefer that
+                    // e.g. if someone overrides "object"
+
+                    //If this is a Python builtin, then we don't include the current path when
+                    //adding to the inherited scopes
+                    if(is_python_builtin(source, tok)) {
+                        inherited_paths.push_back(source.str(tok));
                     } else {
-                        std::cout << "Unexpected token type during function definition: " << lookahead_tok.type << " - " << lookahead_tok.str << std::endl;
+                        inherited_paths.push_back(join_path(body.path, source.str(tok)));
                     }
                 }
+            }
 
-                scopes.push_back(new_scope);
-                for(auto scope: args) {
-                    scopes.push_back(scope);
-                }
+            state.brackets += depth; // Any left open, if the line ended first
+
+            ScopePtr new_scope = std::make_shared<Scope>(new_scope_path, inherited_paths);
+            new_scope->start_line = start_pos.first;
+            new_scope->start_col = start_pos.second;
+            new_scope->kind = Scope::KIND_CLASS;
+            scopes.push_back(new_scope);
+
+            state.header = scopes.size() - 1;
+            return;
+        } else if(next_token && next_token->type == TokenType::NAME && is_def) {
+            //We've found a function or method
+            unicode new_scope_path = join_path(body.path, source.str(*next_token));
+            std::vector<unicode> inherited_scopes;
+            if(body.is_class) {
+                inherited_scopes.push_back("instancemethod");
+            } else {
+                inherited_scopes.push_back("function");
+            }
+            ScopePtr new_scope = std::make_shared<Scope>(new_scope_path, inherited_scopes);
+            new_scope->start_line = this_token.start_pos.first;
+            new_scope->start_col = this_token.end_pos.second; //Start the scope at the end of the method name
+            new_scope->kind = Scope::KIND_FUNCTION;
+            scopes.push_back(new_scope);
 
-            } else if(next_token && next_token->type == TokenType::OP) {
-                if(next_token->str == "=") {
-                    //Let's figure out what's been assigned
-                    int lookahead = i + 2;
+            state.header = scopes.size() - 1;
 
-                    std::vector<unicode> inherited_scopes;
-                    if(lookahead < (int) tokens.size()) {
-                        Token& tok = tokens.at(lookahead);
+            auto def_pos = std::make_pair(this_token.start_pos.first, this_token.end_pos.second);
+
+            bool has_args = after_next && after_next->exact_type == LPAR;
+            window.advance((has_args) ? 3 : 2);
+
+            bool expecting_arg = true;
+            bool next_name_is_args = false;
+            bool next_name_is_kwargs = false;
 
-                        unicode guessed = guess_scope_from_assigned_token(tok);
+            int depth = (has_args) ? 1 : 0;
+            for(; depth > 0 && !window.empty(); window.advance()) {
+                const TokenView& tok = *window.peek(0);
+
+                if(is_opening_bracket(tok)) {
+                    ++depth;
+                } else if(is_closing_bracket(tok)) {
+                    --depth;
+                } else if(tok.type == TokenType::NEWLINE) {
+                    break;
+                } else if(depth > 1) {
+                    continue;
+                } else if(tok.exact_type == COMMA) {
+                    expecting_arg = true;
+                } else if(tok.exact_type == STAR) {
+                    next_name_is_args = true;
+                } else if(tok.exact_type == DOUBLESTAR) {
+                    next_name_is_kwargs = true;
+                } else if(tok.type == TokenType::NAME && expecting_arg) {
+                    const TokenView* after_arg = window.peek(1);
+                    const TokenView* default_value = window.peek(2);
+
+                    std::vector<unicode> inherited_scopes;
+                    if(after_arg && after_arg->exact_type == EQUAL && default_value) {
+                        unicode guessed = guess_scope_from_assigned_token(source, *default_value);
                         if(!guessed.empty()) {
                             inherited_scopes.push_back(guessed);
                         }
-                    } else {
-                        //No inherited scopes... perhaps it should inherit something by default?
+                    } else if(next_name_is_args) {
+                        inherited_scopes.push_back("tuple");
+                    } else if(next_name_is_kwargs) {
+                        inherited_scopes.push_back("dict");
                     }
 
-                    //Assignment to something \o/
-                    unicode new_scope_path = _u(".").join(std::vector<unicode>({current_path, this_token.str}));
-                    ScopePtr new_scope = std::make_shared<Scope>(new_scope_path, inherited_scopes);
-                    new_scope->start_line = this_token.start_pos.first;
-                    new_scope->start_col = next_token->start_pos.second; //Start after the assignment
-                    scopes.push_back(new_scope);
-                    open_scopes.push_back(new_scope);
+                    ScopePtr new_arg = std::make_shared<Scope>(join_path(new_scope_path, source.str(tok)), inherited_scopes);
+                    new_arg->start_line = def_pos.first;
+                    new_arg->start_col = def_pos.second; //Inherit function scope boundaries
+                    new_arg->kind = Scope::KIND_ARGUMENT;
+                    scopes.push_back(new_arg);
+
+                    expecting_arg = next_name_is_args = next_name_is_kwargs = false;
                 }
             }
-        } else if(this_token.type == TokenType::DEDENT) {
-            for(auto scope: open_scopes) {
-                scope->end_line = this_token.end_pos.first;
-                scope->end_col = this_token.end_pos.second;
+
+            state.brackets += depth;
+            return;
+        } else if(next_token && next_token->exact_type == EQUAL && !state.brackets) {
+            //Let's figure out what's been assigned
+            std::vector<unicode> inherited_scopes;
+            if(after_next) {
+                unicode guessed = guess_scope_from_assigned_token(source, *after_next);
+                if(!guessed.empty()) {
+                    inherited_scopes.push_back(guessed);
+                }
+            } else {
+                //No inherited scopes... perhaps it should inherit something by default?
+            }
+
+            //Assignment to something \o/
+            unicode new_scope_path = join_path(body.path, source.str(this_token));
+            ScopePtr new_scope = std::make_shared<Scope>(new_scope_path, inherited_scopes);
+            new_scope->start_line = this_token.start_pos.first;
+            new_scope->start_col = next_token->start_pos.second; //Start after the assignment
+            new_scope->kind = Scope::KIND_VARIABLE;
+            scopes.push_back(new_scope);
+
+            // Variables at the top level last until the end of the file
+            std::size_t owner = state.blocks.back().owner;
+            if(owner) {
+                state.blocks[owner].variables.push_back(scopes.size() - 1);
+            }
+        } else if(next_token && next_token->exact_type == DOT) {
+            // Assigning to an attribute doesn't declare anything here, apart from self.x in a method
+            bool is_self = source.equals(this_token, "self");
+            window.advance(2);
+
+            while(window.peek(1) && window.peek(0)->type == TokenType::NAME && window.peek(1)->exact_type == DOT) {
+                is_self = false;
+                window.advance(2);
+            }
+
+            const TokenView* attribute = window.peek(0);
+            const TokenView* assigned = window.peek(1);
+            if(!attribute || attribute->type != TokenType::NAME) {
+                return;
+            }
+
+            std::size_t method = state.blocks.back().owner;
+            std::size_t owner = (method) ? state.blocks[method - 1].owner : 0;
+
+            if(is_self && assigned && assigned->exact_type == EQUAL && !state.brackets && method && !state.blocks[method].is_class && state.blocks[owner].is_class) {
+                std::vector<unicode> inherited_scopes;
+                if(window.peek(2)) {
+                    unicode guessed = guess_scope_from_assigned_token(source, *window.peek(2));
+                    if(!guessed.empty()) {
+                        inherited_scopes.push_back(guessed);
+                    }
+                }
+
+                // An attribute of the instance, which is part of the class
+                ScopePtr new_scope = std::make_shared<Scope>(join_path(state.blocks[owner].path, source.str(*attribute)), inherited_scopes);
+                new_scope->start_line = attribute->start_pos.first;
+                new_scope->start_col = assigned->start_pos.second;
+                new_scope->kind = Scope::KIND_VARIABLE;
+                scopes.push_back(new_scope);
+                state.blocks[owner].variables.push_back(scopes.size() - 1);
+            }
+
+            window.advance();
+            return;
+        }
+    } else if(is_opening_bracket(this_token)) {
+        ++state.brackets;
+    } else if(is_closing_bracket(this_token)) {
+        --state.brackets; // Below zero if there's one too many, as the tokenizer has it
+    } else if(this_token.exact_type == COLON) {
+        if(state.header != std::string::npos && !state.brackets) {
+            // The body is either indented on the lines which follow or it's the rest of this one
+            bool at_end = next_token && (
+                next_token->type == NEWLINE ||
+                (next_token->type == COMMENT && after_next && after_next->type == NEWLINE)
+            );
+
+            if(at_end) {
+                state.body_next = true;
+            } else {
+                open_body(state, scopes, true);
             }
-            open_scopes.clear();
+        }
+    } else if(this_token.type == TokenType::NEWLINE) {
+        if(state.header != std::string::npos && !state.body_next) {
+            end_header(state, scopes, this_token.end_pos);
+        }
+
+        while(state.blocks.back().inline_body) {
+            end_block(state.blocks.back(), scopes, this_token.end_pos);
+            state.blocks.pop_back();
+        }
+    } else if(this_token.type == TokenType::INDENT) {
+        if(state.body_next) {
+            open_body(state, scopes, false);
+        } else {
+            // An if, for, while... which is part of the body it's in
+            std::size_t owner = state.blocks.back().owner;
+            state.blocks.push_back(ScopeState::Block({std::string::npos, owner, unicode(), false, false, {}}));
+        }
+    } else if(this_token.type == TokenType::DEDENT) {
+        if(state.blocks.size() > 1) {
+            end_block(state.blocks.back(), scopes, this_token.end_pos);
+            state.blocks.pop_back();
+        }
+    } else if(this_token.type == TokenType::ENDMARKER) {
+        if(state.header != std::string::npos) {
+            end_header(state, scopes, this_token.start_pos);
+        }
+
+        while(state.blocks.size() > 1) {
+            end_block(state.blocks.back(), scopes, this_token.start_pos);
+            state.blocks.pop_back();
         }
     }
 
+    window.advance();
+}
+
+}
+
+std::pair<std::vector<ScopePtr>, bool> Python::parse(const unicode& data, const unicode& base_scope)  {
+    /*
+     *  Tokens are streamed through a three token window rather than collected up front,
+     *  and compared by kind or against their text in the data, so the only allocations
+     *  are for the scopes which are found. Nesting comes from the INDENTs and DEDENTs as
+     *  they go past, so every token is looked at once.
+     */
+    Tokenizer tokenizer(data);
+    TokenWindow<Tokenizer> window(tokenizer);
+
+    std::vector<ScopePtr> scopes;
+    ScopeState state(base_scope);
+
+    while(!window.empty()) {
+        parse_token(tokenizer, window, state, scopes);
+    }
+
     return std::make_pair(scopes, true);
 }
 
+namespace {
+
+/* Replaces items[first, last) with the replacement, only moving the items after them once */
+template<typename T>
+void splice(std::vector<T>& items, std::size_t first, std::size_t last, std::vector<T>& replacement) {
+    std::size_t common = std::min(last - first, replacement.size());
+    std::move(replacement.begin(), replacement.begin() + common, items.begin() + first);
+
+    if(replacement.size() > common) {
+        items.insert(
+            items.begin() + first + common,
+            std::make_move_iterator(replacement.begin() + common),
+            std::make_move_iterator(replacement.end())
+        );
+    } else {
+        items.erase(items.begin() + first + common, items.begin() + last);
+    }
+}
+
+ScopePtr copy_scope(const ScopePtr& scope) {
+    return std::make_shared<Scope>(*scope);
+}
+
+}
+
+PythonBuffer::PythonBuffer(const unicode& base_scope):
+    base_scope_(base_scope) {
+
+    set_text(unicode());
+}
+
+BufferChange PythonBuffer::set_text(const unicode& text) {
+    // Start from no text, which is a single empty line with an ENDMARKER
+    text_ = unicode();
+    tokens_.assign(1, TokenView({ENDMARKER, ENDMARKER, 0, 0, std::make_pair(1, 0), std::make_pair(1, 0)}));
+    lines_.assign(1, Line({0, 0, Tokenizer::LineState()}));
+    has_error_ = false;
+
+    scopes_.clear();
+    statements_.clear();
+
+    return replace(0, 0, text);
+}
+
+BufferChange PythonBuffer::insert(int offset, const unicode& text) {
+    return replace(offset, 0, text);
+}
+
+BufferChange PythonBuffer::erase(int offset, int length) {
+    return replace(offset, length, unicode());
+}
+
+std::vector<ScopePtr> PythonBuffer::scopes() const {
+    std::vector<ScopePtr> result;
+    result.reserve(scopes_.size());
+    for(auto& scope: scopes_) {
+        result.push_back(copy_scope(scope));
+    }
+    return result;
+}
+
+std::size_t PythonBuffer::statement_token(std::size_t line) const {
+    if(line + 1 >= lines_.size()) {
+        return std::string::npos;
+    }
+
+    const auto& state = lines_[line].state;
+    if(state.parenlev || state.continued || state.in_string || lines_[line + 1].state.indents.size() != 1) {
+        return std::string::npos;
+    }
+
+    for(std::size_t i = lines_[line].first_token; i < lines_[line + 1].first_token; ++i) {
+        auto type = tokens_[i].type;
+        if(type == DEDENT) {
+            continue;
+        }
+
+        // Blank lines and comments aren't statements
+        return (type == NL || type == COMMENT || type == ENDMARKER) ? std::string::npos : i;
+    }
+
+    return std::string::npos;
+}
+
+BufferChange PythonBuffer::replace(int offset, int length, const unicode& text) {
+    BufferChange change;
+
+    int line_shift = 0;
+    for(int i = offset; i < offset + length; ++i) {
+        line_shift -= (text_[i] == '\n');
+    }
+    for(auto ch: text) {
+        line_shift += (ch == '\n');
+    }
+
+    int char_shift = int(text.length()) - length;
+    int edit_end = offset + text.length();
+
+    // The line the edit starts on. Adding to the end of a last line with no newline changes that line.
+    std::size_t first = std::upper_bound(lines_.begin(), lines_.end(), offset, [](int offset, const Line& line) {
+        return offset < line.offset;
+    }) - lines_.begin() - 1;
+
+    if(first > 0 && lines_[first].offset == offset && text_[offset - 1] != '\n') {
+        --first;
+    }
+
+    text_.erase(offset, length);
+    text_.insert(offset, text);
+
+    /*
+     *  Lex from the start of that line until a line after the edit starts in the same
+     *  state as the old line it corresponds to. From there on the tokens would be the
+     *  same as before, so they're kept.
+     */
+    Tokenizer tokenizer(text_, lines_[first].offset, first + 1, lines_[first].state);
+
+    std::size_t first_token = lines_[first].first_token;
+    std::size_t old_end = lines_.size();
+    bool error = false;
+
+    std::vector<Line> new_lines;
+    std::vector<TokenView> new_tokens;
+
+    while(true) {
+        Line line({tokenizer.offset(), first_token + new_tokens.size(), tokenizer.state()});
+
+        if(line.offset >= edit_end && !tokenizer.finished()) {
+            long old_line = long(first + new_lines.size()) - line_shift;
+            if(old_line >= long(first) && old_line < long(lines_.size()) &&
+               lines_[old_line].offset + char_shift == line.offset &&
+               lines_[old_line].state.converges_with(line.state)) {
+                old_end = old_line;
+                break;
+            }
+        }
+
+        new_lines.push_back(std::move(line));
+
+        try {
+            if(!tokenizer.next_line(new_tokens)) {
+                new_lines.pop_back();
+                break;
+            }
+        } catch(std::logic_error& e) {
+            // The line stays, with no tokens, so lexing can start again from it
+            error = true;
+            break;
+        }
+    }
+
+    bool caught_up = old_end < lines_.size();
+    std::size_t new_end = first + new_lines.size();
+
+    std::size_t old_tokens_end = (caught_up) ? lines_[old_end].first_token : tokens_.size();
+    long token_shift = long(new_tokens.size()) - long(old_tokens_end - first_token);
+
+    change.first_line = first + 1;
+    change.old_end_line = old_end + 1;
+    change.new_end_line = new_end + 1;
+
+    change.tokens.reserve(new_tokens.size());
+    for(auto& token: new_tokens) {
+        change.tokens.push_back(Token({
+            token.type, unicode(&text_[0] + token.offset, &text_[0] + token.offset + token.length), token.start_pos, token.end_pos
+        }));
+    }
+
+    // Whatever comes after only moves
+    for(std::size_t i = old_tokens_end; i < tokens_.size(); ++i) {
+        auto& token = tokens_[i];
+        token.offset += char_shift;
+        token.start_pos.first += line_shift;
+        token.end_pos.first += line_shift;
+    }
+
+    for(std::size_t i = old_end; i < lines_.size(); ++i) {
+        auto& line = lines_[i];
+        line.offset += char_shift;
+        line.first_token += token_shift;
+
+        if(line.state.in_string) {
+            line.state.contstr_start += char_shift;
+            line.state.strstart.first += line_shift;
+        }
+    }
+
+    splice(tokens_, first_token, old_tokens_end, new_tokens);
+    splice(lines_, first, old_end, new_lines);
+
+    if(!caught_up) {
+        has_error_ = error;
+    }
+
+    rebuild_scopes(first, new_end, caught_up, line_shift, token_shift, change.scopes);
+
+    return change;
+}
+
+void PythonBuffer::rebuild_scopes(std::size_t first, std::size_t new_end, bool lexer_caught_up, int line_shift, long token_shift, ScopeDelta& delta) {
+    /*
+     *  Scopes are built again from the last statement which starts before the first line
+     *  that was lexed again, it and everything before it are unchanged. A statement is
+     *  only recorded when the builder has nothing open there, as a line can look like a
+     *  top level statement to the tokenizer while a block or a bracket is still open (the
+     *  NEWLINE which ends an inline body can be swallowed by an error token, a stray ')'
+     *  leaves the brackets below zero). So the builder always starts from nothing and
+     *  none of the scopes before it are still open.
+     */
+    auto it = std::lower_bound(statements_.begin(), statements_.end(), first, [](const Statement& statement, std::size_t line) {
+        return statement.line < line;
+    });
+
+    Statement start;
+    if(it == statements_.begin()) {
+        start.line = 0;
+        start.token = 0;
+        start.first_scope = 0;
+    } else {
+        start = *(--it);
+    }
+
+    std::vector<Statement> old_statements(std::make_move_iterator(it), std::make_move_iterator(statements_.end()));
+    statements_.erase(it, statements_.end());
+
+    std::vector<ScopePtr> old_scopes(std::make_move_iterator(scopes_.begin() + start.first_scope), std::make_move_iterator(scopes_.end()));
+    scopes_.resize(start.first_scope);
+
+    ScopeState state(base_scope_);
+
+    TokenList source(text_, tokens_, start.token);
+    TokenWindow<TokenList> window(source);
+
+    /* Stop at the first statement after the lines which were lexed again that was also a statement before */
+    auto back_in_step = [&](std::size_t line, const Statement& old) -> bool {
+        return lexer_caught_up && line >= new_end && long(old.line) == long(line) - line_shift;
+    };
+
+    std::size_t line = start.line;
+    auto old_statement = old_statements.begin();
+    const Statement* resume = nullptr;
+
+    while(!window.empty() && !resume) {
+        std::size_t position = start.token + window.position();
+
+        for(; line < lines_.size() && lines_[line].first_token <= position; ++line) {
+            std::size_t token = statement_token(line);
+            if(token != std::string::npos && token > position) {
+                break; // Not past the DEDENTs yet
+            } else if(token != position || !state.at_top_level()) {
+                continue; // A def with nothing indented after it is only ended by this line
+            }
+
+            while(old_statement != old_statements.end() && long(old_statement->line) < long(line) - line_shift) {
+                ++old_statement;
+            }
+
+            if(old_statement != old_statements.end() && back_in_step(line, *old_statement)) {
+                resume = &*old_statement;
+                break;
+            }
+
+            statements_.push_back(Statement({line, token, scopes_.size()}));
+        }
+
+        if(!resume) {
+            parse_token(source, window, state, scopes_);
+        }
+    }
+
+    std::size_t old_scopes_end = (resume) ? resume->first_scope - start.first_scope : old_scopes.size();
+
+    for(std::size_t i = 0; i < old_scopes_end; ++i) {
+        delta.removed.push_back(copy_scope(old_scopes[i]));
+    }
+
+    for(std::size_t i = start.first_scope; i < scopes_.size(); ++i) {
+        delta.added.push_back(copy_scope(scopes_[i]));
+    }
+
+    if(!resume) {
+        return;
+    }
+
+    int from_line = resume->line + 1;
+    long scope_shift = long(scopes_.size()) - long(resume->first_scope);
+
+    for(std::size_t i = old_scopes_end; i < old_scopes.size(); ++i) {
+        auto& scope = old_scopes[i];
+        scope->start_line += line_shift;
+        if(scope->end_line >= from_line) {
+            scope->end_line += line_shift;
+        }
+        scopes_.push_back(std::move(scope));
+    }
+
+    for(auto jt = old_statements.begin() + (resume - &old_statements[0]); jt != old_statements.end(); ++jt) {
+        jt->line += line_shift;
+        jt->token += token_shift;
+        jt->first_scope += scope_shift;
+        statements_.push_back(std::move(*jt));
+    }
+
+    delta.from_line = from_line;
+    delta.line_shift = line_shift;
+}
+
 }
 }
@@ -73,13 +73,240 @@ struct Token {
     std::pair<int, int> end_pos; //Line, col
 };
 
+/*
+ *  A token which refers to its text in the data rather than owning a copy. OP tokens
+ *  also say which operator they are (LPAR, EQUAL...) so they can be compared without
+ *  looking at the text, for everything else exact_type is the same as type.
+ */
+struct TokenView {
+    TokenType type;
+    TokenType exact_type;
+    uint32_t offset;
+    uint32_t length;
+    std::pair<int, int> start_pos; //Line, col
+    std::pair<int, int> end_pos; //Line, col
+};
+
+/*
+ *  Produces the tokens of some Python one at a time, following CPython's tokenize.py.
+ *  The data must outlive the tokenizer and any views it hands out. Throws a
+ *  std::logic_error if the data ends inside a string or a bracket, or if a dedent
+ *  doesn't match an outer indentation level.
+ */
+class Tokenizer {
+public:
+    /* Everything the tokenizer carries over from the end of one line to the start of the next */
+    struct LineState {
+        int parenlev = 0;
+        bool continued = false;
+
+        bool in_string = false;
+        int contstr_start = 0;
+        char32_t contstr_quote = 0;
+        bool contstr_triple = false;
+        bool needcont = false;
+        std::pair<int, int> strstart;
+
+        std::vector<int> indents = {0};
+
+        /*
+         *  Whether lexing the same text from the two states gives the same tokens. That
+         *  is never assumed inside a string, which refers back to where it started.
+         *  needcont outlives the string which set it (as it does in tokenize.py), so it
+         *  has to match too.
+         */
+        bool converges_with(const LineState& other) const {
+            return !in_string && !other.in_string && parenlev == other.parenlev &&
+                continued == other.continued && needcont == other.needcont && indents == other.indents;
+        }
+    };
+
+    Tokenizer(const unicode& data);
+
+    /* Carries on from the start of a line (counting from 1), which begins at offset in the data */
+    Tokenizer(const unicode& data, int offset, int line, const LineState& state);
+
+    /* Fills in the next token, returns false once the ENDMARKER has been returned */
+    bool next(TokenView& token);
+
+    unicode str(const TokenView& token) const;
+
+    /* Compares the text of a token with some ASCII, without copying it */
+    int compare(const TokenView& token, const char* ascii) const;
+    bool equals(const TokenView& token, const char* ascii) const { return compare(token, ascii) == 0; }
+
+    /*
+     *  Appends the tokens which end on the next line, returns false once there are no
+     *  lines left. The last line is the empty one at the end of the data, which gives
+     *  the closing DEDENTs and the ENDMARKER. Don't mix this with next().
+     */
+    bool next_line(std::vector<TokenView>& tokens);
+
+    /* The state between lines, and where the next line starts */
+    LineState state() const;
+    int offset() const { return next_line_; }
+    bool finished() const { return finished_; }
+
+private:
+    const char32_t* text_;
+    int length_;
+
+    int lnum_ = 0;
+    int parenlev_ = 0;
+    bool continued_ = false;
+
+    // The current line, and where the next one starts
+    int line_start_ = 0;
+    int line_max_ = 0;
+    int pos_ = 0;
+    int next_line_ = 0;
+    bool in_line_ = false;
+
+    // A string which runs over several lines, all of it is in the data from contstr_start_
+    bool in_string_ = false;
+    int contstr_start_ = 0;
+    char32_t contstr_quote_ = 0;
+    bool contstr_triple_ = false;
+    bool needcont_ = false;
+    std::pair<int, int> strstart_;
+
+    std::vector<int> indents_;
+
+    // Tokens from the start of a line (INDENT, DEDENTs, COMMENT and NL...) waiting to be returned
+    std::vector<TokenView> pending_;
+    std::size_t pending_pos_ = 0;
+
+    bool at_eof_ = false;
+    bool finished_ = false;
+
+    void read_line();
+    bool scan_token(TokenView& token);
+    void push_pending(TokenType type, int start, int end);
+};
+
 class Python : public delimit::FileParser {
 public:
     const unicode name() const { return "PYTHON"; }
     std::pair<std::vector<ScopePtr>, bool> parse(const unicode& data, const unicode& base_scope);
     unicode base_scope_from_filename(const unicode &filename);
+
+    /* All of the tokens with copies of their text, Tokenizer is cheaper if that isn't needed */
     std::vector<Token> tokenize(const unicode& data);
     bool supports_nested_lookups() const { return true; }
+    FileParserPtr clone() const { return std::make_shared<Python>(*this); }
+};
+
+/*
+ *  Where the scope builder is: a block for every INDENT it's inside, innermost last,
+ *  after the module itself. A block which is the body of a class or a def has that
+ *  scope, and the variables assigned in it end where it does. Other blocks (if, for,
+ *  try...) belong to whichever body they're in.
+ */
+struct ScopeState {
+    struct Block {
+        std::size_t scope; // An index into the scopes found so far, or npos
+        std::size_t owner; // The block (maybe this one) whose body this is part of
+        unicode path;
+        bool is_class;
+        bool inline_body; // After the colon on the def's own line, it ends with the line
+        std::vector<std::size_t> variables;
+    };
+
+    std::vector<Block> blocks;
+
+    // A class or def whose body hasn't started yet, and whether it starts at the next INDENT
+    std::size_t header = std::string::npos;
+    bool body_next = false;
+
+    // Names followed by = inside brackets are keyword arguments rather than assignments
+    int brackets = 0;
+
+    ScopeState(const unicode& base_scope=unicode()):
+        blocks(1, Block({std::string::npos, 0, base_scope, false, false, {}})) {}
+
+    const Block& body() const { return blocks[blocks.back().owner]; }
+
+    /* Nothing is open, so building could start again from here with a new state */
+    bool at_top_level() const {
+        return blocks.size() == 1 && header == std::string::npos && !body_next && !brackets;
+    }
+};
+
+/*
+ *  What an edit to a PythonBuffer changed. Lines count from 1 and the ranges are half
+ *  open: the lines from first_line up to old_end_line were lexed again, and are now the
+ *  lines up to new_end_line. tokens has copies of the tokens which end on those lines.
+ *  The lines after them are the same as before, apart from moving.
+ */
+struct BufferChange {
+    int first_line = 1;
+    int old_end_line = 1;
+    int new_end_line = 1;
+    std::vector<Token> tokens;
+    ScopeDelta scopes;
+};
+
+/*
+ *  A Python file which is being edited. Alongside the text it keeps the tokens, the
+ *  tokenizer's state at the start of every line and where every top level statement
+ *  starts, which the scope builder can start again from with nothing open. An edit lexes
+ *  again from the line it starts on until the tokenizer's state matches an old line
+ *  after the edit, and then builds scopes again from the statement that line is in
+ *  until it reaches a statement which was also one before. Everything after that is
+ *  only moved.
+ *
+ *  The tokens and scopes are the same as Python::tokenize and Python::parse give. Text
+ *  which doesn't tokenize (an unclosed bracket while typing...) doesn't throw, the
+ *  buffer keeps what came before the error and lexes on from there after the next edit.
+ */
+class PythonBuffer {
+public:
+    PythonBuffer(const unicode& base_scope=unicode());
+
+    /* Starts again from no text, so the change has every token and only adds scopes */
+    BufferChange set_text(const unicode& text);
+
+    /* Offsets and lengths count characters */
+    BufferChange insert(int offset, const unicode& text);
+    BufferChange erase(int offset, int length);
+
+    const unicode& text() const { return text_; }
+    const std::vector<TokenView>& tokens() const { return tokens_; }
+
+    /* Copies, the buffer's own scopes are updated in place as lines move */
+    std::vector<ScopePtr> scopes() const;
+
+    bool has_error() const { return has_error_; }
+
+private:
+    struct Line {
+        int offset;
+        std::size_t first_token;
+        Tokenizer::LineState state;
+    };
+
+    struct Statement {
+        std::size_t line;
+        std::size_t token; // The first after any DEDENTs
+        std::size_t first_scope;
+    };
+
+    unicode base_scope_;
+    unicode text_;
+
+    // One for every line the tokenizer reads, including the empty one at the end (or the one it failed on)
+    std::vector<Line> lines_;
+    std::vector<TokenView> tokens_;
+    bool has_error_ = false;
+
+    std::vector<ScopePtr> scopes_;
+    std::vector<Statement> statements_;
+
+    BufferChange replace(int offset, int length, const unicode& text);
+    void rebuild_scopes(std::size_t first, std::size_t new_end, bool lexer_caught_up, int line_shift, long token_shift, ScopeDelta& delta);
+
+    /* The index of the first token after the DEDENTs on a line which starts a top level statement, or npos */
+    std::size_t statement_token(std::size_t line) const;
 };
 
 
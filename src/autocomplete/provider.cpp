@@ -1,15 +1,8 @@
-#include <iostream>
 #include "provider.h"
 #include "datastore.h"
 
 #include "../window.h"
 
-#include "parsers/plain.h"
-#include "parsers/python.h"
-
-#include "../utils/kfs.h"
-#include "../utils/base_directory.h"
-
 namespace delimit {
 
 unicode get_parser_to_use(const unicode& mime) {
@@ -19,20 +12,36 @@ unicode get_parser_to_use(const unicode& mime) {
 Provider::Provider(Window* window):
     Glib::ObjectBase(typeid(Provider)),
     Glib::Object(),
-    Gsv::CompletionProvider() {
+    Gsv::CompletionProvider(),
+    window_(window),
+    indexer_(window->project()->indexer()) {
+
+    response_ready_.connect(sigc::mem_fun(this, &Provider::on_response_ready));
+    worker_ = std::thread(&Provider::run_worker, this);
+}
+
+Provider::~Provider() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    request_ready_.notify_one();
 
-    unicode folder = fdo::xdg::make_dir_in_data_home("delimit");
-    unicode database_file = kfs::path::join(folder.encode(), "completions.db");
+    if(worker_.joinable()) {
+        worker_.join();
+    }
 
-    indexer_ = std::make_shared<Indexer>(database_file);
+    cancelled_connection_.disconnect();
+}
 
-    indexer_->register_parser("text/plain", std::make_shared<parser::Plain>());
-    indexer_->register_parser("application/python", std::make_shared<parser::Python>());
+Glib::RefPtr<Provider> Provider::self() {
+    // The RefPtr takes over a reference, so add one for it
+    Glib::RefPtr<Provider> reffed_this(this);
+    reffed_this->reference();
+    return reffed_this;
 }
 
 void Provider::populate_vfunc(const Glib::RefPtr<Gsv::CompletionContext> &context) {
-    L_DEBUG("Populate_vfunc called");
-
     unicode allowed_chars = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_";
 
     auto iter = context->get_iter();
@@ -50,30 +59,116 @@ void Provider::populate_vfunc(const Glib::RefPtr<Gsv::CompletionContext> &contex
         }
     }
 
-    std::vector<Glib::RefPtr<Gsv::CompletionProposal>> results;
+    // Whatever was in flight is for an older position
+    uint64_t generation = ++generation_;
+
+    cancelled_connection_.disconnect();
+    context_.reset();
 
     auto incomplete = buffer->get_text(start, iter, true);
-    if(!incomplete.empty()) {
-        std::cout << incomplete << std::endl;
-
-        unicode parser_name = get_parser_to_use("FIXME");
-        //FIXME: Determine the line that needs completing, and the current filename
-        auto completions = indexer_->datastore()->query_completions(
-            parser_name, "", line, col, unicode(incomplete.c_str()),
-            !indexer()->parser(parser_name)->supports_nested_lookups()
-        );
-
-        for(auto completion: completions) {
-            results.push_back(Gsv::CompletionItem::create(completion.encode(), completion.encode(), Gtk::Stock::INFO, ""));
+    if(incomplete.empty()) {
+        context->add_proposals(self(), std::vector<Glib::RefPtr<Gsv::CompletionProposal>>(), true);
+        return;
+    }
+
+    unicode parser_name = get_parser_to_use("FIXME");
+
+    auto request = std::make_shared<Request>();
+    request->generation = generation;
+    request->parser = parser_name;
+    request->filename = ""; //FIXME: Determine the current filename
+    request->line = line;
+    request->col = col;
+    request->text = unicode(incomplete.c_str());
+    request->word_completion_only = !indexer()->parser(parser_name)->supports_nested_lookups();
+
+    context_ = context;
+    cancelled_connection_ = context->signal_cancelled().connect(
+        sigc::mem_fun(this, &Provider::on_context_cancelled)
+    );
+
+    // Tell the completion the proposals are still to come
+    context->add_proposals(self(), std::vector<Glib::RefPtr<Gsv::CompletionProposal>>(), false);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pending_request_ = request;
+    }
+    request_ready_.notify_one();
+}
+
+void Provider::on_context_cancelled() {
+    ++generation_;
+
+    cancelled_connection_.disconnect();
+    context_.reset();
+}
+
+void Provider::run_worker() {
+    while(true) {
+        std::shared_ptr<Request> request;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            request_ready_.wait(lock, [this]() { return stopping_ || pending_request_; });
+
+            if(stopping_) {
+                return;
+            }
+
+            request.swap(pending_request_);
+        }
+
+        if(request->generation != generation_) {
+            continue;
         }
+
+        auto response = std::make_shared<Response>();
+        response->generation = request->generation;
+
+        try {
+            response->completions = indexer_->datastore()->query_completions(
+                request->parser, request->filename, request->line, request->col,
+                request->text, request->word_completion_only
+            );
+        } catch(std::exception& e) {
+            L_ERROR(_F("Unable to query completions: {0}").format(e.what()));
+        }
+
+        if(request->generation != generation_) {
+            continue;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            response_ = response;
+        }
+        response_ready_.emit();
     }
+}
 
-    L_DEBUG("Populating results");
+void Provider::on_response_ready() {
+    std::shared_ptr<Response> response;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        response.swap(response_);
+    }
 
-    Glib::RefPtr<Provider> reffed_this(this);
-    reffed_this->reference();
+    // Another request or a cancellation got in first
+    if(!response || !context_ || response->generation != generation_) {
+        return;
+    }
+
+    std::vector<Glib::RefPtr<Gsv::CompletionProposal>> results;
+    for(auto completion: response->completions) {
+        results.push_back(Gsv::CompletionItem::create(completion.encode(), completion.encode(), Gtk::Stock::INFO, ""));
+    }
+
+    auto context = context_;
+
+    cancelled_connection_.disconnect();
+    context_.reset();
 
-    context->add_proposals(reffed_this, results, true);
+    context->add_proposals(self(), results, true);
 }
 
 Gsv::CompletionActivation Provider::get_activation_vfunc() const {
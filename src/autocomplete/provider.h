@@ -1,6 +1,11 @@
 #ifndef PROVIDER_H
 #define PROVIDER_H
 
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <memory>
+#include <condition_variable>
 #include <gtksourceviewmm.h>
 
 #include "indexer.h"
@@ -9,9 +14,17 @@ namespace delimit {
 
 class Window;
 
+/*
+ *  Completion proposals from the index. Queries run on a worker thread and the
+ *  results are handed to GtkSourceView asynchronously, so the popup never waits
+ *  on the index. Only the latest request matters: a request which is superseded
+ *  (or whose context is cancelled) before it runs is skipped, and its results are
+ *  dropped if it had already started.
+ */
 class Provider :  public Glib::Object, public Gsv::CompletionProvider {
 public:
     Provider(Window *window);
+    ~Provider();
 
     Glib::ustring get_name() const { return "Delimit"; }
 
@@ -21,8 +34,45 @@ public:
 
     IndexerPtr indexer() { return indexer_; }
 private:
+    struct Request {
+        uint64_t generation;
+        unicode parser;
+        unicode filename;
+        int line;
+        int col;
+        unicode text;
+        bool word_completion_only;
+    };
+
+    struct Response {
+        uint64_t generation;
+        std::vector<unicode> completions;
+    };
+
     Window* window_;
     IndexerPtr indexer_;
+
+    // Bumped by every new request and every cancellation, anything older is stale
+    std::atomic<uint64_t> generation_{0};
+
+    std::mutex mutex_;
+    std::condition_variable request_ready_;
+    std::shared_ptr<Request> pending_request_; // Replaced, not queued
+    std::shared_ptr<Response> response_;
+    bool stopping_ = false;
+
+    std::thread worker_;
+    Glib::Dispatcher response_ready_;
+
+    // Only used on the main thread
+    Glib::RefPtr<Gsv::CompletionContext> context_;
+    sigc::connection cancelled_connection_;
+
+    void run_worker();
+    void on_response_ready();
+    void on_context_cancelled();
+
+    Glib::RefPtr<Provider> self();
 };
 
 }
@@ -0,0 +1,136 @@
+#include <algorithm>
+#include <unordered_set>
+
+#include "scope_tree.h"
+
+namespace delimit {
+
+typedef std::pair<int, int> Position;
+
+static Position start_of(const ScopeRange& range) {
+    return Position(range.start_line, range.start_col);
+}
+
+static Position end_of(const ScopeRange& range) {
+    return Position(range.end_line, range.end_col);
+}
+
+static std::pair<std::string, std::string> split_path(const std::string& path) {
+    /* "a.b.c" -> ("a.b", "c") */
+    auto dot = path.rfind('.');
+    if(dot == std::string::npos) {
+        return std::make_pair(std::string(), path);
+    }
+    return std::make_pair(path.substr(0, dot), path.substr(dot + 1));
+}
+
+ScopeTree::ScopeTree(std::vector<ScopeRange> ranges):
+    ranges_(std::move(ranges)) {
+
+    for(auto& range: ranges_) {
+        if(end_of(range) < start_of(range)) {
+            range.end_line = range.start_line;
+            range.end_col = range.start_col;
+        }
+    }
+
+    std::sort(ranges_.begin(), ranges_.end(), [](const ScopeRange& lhs, const ScopeRange& rhs) {
+        if(start_of(lhs) != start_of(rhs)) return start_of(lhs) < start_of(rhs);
+        return end_of(lhs) > end_of(rhs);
+    });
+
+    // Everything on the stack contains the range before it
+    std::vector<int> stack;
+    parents_.resize(ranges_.size(), -1);
+
+    for(int i = 0; i < int(ranges_.size()); ++i) {
+        while(!stack.empty() && end_of(ranges_[stack.back()]) < end_of(ranges_[i])) {
+            stack.pop_back();
+        }
+
+        parents_[i] = (stack.empty()) ? -1 : stack.back();
+        stack.push_back(i);
+    }
+
+    std::unordered_set<std::string> paths;
+    for(auto& range: ranges_) {
+        paths.insert(range.path);
+    }
+
+    std::unordered_set<std::string> seen;
+    for(auto& range: ranges_) {
+        if(!seen.insert(range.path).second) {
+            continue;
+        }
+
+        auto parent_and_name = split_path(range.path);
+        if(paths.count(parent_and_name.first)) {
+            names_by_parent_[parent_and_name.first].push_back(parent_and_name.second);
+        } else {
+            // The parent isn't a scope in this file (usually it's the module)
+            top_level_names_.push_back(parent_and_name.second);
+        }
+    }
+}
+
+int ScopeTree::innermost_index(int line, int col) const {
+    Position position(line, col);
+
+    // The last range starting at or before the position...
+    auto it = std::upper_bound(
+        ranges_.begin(), ranges_.end(), position,
+        [](const Position& value, const ScopeRange& range) { return value < start_of(range); }
+    );
+
+    int index = int(it - ranges_.begin()) - 1;
+
+    // ...or the nearest of its parents which is still open there
+    while(index != -1 && end_of(ranges_[index]) < position) {
+        index = parents_[index];
+    }
+
+    return index;
+}
+
+const ScopeRange* ScopeTree::innermost(int line, int col) const {
+    int index = innermost_index(line, col);
+    return (index == -1) ? nullptr : &ranges_[index];
+}
+
+std::vector<const ScopeRange*> ScopeTree::enclosing(int line, int col) const {
+    std::vector<const ScopeRange*> result;
+
+    Position position(line, col);
+    for(int index = innermost_index(line, col); index != -1; index = parents_[index]) {
+        if(!(end_of(ranges_[index]) < position)) {
+            result.push_back(&ranges_[index]);
+        }
+    }
+
+    return result;
+}
+
+std::vector<std::string> ScopeTree::visible_names(int line, int col) const {
+    std::vector<std::string> result;
+    std::unordered_set<std::string> seen;
+
+    auto add = [&](const std::vector<std::string>& names) {
+        for(auto& name: names) {
+            if(seen.insert(name).second) {
+                result.push_back(name);
+            }
+        }
+    };
+
+    for(auto range: enclosing(line, col)) {
+        auto it = names_by_parent_.find(range->path);
+        if(it != names_by_parent_.end()) {
+            add(it->second);
+        }
+    }
+
+    add(top_level_names_);
+    return result;
+}
+
+}
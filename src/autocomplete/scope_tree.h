@@ -0,0 +1,59 @@
+#ifndef SCOPE_TREE_H
+#define SCOPE_TREE_H
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+namespace delimit {
+
+struct ScopeRange {
+    std::string path;
+
+    int start_line = 0;
+    int start_col = 0;
+    int end_line = 0;
+    int end_col = 0;
+};
+
+/*
+ *  The scopes of a single file as a sorted array of nested intervals. Each range knows
+ *  the nearest range which contains it, so finding the innermost scope at a position
+ *  is a binary search followed by a short walk up through the parents.
+ *
+ *  Ranges which end before they start are treated as covering just their start.
+ */
+class ScopeTree {
+public:
+    ScopeTree(std::vector<ScopeRange> ranges);
+
+    /* The innermost scope containing the position, or nullptr if there isn't one */
+    const ScopeRange* innermost(int line, int col) const;
+
+    /* Every scope containing the position, innermost first */
+    std::vector<const ScopeRange*> enclosing(int line, int col) const;
+
+    /*
+     *  The names declared in each scope containing the position, innermost scope first,
+     *  followed by the file's top level names. Each name appears once.
+     */
+    std::vector<std::string> visible_names(int line, int col) const;
+
+    std::size_t size() const { return ranges_.size(); }
+
+private:
+    std::vector<ScopeRange> ranges_; // Sorted on start, longest first when they start together
+    std::vector<int> parents_; // Index of the nearest containing range, or -1
+
+    std::unordered_map<std::string, std::vector<std::string>> names_by_parent_;
+    std::vector<std::string> top_level_names_;
+
+    int innermost_index(int line, int col) const;
+};
+
+typedef std::shared_ptr<const ScopeTree> ScopeTreePtr;
+
+}
+
+#endif // SCOPE_TREE_H
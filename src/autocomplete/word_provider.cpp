@@ -0,0 +1,59 @@
+#include "word_provider.h"
+
+namespace delimit {
+
+// The same as CompletionWords' default
+static const int MIN_PREFIX_LENGTH = 2;
+static const std::size_t MAX_PROPOSALS = 50;
+
+static bool is_word_char(gunichar ch) {
+    return g_unichar_isalnum(ch) || ch == '_';
+}
+
+Glib::RefPtr<WordProvider> WordProvider::create(WordIndexPtr index) {
+    return Glib::RefPtr<WordProvider>(new WordProvider(index));
+}
+
+WordProvider::WordProvider(WordIndexPtr index):
+    Glib::ObjectBase(typeid(WordProvider)),
+    Glib::Object(),
+    Gsv::CompletionProvider(),
+    index_(index) {
+
+}
+
+void WordProvider::populate_vfunc(const Glib::RefPtr<Gsv::CompletionContext>& context) {
+    std::vector<Glib::RefPtr<Gsv::CompletionProposal>> results;
+
+    auto iter = context->get_iter();
+    auto start = iter;
+
+    while(start.backward_char()) {
+        if(!is_word_char(start.get_char())) {
+            start.forward_char();
+            break;
+        }
+    }
+
+    auto prefix = start.get_buffer()->get_text(start, iter, true);
+
+    // Typing only pops up the list once there's enough to go on, asking for it always does
+    bool requested = context->get_activation() & Gsv::COMPLETION_ACTIVATION_USER_REQUESTED;
+
+    if(int(prefix.length()) >= MIN_PREFIX_LENGTH || (requested && !prefix.empty())) {
+        for(auto& word: index_->complete(prefix.raw(), MAX_PROPOSALS)) {
+            results.push_back(Gsv::CompletionItem::create(word, word, Glib::RefPtr<Gdk::Pixbuf>(), ""));
+        }
+    }
+
+    Glib::RefPtr<WordProvider> reffed_this(this);
+    reffed_this->reference();
+
+    context->add_proposals(reffed_this, results, true);
+}
+
+Gsv::CompletionActivation WordProvider::get_activation_vfunc() const {
+    return Gsv::COMPLETION_ACTIVATION_INTERACTIVE | Gsv::COMPLETION_ACTIVATION_USER_REQUESTED;
+}
+
+}
@@ -0,0 +1,34 @@
+#ifndef WORD_PROVIDER_H
+#define WORD_PROVIDER_H
+
+#include <gtksourceviewmm.h>
+
+#include "completion_index.h"
+
+namespace delimit {
+
+/*
+ *  Word completion from the project's WordIndex, in place of Gsv::CompletionWords
+ *  which rescans the text of every registered buffer. Lookups are in memory so they
+ *  are answered straight away, the index is kept up to date by the indexer.
+ */
+class WordProvider : public Glib::Object, public Gsv::CompletionProvider {
+public:
+    static Glib::RefPtr<WordProvider> create(WordIndexPtr index);
+
+    Glib::ustring get_name_vfunc() const override { return "Words"; }
+    int get_priority_vfunc() const override { return 1; }
+
+    void populate_vfunc(const Glib::RefPtr<Gsv::CompletionContext>& context) override;
+    bool match_vfunc(const Glib::RefPtr<const Gsv::CompletionContext>& context) const override { return true; }
+    Gsv::CompletionActivation get_activation_vfunc() const override;
+
+private:
+    WordProvider(WordIndexPtr index);
+
+    WordIndexPtr index_;
+};
+
+}
+
+#endif // WORD_PROVIDER_H
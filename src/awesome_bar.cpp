@@ -33,16 +33,17 @@ AwesomeBar::AwesomeBar(Window &parent):
     build_widgets();
 }
 
-void recursive_populate(std::vector<unicode>* output, const unicode& directory)  {
+void recursive_populate(std::vector<unicode>* output, const unicode& directory, IgnoreTreePtr ignore_tree)  {
     const int CYCLES_UNTIL_REFRESH = 15;
     int cycles_until_gtk_update = CYCLES_UNTIL_REFRESH;
     for(unicode thing: kfs::path::list_dir(directory.encode())) {
-        //FIXME: Should use gitignore
-        if(thing.starts_with(".") || thing.ends_with(".pyc")) continue;
-
         auto full_path = kfs::path::join(directory.encode(), thing.encode());
-        if(kfs::path::is_dir(full_path)) {
-            Glib::signal_idle().connect_once(sigc::bind(&recursive_populate, output, full_path));
+        bool is_dir = kfs::path::is_dir(full_path);
+
+        if(ignore_tree->is_ignored(full_path, is_dir)) continue;
+
+        if(is_dir) {
+            Glib::signal_idle().connect_once(sigc::bind(&recursive_populate, output, full_path, ignore_tree));
         } else {
             output->push_back(full_path);
 
@@ -64,7 +65,11 @@ void AwesomeBar::repopulate_files() {
 
     if(!window_.project_path().empty()) {
         //If this is a project window, then crawl to get the file list
-        recursive_populate(&project_files_, window_.project_path());
+        auto ignore_tree = window_.ignore_tree();
+        if(!ignore_tree) {
+            ignore_tree = std::make_shared<IgnoreTree>(window_.project_path().encode());
+        }
+        recursive_populate(&project_files_, window_.project_path(), ignore_tree);
     } else {
         //FIXME: We need to just look at open files, and keep this updated
     }
@@ -1,13 +1,48 @@
 #include <iostream>
 
+#include "../utils/sigc_lambda.h"
 #include "coverage.h"
 #include "../window.h"
-#include "../utils.h"
 #include "../document_view.h"
 #include "../utils/kfs.h"
 
 using namespace coverage;
 
+static const int REPORT_TIMEOUT_MS = 60000;
+
+/* The line numbers in the Missing column of `coverage report -m`, from 0 */
+static std::vector<int32_t> parse_missing_lines(const unicode& report) {
+    unicode last_line = report.strip().split("\n").back();
+    unicode missing = last_line.split("  ").back();
+    std::cout << missing << std::endl;
+    std::vector<unicode> batches = missing.split(",");
+
+    std::vector<int32_t> ret;
+    for(unicode batch: batches) {
+        batch = batch.strip();
+
+        auto high_low = batch.split("-");
+        if(high_low.size() == 1) {
+            try {
+                ret.push_back(high_low.front().to_int() - 1);
+            } catch(std::exception& e) {
+                continue;
+            }
+        } else {
+            try {
+                int start = high_low.front().to_int() - 1;
+                int end = high_low.back().to_int() - 1;
+                for(int i = start; i <= end; ++i) {
+                    ret.push_back(i);
+                }
+            } catch(std::exception& e) {
+                continue;
+            }
+        }
+    }
+    return ret;
+}
+
 void Coverage::clear_document(delimit::DocumentView* buffer) {
     auto gbuf = buffer->buffer();
 
@@ -17,10 +52,16 @@ void Coverage::clear_document(delimit::DocumentView* buffer) {
 void Coverage::apply_to_document(delimit::DocumentView *buffer) {
     L_DEBUG("Applying coverage to buffer");
 
+    // The document owns us, so it's still there when the lines arrive
+    find_uncovered_lines(buffer->path(), buffer->window().project_path(), [this, buffer](const std::vector<int32_t>& lines) {
+        show_uncovered_lines(buffer, lines);
+    });
+}
+
+void Coverage::show_uncovered_lines(delimit::DocumentView* buffer, const std::vector<int32_t>& result) {
     auto gbuf = buffer->buffer();
     clear_document(buffer);
 
-    auto result = find_uncovered_lines(buffer->path(), buffer->window().project_path());
     for(auto line: result) {
         if(!(line >= 0 && line < gbuf->end().get_line())) {
             continue;
@@ -72,10 +113,11 @@ PythonCoverage::~PythonCoverage() {
     }
 }
 
-std::vector<int32_t> PythonCoverage::find_uncovered_lines(const unicode &filename, const unicode &project_root) {
+void PythonCoverage::find_uncovered_lines(const unicode &filename, const unicode &project_root, LinesCallback done) {
     unicode coverage_file = find_coverage_file(filename, project_root);
     if(coverage_file.empty()) {
-        return std::vector<int32_t>();
+        done(std::vector<int32_t>());
+        return;
     }
 
     if(coverage_monitors_.find(coverage_file) == coverage_monitors_.end()) {
@@ -97,51 +139,32 @@ std::vector<int32_t> PythonCoverage::find_uncovered_lines(const unicode &filenam
 
     unicode current_dir = kfs::path::dir_name(coverage_file.encode());
 
-    unicode coverage_command;
+    std::string coverage_command;
 
     for(auto command: { "python-coverage", "coverage"}) {
-        coverage_command = call_command(_F("which {0}").format(command));
+        coverage_command = delimit::find_program(command);
         if(!coverage_command.empty()) {
             break;
         }
     }
 
     if(coverage_command.empty()) {
-        return std::vector<int32_t>();
+        done(std::vector<int32_t>());
+        return;
     }
 
-    unicode result = call_command(
-        _u("{0} report -m --include {1}").format(coverage_command, filename),
-        current_dir
-    );
+    delimit::SubprocessOptions options;
+    options.argv = {coverage_command, "report", "-m", "--include", filename.encode()};
+    options.cwd = current_dir.encode();
+    options.timeout_ms = REPORT_TIMEOUT_MS;
 
-    unicode last_line = result.split("\n").back();
-    unicode missing = last_line.split("  ").back();
-    std::cout << missing << std::endl;
-    std::vector<unicode> batches = missing.split(",");
+    report_ = std::make_shared<delimit::Subprocess>(options);
+    report_->signal_finished().connect([done](const delimit::SubprocessResult& result) {
+        done(parse_missing_lines(unicode(result.out)));
+    });
 
-    std::vector<int32_t> ret;
-    for(unicode batch: batches) {
-        batch = batch.strip();
-
-        auto high_low = batch.split("-");
-        if(high_low.size() == 1) {
-            try {
-                ret.push_back(high_low.front().to_int() - 1);
-            } catch(std::exception& e) {
-                continue;
-            }
-        } else {
-            try {
-                int start = high_low.front().to_int() - 1;
-                int end = high_low.back().to_int() - 1;
-                for(int i = start; i <= end; ++i) {
-                    ret.push_back(i);
-                }
-            } catch(std::exception& e) {
-                continue;
-            }
-        }
+    if(!report_->start()) {
+        L_ERROR(report_->result().error);
+        report_.reset();
     }
-    return ret;
 }
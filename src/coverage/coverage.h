@@ -4,7 +4,9 @@
 #include <vector>
 #include <cstdint>
 #include <memory>
+#include <functional>
 #include "../utils/unicode.h"
+#include "../utils/subprocess.h"
 #include <gtksourceviewmm.h>
 #include <unordered_map>
 
@@ -18,6 +20,9 @@ class Coverage {
 public:
     typedef std::shared_ptr<Coverage> ptr;
 
+    typedef std::function<void (const std::vector<int32_t>&)> LinesCallback;
+
+    /* Starts finding the uncovered lines, they're marked once they're known */
     void apply_to_document(delimit::DocumentView* buffer);
     void clear_document(delimit::DocumentView* buffer);
 
@@ -28,20 +33,25 @@ protected:
     sigc::signal<void ()> signal_coverage_updated_;
 
 private:
-    virtual std::vector<int32_t> find_uncovered_lines(const unicode& filename, const unicode& project_root="") = 0;
+    void show_uncovered_lines(delimit::DocumentView* buffer, const std::vector<int32_t>& lines);
+
+    virtual void find_uncovered_lines(const unicode& filename, const unicode& project_root, LinesCallback done) = 0;
 };
 
 class PythonCoverage: public Coverage {
 public:
     typedef std::shared_ptr<PythonCoverage> ptr;
 
-    std::vector<int32_t> find_uncovered_lines(const unicode &filename, const unicode& project_root="");
+    void find_uncovered_lines(const unicode &filename, const unicode& project_root, LinesCallback done);
 
     ~PythonCoverage();
 
 private:
     unicode find_coverage_file(const unicode &filename, const unicode &project_root);
 
+    // The report being run, a new one kills it
+    delimit::Subprocess::ptr report_;
+
 
     typedef Glib::RefPtr<Gio::FileMonitor> FileMonitor;
     std::unordered_map<unicode, FileMonitor> coverage_monitors_;
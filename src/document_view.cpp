@@ -2,12 +2,18 @@
 #include "document_view.h"
 #include "window.h"
 #include "application.h"
+#include "autocomplete/word_provider.h"
+#include "autocomplete/parsers/python.h"
+#include "gtk/fast_highlighter.h"
 #include "utils/indentation.h"
 #include "utils/kazlog.h"
 #include "utils.h"
 
 namespace delimit {
 
+// How long typing has to pause before the text is linted
+static const int LINT_DELAY_MS = 400;
+
 DocumentView::DocumentView(Window& window):
     window_(window) {
 
@@ -29,6 +35,10 @@ DocumentView::DocumentView(Window& window, const unicode& filename):
     open_file(filename);
 }
 
+DocumentView::~DocumentView() {
+    lint_timeout_.disconnect();
+}
+
 unicode DocumentView::name() const {
     return kfs::path::split(path().encode()).second;
 }
@@ -85,10 +95,7 @@ void DocumentView::build_widgets() {
     auto manager = Gsv::StyleSchemeManager::get_default();
     view_.get_source_buffer()->set_style_scheme(manager->get_scheme("delimit"));
 
-    auto provider = Gsv::CompletionWords::create("", Glib::RefPtr<Gdk::Pixbuf>());
-    provider->register_provider(buffer_);
-    provider->property_priority().set_value(1);
-    view_.get_completion()->add_provider(provider);
+    view_.get_completion()->add_provider(WordProvider::create(window_.word_index()));
     view_.get_completion()->signal_show().connect([&]() { completion_visible_ = true; });
     view_.get_completion()->signal_hide().connect([&]() { completion_visible_ = false; });
 
@@ -256,7 +263,73 @@ void DocumentView::file_changed(const GioFilePtr& file, const GioFilePtr& other_
 }
 
 void DocumentView::connect_signals() {
+    // Before the default handlers, so the iterators still point at what's being changed
+    buffer_->signal_insert().connect(sigc::mem_fun(this, &DocumentView::on_buffer_insert), false);
+    buffer_->signal_erase().connect(sigc::mem_fun(this, &DocumentView::on_buffer_erase), false);
+}
+
+void DocumentView::follow_python_buffer(const Glib::RefPtr<Gio::File>& file, const Glib::ustring& text) {
+    auto language = guess_language_from_file(file);
+    auto project = window_.project();
+
+    if(!project || !language || language->get_name() != "Python") {
+        return;
+    }
+
+    python_buffer_path_ = file->get_path();
+    python_buffer_project_ = project;
+    python_buffer_ = std::make_shared<parser::PythonBuffer>(parser::Python().base_scope_from_filename(python_buffer_path_));
+
+    auto change = python_buffer_->set_text(unicode(text.raw(), "utf-8"));
+    project->open_buffer(python_buffer_path_, python_buffer_.get(), change);
+}
+
+void DocumentView::stop_following_python_buffer() {
+    if(!python_buffer_) {
+        return;
+    }
+
+    python_buffer_project_->close_buffer(python_buffer_path_, python_buffer_.get());
+
+    python_buffer_.reset();
+    python_buffer_project_.reset();
+    python_buffer_path_ = unicode();
+}
+
+void DocumentView::on_buffer_insert(const Gtk::TextBuffer::iterator& pos, const Glib::ustring& text, int /*bytes*/) {
+    if(!python_buffer_) {
+        return;
+    }
+
+    auto change = python_buffer_->insert(pos.get_offset(), unicode(text.raw(), "utf-8"));
+    python_buffer_project_->apply_edit(python_buffer_path_, python_buffer_.get(), change);
+
+    queue_lint();
+}
 
+void DocumentView::on_buffer_erase(const Gtk::TextBuffer::iterator& start, const Gtk::TextBuffer::iterator& end) {
+    if(!python_buffer_) {
+        return;
+    }
+
+    auto change = python_buffer_->erase(start.get_offset(), end.get_offset() - start.get_offset());
+    python_buffer_project_->apply_edit(python_buffer_path_, python_buffer_.get(), change);
+
+    queue_lint();
+}
+
+void DocumentView::queue_lint() {
+    if(!linter_ || !linter_->checks_buffer()) {
+        return;
+    }
+
+    lint_timeout_.disconnect();
+    lint_timeout_ = Glib::signal_timeout().connect([this]() -> bool {
+        if(linter_) {
+            linter_->apply_to_document(this);
+        }
+        return false;
+    }, LINT_DELAY_MS);
 }
 
 bool DocumentView::is_new_file() const {
@@ -349,6 +422,8 @@ void DocumentView::save(const unicode& path) {
 
     apply_settings(guess_mimetype()); //Make sure we update the settings when we've saved the file
 
+    window_.index_document(path);
+
     window_.rebuild_open_list();
     run_linters_and_stuff();
 }
@@ -369,6 +444,24 @@ void DocumentView::apply_language_to_buffer(const Glib::RefPtr<Gsv::Language>& l
     buffer_->set_language(language);
 }
 
+void DocumentView::update_highlighting() {
+    const auto& default_settings = window_.settings()["default"];
+    int threshold = (default_settings.has_key("fast_highlighting_lines")) ? int(default_settings["fast_highlighting_lines"]) : 0;
+
+    auto language = buffer_->get_language();
+    bool python = language && language->get_name() == "Python";
+
+    // Once a file is big enough it stays on the fast path, rather than switching back and forth as lines come and go
+    bool fast = python && threshold > 0 && (fast_highlighter_ || buffer_->get_line_count() >= threshold);
+
+    if(fast && !fast_highlighter_) {
+        L_INFO(_F("Using fast highlighting for {0} lines").format(buffer_->get_line_count()));
+        fast_highlighter_ = std::make_shared<_Gtk::FastHighlighter>(view_);
+    } else if(!fast && fast_highlighter_) {
+        fast_highlighter_.reset();
+    }
+}
+
 void DocumentView::run_linters_and_stuff(bool force) {
     L_DEBUG("DocumentView::run_linters_and_stuff");
 
@@ -380,6 +473,7 @@ void DocumentView::run_linters_and_stuff(bool force) {
 
     L_DEBUG("Detecting language");
     apply_language_to_buffer(guess_language_from_file(file_));
+    update_highlighting();
 
     L_DEBUG("Applying settings");
     apply_settings(guess_mimetype()); //Make sure we update the settings when we've reloaded the file
@@ -396,7 +490,7 @@ void DocumentView::run_linters_and_stuff(bool force) {
         }
         coverage_->apply_to_document(this);
 
-        linter_ = std::make_shared<linter::PythonLinter>();
+        linter_ = std::make_shared<linter::PythonLinter>(window().project()->lint_server());
         linter_->apply_to_document(this);
     } else if(name == "JavaScript") {
         linter_ = std::make_shared<linter::JavascriptLinter>();
@@ -435,11 +529,16 @@ void DocumentView::finish_read(Glib::RefPtr<Gio::File> file, Glib::RefPtr<Gio::A
 
     Glib::ustring result(output);
 
+    // Everything is replaced, so start following the new text afresh
+    stop_following_python_buffer();
+
     buffer_->begin_not_undoable_action();
     buffer_->set_text(result);
     buffer_->set_modified(false);
     buffer_->end_not_undoable_action();
 
+    follow_python_buffer(file, result);
+
     signal_loaded_(*this);
 
     detect_and_apply_indentation();
@@ -488,6 +587,8 @@ void DocumentView::create_new_file() {
 void DocumentView::open_file(const unicode& filename) {
     auto file = Gio::File::create_for_path(filename.encode());
     set_file(file);
+
+    window_.index_document(filename);
 }
 
 void DocumentView::close() {
@@ -512,6 +613,7 @@ void DocumentView::close() {
     }
 
     disconnect_file_monitor();
+    stop_following_python_buffer();
     signal_closed_(*this);
 }
 
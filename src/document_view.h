@@ -12,9 +12,18 @@
 
 #include "utils/jsonic.h"
 
+namespace _Gtk {
+    class FastHighlighter;
+}
+
 namespace delimit {
 
+namespace parser {
+    class PythonBuffer;
+}
+
 class Window;
+class Project;
 
 typedef Glib::RefPtr<Gio::File> GioFilePtr;
 typedef Glib::RefPtr<Gio::FileMonitor> GioFileMonitorPtr;
@@ -25,6 +34,7 @@ public:
 
     DocumentView(Window& window);
     DocumentView(Window& window, const unicode& filename);
+    ~DocumentView();
 
     unicode name() const;
     unicode path() const;
@@ -82,6 +92,24 @@ private:
 
     ErrorList lint_errors_;
 
+    // Python files keep a tokenized copy of the text, so each edit only reparses what it touched
+    std::shared_ptr<parser::PythonBuffer> python_buffer_;
+    std::shared_ptr<Project> python_buffer_project_;
+    unicode python_buffer_path_;
+
+    void follow_python_buffer(const Glib::RefPtr<Gio::File>& file, const Glib::ustring& text);
+    void stop_following_python_buffer();
+    void on_buffer_insert(const Gtk::TextBuffer::iterator& pos, const Glib::ustring& text, int bytes);
+    void on_buffer_erase(const Gtk::TextBuffer::iterator& start, const Gtk::TextBuffer::iterator& end);
+
+    // Linters which check the text rather than the file are rerun once typing pauses
+    sigc::connection lint_timeout_;
+    void queue_lint();
+
+    // Huge Python files are highlighted by our own lexer rather than GtkSourceView's
+    std::shared_ptr<_Gtk::FastHighlighter> fast_highlighter_;
+    void update_highlighting();
+
     void trim_trailing_newlines();
     void trim_trailing_whitespace();
 
@@ -0,0 +1,167 @@
+#include <algorithm>
+
+#include "../utils/sigc_lambda.h"
+#include "fast_highlighter.h"
+
+namespace _Gtk {
+
+using namespace delimit::highlight;
+
+namespace {
+
+// Lines above and below the visible ones which are tagged too, so a small scroll shows nothing untagged
+const int MARGIN_LINES = 100;
+
+// The style scheme entries each style is coloured like
+const char* const STYLE_IDS[] = {
+    "def:keyword",
+    "def:builtin",
+    "def:special-constant",
+    "def:number",
+    "def:string",
+    "def:comment",
+    "def:preprocessor",
+    "def:function"
+};
+
+static_assert(sizeof(STYLE_IDS) / sizeof(STYLE_IDS[0]) == STYLE_COUNT, "Every style needs a scheme entry");
+
+void copy_style(GtkSourceStyleScheme* scheme, const char* id, GtkTextTag* tag) {
+    GtkSourceStyle* style = (scheme) ? gtk_source_style_scheme_get_style(scheme, id) : nullptr;
+    if(!style) {
+        return;
+    }
+
+    gchar* foreground = nullptr;
+    gboolean foreground_set = FALSE, bold = FALSE, bold_set = FALSE, italic = FALSE, italic_set = FALSE;
+
+    g_object_get(
+        style,
+        "foreground", &foreground, "foreground-set", &foreground_set,
+        "bold", &bold, "bold-set", &bold_set,
+        "italic", &italic, "italic-set", &italic_set,
+        nullptr
+    );
+
+    if(foreground_set && foreground) {
+        g_object_set(tag, "foreground", foreground, nullptr);
+    }
+
+    if(bold_set) {
+        g_object_set(tag, "weight", (bold) ? PANGO_WEIGHT_BOLD : PANGO_WEIGHT_NORMAL, nullptr);
+    }
+
+    if(italic_set) {
+        g_object_set(tag, "style", (italic) ? PANGO_STYLE_ITALIC : PANGO_STYLE_NORMAL, nullptr);
+    }
+
+    g_free(foreground);
+}
+
+}
+
+FastHighlighter::FastHighlighter(Gsv::View& view):
+    view_(view),
+    buffer_(view.get_source_buffer()),
+    highlighter_(buffer_->get_line_count()) {
+
+    buffer_->set_highlight_syntax(false);
+    create_tags();
+
+    // Before the default handlers, so the iterators still point at what's being changed
+    connections_.push_back(buffer_->signal_insert().connect(sigc::mem_fun(this, &FastHighlighter::on_insert), false));
+    connections_.push_back(buffer_->signal_erase().connect(sigc::mem_fun(this, &FastHighlighter::on_erase), false));
+
+    connections_.push_back(view_.get_vadjustment()->signal_value_changed().connect(sigc::mem_fun(this, &FastHighlighter::queue_update)));
+    connections_.push_back(view_.signal_size_allocate().connect([this](Gtk::Allocation&) { queue_update(); }));
+
+    queue_update();
+}
+
+FastHighlighter::~FastHighlighter() {
+    update_.disconnect();
+    for(auto& connection: connections_) {
+        connection.disconnect();
+    }
+
+    // Taking the tags out of the table takes them off the text as well
+    auto table = buffer_->get_tag_table();
+    for(auto& tag: tags_) {
+        table->remove(tag);
+    }
+
+    buffer_->set_highlight_syntax(true);
+}
+
+void FastHighlighter::create_tags() {
+    auto scheme = buffer_->get_style_scheme();
+
+    for(int i = 0; i < STYLE_COUNT; ++i) {
+        tags_[i] = buffer_->create_tag();
+        copy_style((scheme) ? scheme->gobj() : nullptr, STYLE_IDS[i], tags_[i]->gobj());
+    }
+}
+
+void FastHighlighter::on_insert(const Gtk::TextBuffer::iterator& pos, const Glib::ustring& text, int /*bytes*/) {
+    const std::string& raw = text.raw();
+    highlighter_.edit(pos.get_line(), 0, std::count(raw.begin(), raw.end(), '\n'));
+    queue_update();
+}
+
+void FastHighlighter::on_erase(const Gtk::TextBuffer::iterator& start, const Gtk::TextBuffer::iterator& end) {
+    highlighter_.edit(start.get_line(), end.get_line() - start.get_line(), 0);
+    queue_update();
+}
+
+void FastHighlighter::queue_update() {
+    if(!update_.connected()) {
+        // Ahead of redrawing, so the lines which just came into view don't show untagged for a frame
+        update_ = Glib::signal_idle().connect(sigc::mem_fun(this, &FastHighlighter::update), Glib::PRIORITY_HIGH_IDLE);
+    }
+}
+
+bool FastHighlighter::update() {
+    Gdk::Rectangle visible;
+    view_.get_visible_rect(visible);
+
+    Gtk::TextBuffer::iterator top, bottom;
+    int line_top;
+    view_.get_line_at_y(top, visible.get_y(), line_top);
+    view_.get_line_at_y(bottom, visible.get_y() + visible.get_height(), line_top);
+
+    auto line_bounds = [this](int line, Gtk::TextBuffer::iterator& start, Gtk::TextBuffer::iterator& end) {
+        start = buffer_->get_iter_at_line(line);
+        end = start;
+        if(!end.ends_line()) {
+            end.forward_to_line_end();
+        }
+    };
+
+    auto read = [&](int line, std::string& text) {
+        Gtk::TextBuffer::iterator start, end;
+        line_bounds(line, start, end);
+        text = buffer_->get_slice(start, end, true).raw();
+    };
+
+    auto style = [&](int line, const std::vector<Span>& spans) {
+        Gtk::TextBuffer::iterator start, end;
+        line_bounds(line, start, end);
+
+        for(auto& tag: tags_) {
+            buffer_->remove_tag(tag, start, end);
+        }
+
+        for(auto& span: spans) {
+            buffer_->apply_tag(
+                tags_[span.style],
+                buffer_->get_iter_at_line_index(line, span.begin),
+                buffer_->get_iter_at_line_index(line, span.end)
+            );
+        }
+    };
+
+    highlighter_.highlight(top.get_line() - MARGIN_LINES, bottom.get_line() + MARGIN_LINES, read, style);
+    return false;
+}
+
+}
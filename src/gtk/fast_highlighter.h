@@ -0,0 +1,48 @@
+#ifndef FAST_HIGHLIGHTER_H
+#define FAST_HIGHLIGHTER_H
+
+#include <vector>
+#include <gtkmm.h>
+#include <gtksourceviewmm.h>
+
+#include "../highlight/python_highlighter.h"
+
+namespace _Gtk {
+
+/*
+ *  Highlights a Python file with our own lexer instead of GtkSourceView's regex engine,
+ *  which is what makes scrolling and typing stutter once a file runs to tens of
+ *  thousands of lines. GtkSourceView's highlighting is off while this exists.
+ *
+ *  Only the lines on screen and a margin either side of them are ever tagged, from an
+ *  idle callback queued by scrolling, resizing or editing, so a line far from the view
+ *  keeps whatever tags it had until it's scrolled back to. The colours are taken from
+ *  the buffer's style scheme.
+ */
+class FastHighlighter {
+public:
+    FastHighlighter(Gsv::View& view);
+    ~FastHighlighter();
+
+private:
+    Gsv::View& view_;
+    Glib::RefPtr<Gsv::Buffer> buffer_;
+    delimit::highlight::PythonHighlighter highlighter_;
+
+    Glib::RefPtr<Gtk::TextTag> tags_[delimit::highlight::STYLE_COUNT];
+
+    std::vector<sigc::connection> connections_;
+    sigc::connection update_;
+
+    void create_tags();
+
+    void on_insert(const Gtk::TextBuffer::iterator& pos, const Glib::ustring& text, int bytes);
+    void on_erase(const Gtk::TextBuffer::iterator& start, const Gtk::TextBuffer::iterator& end);
+
+    void queue_update();
+    bool update();
+};
+
+}
+
+#endif // FAST_HIGHLIGHTER_H
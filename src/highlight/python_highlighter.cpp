@@ -0,0 +1,353 @@
+#include <algorithm>
+#include <climits>
+#include <cstring>
+
+#include "python_highlighter.h"
+#include "../symbols/lexer.h"
+
+namespace delimit {
+namespace highlight {
+
+namespace {
+
+enum Word {
+    WORD_NONE,
+    WORD_KEYWORD,
+    WORD_DEFINER, // def and class, the name after them is styled
+    WORD_BUILTIN,
+    WORD_CONSTANT
+};
+
+// Python 2 and 3 together, print and exec are keywords as they are in GtkSourceView's python.lang
+constexpr lexer::Keyword PYTHON_WORDS[] = {
+    {"and", WORD_KEYWORD}, {"as", WORD_KEYWORD}, {"assert", WORD_KEYWORD}, {"async", WORD_KEYWORD},
+    {"await", WORD_KEYWORD}, {"break", WORD_KEYWORD}, {"class", WORD_DEFINER}, {"continue", WORD_KEYWORD},
+    {"def", WORD_DEFINER}, {"del", WORD_KEYWORD}, {"elif", WORD_KEYWORD}, {"else", WORD_KEYWORD},
+    {"except", WORD_KEYWORD}, {"exec", WORD_KEYWORD}, {"finally", WORD_KEYWORD}, {"for", WORD_KEYWORD},
+    {"from", WORD_KEYWORD}, {"global", WORD_KEYWORD}, {"if", WORD_KEYWORD}, {"import", WORD_KEYWORD},
+    {"in", WORD_KEYWORD}, {"is", WORD_KEYWORD}, {"lambda", WORD_KEYWORD}, {"nonlocal", WORD_KEYWORD},
+    {"not", WORD_KEYWORD}, {"or", WORD_KEYWORD}, {"pass", WORD_KEYWORD}, {"print", WORD_KEYWORD},
+    {"raise", WORD_KEYWORD}, {"return", WORD_KEYWORD}, {"try", WORD_KEYWORD}, {"while", WORD_KEYWORD},
+    {"with", WORD_KEYWORD}, {"yield", WORD_KEYWORD},
+
+    {"True", WORD_CONSTANT}, {"False", WORD_CONSTANT}, {"None", WORD_CONSTANT},
+
+    {"__import__", WORD_BUILTIN}, {"abs", WORD_BUILTIN}, {"all", WORD_BUILTIN}, {"any", WORD_BUILTIN},
+    {"basestring", WORD_BUILTIN}, {"bool", WORD_BUILTIN}, {"bytes", WORD_BUILTIN}, {"callable", WORD_BUILTIN},
+    {"chr", WORD_BUILTIN}, {"classmethod", WORD_BUILTIN}, {"dict", WORD_BUILTIN}, {"dir", WORD_BUILTIN},
+    {"divmod", WORD_BUILTIN}, {"enumerate", WORD_BUILTIN}, {"filter", WORD_BUILTIN}, {"float", WORD_BUILTIN},
+    {"format", WORD_BUILTIN}, {"frozenset", WORD_BUILTIN}, {"getattr", WORD_BUILTIN}, {"globals", WORD_BUILTIN},
+    {"hasattr", WORD_BUILTIN}, {"hash", WORD_BUILTIN}, {"hex", WORD_BUILTIN}, {"id", WORD_BUILTIN},
+    {"input", WORD_BUILTIN}, {"int", WORD_BUILTIN}, {"isinstance", WORD_BUILTIN}, {"issubclass", WORD_BUILTIN},
+    {"iter", WORD_BUILTIN}, {"len", WORD_BUILTIN}, {"list", WORD_BUILTIN}, {"locals", WORD_BUILTIN},
+    {"long", WORD_BUILTIN}, {"map", WORD_BUILTIN}, {"max", WORD_BUILTIN}, {"min", WORD_BUILTIN},
+    {"next", WORD_BUILTIN}, {"object", WORD_BUILTIN}, {"oct", WORD_BUILTIN}, {"open", WORD_BUILTIN},
+    {"ord", WORD_BUILTIN}, {"pow", WORD_BUILTIN}, {"property", WORD_BUILTIN}, {"range", WORD_BUILTIN},
+    {"raw_input", WORD_BUILTIN}, {"reduce", WORD_BUILTIN}, {"repr", WORD_BUILTIN}, {"reversed", WORD_BUILTIN},
+    {"round", WORD_BUILTIN}, {"set", WORD_BUILTIN}, {"setattr", WORD_BUILTIN}, {"slice", WORD_BUILTIN},
+    {"sorted", WORD_BUILTIN}, {"staticmethod", WORD_BUILTIN}, {"str", WORD_BUILTIN}, {"sum", WORD_BUILTIN},
+    {"super", WORD_BUILTIN}, {"tuple", WORD_BUILTIN}, {"type", WORD_BUILTIN}, {"unichr", WORD_BUILTIN},
+    {"unicode", WORD_BUILTIN}, {"vars", WORD_BUILTIN}, {"xrange", WORD_BUILTIN}, {"zip", WORD_BUILTIN}
+};
+
+constexpr lexer::KeywordSet PYTHON_WORD_SET(PYTHON_WORDS);
+
+constexpr lexer::CharTable PYTHON_CHARS = lexer::make_char_table("", "'\"");
+
+const uint8_t NOT_STYLED = 0xff;
+
+bool is(char c, int char_class) {
+    return PYTHON_CHARS.is(c, char_class);
+}
+
+bool is_string_prefix(const char* begin, const char* end) {
+    if(end - begin > 2) {
+        return false;
+    }
+
+    for(; begin != end; ++begin) {
+        if(!strchr("rRuUbBfF", *begin)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Moves pos past the end of a string, returns the state the next line is in if it doesn't end on this one */
+LineState read_string(const char*& pos, const char* end, char quote, bool triple) {
+    bool continued = false;
+
+    while(pos < end) {
+        if(*pos == '\\') {
+            // Even in raw strings a backslash stops the quote after it ending the string
+            if(pos + 1 == end) {
+                continued = true;
+                ++pos;
+            } else {
+                pos += 2;
+            }
+        } else if(*pos == quote && (!triple || (end - pos >= 3 && pos[1] == quote && pos[2] == quote))) {
+            pos += (triple) ? 3 : 1;
+            return LINE_CLEAN;
+        } else {
+            ++pos;
+        }
+    }
+
+    if(triple) {
+        return (quote == '\'') ? LINE_IN_TRIPLE_SINGLE : LINE_IN_TRIPLE_DOUBLE;
+    }
+
+    // Unterminated strings end with the line, unless it ends with a backslash
+    return (!continued) ? LINE_CLEAN : (quote == '\'') ? LINE_IN_SINGLE : LINE_IN_DOUBLE;
+}
+
+}
+
+LineState lex_line(const char* begin, const char* end, LineState state, std::vector<Span>& spans) {
+    if(end > begin && end[-1] == '\r') {
+        --end;
+    }
+
+    const char* pos = begin;
+
+    auto add = [&](const char* from, Style style) {
+        spans.push_back(Span{uint32_t(from - begin), uint32_t(pos - begin), style});
+    };
+
+    auto string = [&](const char* from) -> LineState {
+        char quote = *pos;
+        bool triple = end - pos >= 3 && pos[1] == quote && pos[2] == quote;
+        pos += (triple) ? 3 : 1;
+
+        LineState open = read_string(pos, end, quote, triple);
+        add(from, STYLE_STRING);
+        return open;
+    };
+
+    if(state != LINE_CLEAN) {
+        char quote = (state == LINE_IN_TRIPLE_SINGLE || state == LINE_IN_SINGLE) ? '\'' : '"';
+        state = read_string(pos, end, quote, state == LINE_IN_TRIPLE_SINGLE || state == LINE_IN_TRIPLE_DOUBLE);
+        add(begin, STYLE_STRING);
+
+        if(state != LINE_CLEAN) {
+            return state;
+        }
+    }
+
+    bool first = (pos == begin); // A decorator has to start the line
+    bool definition_next = false;
+    bool after_dot = false;
+
+    while(pos < end) {
+        char c = *pos;
+        if(is(c, lexer::CHAR_SPACE)) {
+            ++pos;
+            continue;
+        }
+
+        const char* start = pos;
+        bool definition = definition_next;
+        bool attribute = after_dot;
+        definition_next = after_dot = false;
+
+        if(c == '#') {
+            pos = end;
+            add(start, STYLE_COMMENT);
+            return LINE_CLEAN;
+        } else if(is(c, lexer::CHAR_IDENT)) {
+            while(pos < end && is(*pos, lexer::CHAR_IDENT | lexer::CHAR_DIGIT)) {
+                ++pos;
+            }
+
+            if(pos < end && is(*pos, lexer::CHAR_QUOTE) && is_string_prefix(start, pos)) {
+                LineState open = string(start);
+                if(open != LINE_CLEAN) {
+                    return open;
+                }
+            } else if(definition) {
+                add(start, STYLE_DEFINITION);
+            } else if(!attribute) {
+                lexer::Token word;
+                word.kind = lexer::TOKEN_IDENTIFIER;
+                word.begin = start;
+                word.end = pos;
+                word.hash = lexer::hash(start, pos);
+
+                switch(PYTHON_WORD_SET.find(word)) {
+                    case WORD_KEYWORD: add(start, STYLE_KEYWORD); break;
+                    case WORD_DEFINER: add(start, STYLE_KEYWORD); definition_next = true; break;
+                    case WORD_BUILTIN: add(start, STYLE_BUILTIN); break;
+                    case WORD_CONSTANT: add(start, STYLE_CONSTANT); break;
+                    default: break;
+                }
+            }
+        } else if(is(c, lexer::CHAR_DIGIT) || (c == '.' && pos + 1 < end && is(pos[1], lexer::CHAR_DIGIT))) {
+            bool hex = c == '0' && pos + 1 < end && (pos[1] == 'x' || pos[1] == 'X');
+            ++pos;
+
+            while(pos < end) {
+                if(is(*pos, lexer::CHAR_IDENT | lexer::CHAR_DIGIT) || *pos == '.') {
+                    ++pos;
+                } else if((*pos == '+' || *pos == '-') && !hex && (pos[-1] == 'e' || pos[-1] == 'E')) {
+                    ++pos;
+                } else {
+                    break;
+                }
+            }
+            add(start, STYLE_NUMBER);
+        } else if(is(c, lexer::CHAR_QUOTE)) {
+            LineState open = string(start);
+            if(open != LINE_CLEAN) {
+                return open;
+            }
+        } else if(c == '@' && first) {
+            ++pos;
+            while(pos < end && (is(*pos, lexer::CHAR_IDENT | lexer::CHAR_DIGIT) || *pos == '.')) {
+                ++pos;
+            }
+            add(start, STYLE_DECORATOR);
+        } else {
+            after_dot = (c == '.');
+            ++pos;
+        }
+
+        first = false;
+    }
+
+    return LINE_CLEAN;
+}
+
+PythonHighlighter::PythonHighlighter(int line_count, int checkpoint_interval):
+    interval_(std::max(checkpoint_interval, 1)),
+    styled_(std::max(line_count, 1), NOT_STYLED) {
+
+    checkpoints_.push_back(Checkpoint{0, LINE_CLEAN});
+}
+
+void PythonHighlighter::edit(int line, int removed, int added) {
+    line = std::min(std::max(line, 0), line_count() - 1);
+    removed = std::min(std::max(removed, 0), line_count() - 1 - line);
+    added = std::max(added, 0);
+
+    int delta = added - removed;
+
+    // The state at the start of the edited line can't change, the joined lines' checkpoints
+    // are gone and the rest move with their lines
+    auto first = std::upper_bound(checkpoints_.begin(), checkpoints_.end(), line, [](int l, const Checkpoint& c) { return l < c.line; });
+    auto last = std::upper_bound(first, checkpoints_.end(), line + removed, [](int l, const Checkpoint& c) { return l < c.line; });
+    first = checkpoints_.erase(first, last);
+
+    for(; first != checkpoints_.end(); ++first) {
+        first->line += delta;
+    }
+
+    for(auto& edit: edits_) {
+        edit = (edit > line + removed) ? edit + delta : std::min(edit, line);
+    }
+    edits_.push_back(line);
+    std::sort(edits_.begin(), edits_.end());
+    edits_.erase(std::unique(edits_.begin(), edits_.end()), edits_.end());
+
+    styled_[line] = NOT_STYLED;
+    styled_.erase(styled_.begin() + line + 1, styled_.begin() + line + 1 + removed);
+    styled_.insert(styled_.begin() + line + 1, added, NOT_STYLED);
+}
+
+std::vector<PythonHighlighter::Checkpoint>::const_iterator PythonHighlighter::last_known(int line) const {
+    int known = (edits_.empty()) ? INT_MAX : edits_.front();
+
+    // There's always one at line 0
+    auto it = std::upper_bound(checkpoints_.begin(), checkpoints_.end(), std::min(line, known), [](int l, const Checkpoint& c) { return l < c.line; });
+    return --it;
+}
+
+LineState PythonHighlighter::state_at(int line, const LineReader& read) {
+    auto it = last_known(line);
+
+    int current = it->line;
+    LineState state = it->state;
+
+    while(current < line) {
+        read(current, text_);
+        spans_.clear();
+        state = lex_line(text_.data(), text_.data() + text_.size(), state, spans_);
+        record(++current, state);
+
+        // Once the lexing has caught up with an edit, jump over whatever it didn't change
+        it = last_known(line);
+        if(it->line > current) {
+            current = it->line;
+            state = it->state;
+        }
+    }
+
+    return state;
+}
+
+void PythonHighlighter::record(int line, LineState state) {
+    auto it = std::lower_bound(checkpoints_.begin(), checkpoints_.end(), line, [](const Checkpoint& c, int l) { return c.line < l; });
+    bool exists = it != checkpoints_.end() && it->line == line;
+
+    if(!edits_.empty() && line > edits_.front()) {
+        // Lexing has gone past these
+        while(!edits_.empty() && edits_.front() < line) {
+            edits_.erase(edits_.begin());
+        }
+
+        if(exists && it->state == state) {
+            // Nothing changed by the edits reaches here, so the checkpoints after it are still right
+            return;
+        }
+
+        // Known as far as here, and no further
+        edits_.insert(edits_.begin(), line);
+
+        if(exists) {
+            it->state = state;
+            return;
+        }
+    } else if(exists) {
+        return;
+    }
+
+    int previous = (it == checkpoints_.begin()) ? INT_MIN / 2 : (it - 1)->line;
+    if(line - previous >= interval_) {
+        checkpoints_.insert(it, Checkpoint{line, state});
+    }
+}
+
+int PythonHighlighter::highlight(int first, int last, const LineReader& read, const LineStyler& style) {
+    first = std::max(first, 0);
+    last = std::min(last, line_count() - 1);
+
+    if(first > last) {
+        return 0;
+    }
+
+    LineState state = state_at(first, read);
+    int restyled = 0;
+
+    for(int line = first; line <= last; ++line) {
+        read(line, text_);
+        spans_.clear();
+        LineState next = lex_line(text_.data(), text_.data() + text_.size(), state, spans_);
+
+        // A line's styling only depends on its text and the state it starts in
+        if(styled_[line] != state) {
+            style(line, spans_);
+            styled_[line] = state;
+            ++restyled;
+        }
+
+        if(line + 1 < line_count()) {
+            record(line + 1, next);
+        }
+        state = next;
+    }
+
+    return restyled;
+}
+
+}
+}
@@ -0,0 +1,114 @@
+#ifndef HIGHLIGHT_PYTHON_HIGHLIGHTER_H
+#define HIGHLIGHT_PYTHON_HIGHLIGHTER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <functional>
+
+namespace delimit {
+namespace highlight {
+
+/*
+ *  Syntax highlighting for Python which only ever looks at the lines it's asked about.
+ *
+ *  Lines are lexed one at a time (as UTF-8, which is what a GtkTextBuffer hands over)
+ *  and the only thing carried from one line to the next is whether a string is still
+ *  open, so the state at the start of a line is a single byte. The highlighter keeps
+ *  that state at checkpoints every so many lines; styling a range means lexing forward
+ *  from the nearest checkpoint before it, and only the lines in the range which weren't
+ *  already styled from the same state are handed back to be restyled.
+ *
+ *  An edit marks the checkpoints after it as unverified rather than throwing them away.
+ *  The next time lexing passes one, either the state there hasn't changed (the usual
+ *  case, and everything after is still right) or it has, and the lexing carries on.
+ */
+
+enum Style {
+    STYLE_KEYWORD,
+    STYLE_BUILTIN,
+    STYLE_CONSTANT, // True, False and None
+    STYLE_NUMBER,
+    STYLE_STRING,
+    STYLE_COMMENT,
+    STYLE_DECORATOR,
+    STYLE_DEFINITION, // The name after def or class
+    STYLE_COUNT
+};
+
+struct Span {
+    uint32_t begin; // Byte offsets into the line
+    uint32_t end;
+    Style style;
+
+    bool operator==(const Span& rhs) const {
+        return begin == rhs.begin && end == rhs.end && style == rhs.style;
+    }
+};
+
+/* What a line leaves open for the one after it */
+enum LineState {
+    LINE_CLEAN,
+    LINE_IN_TRIPLE_SINGLE,
+    LINE_IN_TRIPLE_DOUBLE,
+    LINE_IN_SINGLE, // A quoted string continued with a backslash
+    LINE_IN_DOUBLE
+};
+
+/* Appends the spans of a line (without its newline) which starts in state, and returns the state the next line starts in */
+LineState lex_line(const char* begin, const char* end, LineState state, std::vector<Span>& spans);
+
+class PythonHighlighter {
+public:
+    /* Fills in the text of a line, without its newline */
+    typedef std::function<void (int line, std::string& text)> LineReader;
+
+    /* Replaces whatever styling a line had with the given spans */
+    typedef std::function<void (int line, const std::vector<Span>& spans)> LineStyler;
+
+    PythonHighlighter(int line_count, int checkpoint_interval=64);
+
+    /*
+     *  Called for each edit of the text: removed lines after line were joined onto it,
+     *  and added new ones were split off it. The lines after move to match.
+     */
+    void edit(int line, int removed, int added);
+
+    /* Styles any of lines first to last (clamped to the text) which need it. Returns how many that was. */
+    int highlight(int first, int last, const LineReader& read, const LineStyler& style);
+
+    int line_count() const { return styled_.size(); }
+    int checkpoint_count() const { return checkpoints_.size(); }
+
+private:
+    struct Checkpoint {
+        int line;
+        LineState state; // At the start of the line
+    };
+
+    int interval_;
+
+    // Sorted by line, the first is always line 0
+    std::vector<Checkpoint> checkpoints_;
+
+    // The lines of edits which haven't been lexed past yet. Checkpoints up to the
+    // first of these are right, the ones after it might not be.
+    std::vector<int> edits_;
+
+    // For each line, the state it was styled from or NOT_STYLED
+    std::vector<uint8_t> styled_;
+
+    std::string text_;
+    std::vector<Span> spans_;
+
+    /* The last checkpoint at or before line which can be trusted */
+    std::vector<Checkpoint>::const_iterator last_known(int line) const;
+
+    LineState state_at(int line, const LineReader& read);
+    void record(int line, LineState state);
+};
+
+}
+}
+
+#endif // HIGHLIGHT_PYTHON_HIGHLIGHTER_H
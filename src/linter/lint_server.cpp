@@ -0,0 +1,178 @@
+#include <cstdio>
+
+#include "../utils/sigc_lambda.h"
+#include "lint_server.h"
+
+#include "../utils/kazlog.h"
+#include "../utils/jsonic.h"
+#include "../utils/base_directory.h"
+
+namespace linter {
+
+namespace {
+
+const char* const SERVER_SCRIPT = "delimit/lint_server.py";
+
+// After this many exits without a reply, something's broken and we stop restarting it
+const int MAX_FAILED_STARTS = 3;
+
+void append_json_string(std::string& out, const std::string& value) {
+    out.push_back('"');
+    for(char c: value) {
+        switch(c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if((unsigned char) c < 0x20) {
+                    char escaped[8];
+                    std::snprintf(escaped, sizeof(escaped), "\\u%04x", (unsigned char) c);
+                    out += escaped;
+                } else {
+                    out.push_back(c); // UTF-8 passes straight through
+                }
+        }
+    }
+    out.push_back('"');
+}
+
+}
+
+std::string encode_lint_request(uint64_t id, const unicode& filename, const std::string& source) {
+    std::string line = "{\"id\": " + std::to_string(id) + ", \"filename\": ";
+    append_json_string(line, filename.encode());
+    line += ", \"source\": ";
+    append_json_string(line, source);
+    line += "}\n";
+    return line;
+}
+
+bool parse_lint_reply(const std::string& line, LintReply& reply) {
+    try {
+        jsonic::Node node;
+        jsonic::loads(line, node);
+
+        const jsonic::Node& fields = node;
+        if(!fields.has_key("id")) {
+            return false;
+        }
+
+        reply = LintReply();
+        reply.id = (uint64_t) fields["id"];
+
+        if(fields.has_key("error")) {
+            reply.error = (jsonic::String) fields["error"];
+        }
+
+        if(fields.has_key("errors")) {
+            jsonic::Node& errors = node["errors"];
+            for(int32_t i = 0; i < (int32_t) errors.length(); ++i) {
+                const jsonic::Node& error = errors[i];
+                int32_t line_number = (int32_t) error["line"] - 1;
+                reply.errors.insert(std::make_pair(line_number, unicode((jsonic::String) error["message"])));
+            }
+        }
+    } catch(std::exception& e) {
+        return false;
+    }
+
+    return true;
+}
+
+uint64_t LintServer::check(const unicode& filename, const std::string& source, ErrorsCallback done) {
+    if(!ensure_running()) {
+        return 0;
+    }
+
+    uint64_t id = next_id_++;
+    pending_[id] = done;
+    process_->write(encode_lint_request(id, filename, source));
+    return id;
+}
+
+void LintServer::cancel(uint64_t id) {
+    // The server still checks it, the answer is just ignored
+    pending_.erase(id);
+}
+
+bool LintServer::ensure_running() {
+    if(process_ && process_->running()) {
+        return true;
+    }
+
+    if(failed_starts_ >= MAX_FAILED_STARTS) {
+        return false;
+    }
+
+    auto script = fdo::xdg::find_data_file(SERVER_SCRIPT);
+    if(!script.second) {
+        L_ERROR(_F("Couldn't find {0}, Python files won't be linted").format(SERVER_SCRIPT));
+        failed_starts_ = MAX_FAILED_STARTS;
+        return false;
+    }
+
+    std::string python = delimit::find_program("python3");
+    if(python.empty()) {
+        python = delimit::find_program("python");
+    }
+
+    delimit::SubprocessOptions options;
+    options.argv = {(python.empty()) ? "python3" : python, script.first.encode()};
+    options.keep_input_open = true;
+    options.keep_output = false;
+
+    // Whatever was sent to one which has exited won't be answered
+    pending_.clear();
+
+    process_ = std::make_shared<delimit::Subprocess>(options);
+    process_->signal_line().connect(sigc::mem_fun(this, &LintServer::on_line));
+    process_->signal_finished().connect(sigc::mem_fun(this, &LintServer::on_finished));
+
+    if(!process_->start()) {
+        L_ERROR(_F("Couldn't start the lint server: {0}").format(process_->result().error));
+        failed_starts_ = MAX_FAILED_STARTS;
+        return false;
+    }
+
+    ++failed_starts_; // Until it answers something
+    return true;
+}
+
+void LintServer::on_line(delimit::SubprocessStream stream, const std::string& line) {
+    if(stream == delimit::SUBPROCESS_STDERR) {
+        L_DEBUG(_F("lint_server.py: {0}").format(line));
+        return;
+    }
+
+    LintReply reply;
+    if(!parse_lint_reply(line, reply)) {
+        L_ERROR(_F("Ignoring a reply from the lint server which doesn't make sense: {0}").format(line));
+        return;
+    }
+
+    failed_starts_ = 0;
+
+    auto it = pending_.find(reply.id);
+    if(it == pending_.end()) {
+        return; // Cancelled
+    }
+
+    auto done = it->second;
+    pending_.erase(it);
+
+    if(!reply.error.empty()) {
+        L_ERROR(_F("The lint server couldn't check a file: {0}").format(reply.error));
+    }
+
+    done(reply.errors);
+}
+
+void LintServer::on_finished(const delimit::SubprocessResult& result) {
+    // The next check starts another. The Subprocess can't be destroyed from here, it's
+    // the one emitting this.
+    L_ERROR(_F("The lint server exited ({0}, signal {1})").format(result.exit_status, result.signal));
+}
+
+}
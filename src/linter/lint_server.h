@@ -0,0 +1,63 @@
+#ifndef LINT_SERVER_H
+#define LINT_SERVER_H
+
+#include <map>
+#include <memory>
+#include <string>
+#include <cstdint>
+#include <functional>
+
+#include "linter.h"
+#include "../utils/unicode.h"
+#include "../utils/subprocess.h"
+
+namespace linter {
+
+struct LintReply {
+    uint64_t id = 0;
+    std::string error; // Why the source couldn't be checked, if it couldn't
+    delimit::ErrorList errors; // By line, from 0
+};
+
+/* One line of the protocol spoken with data/lint_server.py, newline included */
+std::string encode_lint_request(uint64_t id, const unicode& filename, const std::string& source);
+
+/* Returns false if the line isn't a reply */
+bool parse_lint_reply(const std::string& line, LintReply& reply);
+
+/*
+ *  A lint_server.py which stays running, so checking some Python is a write to its
+ *  stdin rather than an interpreter starting up. Projects start one the first time
+ *  it's needed, it's stopped with the project.
+ *
+ *  The server is given the text to check, so what's checked is what's in the editor.
+ *  If it exits it's started again by the next check, unless it keeps dying without
+ *  answering anything.
+ */
+class LintServer {
+public:
+    typedef std::shared_ptr<LintServer> ptr;
+    typedef std::function<void (const delimit::ErrorList&)> ErrorsCallback;
+
+    /* done is called once the server has answered. Returns an id to cancel() with, 0 if
+     * the server couldn't be started. */
+    uint64_t check(const unicode& filename, const std::string& source, ErrorsCallback done);
+    void cancel(uint64_t id);
+
+private:
+    delimit::Subprocess::ptr process_;
+
+    uint64_t next_id_ = 1;
+    std::map<uint64_t, ErrorsCallback> pending_;
+
+    int failed_starts_ = 0; // Exits without a single reply, reset by one
+
+    bool ensure_running();
+
+    void on_line(delimit::SubprocessStream stream, const std::string& line);
+    void on_finished(const delimit::SubprocessResult& result);
+};
+
+}
+
+#endif // LINT_SERVER_H
@@ -1,11 +1,16 @@
 #include <iostream>
+#include "../utils/sigc_lambda.h"
 #include "linter.h"
 
+#include "lint_server.h"
 #include "../window.h"
-#include "../utils.h"
+#include "../utils/kazlog.h"
 
 using namespace linter;
 
+// Long enough for a big file, short enough that a hung linter doesn't hang around
+static const int LINT_TIMEOUT_MS = 30000;
+
 void Linter::clear_document(delimit::DocumentView* buffer) {
     auto gbuf = buffer->buffer();
 
@@ -13,10 +18,16 @@ void Linter::clear_document(delimit::DocumentView* buffer) {
 }
 
 void Linter::apply_to_document(delimit::DocumentView *buffer) {
+    // The document owns us, and nothing is called back once we're gone
+    check(buffer, [this, buffer](const delimit::ErrorList& errors) {
+        show_errors(buffer, errors);
+    });
+}
+
+void Linter::show_errors(delimit::DocumentView* buffer, const delimit::ErrorList& result) {
     auto gbuf = buffer->buffer();
     clear_document(buffer);
 
-    auto result = find_problematic_lines(buffer->path(), buffer->window().project_path());
     for(auto line_and_message: result) {
         auto line = line_and_message.first;
         auto message = line_and_message.second;
@@ -45,41 +56,46 @@ void Linter::apply_to_document(delimit::DocumentView *buffer) {
     }
 
     buffer->set_lint_errors(result);
-    buffer->window().update_error_panel(result);
-}
-
-delimit::ErrorList PythonLinter::find_problematic_lines(const unicode& filename, const unicode& project_root) {
-    unicode result = call_command(
-        _u("pyflakes {0}").format(filename)
-    );
 
-    if(result.strip().empty()) {
-        return delimit::ErrorList();
+    // The user may have switched to another document while the check ran
+    if(buffer->window().current_buffer().get() == buffer) {
+        buffer->window().update_error_panel(result);
     }
+}
 
-    delimit::ErrorList ret;
+PythonLinter::PythonLinter(std::shared_ptr<LintServer> server):
+    server_(server) {
 
-    for(auto line: result.split("\n")) {
-        try {
-            auto parts = line.split(":");
-            unicode message = parts[parts.size()-1];
-            int32_t lineno = parts.at(1).to_int() - 1;
-            ret.insert(std::make_pair(lineno, message));
+}
 
-            std::cout << lineno << ": " << message << std::endl;
-        } catch(std::exception& e) {
-            continue;
-        }
-    }
+PythonLinter::~PythonLinter() {
+    server_->cancel(request_);
+}
 
-    return ret;
+void PythonLinter::check(delimit::DocumentView* buffer, ErrorsCallback done) {
+    // Only the latest text matters
+    server_->cancel(request_);
+    request_ = server_->check(buffer->path(), buffer->buffer()->get_text().raw(), done);
 }
 
-delimit::ErrorList JavascriptLinter::find_problematic_lines(const unicode& filename, const unicode& project_root) {
-    unicode result = call_command(
-        _u("jshint {0}").format(filename)
-    );
+void JavascriptLinter::check(delimit::DocumentView* buffer, ErrorsCallback done) {
+    delimit::SubprocessOptions options;
+    options.argv = {"jshint", buffer->path().encode()};
+    options.timeout_ms = LINT_TIMEOUT_MS;
+
+    // Replaces (and kills) a check which is still running
+    process_ = std::make_shared<delimit::Subprocess>(options);
+    process_->signal_finished().connect([this, done](const delimit::SubprocessResult& result) {
+        done(find_problematic_lines(unicode(result.out + result.err)));
+    });
+
+    if(!process_->start()) {
+        L_ERROR(process_->result().error);
+        process_.reset();
+    }
+}
 
+delimit::ErrorList JavascriptLinter::find_problematic_lines(const unicode& result) {
     if(result.strip().empty()) {
         return delimit::ErrorList();
     }
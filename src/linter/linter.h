@@ -4,7 +4,10 @@
 #include <map>
 #include <memory>
 #include <vector>
+#include <cstdint>
+#include <functional>
 #include "../utils/unicode.h"
+#include "../utils/subprocess.h"
 
 namespace delimit {
     class DocumentView;
@@ -14,23 +17,43 @@ namespace delimit {
 
 namespace linter {
 
+class LintServer;
+
+typedef std::function<void (const delimit::ErrorList&)> ErrorsCallback;
+
 class Linter {
 public:
     typedef std::shared_ptr<Linter> ptr;
 
+    virtual ~Linter() {}
+
+    /* Starts checking the document, its marks are updated once the check is done */
     void apply_to_document(delimit::DocumentView* buffer);
     void clear_document(delimit::DocumentView* buffer);
 
+    /* Whether what's checked is the text being edited, rather than the file on disk */
+    virtual bool checks_buffer() const { return false; }
+
 private:
-    virtual delimit::ErrorList find_problematic_lines(const unicode& filename, const unicode& project_root="") = 0;
+    void show_errors(delimit::DocumentView* buffer, const delimit::ErrorList& errors);
+
+    virtual void check(delimit::DocumentView* buffer, ErrorsCallback done) = 0;
 };
 
 class PythonLinter : public Linter {
 public:
     typedef std::shared_ptr<PythonLinter> ptr;
 
+    PythonLinter(std::shared_ptr<LintServer> server);
+    ~PythonLinter();
+
+    bool checks_buffer() const { return true; }
+
 private:
-    delimit::ErrorList find_problematic_lines(const unicode& filename, const unicode& project_root="");
+    std::shared_ptr<LintServer> server_;
+    uint64_t request_ = 0;
+
+    void check(delimit::DocumentView* buffer, ErrorsCallback done);
 };
 
 class JavascriptLinter : public Linter {
@@ -38,7 +61,10 @@ public:
     typedef std::shared_ptr<JavascriptLinter> ptr;
 
 private:
-    delimit::ErrorList find_problematic_lines(const unicode& filename, const unicode& project_root="");
+    delimit::Subprocess::ptr process_;
+
+    void check(delimit::DocumentView* buffer, ErrorsCallback done);
+    delimit::ErrorList find_problematic_lines(const unicode& output);
 };
 
 }
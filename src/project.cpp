@@ -0,0 +1,162 @@
+#include <cstdio>
+
+#include "project.h"
+#include "project_info.h"
+#include "autocomplete/datastore.h"
+#include "autocomplete/parsers/plain.h"
+#include "autocomplete/parsers/python.h"
+#include "linter/lint_server.h"
+
+#include "utils/kfs.h"
+#include "utils/kazlog.h"
+#include "utils/xxhash.h"
+#include "utils/base_directory.h"
+
+namespace delimit {
+
+std::map<unicode, std::weak_ptr<Project>> Project::projects_;
+
+static unicode canonical_root(const unicode& root) {
+    if(root.empty()) {
+        return root;
+    }
+
+    // Symlinks and trailing slashes shouldn't give the same folder two projects
+    auto real = kfs::path::real_path(root.encode());
+    if(real.empty()) {
+        real = root.encode();
+        while(real.length() > 1 && real.back() == '/') {
+            real.pop_back();
+        }
+    }
+    return real;
+}
+
+static unicode datastore_location(const unicode& root) {
+    auto folder = fdo::xdg::make_dir_in_data_home("delimit").encode();
+
+    if(root.empty()) {
+        return kfs::path::join(folder, "completions.db");
+    }
+
+    folder = kfs::path::join(folder, "completions");
+    if(!kfs::path::exists(folder)) {
+        kfs::make_dirs(folder);
+    }
+
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.db", (unsigned long long) xxh64(root.encode()));
+    return kfs::path::join(folder, name);
+}
+
+ProjectPtr Project::attach(const unicode& root) {
+    unicode key = canonical_root(root);
+
+    auto it = projects_.find(key);
+    if(it != projects_.end()) {
+        if(auto existing = it->second.lock()) {
+            L_DEBUG(_F("Attaching to the open project at {0}").format(key));
+            return existing;
+        }
+    }
+
+    // Drop anything left behind by projects which have since been closed
+    for(auto jt = projects_.begin(); jt != projects_.end();) {
+        if(jt->second.expired()) {
+            jt = projects_.erase(jt);
+        } else {
+            ++jt;
+        }
+    }
+
+    ProjectPtr project(new Project(key));
+    projects_[key] = project;
+    return project;
+}
+
+Project::Project(const unicode& root):
+    root_(root),
+    info_(new ProjectInfo()) {
+
+    indexer_ = std::make_shared<Indexer>(datastore_location(root_));
+    indexer_->register_parser("text/plain", std::make_shared<parser::Plain>());
+    indexer_->register_parser("application/python", std::make_shared<parser::Python>());
+
+    if(has_root()) {
+        ignore_tree_ = std::make_shared<IgnoreTree>(root_.encode());
+    }
+
+    background_indexer_ = std::make_shared<BackgroundIndexer>(indexer_, root_, ignore_tree_);
+
+    if(!has_root()) {
+        return;
+    }
+
+    L_DEBUG(_F("Opening project at {0}").format(root_));
+
+    info_->recursive_populate(root_, ignore_tree_);
+    background_indexer_->rescan();
+
+    watcher_ = std::make_shared<ProjectWatcher>(root_.encode(), ignore_tree_);
+    watcher_->signal_changed().connect(sigc::mem_fun(*info_, &ProjectInfo::apply_delta));
+    watcher_->signal_changed().connect(sigc::mem_fun(*background_indexer_, &BackgroundIndexer::apply_delta));
+    watcher_->signal_changed().connect(signal_changed_.make_slot());
+    watcher_->start();
+}
+
+WordIndexPtr Project::word_index() const {
+    return indexer_->datastore()->word_index();
+}
+
+std::shared_ptr<linter::LintServer> Project::lint_server() {
+    if(!lint_server_) {
+        lint_server_ = std::make_shared<linter::LintServer>();
+    }
+    return lint_server_;
+}
+
+void Project::index_file(const unicode& path) {
+    background_indexer_->update({path.encode()});
+}
+
+void Project::open_buffer(const unicode& path, const parser::PythonBuffer* buffer, const parser::BufferChange& change) {
+    auto it = open_buffers_.find(path);
+    if(it != open_buffers_.end() && it->second != buffer) {
+        return; // Another window is already editing it
+    }
+
+    open_buffers_[path] = buffer;
+
+    // The change from set_text only adds, so it has every scope
+    indexer_->datastore()->open_buffer(parser::Python().name(), change.scopes.added, path);
+    info_->open_buffer(path, change.scopes.added);
+}
+
+void Project::apply_edit(const unicode& path, const parser::PythonBuffer* buffer, const parser::BufferChange& change) {
+    auto it = open_buffers_.find(path);
+    if(it == open_buffers_.end() || it->second != buffer) {
+        return;
+    }
+
+    if(!change.scopes.empty()) {
+        indexer_->datastore()->apply_scope_delta(parser::Python().name(), change.scopes, path);
+        info_->update_symbols(path, change.scopes);
+    }
+}
+
+void Project::close_buffer(const unicode& path, const parser::PythonBuffer* buffer) {
+    auto it = open_buffers_.find(path);
+    if(it == open_buffers_.end() || it->second != buffer) {
+        return;
+    }
+
+    open_buffers_.erase(it);
+
+    indexer_->datastore()->close_buffer(path);
+    info_->close_buffer(path);
+
+    // The buffer may not have been saved
+    index_file(path);
+}
+
+}
@@ -0,0 +1,97 @@
+#ifndef PROJECT_H
+#define PROJECT_H
+
+#include <map>
+#include <memory>
+
+#include "utils/unicode.h"
+#include "utils/gitignore.h"
+#include "utils/project_watcher.h"
+#include "autocomplete/indexer.h"
+#include "autocomplete/background_indexer.h"
+#include "autocomplete/completion_index.h"
+
+namespace linter {
+    class LintServer;
+}
+
+namespace delimit {
+
+namespace parser {
+    class PythonBuffer;
+    struct BufferChange;
+}
+
+class ProjectInfo;
+class Project;
+
+typedef std::shared_ptr<Project> ProjectPtr;
+
+/*
+ *  Everything we know about one project: the crawled file list and symbols, the
+ *  completion index and the watcher which keeps them current. Windows attach to a
+ *  project rather than building their own, so a folder which is open twice is only
+ *  crawled, indexed and watched once. The project goes away when the last window
+ *  on it is closed.
+ *
+ *  Projects are looked up by the canonical path of their root. Windows which
+ *  aren't showing a folder share a single project with no root, which has no file
+ *  list and only indexes the files which are opened or saved in it.
+ *
+ *  Only used from the main thread.
+ */
+class Project {
+public:
+    static ProjectPtr attach(const unicode& root=unicode());
+
+    const unicode& root() const { return root_; }
+    bool has_root() const { return !root_.empty(); }
+
+    IgnoreTreePtr ignore_tree() const { return ignore_tree_; }
+    std::shared_ptr<ProjectInfo> info() const { return info_; }
+    IndexerPtr indexer() const { return indexer_; }
+    WordIndexPtr word_index() const;
+
+    /* Queues a file to be (re)indexed, or removed from the index if it's gone */
+    void index_file(const unicode& path);
+
+    /*
+     *  While a Python file is being edited its scopes and symbols follow the buffer,
+     *  so completions see unsaved changes. open_buffer takes them from the change
+     *  set_text gave, every later change is then applied as it's made. Only the first
+     *  buffer opened on a path is followed, closing it goes back to what's on disk.
+     */
+    void open_buffer(const unicode& path, const parser::PythonBuffer* buffer, const parser::BufferChange& change);
+    void apply_edit(const unicode& path, const parser::PythonBuffer* buffer, const parser::BufferChange& change);
+    void close_buffer(const unicode& path, const parser::PythonBuffer* buffer);
+
+    /* Checks Python for the project's documents, started the first time it's asked for */
+    std::shared_ptr<linter::LintServer> lint_server();
+
+    /* Fired with every change the watcher sees, after the project has applied it */
+    sigc::signal<void, const WatchDelta&>& signal_changed() { return signal_changed_; }
+
+private:
+    Project(const unicode& root);
+
+    static std::map<unicode, std::weak_ptr<Project>> projects_;
+
+    unicode root_;
+    IgnoreTreePtr ignore_tree_;
+    std::shared_ptr<ProjectInfo> info_;
+    IndexerPtr indexer_;
+
+    // The watcher feeds the background indexer, so it must be destroyed first
+    BackgroundIndexerPtr background_indexer_;
+    std::shared_ptr<ProjectWatcher> watcher_;
+
+    sigc::signal<void, const WatchDelta&> signal_changed_;
+
+    std::map<unicode, const parser::PythonBuffer*> open_buffers_;
+
+    std::shared_ptr<linter::LintServer> lint_server_;
+};
+
+}
+
+#endif // PROJECT_H
@@ -1,17 +1,57 @@
 #include <thread>
 #include <iostream>
 #include <queue>
+#include <functional>
+#include <unordered_map>
 
 #include "project_info.h"
 #include "utils.h"
 #include "utils/bfs.h"
+#include "utils/git_index.h"
+#include "utils/crawl_snapshot.h"
+#include "utils/content_type.h"
 #include "utils/sigc_lambda.h"
 #include "utils/kazlog.h"
 #include "autocomplete/parsers/python.h"
-#include "autocomplete/parsers/plain.h"
+#include "symbols/extractors.h"
 
 namespace delimit {
 
+static SymbolArray python_symbols(const unicode& filename, const std::vector<ScopePtr>& scopes) {
+    /*
+     *  The same scopes the indexer gets from the parser, so classes, functions and
+     *  variables are found the same way for both. Arguments aren't symbols.
+     */
+    SymbolArray result;
+
+    for(auto& scope: scopes) {
+        Symbol new_symbol;
+
+        if(scope->kind == Scope::KIND_CLASS) {
+            new_symbol.type = SymbolType::CLASS;
+        } else if(scope->kind == Scope::KIND_FUNCTION) {
+            auto inherited = scope->inherited_paths();
+            bool method = !inherited.empty() && inherited[0] == "instancemethod";
+            new_symbol.type = (method) ? SymbolType::METHOD : SymbolType::FUNCTION;
+        } else if(scope->kind == Scope::KIND_VARIABLE) {
+            new_symbol.type = SymbolType::VARIABLE;
+        } else {
+            continue;
+        }
+
+        unicode path = scope->path();
+        auto dot = path.rfind(".");
+
+        new_symbol.filename = filename;
+        new_symbol.name = (dot == std::string::npos) ? path : path.slice(dot + 1, nullptr);
+        new_symbol.line_number = scope->start_line - 1;
+
+        result.push_back(new_symbol);
+    }
+
+    return result;
+}
+
 SymbolArray ProjectInfo::find_symbols(const unicode& filename, Glib::RefPtr<Gsv::Language>& lang, Glib::RefPtr<Gio::FileInputStream>& stream) {
     char buffer[1024 * 1024];
     gsize read = 0;
@@ -25,67 +65,15 @@ SymbolArray ProjectInfo::find_symbols(const unicode& filename, Glib::RefPtr<Gsv:
 
     SymbolArray result;
 
-    if(lang && lang->get_name() == "Python") {
-        parser::Python parser;
-        auto tokens = parser.tokenize(data);
-
-        bool next_token_is_class = false;
-        bool next_token_is_function = false;
-
-        int line_number = 0;
-
-        parser::Token last_name_token;
-
-        //FIXME: Handle methods and function arguments
-        for(auto tok: tokens) {
-            if(tok.type == parser::TokenType::NL) {
-                line_number++;
-            }
-
-            if(next_token_is_class && tok.type == parser::TokenType::NAME) {
-                next_token_is_class = false;
+    std::string language = lang ? lang->get_id() : "";
 
-                Symbol new_symbol;
-                new_symbol.filename = filename;
-                new_symbol.name = tok.str;
-                new_symbol.line_number = line_number;
-                new_symbol.type = SymbolType::CLASS;
-
-                result.push_back(new_symbol);
-            } else if(next_token_is_function && tok.type == parser::TokenType::NAME) {
-                next_token_is_function = false;
-
-                Symbol new_symbol;
-                new_symbol.filename = filename;
-                new_symbol.name = tok.str;
-                new_symbol.line_number = line_number;
-                new_symbol.type = SymbolType::FUNCTION;
-
-                result.push_back(new_symbol);
-            }
-
-            if(tok.str == "class" && tok.type == parser::TokenType::NAME) {
-                next_token_is_class = true;
-            } else if(tok.str == "def" && tok.type == parser::TokenType::NAME) {
-                next_token_is_function = true;
-            } else if(tok.str == "=" && tok.type == parser::TokenType::OP) {
-                Symbol new_symbol;
-                new_symbol.filename = filename;
-                new_symbol.name = last_name_token.str;
-                new_symbol.line_number = line_number;
-                new_symbol.type = SymbolType::VARIABLE;
-
-                result.push_back(new_symbol);
-            }
-
-            if(tok.type == parser::TokenType::NAME) {
-                last_name_token = tok;
-            }
-        }
-
-    } else {
-        parser::Plain parser;
-        auto tokens = parser.tokenize(data);
+    if(language == "python") {
+        parser::Python parser;
+        result = python_symbols(filename, parser.parse(data, unicode()).first);
+    } else if(language == "js") {
+        result = javascript_symbols(filename, data);
+    } else if(language == "c" || language == "cpp" || language == "chdr" || language == "cpphdr") {
+        result = c_symbols(filename, data);
     }
 
     return result;
@@ -100,18 +88,15 @@ void ProjectInfo::offline_update(const unicode& filename) {
     auto lang = guess_language_from_file(file);
     auto stream = file->read();
 
-    remove(filename);
-
     // Lock the members for update
     std::lock_guard<std::mutex> lock(mutex_);
-    {        
-        try {
-            SymbolArray symbols = find_symbols(filename, lang, stream);
-            //filenames_.insert(filename);
-            symbols_by_filename_[filename] = symbols;
+    {
+        if(open_buffers_.count(filename)) {
+            return; // The buffer knows better than the disk
+        }
 
-            // Insert all the found symbols
-            symbols_.insert(symbols_.end(), symbols.begin(), symbols.end());
+        try {
+            set_file_symbols(filename, find_symbols(filename, lang, stream));
         } catch (std::exception& e) {
             L_ERROR(_F("An error occurred while indexing: {0}").format(filename));
             return;
@@ -119,6 +104,67 @@ void ProjectInfo::offline_update(const unicode& filename) {
     }
 }
 
+void ProjectInfo::set_file_symbols(const unicode& filename, const SymbolArray& symbols) {
+    symbols_.erase(std::remove_if(symbols_.begin(), symbols_.end(), [&filename](const Symbol& symbol) {
+        return symbol.filename == filename;
+    }), symbols_.end());
+
+    symbols_.insert(symbols_.end(), symbols.begin(), symbols.end());
+    symbols_by_filename_[filename] = symbols;
+}
+
+void ProjectInfo::open_buffer(const unicode& filename, const std::vector<ScopePtr>& scopes) {
+    SymbolArray symbols = python_symbols(filename, scopes);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    open_buffers_.insert(filename);
+    set_file_symbols(filename, symbols);
+}
+
+void ProjectInfo::update_symbols(const unicode& filename, const ScopeDelta& delta) {
+    SymbolArray removed = python_symbols(filename, delta.removed);
+    SymbolArray added = python_symbols(filename, delta.added);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if(!open_buffers_.count(filename)) {
+        return;
+    }
+
+    SymbolArray symbols = symbols_by_filename_[filename];
+
+    // Each removed scope takes away one symbol like it
+    for(auto& old: removed) {
+        auto it = std::find_if(symbols.begin(), symbols.end(), [&old](const Symbol& symbol) {
+            return symbol.line_number == old.line_number && symbol.type == old.type && symbol.name == old.name;
+        });
+
+        if(it != symbols.end()) {
+            symbols.erase(it);
+        }
+    }
+
+    // Symbol lines count from zero
+    for(auto& symbol: symbols) {
+        if(symbol.line_number + 1 >= delta.from_line) {
+            symbol.line_number += delta.line_shift;
+        }
+    }
+
+    symbols.insert(symbols.end(), added.begin(), added.end());
+    set_file_symbols(filename, symbols);
+}
+
+void ProjectInfo::close_buffer(const unicode& filename) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        open_buffers_.erase(filename);
+    }
+
+    // Whatever is on disk, if anything
+    remove(filename);
+    add_or_update(filename);
+}
+
 std::vector<unicode> ProjectInfo::file_paths() const {
     return std::vector<unicode>(filenames_.begin(), filenames_.end());
 }
@@ -159,8 +205,8 @@ void ProjectInfo::remove(const unicode& filename) {
 }
 
 std::vector<unicode> ProjectInfo::filenames_including(const std::vector<char32_t>& characters) {
-    std::unordered_set<unicode*> results;
-    std::unordered_set<unicode*> new_results;
+    std::unordered_set<const unicode*> results;
+    std::unordered_set<const unicode*> new_results;
 
     std::unordered_set<char32_t> distinct_chars(characters.begin(), characters.end());
 
@@ -197,29 +243,252 @@ std::vector<unicode> ProjectInfo::filenames_including(const std::vector<char32_t
 void ProjectInfo::update_files(const std::vector<unicode> &new_files) {
     std::lock_guard<std::mutex> lock(mutex_);
 
-    filenames_.assign(new_files.begin(), new_files.end());
+    filenames_.clear();
     filenames_including_character_.clear();
 
-    for(auto& file: filenames_) {
-        unicode lower_file = file.lower();
-        std::unordered_set<char32_t> distinct(lower_file.begin(), lower_file.end());
-        for(char32_t c: distinct) {
-            filenames_including_character_[c].insert(&file);
+    filenames_.reserve(new_files.size());
+    for(auto& file: new_files) {
+        add_file(file);
+    }
+}
+
+void ProjectInfo::add_file(const unicode& filename) {
+    // mutex_ must be held
+
+    auto result = filenames_.insert(filename);
+    if(!result.second) {
+        return;
+    }
+
+    const unicode* file = &(*result.first);
+    unicode lower_file = file->lower();
+    std::unordered_set<char32_t> distinct(lower_file.begin(), lower_file.end());
+    for(char32_t c: distinct) {
+        filenames_including_character_[c].insert(file);
+    }
+}
+
+void ProjectInfo::remove_file(const unicode& filename) {
+    // mutex_ must be held
+
+    auto it = filenames_.find(filename);
+    if(it == filenames_.end()) {
+        return;
+    }
+
+    const unicode* file = &(*it);
+    unicode lower_file = file->lower();
+    std::unordered_set<char32_t> distinct(lower_file.begin(), lower_file.end());
+    for(char32_t c: distinct) {
+        filenames_including_character_[c].erase(file);
+    }
+
+    filenames_.erase(it);
+}
+
+void ProjectInfo::apply_delta(const WatchDelta& delta) {
+    if(delta.overflowed) {
+        // We've no idea what we missed, start again
+        if(!root_dir_.empty()) {
+            recursive_populate(root_dir_, ignore_tree_);
+        }
+        return;
+    }
+
+    std::vector<unicode> removed;
+    std::vector<unicode> stale_symbols;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        for(auto& directory: delta.deleted_directories) {
+            unicode prefix = directory + "/";
+            for(auto& file: filenames_) {
+                if(file.starts_with(prefix)) {
+                    removed.push_back(file);
+                }
+            }
+        }
+
+        removed.insert(removed.end(), delta.deleted.begin(), delta.deleted.end());
+
+        for(auto& file: removed) {
+            remove_file(file);
+        }
+
+        for(auto& file: delta.created) {
+            if(ContentClassifier::instance().is_text(file)) {
+                add_file(file);
+            }
+        }
+
+        // Only reparse files we were already holding symbols for
+        for(auto& file: delta.modified) {
+            if(symbols_by_filename_.count(file)) {
+                stale_symbols.push_back(file);
+            }
         }
     }
+
+    for(auto& file: removed) {
+        remove(file);
+    }
+
+    for(auto& file: stale_symbols) {
+        add_or_update(file);
+    }
+
+    for(auto& directory: delta.rescan_directories) {
+        repopulate_directory(directory);
+    }
 }
 
-void ProjectInfo::recursive_populate(const unicode& directory)  {
-    auto all_files = std::make_shared<BFS>(directory);
+void ProjectInfo::repopulate_directory(const unicode& directory) {
+    /*
+     *  Recrawls part of the project in the background, then swaps the files below it
+     *  for whatever was found
+     */
+    auto crawler = std::make_shared<BFS>(directory, ignore_tree_);
+
+    struct Wrapper {
+        std::future<std::vector<unicode>> wrapped;
+    };
+
+    auto wrapper = std::make_shared<Wrapper>();
+    wrapper->wrapped = std::async(std::launch::async, std::bind(&BFS::run, crawler));
+
+    Glib::signal_idle().connect([=]() -> bool {
+        if(wrapper->wrapped.wait_for(std::chrono::milliseconds(1)) != std::future_status::ready) {
+            return true;
+        }
+
+        auto result = wrapper->wrapped.get();
+
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        unicode prefix = directory + "/";
+        std::vector<unicode> old_files;
+        for(auto& file: filenames_) {
+            if(file.starts_with(prefix)) {
+                old_files.push_back(file);
+            }
+        }
+
+        for(auto& file: old_files) {
+            remove_file(file);
+        }
+
+        for(auto& file: result) {
+            add_file(file);
+        }
+
+        return false;
+    });
+}
+
+std::vector<unicode> ProjectInfo::tracked_files(const unicode& directory, IgnoreTreePtr ignore_tree) {
+    /*
+     *  If this is a git checkout, the index already knows (almost) every file in the project, so we
+     *  can list them without touching the disk. Only the name is used to throw out binaries here,
+     *  anything else will be corrected when the crawl finishes.
+     */
+    std::vector<unicode> result;
+
+    GitIndex index(directory.encode());
+    if(!index.load()) {
+        return result;
+    }
+
+    /*
+     *  A crawl never goes into an ignored directory, so a file inside one is ignored
+     *  whatever its own name matches. Most files share their directories, so each
+     *  directory is only tested once.
+     */
+    std::unordered_map<std::string, bool> ignored_directories;
+    std::function<bool (const std::string&)> directory_ignored = [&](const std::string& path) -> bool {
+        if(path.length() <= ignore_tree->root().length()) {
+            return false;
+        }
+
+        auto it = ignored_directories.find(path);
+        if(it != ignored_directories.end()) {
+            return it->second;
+        }
+
+        bool ignored = directory_ignored(path.substr(0, path.rfind('/'))) || ignore_tree->is_ignored(path, true);
+        ignored_directories[path] = ignored;
+        return ignored;
+    };
+
+    for(auto& path: index.tracked_files()) {
+        if(ignore_tree && (directory_ignored(path.substr(0, path.rfind('/'))) || ignore_tree->is_ignored(path, false))) {
+            continue;
+        }
+
+        if(classify_by_name(path) == CONTENT_CLASS_BINARY) {
+            continue;
+        }
+
+        result.push_back(path);
+    }
+
+    L_DEBUG(_F("Seeded {0} files from the git index").format(result.size()));
+    return result;
+}
+
+void ProjectInfo::recursive_populate(const unicode& directory, IgnoreTreePtr ignore_tree)  {
+    if(!ignore_tree) {
+        ignore_tree = std::make_shared<IgnoreTree>(directory.encode());
+    }
+
+    root_dir_ = directory;
+    ignore_tree_ = ignore_tree;
+
+    /*
+     *  Show something straight away: ideally what we found the last time the project was
+     *  open, otherwise whatever git is tracking. The crawl then only has to list the
+     *  directories which have changed since the snapshot was taken.
+     */
+    std::string snapshot_file;
+    try {
+        snapshot_file = CrawlSnapshot::default_location(directory.encode());
+    } catch(kfs::IOError& e) {
+        L_WARN(_F("Unable to create the snapshot directory: {0}").format(e.what()));
+    }
+
+    auto previous = std::make_shared<CrawlSnapshot>(directory.encode());
+    auto seeded = std::make_shared<std::vector<unicode>>();
+
+    if(!snapshot_file.empty() && previous->load(snapshot_file)) {
+        auto files = previous->files();
+        seeded->assign(files.begin(), files.end());
+        L_DEBUG(_F("Loaded {0} files from the crawl snapshot").format(seeded->size()));
+    } else {
+        previous.reset();
+        *seeded = tracked_files(directory, ignore_tree);
+    }
+
+    if(!seeded->empty()) {
+        update_files(*seeded);
+    }
+
+    auto all_files = std::make_shared<BFS>(directory, ignore_tree, previous);
 
     /*
      *  When each level of the tree has been processed, update the files list in the idle
      *  of the main thread. This way, we can keep scanning in the background without blocking
-     *  the main thread.
+     *  the main thread. Until the crawl is complete, the seeded files are kept so that the list
+     *  doesn't shrink while the rest are found.
      */
     all_files->signal_level_complete().connect([=](const std::vector<unicode>& result, int level) {        
         if((level % 5) == 0) { //Perform an update every 5 levels
-            update_files(result);
+            if(seeded->empty()) {
+                update_files(result);
+            } else {
+                std::unordered_set<unicode> merged(seeded->begin(), seeded->end());
+                merged.insert(result.begin(), result.end());
+                update_files(std::vector<unicode>(merged.begin(), merged.end()));
+            }
         }
     });
 
@@ -228,7 +497,15 @@ void ProjectInfo::recursive_populate(const unicode& directory)  {
     };
 
     auto wrapper = std::make_shared<Wrapper>();
-    wrapper->wrapped = std::async(std::launch::async, std::bind(&BFS::run, all_files));
+    wrapper->wrapped = std::async(std::launch::async, [=]() -> std::vector<unicode> {
+        auto result = all_files->run();
+
+        if(!snapshot_file.empty() && !all_files->snapshot()->save(snapshot_file)) {
+            L_WARN(_F("Unable to save the crawl snapshot to {0}").format(snapshot_file));
+        }
+
+        return result;
+    });
 
     Glib::signal_idle().connect([=]() -> bool {
         if(wrapper->wrapped.wait_for(std::chrono::milliseconds(1)) == std::future_status::ready) {
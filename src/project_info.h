@@ -8,46 +8,13 @@
 #include <future>
 
 #include "utils/unicode.h"
+#include "utils/gitignore.h"
+#include "utils/project_watcher.h"
+#include "symbols/symbol.h"
+#include "autocomplete/base.h"
 
 namespace delimit {
 
-enum SymbolType {
-    NAMESPACE = 0,
-    CLASS,
-    METHOD,
-    FUNCTION,
-    VARIABLE,
-    UNKNOWN
-};
-
-struct Symbol {
-    unicode name;
-    SymbolType type;
-    unicode filename;
-    int line_number;
-
-    bool operator==(const Symbol& rhs) const {
-        return name == rhs.name && filename == rhs.filename && type == rhs.type && line_number == rhs.line_number;
-    }
-
-    const Symbol& operator=(const Symbol& rhs) {
-        if(&rhs == this) return *this;
-
-        name = rhs.name;
-        type = rhs.type;
-        filename = rhs.filename;
-        line_number = rhs.line_number;
-
-        return *this;
-    }
-
-    bool operator<(const Symbol& rhs) const {
-        return name < rhs.name;
-    }
-};
-
-typedef std::vector<Symbol> SymbolArray;
-
 class ProjectInfo {
 public:
     std::vector<unicode> file_paths() const;
@@ -56,21 +23,44 @@ public:
     void add_or_update(const unicode& filename, bool offline=true);
     void remove(const unicode& filename);
 
-    void recursive_populate(const unicode& root_dir);
+    void recursive_populate(const unicode& root_dir, IgnoreTreePtr ignore_tree=IgnoreTreePtr());
+
+    /* Brings the file list (and any symbols we have) up to date with changes on disk */
+    void apply_delta(const WatchDelta& delta);
 
     std::vector<unicode> filenames_including(const std::vector<char32_t>& characters);
 
+    /*
+     *  While a Python file is open in the editor its symbols follow the buffer rather
+     *  than the disk. They come from the buffer's scopes, update_symbols applies the
+     *  change an edit made to them.
+     */
+    void open_buffer(const unicode& filename, const std::vector<ScopePtr>& scopes);
+    void update_symbols(const unicode& filename, const ScopeDelta& delta);
+    void close_buffer(const unicode& filename);
+
 private:
     void update_files(const std::vector<unicode>& new_files);
+    void add_file(const unicode& filename);
+    void remove_file(const unicode& filename);
+    void repopulate_directory(const unicode& directory);
+    std::vector<unicode> tracked_files(const unicode& directory, IgnoreTreePtr ignore_tree);
 
     std::mutex mutex_;
 
     std::unordered_map<unicode, SymbolArray> symbols_by_filename_;
 
-    std::vector<unicode> filenames_;
-    std::unordered_map<char32_t, std::unordered_set<unicode*> > filenames_including_character_;
+    unicode root_dir_;
+    IgnoreTreePtr ignore_tree_;
+
+    // A node based container, so filenames_including_character_ can point into it
+    std::unordered_set<unicode> filenames_;
+    std::unordered_map<char32_t, std::unordered_set<const unicode*> > filenames_including_character_;
 
     SymbolArray symbols_;
+    std::unordered_set<unicode> open_buffers_;
+
+    void set_file_symbols(const unicode& filename, const SymbolArray& symbols);
 
     void clear_old_futures();
     void offline_update(const unicode& filename);
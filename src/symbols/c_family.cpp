@@ -0,0 +1,267 @@
+#include <vector>
+
+#include "extractors.h"
+#include "lexer.h"
+
+namespace delimit {
+
+namespace {
+
+enum CKeyword {
+    C_NOT_KEYWORD,
+    C_NAMESPACE,
+    C_CLASS, // Or a struct or union
+    C_ENUM,
+    C_EXTERN,
+    C_TEMPLATE,
+    C_OPERATOR,
+    C_FINAL,
+    C_TYPE, // Built in, so never the name of a function, as in std::function<void ()>
+    C_STATEMENT // Can be followed by brackets, but doesn't declare anything
+};
+
+constexpr lexer::Keyword C_KEYWORDS[] = {
+    {"namespace", C_NAMESPACE}, {"class", C_CLASS}, {"struct", C_CLASS}, {"union", C_CLASS},
+    {"enum", C_ENUM}, {"extern", C_EXTERN}, {"template", C_TEMPLATE}, {"operator", C_OPERATOR},
+    {"final", C_FINAL},
+    {"void", C_TYPE}, {"bool", C_TYPE}, {"char", C_TYPE}, {"short", C_TYPE}, {"int", C_TYPE}, {"long", C_TYPE},
+    {"float", C_TYPE}, {"double", C_TYPE}, {"signed", C_TYPE}, {"unsigned", C_TYPE}, {"auto", C_TYPE},
+    {"if", C_STATEMENT}, {"for", C_STATEMENT}, {"while", C_STATEMENT}, {"switch", C_STATEMENT},
+    {"return", C_STATEMENT}, {"catch", C_STATEMENT}, {"throw", C_STATEMENT}, {"noexcept", C_STATEMENT},
+    {"sizeof", C_STATEMENT}, {"alignof", C_STATEMENT}, {"alignas", C_STATEMENT}, {"decltype", C_STATEMENT},
+    {"typeid", C_STATEMENT}, {"static_assert", C_STATEMENT}, {"new", C_STATEMENT}, {"delete", C_STATEMENT},
+    {"__attribute__", C_STATEMENT}, {"__declspec", C_STATEMENT}
+};
+
+constexpr lexer::KeywordSet C_KEYWORD_SET(C_KEYWORDS);
+
+constexpr lexer::Language C_FAMILY = {
+    lexer::make_char_table("", "\"'"), true, false, ""
+};
+
+enum ScopeKind {
+    SCOPE_NAMESPACE, // Including the file itself and extern "C" blocks
+    SCOPE_CLASS,
+    SCOPE_BLOCK // Function bodies, enums and initializers, which are skipped
+};
+
+int keyword_of(const lexer::Token& token) {
+    return (token.kind == lexer::TOKEN_IDENTIFIER) ? C_KEYWORD_SET.find(token) : C_NOT_KEYWORD;
+}
+
+}
+
+SymbolArray c_symbols(const unicode& filename, const std::string& data) {
+    /*
+     *  Follows which braces are namespaces, classes or anything else. Only namespaces
+     *  and class bodies are looked inside. A name followed by brackets is a function
+     *  if a body follows them, and a method if it's in a class (bodies or not) or is
+     *  qualified with ::.
+     */
+    SymbolArray result;
+
+    auto add = [&](const std::string& name, int line, SymbolType type) {
+        Symbol symbol;
+        symbol.filename = filename;
+        symbol.name = unicode(name, "utf-8");
+        symbol.line_number = line;
+        symbol.type = type;
+        result.push_back(symbol);
+    };
+
+    lexer::Lexer lexer(data, C_FAMILY);
+    lexer::Token token, previous, before_previous, earlier;
+
+    std::vector<ScopeKind> scopes;
+
+    // A namespace, class or enum, which opens next_scope at the next brace
+    SymbolType declared = UNKNOWN;
+    ScopeKind next_scope = SCOPE_BLOCK;
+    lexer::Token declared_name;
+    bool naming = false; // The name is the last identifier before a brace or a colon
+
+    // A possible function, its name and where things are up to with its brackets
+    std::string function;
+    int function_line = 0;
+    bool qualified = false;
+    bool in_parameters = false;
+    bool after_parameters = false;
+    bool in_initializers = false; // A constructor's, after its parameters
+
+    int paren_depth = 0;
+    bool assignment = false;
+    bool template_next = false;
+
+    auto reset_function = [&]() {
+        function.clear();
+        in_parameters = after_parameters = in_initializers = false;
+    };
+
+    auto reset = [&]() {
+        reset_function();
+        declared = UNKNOWN;
+        next_scope = SCOPE_BLOCK;
+        declared_name = lexer::Token();
+        naming = assignment = template_next = false;
+    };
+
+    auto skip_balanced = [&](char open, char close) {
+        int depth = 1;
+        while(depth && lexer.next(token)) {
+            depth += token.is(open) - token.is(close);
+        }
+    };
+
+    while(lexer.next(token)) {
+        if(token.kind == lexer::TOKEN_DIRECTIVE) {
+            if(token.hash == lexer::hash("define") && lexer.next(token) && token.kind == lexer::TOKEN_IDENTIFIER) {
+                // Function-like macros have their bracket straight after the name
+                add(token.str(), token.line, (*token.end == '(') ? FUNCTION : VARIABLE);
+            }
+            lexer.skip_line();
+            continue;
+        }
+
+        ScopeKind scope = scopes.empty() ? SCOPE_NAMESPACE : scopes.back();
+
+        if(scope == SCOPE_BLOCK) {
+            if(token.is('{')) {
+                scopes.push_back(SCOPE_BLOCK);
+            } else if(token.is('}')) {
+                scopes.pop_back();
+            }
+        } else if(paren_depth) {
+            // Nothing in brackets declares anything, parameters included
+            if(token.is('(')) {
+                ++paren_depth;
+            } else if(token.is(')') && !--paren_depth && in_parameters) {
+                in_parameters = false;
+                after_parameters = true;
+            }
+        } else if((template_next || naming) && token.is('<')) {
+            // Template parameters, or the arguments of a specialization
+            skip_balanced('<', '>');
+            template_next = false;
+        } else if(token.kind == lexer::TOKEN_IDENTIFIER) {
+            int keyword = C_KEYWORD_SET.find(token);
+
+            if(after_parameters && !in_initializers && (keyword == C_NAMESPACE || keyword == C_CLASS || keyword == C_ENUM || keyword == C_TEMPLATE)) {
+                // What looked like a function was a macro
+                reset_function();
+            }
+
+            if(keyword == C_NAMESPACE) {
+                declared = NAMESPACE;
+                next_scope = SCOPE_NAMESPACE;
+                naming = true;
+            } else if(keyword == C_CLASS && !after_parameters && !assignment) {
+                declared = CLASS;
+                naming = true;
+                if(keyword_of(previous) != C_ENUM) { // enum class is an enum
+                    next_scope = SCOPE_CLASS;
+                }
+            } else if(keyword == C_ENUM && !after_parameters && !assignment) {
+                declared = CLASS;
+                next_scope = SCOPE_BLOCK;
+                naming = true;
+            } else if(keyword == C_TEMPLATE) {
+                template_next = true;
+            } else if(keyword == C_OPERATOR && !after_parameters && !assignment) {
+                // The name runs up to the parameters, and operator() has brackets of its own
+                function = "operator";
+                function_line = token.line;
+                qualified = previous.is(':');
+
+                while(lexer.next(token) && !token.is('(')) {
+                    function += (token.kind == lexer::TOKEN_IDENTIFIER) ? " " + token.str() : token.str();
+                }
+
+                if(function == "operator" && lexer.next(token) && token.is(')')) {
+                    function += "()";
+                    lexer.next(token);
+                }
+
+                if(token.is('(')) {
+                    in_parameters = true;
+                    paren_depth = 1;
+                } else {
+                    reset_function();
+                }
+            } else if(naming && !keyword) {
+                declared_name = token;
+            }
+        } else if(token.kind == lexer::TOKEN_STRING) {
+            if(keyword_of(previous) == C_EXTERN) {
+                next_scope = SCOPE_NAMESPACE; // extern "C" {
+            }
+        } else if(token.is('(')) {
+            paren_depth = 1;
+
+            bool named = previous.kind == lexer::TOKEN_IDENTIFIER && !keyword_of(previous);
+            if(named && !assignment && !in_initializers) {
+                naming = false;
+                declared = UNKNOWN; // struct stat stat(...) is a function
+                next_scope = SCOPE_BLOCK;
+
+                function = before_previous.is('~') ? "~" + previous.str() : previous.str();
+                function_line = previous.line;
+                qualified = (before_previous.is('~') ? earlier : before_previous).is(':');
+                in_parameters = true;
+                after_parameters = false;
+            }
+        } else if(token.is(':')) {
+            bool scope_operator = *token.end == ':' || (previous.is(':') && previous.end == token.begin);
+
+            if(!scope_operator) {
+                if(naming) {
+                    naming = false; // Base classes or an enum's type follow
+                } else if(after_parameters) {
+                    in_initializers = true;
+                }
+            }
+        } else if(token.is('=')) {
+            if(naming) {
+                reset(); // namespace a = b; or struct s s = {...};
+            }
+            if(!after_parameters) {
+                assignment = true;
+            }
+        } else if(token.is(',')) {
+            if(after_parameters && !in_initializers) {
+                reset_function();
+            }
+        } else if(token.is(';')) {
+            if(after_parameters && scope == SCOPE_CLASS) {
+                add(function, function_line, METHOD);
+            }
+            reset();
+        } else if(token.is('{')) {
+            if(in_initializers && (previous.kind == lexer::TOKEN_IDENTIFIER || previous.is('>'))) {
+                skip_balanced('{', '}'); // A member initialized with braces
+            } else if(after_parameters) {
+                add(function, function_line, (qualified || scope == SCOPE_CLASS) ? METHOD : FUNCTION);
+                scopes.push_back(SCOPE_BLOCK);
+                reset();
+            } else {
+                if(declared != UNKNOWN && declared_name.kind == lexer::TOKEN_IDENTIFIER) {
+                    add(declared_name.str(), declared_name.line, declared);
+                }
+                scopes.push_back(next_scope);
+                reset();
+            }
+        } else if(token.is('}')) {
+            if(!scopes.empty()) {
+                scopes.pop_back();
+            }
+            reset();
+        }
+
+        earlier = before_previous;
+        before_previous = previous;
+        previous = token;
+    }
+
+    return result;
+}
+
+}
@@ -0,0 +1,26 @@
+#ifndef SYMBOLS_EXTRACTORS_H
+#define SYMBOLS_EXTRACTORS_H
+
+#include <string>
+
+#include "symbol.h"
+
+namespace delimit {
+
+/*
+ *  Symbols found in one pass over a file's (UTF-8) contents, without parsing it
+ *  properly, so they can be wrong about code which is unusual enough.
+ */
+
+/* Classes, functions, methods of classes and variables declared at the top level */
+SymbolArray javascript_symbols(const unicode& filename, const std::string& data);
+
+/*
+ *  Namespaces, classes, structs, unions and enums, function definitions, the methods
+ *  declared in classes, and macros. For C, C++ and their headers.
+ */
+SymbolArray c_symbols(const unicode& filename, const std::string& data);
+
+}
+
+#endif // SYMBOLS_EXTRACTORS_H
@@ -0,0 +1,120 @@
+#include <vector>
+#include <algorithm>
+
+#include "extractors.h"
+#include "lexer.h"
+
+namespace delimit {
+
+namespace {
+
+enum JavaScriptKeyword {
+    JS_NOT_KEYWORD,
+    JS_FUNCTION,
+    JS_CLASS,
+    JS_VARIABLE,
+    JS_STATEMENT // Can be followed by brackets and a block, but isn't a method
+};
+
+constexpr lexer::Keyword JAVASCRIPT_KEYWORDS[] = {
+    {"function", JS_FUNCTION}, {"class", JS_CLASS},
+    {"var", JS_VARIABLE}, {"let", JS_VARIABLE}, {"const", JS_VARIABLE},
+    {"if", JS_STATEMENT}, {"for", JS_STATEMENT}, {"while", JS_STATEMENT}, {"switch", JS_STATEMENT},
+    {"catch", JS_STATEMENT}, {"with", JS_STATEMENT}, {"return", JS_STATEMENT}, {"extends", JS_STATEMENT}
+};
+
+constexpr lexer::KeywordSet JAVASCRIPT_KEYWORD_SET(JAVASCRIPT_KEYWORDS);
+
+constexpr lexer::Language JAVASCRIPT = {
+    lexer::make_char_table("$", "\"'`"), false, true, "`"
+};
+
+}
+
+SymbolArray javascript_symbols(const unicode& filename, const std::string& data) {
+    SymbolArray result;
+
+    auto add = [&](const lexer::Token& token, SymbolType type) {
+        Symbol symbol;
+        symbol.filename = filename;
+        symbol.name = unicode(token.str(), "utf-8");
+        symbol.line_number = token.line;
+        symbol.type = type;
+        result.push_back(symbol);
+    };
+
+    lexer::Lexer lexer(data, JAVASCRIPT);
+    lexer::Token token, previous;
+
+    std::vector<bool> braces; // Whether each open brace is a class body
+    bool class_body_next = false;
+    int paren_depth = 0;
+
+    // Whatever the last keyword says the next name is
+    SymbolType expected = UNKNOWN;
+
+    // In a class body, a name and then brackets is a method if a block follows them
+    lexer::Token method;
+    bool method_open = false;
+    bool method_closed = false;
+
+    while(lexer.next(token)) {
+        bool after_method = method_closed;
+        method_closed = false;
+
+        if(token.kind == lexer::TOKEN_IDENTIFIER) {
+            // obj.class and the like are just names
+            int keyword = previous.is('.') ? JS_NOT_KEYWORD : JAVASCRIPT_KEYWORD_SET.find(token);
+
+            if(expected != UNKNOWN && !keyword) {
+                add(token, expected);
+                expected = UNKNOWN;
+            } else if(keyword == JS_FUNCTION) {
+                expected = FUNCTION;
+            } else if(keyword == JS_CLASS) {
+                expected = CLASS;
+                class_body_next = true;
+            } else if(keyword == JS_VARIABLE && braces.empty() && !paren_depth) {
+                expected = VARIABLE;
+            } else {
+                expected = UNKNOWN;
+            }
+        } else if(token.is('*') && expected == FUNCTION) {
+            // A generator, the name comes next
+        } else {
+            expected = UNKNOWN;
+
+            bool in_class_body = !braces.empty() && braces.back() && !paren_depth;
+
+            if(token.is('(')) {
+                if(in_class_body && previous.kind == lexer::TOKEN_IDENTIFIER && !JAVASCRIPT_KEYWORD_SET.find(previous)) {
+                    method = previous;
+                    method_open = true;
+                }
+                ++paren_depth;
+            } else if(token.is(')')) {
+                paren_depth = std::max(paren_depth - 1, 0);
+                if(!paren_depth && method_open) {
+                    method_open = false;
+                    method_closed = true;
+                }
+            } else if(token.is('{')) {
+                if(after_method) {
+                    add(method, METHOD);
+                }
+                braces.push_back(class_body_next);
+                class_body_next = false;
+            } else if(token.is('}')) {
+                if(!braces.empty()) {
+                    braces.pop_back();
+                }
+            }
+        }
+
+        previous = token;
+    }
+
+    return result;
+}
+
+}
@@ -0,0 +1,230 @@
+#include <cstring>
+#include <algorithm>
+
+#include "lexer.h"
+
+namespace delimit {
+namespace lexer {
+
+namespace {
+
+// Words after which a / starts a regular expression rather than dividing
+constexpr Keyword REGEX_PREFIX_KEYWORDS[] = {
+    {"return", 1}, {"typeof", 1}, {"instanceof", 1}, {"in", 1}, {"of", 1}, {"new", 1},
+    {"delete", 1}, {"void", 1}, {"throw", 1}, {"case", 1}, {"do", 1}, {"else", 1},
+    {"yield", 1}, {"await", 1}
+};
+
+constexpr KeywordSet REGEX_PREFIXES(REGEX_PREFIX_KEYWORDS);
+
+}
+
+int KeywordSet::find(const Token& token) const {
+    if(!(mask_ & (uint64_t(1) << (token.hash & 63)))) {
+        return 0;
+    }
+
+    std::size_t token_length = token.end - token.begin;
+    for(std::size_t i = 0; i < count_; ++i) {
+        auto& keyword = keywords_[i];
+        if(keyword.hash == token.hash && keyword.length == token_length && !memcmp(keyword.text, token.begin, token_length)) {
+            return keyword.id;
+        }
+    }
+    return 0;
+}
+
+Lexer::Lexer(const std::string& data, const Language& language):
+    language_(language),
+    pos_(data.data()),
+    end_(data.data() + data.size()) {
+
+}
+
+void Lexer::skip_space_and_comments() {
+    auto& chars = language_.chars;
+
+    while(pos_ < end_) {
+        unsigned char c = *pos_;
+
+        if(chars.is(c, CHAR_SPACE)) {
+            ++pos_;
+        } else if(c == '\n') {
+            ++pos_;
+            ++line_;
+            line_start_ = true;
+        } else if(c == '/' && pos_ + 1 < end_ && pos_[1] == '/') {
+            while(pos_ < end_ && *pos_ != '\n') {
+                ++pos_;
+            }
+        } else if(c == '/' && pos_ + 1 < end_ && pos_[1] == '*') {
+            pos_ += 2;
+            while(pos_ < end_ && !(*pos_ == '*' && pos_ + 1 < end_ && pos_[1] == '/')) {
+                line_ += (*pos_ == '\n');
+                ++pos_;
+            }
+            pos_ = std::min(pos_ + 2, end_);
+        } else if(c == '\\' && pos_ + 1 < end_ && pos_[1] == '\n') {
+            // A line continuation, the next line carries on this one
+            pos_ += 2;
+            ++line_;
+        } else {
+            break;
+        }
+    }
+}
+
+void Lexer::read_string(Token& token) {
+    char quote = *pos_++;
+    bool multiline = strchr(language_.multiline_quotes, quote) != nullptr;
+
+    while(pos_ < end_ && *pos_ != quote) {
+        if(*pos_ == '\\' && pos_ + 1 < end_) {
+            line_ += (pos_[1] == '\n');
+            pos_ += 2;
+            continue;
+        }
+
+        if(*pos_ == '\n') {
+            if(!multiline) {
+                break; // Unterminated, don't let it swallow the file
+            }
+            ++line_;
+        }
+        ++pos_;
+    }
+
+    if(pos_ < end_ && *pos_ == quote) {
+        ++pos_;
+    }
+
+    token.kind = TOKEN_STRING;
+}
+
+void Lexer::read_regex(Token& token) {
+    ++pos_;
+
+    bool in_class = false;
+    while(pos_ < end_ && *pos_ != '\n') {
+        char c = *pos_++;
+        if(c == '\\' && pos_ < end_ && *pos_ != '\n') {
+            ++pos_;
+        } else if(c == '[') {
+            in_class = true;
+        } else if(c == ']') {
+            in_class = false;
+        } else if(c == '/' && !in_class) {
+            break;
+        }
+    }
+
+    // Flags
+    while(pos_ < end_ && language_.chars.is(*pos_, CHAR_IDENT)) {
+        ++pos_;
+    }
+
+    token.kind = TOKEN_STRING;
+}
+
+bool Lexer::next(Token& token) {
+    skip_space_and_comments();
+
+    token.first_on_line = line_start_;
+    token.line = line_;
+    token.begin = pos_;
+    token.hash = 0;
+    line_start_ = false;
+
+    if(pos_ >= end_) {
+        token.kind = TOKEN_END;
+        token.end = pos_;
+        return false;
+    }
+
+    auto& chars = language_.chars;
+    unsigned char c = *pos_;
+
+    if(chars.is(c, CHAR_IDENT)) {
+        uint32_t h = 2166136261u;
+        while(pos_ < end_ && chars.is(*pos_, CHAR_IDENT | CHAR_DIGIT)) {
+            h = (h ^ uint8_t(*pos_)) * 16777619u;
+            ++pos_;
+        }
+        token.kind = TOKEN_IDENTIFIER;
+        token.hash = h;
+        token.end = pos_;
+        after_value_ = !REGEX_PREFIXES.find(token);
+        return true;
+    }
+
+    if(chars.is(c, CHAR_DIGIT) || (c == '.' && pos_ + 1 < end_ && chars.is(pos_[1], CHAR_DIGIT))) {
+        // Close enough for every kind of number, exponents with signs aside
+        ++pos_;
+        while(pos_ < end_ && (chars.is(*pos_, CHAR_IDENT | CHAR_DIGIT) || *pos_ == '.')) {
+            ++pos_;
+        }
+        token.kind = TOKEN_NUMBER;
+        token.end = pos_;
+        after_value_ = true;
+        return true;
+    }
+
+    if(chars.is(c, CHAR_QUOTE)) {
+        read_string(token);
+        token.end = pos_;
+        after_value_ = true;
+        return true;
+    }
+
+    if(c == '#' && token.first_on_line && language_.preprocessor) {
+        ++pos_;
+        while(pos_ < end_ && chars.is(*pos_, CHAR_SPACE)) {
+            ++pos_;
+        }
+
+        token.begin = pos_;
+        while(pos_ < end_ && chars.is(*pos_, CHAR_IDENT | CHAR_DIGIT)) {
+            ++pos_;
+        }
+        token.kind = TOKEN_DIRECTIVE;
+        token.end = pos_;
+        token.hash = hash(token.begin, token.end);
+        after_value_ = false;
+        return true;
+    }
+
+    if(c == '/' && language_.regex_literals && !after_value_) {
+        read_regex(token);
+        token.end = pos_;
+        after_value_ = true;
+        return true;
+    }
+
+    ++pos_;
+    token.kind = TOKEN_PUNCTUATION;
+    token.end = pos_;
+    after_value_ = (c == ')' || c == ']'); // After a } is more likely a statement than a division
+    return true;
+}
+
+void Lexer::skip_line() {
+    while(pos_ < end_ && *pos_ != '\n') {
+        if(*pos_ == '\\' && pos_ + 1 < end_ && pos_[1] == '\n') {
+            ++line_;
+            ++pos_;
+        } else if(*pos_ == '/' && pos_ + 1 < end_ && pos_[1] == '*') {
+            // A comment which starts on the line carries on until it ends
+            pos_ += 2;
+            while(pos_ < end_ && !(*pos_ == '*' && pos_ + 1 < end_ && pos_[1] == '/')) {
+                line_ += (*pos_ == '\n');
+                ++pos_;
+            }
+            pos_ = std::min(pos_ + 2, end_);
+            continue;
+        }
+        ++pos_;
+    }
+}
+
+}
+}
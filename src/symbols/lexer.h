@@ -0,0 +1,167 @@
+#ifndef SYMBOLS_LEXER_H
+#define SYMBOLS_LEXER_H
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+namespace delimit {
+namespace lexer {
+
+/*
+ *  A small lexer for C-like languages, good enough to find declarations without
+ *  understanding expressions. It works on the UTF-8 bytes, anything outside ASCII
+ *  counts as part of an identifier. The character classes and keyword sets of each
+ *  language are built by the compiler, so nothing is set up at runtime.
+ */
+
+enum CharClass {
+    CHAR_SPACE = 1 << 0, // Not newlines
+    CHAR_NEWLINE = 1 << 1,
+    CHAR_IDENT = 1 << 2, // Can start an identifier
+    CHAR_DIGIT = 1 << 3,
+    CHAR_QUOTE = 1 << 4
+};
+
+constexpr bool one_of(char c, const char* chars) {
+    return *chars && (*chars == c || one_of(c, chars + 1));
+}
+
+constexpr uint8_t classify(unsigned c, const char* ident_extra, const char* quotes) {
+    return (c == ' ' || c == '\t' || c == '\r' || c == '\f' || c == '\v') ? CHAR_SPACE :
+        (c == '\n') ? CHAR_NEWLINE :
+        ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || c >= 0x80 || one_of(char(c), ident_extra)) ? CHAR_IDENT :
+        (c >= '0' && c <= '9') ? CHAR_DIGIT :
+        one_of(char(c), quotes) ? CHAR_QUOTE : 0;
+}
+
+struct CharTable {
+    uint8_t classes[256];
+
+    bool is(unsigned char c, int char_class) const { return classes[c] & char_class; }
+};
+
+template<std::size_t... I> struct Indexes {};
+template<std::size_t N, std::size_t... I> struct MakeIndexes : MakeIndexes<N - 1, N - 1, I...> {};
+template<std::size_t... I> struct MakeIndexes<0, I...> { typedef Indexes<I...> type; };
+
+template<std::size_t... I>
+constexpr CharTable make_char_table(const char* ident_extra, const char* quotes, Indexes<I...>) {
+    return CharTable{{classify(I, ident_extra, quotes)...}};
+}
+
+/* ident_extra are punctuation characters which can appear in identifiers, quotes start strings */
+constexpr CharTable make_char_table(const char* ident_extra, const char* quotes) {
+    return make_char_table(ident_extra, quotes, MakeIndexes<256>::type());
+}
+
+/* FNV-1a, the same at compile time for keywords and at runtime for identifiers */
+constexpr uint32_t hash(const char* text, uint32_t h=2166136261u) {
+    return *text ? hash(text + 1, (h ^ uint8_t(*text)) * 16777619u) : h;
+}
+
+inline uint32_t hash(const char* begin, const char* end) {
+    uint32_t h = 2166136261u;
+    for(; begin != end; ++begin) {
+        h = (h ^ uint8_t(*begin)) * 16777619u;
+    }
+    return h;
+}
+
+constexpr std::size_t length(const char* text) {
+    return *text ? 1 + length(text + 1) : 0;
+}
+
+enum TokenKind {
+    TOKEN_END,
+    TOKEN_IDENTIFIER,
+    TOKEN_NUMBER,
+    TOKEN_STRING,
+    TOKEN_PUNCTUATION, // A single character, so ">>" is two of them
+    TOKEN_DIRECTIVE // The name of a preprocessor directive, the line after it is left alone
+};
+
+struct Token {
+    TokenKind kind = TOKEN_END;
+    const char* begin = nullptr;
+    const char* end = nullptr;
+    int line = 0; // Counting from 0
+    uint32_t hash = 0; // Only for identifiers and directives
+    bool first_on_line = false;
+
+    bool is(char punctuation) const {
+        return kind == TOKEN_PUNCTUATION && *begin == punctuation;
+    }
+
+    std::string str() const { return std::string(begin, end); }
+};
+
+struct Keyword {
+    constexpr Keyword(const char* text, int id):
+        text(text), length(lexer::length(text)), hash(lexer::hash(text)), id(id) {}
+
+    const char* text;
+    std::size_t length;
+    uint32_t hash;
+    int id;
+};
+
+/*
+ *  A language's keywords. Each keyword sets a bit of mask (chosen by its hash), which
+ *  rules out most identifiers before any keyword is looked at.
+ */
+class KeywordSet {
+public:
+    template<std::size_t N>
+    constexpr KeywordSet(const Keyword (&keywords)[N]):
+        keywords_(keywords), count_(N), mask_(make_mask(keywords, N)) {}
+
+    /* The id of the keyword the token is, or 0 */
+    int find(const Token& token) const;
+
+private:
+    const Keyword* keywords_;
+    std::size_t count_;
+    uint64_t mask_;
+
+    static constexpr uint64_t make_mask(const Keyword* keywords, std::size_t count) {
+        return count ? (uint64_t(1) << (keywords->hash & 63)) | make_mask(keywords + 1, count - 1) : 0;
+    }
+};
+
+struct Language {
+    CharTable chars;
+    bool preprocessor; // # at the start of a line begins a directive
+    bool regex_literals; // A / where a value is expected starts a regular expression
+    const char* multiline_quotes; // Quotes whose strings carry on over newlines
+};
+
+class Lexer {
+public:
+    Lexer(const std::string& data, const Language& language);
+
+    /* Fills in the next token, comments are skipped. Returns false at the end. */
+    bool next(Token& token);
+
+    /* Skips the rest of the line (and any lines it's continued on with a backslash) */
+    void skip_line();
+
+private:
+    const Language& language_;
+    const char* pos_;
+    const char* end_;
+    int line_ = 0;
+    bool line_start_ = true;
+
+    // Whether a / would be a division, which is the case after anything with a value
+    bool after_value_ = false;
+
+    void skip_space_and_comments();
+    void read_string(Token& token);
+    void read_regex(Token& token);
+};
+
+}
+}
+
+#endif // SYMBOLS_LEXER_H
@@ -0,0 +1,49 @@
+#ifndef SYMBOL_H
+#define SYMBOL_H
+
+#include <vector>
+
+#include "../utils/unicode.h"
+
+namespace delimit {
+
+enum SymbolType {
+    NAMESPACE = 0,
+    CLASS,
+    METHOD,
+    FUNCTION,
+    VARIABLE,
+    UNKNOWN
+};
+
+struct Symbol {
+    unicode name;
+    SymbolType type;
+    unicode filename;
+    int line_number;
+
+    bool operator==(const Symbol& rhs) const {
+        return name == rhs.name && filename == rhs.filename && type == rhs.type && line_number == rhs.line_number;
+    }
+
+    const Symbol& operator=(const Symbol& rhs) {
+        if(&rhs == this) return *this;
+
+        name = rhs.name;
+        type = rhs.type;
+        filename = rhs.filename;
+        line_number = rhs.line_number;
+
+        return *this;
+    }
+
+    bool operator<(const Symbol& rhs) const {
+        return name < rhs.name;
+    }
+};
+
+typedef std::vector<Symbol> SymbolArray;
+
+}
+
+#endif // SYMBOL_H
@@ -1,36 +1,9 @@
 #include <vector>
-#include <fstream>
 #include <string>
 
 #include "utils.h"
 #include "utils/kazlog.h"
 
-unicode call_command(unicode command, unicode cwd) {
-    char tmpname [L_tmpnam];
-    std::tmpnam ( tmpname );
-    std::string scommand = command.encode();
-    if(!cwd.empty()) {
-        scommand = _u("cd {0}; {1}").format(cwd, scommand).encode();
-    }
-    std::string cmd = scommand + " &> " + tmpname;
-    std::system(cmd.c_str());
-    std::ifstream file(tmpname, std::ios::in );
-    std::vector<unicode> lines;
-    while(file.good()) {
-        std::string line;
-        std::getline(file, line);
-        lines.push_back(line);
-    }
-
-    file.close();
-
-    remove(tmpname);
-
-    unicode ret = _u("\n").join(lines);
-
-    return ret;
-}
-
 
 Glib::RefPtr<Gsv::Language> guess_language_from_file(const Glib::RefPtr<Gio::File>& file) {
     L_DEBUG("Detecting language...");
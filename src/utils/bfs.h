@@ -4,15 +4,31 @@
 #include <gtkmm.h>
 #include <queue>
 #include <algorithm>
+#include <unordered_set>
 
 #include "unicode.h"
 #include "kfs.h"
-
+#include "content_type.h"
+#include "gitignore.h"
+#include "crawl_snapshot.h"
+
+/*
+ *  Breadth-first crawl of a project for text files. If the previous crawl's snapshot is
+ *  given, directories whose mtime (and .gitignore) haven't changed since are not listed
+ *  again, their files are taken from the snapshot. Either way, snapshot() holds the
+ *  result of this crawl once run() returns.
+ */
 class BFS {
 public:
-    BFS(const unicode& root_path):
-        root_(root_path) {
-
+    BFS(const unicode& root_path, delimit::IgnoreTreePtr ignore_tree=delimit::IgnoreTreePtr(), std::shared_ptr<delimit::CrawlSnapshot> previous=std::shared_ptr<delimit::CrawlSnapshot>()):
+        root_(root_path),
+        ignore_tree_(ignore_tree),
+        previous_(previous),
+        snapshot_(std::make_shared<delimit::CrawlSnapshot>(root_path.encode())) {
+
+        if(!ignore_tree_) {
+            ignore_tree_ = std::make_shared<delimit::IgnoreTree>(root_.encode());
+        }
     }
 
     std::vector<unicode> run() {
@@ -23,6 +39,8 @@ public:
         return result;
     }
 
+    std::shared_ptr<delimit::CrawlSnapshot> snapshot() const { return snapshot_; }
+
     sigc::signal<void (const std::vector<unicode>&, int)>& signal_level_complete() { return signal_level_complete_; }
 
 private:
@@ -38,36 +56,39 @@ private:
             unicode file_or_folder = level.front();
             level.pop();
 
-            if(file_or_folder.starts_with(".") || file_or_folder.ends_with(".pyc")) {
+            std::string path = file_or_folder.encode();
+
+            // One stat per path, following symlinks. Broken links just fail here
+            struct stat st;
+            if(::stat(path.c_str(), &st) == -1) {
+                std::cout << "Unable to deal with file path " << std::endl;
                 continue;
             }
 
-            unicode abs_path;
-            try {
-                abs_path = kfs::path::real_path(file_or_folder.encode());
-            } catch(...) {
-                std::cout << "Unable to deal with file path " << std::endl;
+            bool is_dir = S_ISDIR(st.st_mode);
+
+            // Checked before descending, so ignored directories are pruned entirely
+            if(ignore_tree_->is_ignored(path, is_dir)) {
                 continue;
             }
 
-            if(kfs::path::is_dir(abs_path.encode())) {
-                auto files = kfs::path::list_dir(abs_path.encode());
-                for(unicode file: files) {
-                    if(!file.starts_with(".")) {
-                        temp_.push(kfs::path::join(file_or_folder.encode(), file.encode()));
-                    }
+            auto slash = path.rfind('/');
+            bool is_root = (file_or_folder == root_);
+
+            if(is_dir) {
+                if(!is_root) {
+                    snapshot_->add_directory(path.substr(0, slash), path.substr(slash + 1));
                 }
+                process_directory(path, st, result);
+                continue;
             }
 
-            auto content_type = Gio::File::create_for_path(file_or_folder.encode())->query_info(
-                G_FILE_ATTRIBUTE_STANDARD_CONTENT_TYPE
-            )->get_content_type();
-
-            if(!_u(content_type).starts_with("text/") && !_u(content_type).starts_with("application/")) {
+            if(!delimit::ContentClassifier::instance().is_text(path, st)) {
                 //Only include text files
                 continue;
             }
 
+            snapshot_->add_file(path.substr(0, slash), path.substr(slash + 1));
             result.push_back(file_or_folder);
         }
 
@@ -75,11 +96,55 @@ private:
         process_level(result, level_num + 1);
     }
 
+    void process_directory(const std::string& path, const struct stat& st, std::vector<unicode>& result) {
+        struct stat ignore_st;
+        bool has_ignore_file = ::stat(kfs::path::join(path, ".gitignore").c_str(), &ignore_st) == 0;
+
+        delimit::SnapshotDirectory& entry = snapshot_->insert(path);
+        entry.mtime_sec = st.st_mtim.tv_sec;
+        entry.mtime_nsec = st.st_mtim.tv_nsec;
+        entry.ignore_mtime_sec = (has_ignore_file) ? ignore_st.st_mtim.tv_sec : 0;
+        entry.ignore_mtime_nsec = (has_ignore_file) ? ignore_st.st_mtim.tv_nsec : 0;
+
+        const delimit::SnapshotDirectory* previous = (previous_) ? previous_->find(path) : nullptr;
+
+        // If the ignore rules changed then everything below here needs to be looked at again
+        bool rules_changed = force_relist_.count(path) > 0 || (previous && (
+            previous->ignore_mtime_sec != entry.ignore_mtime_sec ||
+            previous->ignore_mtime_nsec != entry.ignore_mtime_nsec
+        ));
+
+        if(previous && !rules_changed && previous->mtime_sec == entry.mtime_sec && previous->mtime_nsec == entry.mtime_nsec) {
+            // Nothing was added or removed, so the files are the same as last time
+            entry.files = previous->files;
+            for(auto& name: previous->files) {
+                result.push_back(kfs::path::join(path, name));
+            }
+
+            // Subdirectories are still visited, they may have changed
+            for(auto& name: previous->directories) {
+                temp_.push(kfs::path::join(path, name));
+            }
+            return;
+        }
+
+        for(auto& file: kfs::path::list_dir(path)) {
+            auto child = kfs::path::join(path, file);
+            if(rules_changed) {
+                force_relist_.insert(child);
+            }
+            temp_.push(child);
+        }
+    }
+
     unicode root_;
+    delimit::IgnoreTreePtr ignore_tree_;
+    std::shared_ptr<delimit::CrawlSnapshot> previous_;
+    std::shared_ptr<delimit::CrawlSnapshot> snapshot_;
+    std::unordered_set<std::string> force_relist_;
     std::queue<unicode> temp_;
 
     sigc::signal<void (const std::vector<unicode>&, int)> signal_level_complete_;
 };
 
 #endif // BFS_H
-
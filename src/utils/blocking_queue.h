@@ -0,0 +1,92 @@
+#ifndef BLOCKING_QUEUE_H
+#define BLOCKING_QUEUE_H
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+namespace delimit {
+
+/*
+ *  A simple multi-producer, multi-consumer queue. Once closed, pop() drains whatever
+ *  is left and then returns false, so consumer threads know when to exit. If given a
+ *  capacity, push() waits for room so producers can't run too far ahead.
+ */
+template<typename T>
+class BlockingQueue {
+public:
+    BlockingQueue(std::size_t capacity=0):
+        capacity_(capacity) {}
+
+    void push(T value) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            if(capacity_) {
+                not_full_.wait(lock, [this]() { return closed_ || items_.size() < capacity_; });
+            }
+
+            if(closed_) {
+                return;
+            }
+            items_.push_back(std::move(value));
+        }
+        condition_.notify_one();
+    }
+
+    /* Waits for an item, returns false if the queue was closed and is empty */
+    bool pop(T& out) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            condition_.wait(lock, [this]() { return closed_ || !items_.empty(); });
+
+            if(items_.empty()) {
+                return false;
+            }
+
+            out = std::move(items_.front());
+            items_.pop_front();
+        }
+        not_full_.notify_one();
+        return true;
+    }
+
+    bool try_pop(T& out) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if(items_.empty()) {
+                return false;
+            }
+
+            out = std::move(items_.front());
+            items_.pop_front();
+        }
+        not_full_.notify_one();
+        return true;
+    }
+
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            closed_ = true;
+        }
+        condition_.notify_all();
+        not_full_.notify_all();
+    }
+
+    bool empty() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return items_.empty();
+    }
+
+private:
+    mutable std::mutex mutex_;
+    std::condition_variable condition_;
+    std::condition_variable not_full_;
+    std::deque<T> items_;
+    std::size_t capacity_ = 0;
+    bool closed_ = false;
+};
+
+}
+
+#endif // BLOCKING_QUEUE_H
@@ -0,0 +1,171 @@
+#include <fstream>
+#include <algorithm>
+#include <unordered_map>
+
+#include "content_type.h"
+#include "utf8.h"
+
+namespace delimit {
+
+static const std::size_t PROBE_BLOCK_SIZE = 4096;
+
+static const std::unordered_map<std::string, ContentClass> EXTENSIONS = {
+    // Source code
+    { ".py", CONTENT_CLASS_TEXT }, { ".pyw", CONTENT_CLASS_TEXT }, { ".pyx", CONTENT_CLASS_TEXT },
+    { ".pxd", CONTENT_CLASS_TEXT }, { ".pyi", CONTENT_CLASS_TEXT },
+    { ".c", CONTENT_CLASS_TEXT }, { ".h", CONTENT_CLASS_TEXT }, { ".cc", CONTENT_CLASS_TEXT },
+    { ".cpp", CONTENT_CLASS_TEXT }, { ".cxx", CONTENT_CLASS_TEXT }, { ".hpp", CONTENT_CLASS_TEXT },
+    { ".hh", CONTENT_CLASS_TEXT }, { ".hxx", CONTENT_CLASS_TEXT }, { ".inl", CONTENT_CLASS_TEXT },
+    { ".m", CONTENT_CLASS_TEXT }, { ".mm", CONTENT_CLASS_TEXT },
+    { ".js", CONTENT_CLASS_TEXT }, { ".jsx", CONTENT_CLASS_TEXT }, { ".ts", CONTENT_CLASS_TEXT },
+    { ".tsx", CONTENT_CLASS_TEXT }, { ".coffee", CONTENT_CLASS_TEXT }, { ".mjs", CONTENT_CLASS_TEXT },
+    { ".java", CONTENT_CLASS_TEXT }, { ".kt", CONTENT_CLASS_TEXT }, { ".scala", CONTENT_CLASS_TEXT },
+    { ".go", CONTENT_CLASS_TEXT }, { ".rs", CONTENT_CLASS_TEXT }, { ".rb", CONTENT_CLASS_TEXT },
+    { ".php", CONTENT_CLASS_TEXT }, { ".pl", CONTENT_CLASS_TEXT }, { ".pm", CONTENT_CLASS_TEXT },
+    { ".lua", CONTENT_CLASS_TEXT }, { ".cs", CONTENT_CLASS_TEXT }, { ".vala", CONTENT_CLASS_TEXT },
+    { ".sh", CONTENT_CLASS_TEXT }, { ".bash", CONTENT_CLASS_TEXT }, { ".zsh", CONTENT_CLASS_TEXT },
+    { ".sql", CONTENT_CLASS_TEXT }, { ".glsl", CONTENT_CLASS_TEXT }, { ".vert", CONTENT_CLASS_TEXT },
+    { ".frag", CONTENT_CLASS_TEXT },
+
+    // Markup, config and data
+    { ".txt", CONTENT_CLASS_TEXT }, { ".md", CONTENT_CLASS_TEXT }, { ".rst", CONTENT_CLASS_TEXT },
+    { ".html", CONTENT_CLASS_TEXT }, { ".htm", CONTENT_CLASS_TEXT }, { ".xml", CONTENT_CLASS_TEXT },
+    { ".xhtml", CONTENT_CLASS_TEXT }, { ".svg", CONTENT_CLASS_TEXT }, { ".glade", CONTENT_CLASS_TEXT },
+    { ".ui", CONTENT_CLASS_TEXT }, { ".css", CONTENT_CLASS_TEXT }, { ".scss", CONTENT_CLASS_TEXT },
+    { ".sass", CONTENT_CLASS_TEXT }, { ".less", CONTENT_CLASS_TEXT }, { ".json", CONTENT_CLASS_TEXT },
+    { ".yaml", CONTENT_CLASS_TEXT }, { ".yml", CONTENT_CLASS_TEXT }, { ".toml", CONTENT_CLASS_TEXT },
+    { ".ini", CONTENT_CLASS_TEXT }, { ".cfg", CONTENT_CLASS_TEXT }, { ".conf", CONTENT_CLASS_TEXT },
+    { ".csv", CONTENT_CLASS_TEXT }, { ".tsv", CONTENT_CLASS_TEXT }, { ".cmake", CONTENT_CLASS_TEXT },
+    { ".mk", CONTENT_CLASS_TEXT }, { ".in", CONTENT_CLASS_TEXT }, { ".desktop", CONTENT_CLASS_TEXT },
+    { ".diff", CONTENT_CLASS_TEXT }, { ".patch", CONTENT_CLASS_TEXT }, { ".log", CONTENT_CLASS_TEXT },
+    { ".tex", CONTENT_CLASS_TEXT }, { ".po", CONTENT_CLASS_TEXT },
+
+    // Binaries, archives and media
+    { ".pyc", CONTENT_CLASS_BINARY }, { ".pyo", CONTENT_CLASS_BINARY }, { ".o", CONTENT_CLASS_BINARY },
+    { ".obj", CONTENT_CLASS_BINARY }, { ".a", CONTENT_CLASS_BINARY }, { ".so", CONTENT_CLASS_BINARY },
+    { ".dll", CONTENT_CLASS_BINARY }, { ".dylib", CONTENT_CLASS_BINARY }, { ".exe", CONTENT_CLASS_BINARY },
+    { ".class", CONTENT_CLASS_BINARY }, { ".jar", CONTENT_CLASS_BINARY }, { ".wasm", CONTENT_CLASS_BINARY },
+    { ".zip", CONTENT_CLASS_BINARY }, { ".gz", CONTENT_CLASS_BINARY }, { ".tgz", CONTENT_CLASS_BINARY },
+    { ".bz2", CONTENT_CLASS_BINARY }, { ".xz", CONTENT_CLASS_BINARY }, { ".7z", CONTENT_CLASS_BINARY },
+    { ".tar", CONTENT_CLASS_BINARY }, { ".rar", CONTENT_CLASS_BINARY }, { ".whl", CONTENT_CLASS_BINARY },
+    { ".egg", CONTENT_CLASS_BINARY }, { ".png", CONTENT_CLASS_BINARY }, { ".jpg", CONTENT_CLASS_BINARY },
+    { ".jpeg", CONTENT_CLASS_BINARY }, { ".gif", CONTENT_CLASS_BINARY }, { ".bmp", CONTENT_CLASS_BINARY },
+    { ".ico", CONTENT_CLASS_BINARY }, { ".tga", CONTENT_CLASS_BINARY }, { ".webp", CONTENT_CLASS_BINARY },
+    { ".pdf", CONTENT_CLASS_BINARY }, { ".mp3", CONTENT_CLASS_BINARY }, { ".ogg", CONTENT_CLASS_BINARY },
+    { ".wav", CONTENT_CLASS_BINARY }, { ".mp4", CONTENT_CLASS_BINARY }, { ".avi", CONTENT_CLASS_BINARY },
+    { ".ttf", CONTENT_CLASS_BINARY }, { ".otf", CONTENT_CLASS_BINARY }, { ".woff", CONTENT_CLASS_BINARY },
+    { ".woff2", CONTENT_CLASS_BINARY }, { ".db", CONTENT_CLASS_BINARY }, { ".sqlite", CONTENT_CLASS_BINARY },
+    { ".bin", CONTENT_CLASS_BINARY }, { ".dat", CONTENT_CLASS_BINARY }, { ".mo", CONTENT_CLASS_BINARY },
+};
+
+static std::string extension(const std::string& path) {
+    /*
+     *  Returns the extension of the final path component, including
+     *  the dot. Leading dots (e.g. .bashrc) don't count as an extension.
+     */
+    auto sep = path.rfind('/');
+    auto name_start = (sep == std::string::npos) ? 0 : sep + 1;
+    auto dot = path.rfind('.');
+
+    if(dot == std::string::npos || dot <= name_start) {
+        return std::string();
+    }
+
+    return path.substr(dot);
+}
+
+ContentClass classify_by_name(const std::string& path) {
+    std::string ext = extension(path);
+    if(ext.empty()) {
+        return CONTENT_CLASS_UNKNOWN;
+    }
+
+    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+
+    auto it = EXTENSIONS.find(ext);
+    if(it == EXTENSIONS.end()) {
+        return CONTENT_CLASS_UNKNOWN;
+    }
+
+    return it->second;
+}
+
+ContentClass classify_by_contents(const std::string& path) {
+    std::ifstream in(path.c_str(), std::ios::in | std::ios::binary);
+    if(!in) {
+        return CONTENT_CLASS_UNKNOWN;
+    }
+
+    char buffer[PROBE_BLOCK_SIZE];
+    in.read(buffer, PROBE_BLOCK_SIZE);
+    std::size_t read = in.gcount();
+
+    if(std::find(buffer, buffer + read, '\0') != buffer + read) {
+        return CONTENT_CLASS_BINARY;
+    }
+
+    auto invalid = utf8::find_invalid(buffer, buffer + read);
+    if(invalid == buffer + read) {
+        return CONTENT_CLASS_TEXT;
+    }
+
+    /*
+     *  If we filled the block, the last character may just have been cut in half. A UTF-8
+     *  sequence is at most 4 bytes, so only let an error through if it's in the final 3
+     */
+    if(read == PROBE_BLOCK_SIZE && (buffer + read) - invalid < 4) {
+        return CONTENT_CLASS_TEXT;
+    }
+
+    return CONTENT_CLASS_BINARY;
+}
+
+ContentClassifier& ContentClassifier::instance() {
+    static ContentClassifier classifier;
+    return classifier;
+}
+
+bool ContentClassifier::is_text(const std::string& path) {
+    struct stat st;
+    if(::stat(path.c_str(), &st) == -1) {
+        return false;
+    }
+
+    return is_text(path, st);
+}
+
+bool ContentClassifier::is_text(const std::string& path, const struct stat& st) {
+    if(!S_ISREG(st.st_mode)) {
+        return false;
+    }
+
+    ContentClass by_name = classify_by_name(path);
+    if(by_name != CONTENT_CLASS_UNKNOWN) {
+        return by_name == CONTENT_CLASS_TEXT;
+    }
+
+    Key key = { st.st_dev, st.st_ino };
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = cache_.find(key);
+        if(it != cache_.end() && it->second.mtime_sec == st.st_mtim.tv_sec && it->second.mtime_nsec == st.st_mtim.tv_nsec) {
+            return it->second.content_class == CONTENT_CLASS_TEXT;
+        }
+    }
+
+    // Don't hold the lock while we hit the disk
+    ContentClass by_contents = classify_by_contents(path);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    cache_[key] = Entry({ st.st_mtim.tv_sec, st.st_mtim.tv_nsec, by_contents });
+
+    return by_contents == CONTENT_CLASS_TEXT;
+}
+
+void ContentClassifier::clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    cache_.clear();
+}
+
+}
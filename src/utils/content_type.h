@@ -0,0 +1,74 @@
+#ifndef CONTENT_TYPE_H
+#define CONTENT_TYPE_H
+
+#include <mutex>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <sys/stat.h>
+
+namespace delimit {
+
+enum ContentClass {
+    CONTENT_CLASS_UNKNOWN = 0,
+    CONTENT_CLASS_TEXT,
+    CONTENT_CLASS_BINARY
+};
+
+/*
+ *  Classifies a file purely by its name, using the extension table. Returns
+ *  CONTENT_CLASS_UNKNOWN if the extension isn't one we recognise.
+ */
+ContentClass classify_by_name(const std::string& path);
+
+/*
+ *  Reads the first block of a file and checks it for NUL bytes and UTF-8 validity
+ */
+ContentClass classify_by_contents(const std::string& path);
+
+/*
+ *  Decides whether files are text without asking Gio to sniff them. Known extensions
+ *  are answered from a table, anything else is probed once and the answer is memoized
+ *  against the (device, inode, mtime) of the file. A single instance is shared by
+ *  every crawler in the process.
+ */
+class ContentClassifier {
+public:
+    static ContentClassifier& instance();
+
+    bool is_text(const std::string& path);
+    bool is_text(const std::string& path, const struct stat& st);
+
+    void clear();
+
+private:
+    ContentClassifier() {}
+
+    struct Key {
+        dev_t dev;
+        ino_t ino;
+
+        bool operator==(const Key& rhs) const {
+            return dev == rhs.dev && ino == rhs.ino;
+        }
+    };
+
+    struct KeyHash {
+        std::size_t operator()(const Key& key) const {
+            return std::hash<uint64_t>()(uint64_t(key.ino)) ^ (std::hash<uint64_t>()(uint64_t(key.dev)) << 1);
+        }
+    };
+
+    struct Entry {
+        time_t mtime_sec;
+        long mtime_nsec;
+        ContentClass content_class;
+    };
+
+    std::mutex mutex_;
+    std::unordered_map<Key, Entry, KeyHash> cache_;
+};
+
+}
+
+#endif // CONTENT_TYPE_H
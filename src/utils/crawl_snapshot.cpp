@@ -0,0 +1,277 @@
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <unistd.h>
+
+#include "crawl_snapshot.h"
+#include "base_directory.h"
+#include "kfs.h"
+#include "xxhash.h"
+
+namespace delimit {
+
+static const char SNAPSHOT_MAGIC[4] = { 'D', 'L', 'C', 'S' };
+static const uint32_t SNAPSHOT_VERSION = 1;
+
+namespace {
+
+class Writer {
+public:
+    void u32(uint32_t value) {
+        for(int i = 0; i < 4; ++i) {
+            data_.push_back(char((value >> (i * 8)) & 0xFF));
+        }
+    }
+
+    void i64(int64_t value) {
+        uint64_t v = uint64_t(value);
+        for(int i = 0; i < 8; ++i) {
+            data_.push_back(char((v >> (i * 8)) & 0xFF));
+        }
+    }
+
+    void str(const std::string& value) {
+        u32(value.length());
+        data_.append(value);
+    }
+
+    void bytes(const char* value, std::size_t length) {
+        data_.append(value, length);
+    }
+
+    const std::string& data() const { return data_; }
+
+private:
+    std::string data_;
+};
+
+class Reader {
+public:
+    Reader(const std::string& data):
+        data_(data) {}
+
+    bool u32(uint32_t& out) {
+        if(data_.length() - pos_ < 4) return false;
+
+        out = 0;
+        for(int i = 0; i < 4; ++i) {
+            out |= uint32_t(uint8_t(data_[pos_ + i])) << (i * 8);
+        }
+        pos_ += 4;
+        return true;
+    }
+
+    bool i64(int64_t& out) {
+        if(data_.length() - pos_ < 8) return false;
+
+        uint64_t v = 0;
+        for(int i = 0; i < 8; ++i) {
+            v |= uint64_t(uint8_t(data_[pos_ + i])) << (i * 8);
+        }
+        out = int64_t(v);
+        pos_ += 8;
+        return true;
+    }
+
+    bool str(std::string& out) {
+        uint32_t length = 0;
+        if(!u32(length) || data_.length() - pos_ < length) return false;
+
+        out.assign(data_, pos_, length);
+        pos_ += length;
+        return true;
+    }
+
+    bool bytes(const char* expected, std::size_t length) {
+        if(data_.length() - pos_ < length || std::memcmp(data_.c_str() + pos_, expected, length) != 0) {
+            return false;
+        }
+        pos_ += length;
+        return true;
+    }
+
+private:
+    const std::string& data_;
+    std::size_t pos_ = 0;
+};
+
+}
+
+CrawlSnapshot::CrawlSnapshot(const std::string& root):
+    root_(root) {
+
+    while(root_.length() > 1 && root_.back() == '/') {
+        root_.pop_back();
+    }
+}
+
+std::string CrawlSnapshot::default_location(const std::string& root) {
+    auto folder = kfs::path::join(fdo::xdg::make_dir_in_data_home("delimit").encode(), "snapshots");
+    if(!kfs::path::exists(folder)) {
+        kfs::make_dirs(folder);
+    }
+
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.snapshot", (unsigned long long) xxh64(root));
+    return kfs::path::join(folder, name);
+}
+
+std::string CrawlSnapshot::relative(const std::string& directory) const {
+    if(directory.length() <= root_.length()) {
+        return std::string();
+    }
+    return directory.substr(root_.length() + 1);
+}
+
+std::string CrawlSnapshot::absolute(const std::string& relative) const {
+    if(relative.empty()) {
+        return root_;
+    }
+    return root_ + "/" + relative;
+}
+
+const SnapshotDirectory* CrawlSnapshot::find(const std::string& directory) const {
+    auto it = directories_.find(relative(directory));
+    if(it == directories_.end()) {
+        return nullptr;
+    }
+    return &it->second;
+}
+
+SnapshotDirectory& CrawlSnapshot::insert(const std::string& directory) {
+    SnapshotDirectory& result = directories_[relative(directory)];
+    result = SnapshotDirectory();
+    return result;
+}
+
+void CrawlSnapshot::add_file(const std::string& directory, const std::string& name) {
+    directories_[relative(directory)].files.push_back(name);
+}
+
+void CrawlSnapshot::add_directory(const std::string& directory, const std::string& name) {
+    directories_[relative(directory)].directories.push_back(name);
+}
+
+std::vector<std::string> CrawlSnapshot::files() const {
+    std::vector<std::string> result;
+
+    for(auto& pair: directories_) {
+        std::string directory = absolute(pair.first);
+        for(auto& name: pair.second.files) {
+            result.push_back(directory + "/" + name);
+        }
+    }
+
+    return result;
+}
+
+bool CrawlSnapshot::load(const std::string& filename) {
+    std::ifstream in(filename.c_str(), std::ios::in | std::ios::binary);
+    if(!in) {
+        return false;
+    }
+
+    std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    Reader reader(data);
+
+    uint32_t version = 0;
+    std::string root;
+    uint32_t count = 0;
+
+    if(!reader.bytes(SNAPSHOT_MAGIC, 4) || !reader.u32(version) || version != SNAPSHOT_VERSION) {
+        return false;
+    }
+
+    // Two projects could hash to the same file, so make sure this one is ours
+    if(!reader.str(root) || root != root_ || !reader.u32(count)) {
+        return false;
+    }
+
+    std::unordered_map<std::string, SnapshotDirectory> directories;
+    directories.reserve(count);
+
+    for(uint32_t i = 0; i < count; ++i) {
+        std::string path;
+        SnapshotDirectory directory;
+        uint32_t file_count = 0, directory_count = 0;
+
+        if(!reader.str(path) ||
+           !reader.i64(directory.mtime_sec) || !reader.i64(directory.mtime_nsec) ||
+           !reader.i64(directory.ignore_mtime_sec) || !reader.i64(directory.ignore_mtime_nsec)) {
+            return false;
+        }
+
+        // Every name takes at least 4 bytes, so anything bigger than this is garbage
+        if(!reader.u32(file_count) || file_count > data.length()) return false;
+        directory.files.resize(file_count);
+        for(auto& name: directory.files) {
+            if(!reader.str(name)) return false;
+        }
+
+        if(!reader.u32(directory_count) || directory_count > data.length()) return false;
+        directory.directories.resize(directory_count);
+        for(auto& name: directory.directories) {
+            if(!reader.str(name)) return false;
+        }
+
+        directories[path] = std::move(directory);
+    }
+
+    directories_.swap(directories);
+    return true;
+}
+
+bool CrawlSnapshot::save(const std::string& filename) const {
+    Writer writer;
+
+    writer.bytes(SNAPSHOT_MAGIC, 4);
+    writer.u32(SNAPSHOT_VERSION);
+    writer.str(root_);
+    writer.u32(directories_.size());
+
+    for(auto& pair: directories_) {
+        const SnapshotDirectory& directory = pair.second;
+
+        writer.str(pair.first);
+        writer.i64(directory.mtime_sec);
+        writer.i64(directory.mtime_nsec);
+        writer.i64(directory.ignore_mtime_sec);
+        writer.i64(directory.ignore_mtime_nsec);
+
+        writer.u32(directory.files.size());
+        for(auto& name: directory.files) {
+            writer.str(name);
+        }
+
+        writer.u32(directory.directories.size());
+        for(auto& name: directory.directories) {
+            writer.str(name);
+        }
+    }
+
+    const std::string& data = writer.data();
+
+    // Write to the side and rename, so a crash can't leave half a snapshot behind
+    std::string temp_file = filename + ".tmp";
+    {
+        std::ofstream out(temp_file.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+        if(!out) {
+            return false;
+        }
+
+        out.write(data.c_str(), data.length());
+        if(!out) {
+            return false;
+        }
+    }
+
+    if(std::rename(temp_file.c_str(), filename.c_str()) != 0) {
+        ::unlink(temp_file.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+}
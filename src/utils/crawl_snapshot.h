@@ -0,0 +1,65 @@
+#ifndef CRAWL_SNAPSHOT_H
+#define CRAWL_SNAPSHOT_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+namespace delimit {
+
+struct SnapshotDirectory {
+    int64_t mtime_sec = 0;
+    int64_t mtime_nsec = 0;
+
+    // The directory's .gitignore, zero if it doesn't have one
+    int64_t ignore_mtime_sec = 0;
+    int64_t ignore_mtime_nsec = 0;
+
+    // Names of the (text) files and subdirectories which made it through the crawl
+    std::vector<std::string> files;
+    std::vector<std::string> directories;
+};
+
+/*
+ *  The result of crawling a project, along with the mtime of every directory we listed.
+ *  It's saved to the data directory when a crawl finishes and loaded the next time the
+ *  project is opened, so the file list is available straight away and the next crawl
+ *  only needs to re-list directories which have changed since.
+ */
+class CrawlSnapshot {
+public:
+    CrawlSnapshot(const std::string& root);
+
+    const std::string& root() const { return root_; }
+
+    /* Where the snapshot for a project lives in the data directory */
+    static std::string default_location(const std::string& root);
+
+    bool load(const std::string& filename);
+    bool save(const std::string& filename) const;
+
+    const SnapshotDirectory* find(const std::string& directory) const;
+    SnapshotDirectory& insert(const std::string& directory);
+
+    void add_file(const std::string& directory, const std::string& name);
+    void add_directory(const std::string& directory, const std::string& name);
+
+    /* Absolute paths of every file in the snapshot */
+    std::vector<std::string> files() const;
+
+    std::size_t directory_count() const { return directories_.size(); }
+
+private:
+    std::string root_;
+
+    // Keyed on the path relative to the root, the root itself is ""
+    std::unordered_map<std::string, SnapshotDirectory> directories_;
+
+    std::string relative(const std::string& directory) const;
+    std::string absolute(const std::string& relative) const;
+};
+
+}
+
+#endif // CRAWL_SNAPSHOT_H
@@ -5,18 +5,22 @@
 
 #include "unicode.h"
 
-static unicode read_file_contents(const unicode& filename, std::string* encoding_out=nullptr) {
-    std::ifstream in(filename.encode().c_str());
+static std::string read_file_bytes(const unicode& filename) {
+    std::ifstream in(filename.encode().c_str(), std::ios::in | std::ios::binary);
     if(!in) {
         throw std::runtime_error((_u("Unable to load file") + filename).encode());
     }
 
-    auto str = [&in]{
-      std::ostringstream ss{};
-      ss << in.rdbuf();
-      return ss.str();
-    }();
+    std::ostringstream ss{};
+    ss << in.rdbuf();
+    return ss.str();
+}
 
+/*
+ *  Decodes the raw contents of a file, detecting UTF-16/32 from the BOM and
+ *  falling back to latin-1 if the data isn't valid UTF-8
+ */
+static unicode decode_file_contents(const std::string& str, std::string* encoding_out=nullptr) {
     std::string enc;
 
     enc = "utf-8";
@@ -55,7 +59,9 @@ static unicode read_file_contents(const unicode& filename, std::string* encoding
              */
             unicode ret(str, "iso-8859-1");
             ret.encode();
-            *encoding_out = "iso-8859-1";
+            if(encoding_out) {
+                *encoding_out = "iso-8859-1";
+            }
             return ret;
         } else {
             throw;
@@ -63,6 +69,9 @@ static unicode read_file_contents(const unicode& filename, std::string* encoding
     }
 }
 
+static unicode read_file_contents(const unicode& filename, std::string* encoding_out=nullptr) {
+    return decode_file_contents(read_file_bytes(filename), encoding_out);
+}
 
 static std::vector<unicode> read_file_lines(const unicode& filename, std::string* encoding_out=nullptr) {
     return read_file_contents(filename, encoding_out).replace("\r\n", "\n").split("\n");
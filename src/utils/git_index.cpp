@@ -0,0 +1,267 @@
+#include <cstring>
+#include <fstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "git_index.h"
+#include "kfs.h"
+
+namespace delimit {
+
+static const std::size_t HEADER_SIZE = 12;
+static const std::size_t ENTRY_FIXED_SIZE = 62; // Stat data, sha1 and flags
+static const uint16_t FLAG_EXTENDED = 0x4000;
+static const uint16_t NAME_MASK = 0x0FFF;
+
+static uint32_t read_u32(const uint8_t* data) {
+    return (uint32_t(data[0]) << 24) | (uint32_t(data[1]) << 16) | (uint32_t(data[2]) << 8) | uint32_t(data[3]);
+}
+
+static uint16_t read_u16(const uint8_t* data) {
+    return uint16_t((data[0] << 8) | data[1]);
+}
+
+static bool read_varint(const uint8_t*& it, const uint8_t* end, uint64_t& out) {
+    /*
+     *  Git's offset encoding, not quite the usual varint: each continuation
+     *  adds one before shifting so that there is only one way to encode a value
+     */
+    if(it == end) {
+        return false;
+    }
+
+    uint8_t c = *it++;
+    uint64_t value = c & 0x7F;
+    while(c & 0x80) {
+        if(it == end || value > (UINT64_MAX >> 7)) {
+            return false;
+        }
+        c = *it++;
+        value = ((value + 1) << 7) | (c & 0x7F);
+    }
+
+    out = value;
+    return true;
+}
+
+GitIndex::GitIndex(const std::string& work_tree):
+    work_tree_(work_tree) {
+
+    while(work_tree_.length() > 1 && work_tree_.back() == '/') {
+        work_tree_.pop_back();
+    }
+}
+
+std::string GitIndex::find_index(const std::string& work_tree) {
+    auto dot_git = kfs::path::join(work_tree, ".git");
+
+    struct stat st;
+    if(::stat(dot_git.c_str(), &st) == -1) {
+        return std::string();
+    }
+
+    if(S_ISDIR(st.st_mode)) {
+        return kfs::path::join(dot_git, "index");
+    }
+
+    // Worktrees and submodules have a .git file pointing at the real directory
+    std::ifstream in(dot_git.c_str());
+    std::string line;
+    std::getline(in, line);
+
+    const std::string PREFIX = "gitdir: ";
+    if(line.compare(0, PREFIX.length(), PREFIX) != 0) {
+        return std::string();
+    }
+
+    std::string git_dir = line.substr(PREFIX.length());
+    while(!git_dir.empty() && (git_dir.back() == '\r' || git_dir.back() == ' ')) {
+        git_dir.pop_back();
+    }
+
+    if(git_dir.empty()) {
+        return std::string();
+    }
+
+    if(git_dir[0] != '/') {
+        git_dir = kfs::path::join(work_tree, git_dir);
+    }
+
+    return kfs::path::join(git_dir, "index");
+}
+
+bool GitIndex::load() {
+    entries_.clear();
+    version_ = 0;
+
+    auto index_path = find_index(work_tree_);
+    if(index_path.empty()) {
+        return false;
+    }
+
+    int fd = ::open(index_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd == -1) {
+        return false;
+    }
+
+    struct stat st;
+    if(::fstat(fd, &st) == -1 || st.st_size < off_t(HEADER_SIZE)) {
+        ::close(fd);
+        return false;
+    }
+
+    std::size_t length = st.st_size;
+    void* data = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+
+    if(data == MAP_FAILED) {
+        return false;
+    }
+
+    bool ok = parse(static_cast<const uint8_t*>(data), length);
+    ::munmap(data, length);
+
+    if(!ok) {
+        entries_.clear();
+        version_ = 0;
+    }
+
+    return ok;
+}
+
+bool GitIndex::parse(const uint8_t* data, std::size_t length) {
+    const uint8_t* end = data + length;
+
+    if(std::memcmp(data, "DIRC", 4) != 0) {
+        return false;
+    }
+
+    version_ = read_u32(data + 4);
+    if(version_ < 2 || version_ > 4) {
+        return false;
+    }
+
+    uint32_t count = read_u32(data + 8);
+
+    // Every entry takes at least the fixed part plus a terminator, so a bogus count can't make us over-allocate
+    if(count > (length - HEADER_SIZE) / (ENTRY_FIXED_SIZE + 1)) {
+        return false;
+    }
+
+    entries_.reserve(count);
+
+    const uint8_t* it = data + HEADER_SIZE;
+    std::string previous_path;
+
+    for(uint32_t i = 0; i < count; ++i) {
+        const uint8_t* entry_start = it;
+
+        if(std::size_t(end - it) < ENTRY_FIXED_SIZE) {
+            return false;
+        }
+
+        GitIndexEntry entry;
+        entry.ctime_sec = read_u32(it);
+        entry.ctime_nsec = read_u32(it + 4);
+        entry.mtime_sec = read_u32(it + 8);
+        entry.mtime_nsec = read_u32(it + 12);
+        entry.dev = read_u32(it + 16);
+        entry.ino = read_u32(it + 20);
+        entry.mode = read_u32(it + 24);
+        entry.uid = read_u32(it + 28);
+        entry.gid = read_u32(it + 32);
+        entry.size = read_u32(it + 36);
+        std::memcpy(entry.sha1, it + 40, 20);
+        entry.flags = read_u16(it + 60);
+        entry.extended_flags = 0;
+        it += ENTRY_FIXED_SIZE;
+
+        if(entry.flags & FLAG_EXTENDED) {
+            if(version_ < 3 || end - it < 2) {
+                return false;
+            }
+            entry.extended_flags = read_u16(it);
+            it += 2;
+        }
+
+        if(version_ == 4) {
+            // Each path drops some bytes from the end of the previous one, then appends a suffix
+            uint64_t strip = 0;
+            if(!read_varint(it, end, strip) || strip > previous_path.length()) {
+                return false;
+            }
+
+            auto terminator = static_cast<const uint8_t*>(std::memchr(it, '\0', end - it));
+            if(!terminator) {
+                return false;
+            }
+
+            entry.path.reserve(previous_path.length() - strip + (terminator - it));
+            entry.path.assign(previous_path, 0, previous_path.length() - strip);
+            entry.path.append(reinterpret_cast<const char*>(it), terminator - it);
+            it = terminator + 1;
+        } else {
+            std::size_t name_length = entry.flags & NAME_MASK;
+            const uint8_t* terminator = nullptr;
+
+            if(name_length < NAME_MASK) {
+                // The common case, the length is stored in the flags
+                if(std::size_t(end - it) <= name_length || it[name_length] != '\0') {
+                    return false;
+                }
+                terminator = it + name_length;
+            } else {
+                terminator = static_cast<const uint8_t*>(std::memchr(it, '\0', end - it));
+                if(!terminator) {
+                    return false;
+                }
+            }
+
+            entry.path.assign(reinterpret_cast<const char*>(it), terminator - it);
+
+            // Entries are NUL padded to a multiple of 8 bytes, with at least one NUL
+            std::size_t entry_length = (terminator - entry_start + 8) & ~std::size_t(7);
+            if(std::size_t(end - entry_start) < entry_length) {
+                return false;
+            }
+            it = entry_start + entry_length;
+        }
+
+        previous_path = entry.path;
+        entries_.push_back(std::move(entry));
+    }
+
+    return true;
+}
+
+std::vector<std::string> GitIndex::tracked_files() const {
+    std::vector<std::string> result;
+    result.reserve(entries_.size());
+
+    const std::string* last_path = nullptr;
+
+    for(auto& entry: entries_) {
+        if(entry.is_gitlink() || entry.is_skip_worktree()) {
+            continue;
+        }
+
+        // Sparse directory entries
+        if(!entry.path.empty() && entry.path.back() == '/') {
+            continue;
+        }
+
+        // Unmerged paths have an entry per stage, and entries are sorted by path
+        if(last_path && *last_path == entry.path) {
+            continue;
+        }
+        last_path = &entry.path;
+
+        result.push_back(work_tree_ + "/" + entry.path);
+    }
+
+    return result;
+}
+
+}
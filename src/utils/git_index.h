@@ -0,0 +1,73 @@
+#ifndef GIT_INDEX_H
+#define GIT_INDEX_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace delimit {
+
+/*
+ *  A single entry from the git index, along with the stat data git cached for it
+ *  when it was last staged. Paths are relative to the root of the work tree and
+ *  always use '/' as the separator.
+ */
+struct GitIndexEntry {
+    std::string path;
+
+    uint32_t ctime_sec;
+    uint32_t ctime_nsec;
+    uint32_t mtime_sec;
+    uint32_t mtime_nsec;
+    uint32_t dev;
+    uint32_t ino;
+    uint32_t mode;
+    uint32_t uid;
+    uint32_t gid;
+    uint32_t size;
+
+    uint8_t sha1[20];
+    uint16_t flags;
+    uint16_t extended_flags;
+
+    int stage() const { return (flags >> 12) & 0x3; }
+    bool is_gitlink() const { return (mode & 0170000) == 0160000; }
+    bool is_skip_worktree() const { return (extended_flags & 0x4000) != 0; }
+};
+
+/*
+ *  Reads the list of tracked files straight out of .git/index, rather than asking
+ *  a git subprocess for them. The file is mmapped and parsed in a single pass;
+ *  versions 2, 3 and 4 (prefix compressed paths) are supported. Extensions and
+ *  the trailing checksum are ignored.
+ */
+class GitIndex {
+public:
+    GitIndex(const std::string& work_tree);
+
+    /* Returns false if there is no index, or it isn't one we understand */
+    bool load();
+
+    uint32_t version() const { return version_; }
+    const std::vector<GitIndexEntry>& entries() const { return entries_; }
+
+    /*
+     *  Absolute paths of the files which should be present in the work tree:
+     *  submodules, unmerged duplicates and skip-worktree entries are left out
+     */
+    std::vector<std::string> tracked_files() const;
+
+    /* Finds the index for a work tree, following a .git file for worktrees and submodules */
+    static std::string find_index(const std::string& work_tree);
+
+private:
+    std::string work_tree_;
+    uint32_t version_ = 0;
+    std::vector<GitIndexEntry> entries_;
+
+    bool parse(const uint8_t* data, std::size_t length);
+};
+
+}
+
+#endif // GIT_INDEX_H
@@ -0,0 +1,395 @@
+#include <cstring>
+#include <fstream>
+#include <algorithm>
+
+#include "gitignore.h"
+#include "kfs.h"
+
+namespace delimit {
+
+static const std::vector<std::string> DEFAULT_IGNORE_PATTERNS = {
+    ".*",
+    "*.pyc"
+};
+
+GlobPattern::GlobPattern(const std::string& pattern) {
+    auto add_literal = [this](char c) {
+        if(!ops_.empty() && ops_.back().code == OP_LITERAL) {
+            ops_.back().text.push_back(c);
+        } else {
+            ops_.push_back(Op({OP_LITERAL, std::string(1, c), false}));
+        }
+    };
+
+    const std::size_t n = pattern.length();
+    std::size_t i = 0;
+
+    while(i < n) {
+        char c = pattern[i];
+
+        if(c == '\\' && i + 1 < n) {
+            add_literal(pattern[i + 1]);
+            i += 2;
+        } else if(c == '*') {
+            bool double_star = (i + 1 < n && pattern[i + 1] == '*');
+            bool segment_start = (i == 0 || pattern[i - 1] == '/');
+
+            if(double_star && segment_start && i + 2 < n && pattern[i + 2] == '/') {
+                ops_.push_back(Op({OP_ANY_DIRS, "", false}));
+                i += 3;
+            } else if(double_star && segment_start && i + 2 == n) {
+                ops_.push_back(Op({OP_ANYTHING, "", false}));
+                i += 2;
+            } else {
+                // Anything else is just a regular star, no matter how many there are
+                ops_.push_back(Op({OP_STAR, "", false}));
+                while(i < n && pattern[i] == '*') {
+                    ++i;
+                }
+            }
+        } else if(c == '?') {
+            ops_.push_back(Op({OP_ANY_CHAR, "", false}));
+            ++i;
+        } else if(c == '[') {
+            std::size_t j = i + 1;
+            Op op({OP_CLASS, "", false});
+
+            if(j < n && (pattern[j] == '!' || pattern[j] == '^')) {
+                op.negated = true;
+                ++j;
+            }
+
+            bool first = true;
+            while(j < n && (pattern[j] != ']' || first)) {
+                char lo = pattern[j];
+                char hi = lo;
+                if(j + 2 < n && pattern[j + 1] == '-' && pattern[j + 2] != ']') {
+                    hi = pattern[j + 2];
+                    j += 2;
+                }
+                op.text.push_back(lo);
+                op.text.push_back(hi);
+                first = false;
+                ++j;
+            }
+
+            if(j < n) {
+                ops_.push_back(op);
+                i = j + 1;
+            } else {
+                // No closing bracket, so it wasn't a class after all
+                add_literal(c);
+                ++i;
+            }
+        } else {
+            add_literal(c);
+            ++i;
+        }
+    }
+}
+
+bool GlobPattern::match(const std::string& str) const {
+    return match_from(0, str.c_str(), str.c_str() + str.length());
+}
+
+bool GlobPattern::match_class(const Op& op, char c) const {
+    bool found = false;
+    for(std::size_t i = 0; i + 1 < op.text.length(); i += 2) {
+        if(c >= op.text[i] && c <= op.text[i + 1]) {
+            found = true;
+            break;
+        }
+    }
+    return found != op.negated;
+}
+
+bool GlobPattern::match_from(uint32_t op, const char* str, const char* end) const {
+    while(op < ops_.size()) {
+        const Op& current = ops_[op];
+
+        switch(current.code) {
+            case OP_LITERAL: {
+                std::size_t length = current.text.length();
+                if(std::size_t(end - str) < length || std::memcmp(str, current.text.c_str(), length) != 0) {
+                    return false;
+                }
+                str += length;
+            } break;
+            case OP_ANY_CHAR:
+                if(str == end || *str == '/') {
+                    return false;
+                }
+                ++str;
+            break;
+            case OP_CLASS:
+                if(str == end || *str == '/' || !match_class(current, *str)) {
+                    return false;
+                }
+                ++str;
+            break;
+            case OP_STAR: {
+                if(op + 1 == ops_.size()) {
+                    return std::find(str, end, '/') == end;
+                }
+
+                for(const char* it = str; ; ++it) {
+                    if(match_from(op + 1, it, end)) {
+                        return true;
+                    }
+
+                    if(it == end || *it == '/') {
+                        return false;
+                    }
+                }
+            } break;
+            case OP_ANY_DIRS: {
+                for(const char* it = str; ; ) {
+                    if(match_from(op + 1, it, end)) {
+                        return true;
+                    }
+
+                    it = std::find(it, end, '/');
+                    if(it == end) {
+                        return false;
+                    }
+                    ++it;
+                }
+            } break;
+            case OP_ANYTHING:
+                return true;
+        }
+
+        ++op;
+    }
+
+    return str == end;
+}
+
+void IgnoreRules::add_pattern(const std::string& line) {
+    std::string pattern = line;
+
+    if(!pattern.empty() && pattern.back() == '\r') {
+        pattern.pop_back();
+    }
+
+    if(pattern.empty() || pattern[0] == '#') {
+        return;
+    }
+
+    // Trailing spaces are ignored unless they are escaped
+    while(!pattern.empty() && pattern.back() == ' ' && !(pattern.length() > 1 && pattern[pattern.length() - 2] == '\\')) {
+        pattern.pop_back();
+    }
+
+    Rule rule({rule_count_, false, false});
+
+    if(!pattern.empty() && pattern[0] == '!') {
+        rule.negated = true;
+        pattern.erase(0, 1);
+    } else if(pattern.length() > 1 && pattern[0] == '\\' && (pattern[1] == '!' || pattern[1] == '#')) {
+        pattern.erase(0, 1);
+    }
+
+    if(!pattern.empty() && pattern.back() == '/') {
+        rule.directory_only = true;
+        pattern.pop_back();
+    }
+
+    if(pattern.empty()) {
+        return;
+    }
+
+    // A slash anywhere but the end means the pattern is relative to this directory
+    bool anchored = pattern.find('/') != std::string::npos;
+    if(pattern[0] == '/') {
+        pattern.erase(0, 1);
+    }
+
+    ++rule_count_;
+
+    bool has_wildcards = pattern.find_first_of("*?[\\") != std::string::npos;
+
+    if(!anchored && !has_wildcards) {
+        names_[pattern].push_back(rule);
+    } else if(!anchored && pattern.length() > 2 && pattern[0] == '*' && pattern[1] == '.' &&
+              pattern.find_first_of("*?[\\.", 2) == std::string::npos) {
+        extensions_[pattern.substr(1)].push_back(rule);
+    } else {
+        globs_.push_back(GlobRule({rule, anchored, GlobPattern(pattern)}));
+    }
+}
+
+void IgnoreRules::load(const std::string& ignore_file) {
+    std::ifstream in(ignore_file.c_str());
+    std::string line;
+    while(std::getline(in, line)) {
+        add_pattern(line);
+    }
+}
+
+void IgnoreRules::consider(const std::vector<Rule>& rules, bool is_dir, const Rule*& best) const {
+    for(auto& rule: rules) {
+        if(rule.directory_only && !is_dir) {
+            continue;
+        }
+
+        if(!best || rule.index > best->index) {
+            best = &rule;
+        }
+    }
+}
+
+IgnoreMatch IgnoreRules::match(const std::string& relative_path, const std::string& name, bool is_dir) const {
+    const Rule* best = nullptr;
+
+    auto it = names_.find(name);
+    if(it != names_.end()) {
+        consider(it->second, is_dir, best);
+    }
+
+    auto dot = name.rfind('.');
+    if(dot != std::string::npos && !extensions_.empty()) {
+        auto ext = extensions_.find(name.substr(dot));
+        if(ext != extensions_.end()) {
+            consider(ext->second, is_dir, best);
+        }
+    }
+
+    // Work backwards, we can stop as soon as we reach rules older than the best match
+    for(auto glob = globs_.rbegin(); glob != globs_.rend(); ++glob) {
+        if(best && glob->rule.index < best->index) {
+            break;
+        }
+
+        if(glob->rule.directory_only && !is_dir) {
+            continue;
+        }
+
+        if(glob->pattern.match(glob->anchored ? relative_path : name)) {
+            best = &glob->rule;
+            break;
+        }
+    }
+
+    if(!best) {
+        return IGNORE_MATCH_NONE;
+    }
+
+    return (best->negated) ? IGNORE_MATCH_INCLUDED : IGNORE_MATCH_IGNORED;
+}
+
+static std::string relative_to(const std::string& directory, const std::string& path) {
+    if(directory == "/") {
+        return path.substr(1);
+    }
+    return path.substr(directory.length() + 1);
+}
+
+IgnoreTree::IgnoreTree(const std::string& root):
+    root_(root) {
+
+    while(root_.length() > 1 && root_.back() == '/') {
+        root_.pop_back();
+    }
+}
+
+bool IgnoreTree::is_ignored(const std::string& path, bool is_dir) {
+    if(path.length() <= root_.length() || path.compare(0, root_.length(), root_) != 0) {
+        // The root itself, or something outside of it
+        return false;
+    }
+
+    auto slash = path.rfind('/');
+    std::string directory = (slash == 0) ? "/" : path.substr(0, slash);
+    std::string name = path.substr(slash + 1);
+
+    for(LayerPtr layer = layer_for(directory); layer; layer = layer->parent) {
+        if(!layer->rules) {
+            continue;
+        }
+
+        auto result = layer->rules->match(relative_to(layer->directory, path), name, is_dir);
+        if(result != IGNORE_MATCH_NONE) {
+            return result == IGNORE_MATCH_IGNORED;
+        }
+    }
+
+    return false;
+}
+
+void IgnoreTree::invalidate(const std::string& directory) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    // Child layers point at their parent, so they have to go too
+    std::string prefix = directory + "/";
+    for(auto it = layers_.begin(); it != layers_.end();) {
+        if(it->first == directory || it->first.compare(0, prefix.length(), prefix) == 0) {
+            it = layers_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+IgnoreTree::LayerPtr IgnoreTree::layer_for(const std::string& directory) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    /*
+     *  Find the deepest directory we already have a layer for, then build the
+     *  missing ones on the way back down
+     */
+    std::vector<std::string> missing;
+    std::string current = directory;
+    LayerPtr parent;
+
+    while(true) {
+        auto it = layers_.find(current);
+        if(it != layers_.end()) {
+            parent = it->second;
+            break;
+        }
+
+        missing.push_back(current);
+
+        if(current.length() <= root_.length()) {
+            break;
+        }
+
+        auto slash = current.rfind('/');
+        current = (slash == 0) ? "/" : current.substr(0, slash);
+    }
+
+    for(auto it = missing.rbegin(); it != missing.rend(); ++it) {
+        auto layer = std::make_shared<Layer>();
+        layer->directory = *it;
+        layer->parent = parent;
+
+        auto rules = std::make_shared<IgnoreRules>();
+        if(*it == root_) {
+            for(auto& pattern: DEFAULT_IGNORE_PATTERNS) {
+                rules->add_pattern(pattern);
+            }
+
+            auto exclude = kfs::path::join(kfs::path::join(root_, ".git"), kfs::path::join("info", "exclude"));
+            if(kfs::path::exists(exclude)) {
+                rules->load(exclude);
+            }
+        }
+
+        auto ignore_file = kfs::path::join(*it, ".gitignore");
+        if(kfs::path::exists(ignore_file)) {
+            rules->load(ignore_file);
+        }
+
+        if(!rules->empty()) {
+            layer->rules = rules;
+        }
+
+        layers_[*it] = layer;
+        parent = layer;
+    }
+
+    return parent;
+}
+
+}
@@ -0,0 +1,137 @@
+#ifndef GITIGNORE_H
+#define GITIGNORE_H
+
+#include <mutex>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+namespace delimit {
+
+/*
+ *  A single glob, compiled into a flat list of matching instructions so that we don't
+ *  reparse the pattern text every time we test a path. Follows the gitignore flavour
+ *  of globbing: '*' and '?' never cross a '/', '**' does.
+ */
+class GlobPattern {
+public:
+    GlobPattern() {}
+    GlobPattern(const std::string& pattern);
+
+    bool match(const std::string& str) const;
+
+private:
+    enum OpCode {
+        OP_LITERAL,
+        OP_ANY_CHAR,
+        OP_STAR,
+        OP_ANY_DIRS, // "**/", zero or more whole directories
+        OP_ANYTHING, // trailing "**", everything including '/'
+        OP_CLASS
+    };
+
+    struct Op {
+        OpCode code;
+        std::string text; // Literal text, or pairs of range bounds for a class
+        bool negated;
+    };
+
+    std::vector<Op> ops_;
+
+    bool match_from(uint32_t op, const char* str, const char* end) const;
+    bool match_class(const Op& op, char c) const;
+};
+
+enum IgnoreMatch {
+    IGNORE_MATCH_NONE = 0,
+    IGNORE_MATCH_IGNORED,
+    IGNORE_MATCH_INCLUDED
+};
+
+/*
+ *  The rules from a single ignore file (or a set of default rules). Patterns which are
+ *  just a literal name, or just "*.ext", are by far the most common so they are kept
+ *  in hash tables and answered with a single lookup. Everything else is tested with
+ *  its compiled GlobPattern. As with git, the last matching rule wins.
+ */
+class IgnoreRules {
+public:
+    void add_pattern(const std::string& line);
+    void load(const std::string& ignore_file);
+
+    bool empty() const { return rule_count_ == 0; }
+
+    /*
+     *  relative_path is relative to the directory the rules were loaded from, name is
+     *  the final component of the path
+     */
+    IgnoreMatch match(const std::string& relative_path, const std::string& name, bool is_dir) const;
+
+private:
+    struct Rule {
+        uint32_t index;
+        bool negated;
+        bool directory_only;
+    };
+
+    struct GlobRule {
+        Rule rule;
+        bool anchored;
+        GlobPattern pattern;
+    };
+
+    uint32_t rule_count_ = 0;
+
+    std::unordered_map<std::string, std::vector<Rule>> names_;
+    std::unordered_map<std::string, std::vector<Rule>> extensions_;
+    std::vector<GlobRule> globs_;
+
+    void consider(const std::vector<Rule>& rules, bool is_dir, const Rule*& best) const;
+};
+
+/*
+ *  Answers "is this path ignored?" for everything below a root directory. Each
+ *  directory's .gitignore is loaded (once) the first time something inside it is
+ *  tested, and layered on top of its parent directories' rules. Crawlers should test
+ *  each directory before descending into it so that whole subtrees get pruned.
+ *
+ *  The root also picks up .git/info/exclude, and the defaults which Delimit has always
+ *  applied: hidden files and *.pyc are ignored.
+ *
+ *  Instances are thread safe and intended to be shared between everything that crawls
+ *  the same project.
+ */
+class IgnoreTree {
+public:
+    IgnoreTree(const std::string& root);
+
+    const std::string& root() const { return root_; }
+
+    bool is_ignored(const std::string& path, bool is_dir);
+
+    /* Forget any loaded rules for a directory, e.g. when its .gitignore changes */
+    void invalidate(const std::string& directory);
+
+private:
+    struct Layer {
+        std::string directory;
+        std::shared_ptr<IgnoreRules> rules;
+        std::shared_ptr<Layer> parent;
+    };
+
+    typedef std::shared_ptr<Layer> LayerPtr;
+
+    std::string root_;
+    std::mutex mutex_;
+    std::unordered_map<std::string, LayerPtr> layers_;
+
+    LayerPtr layer_for(const std::string& directory);
+};
+
+typedef std::shared_ptr<IgnoreTree> IgnoreTreePtr;
+
+}
+
+#endif // GITIGNORE_H
@@ -0,0 +1,535 @@
+#include <cerrno>
+#include <cstring>
+#include <unordered_set>
+#include <algorithm>
+#include <functional>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+#include "project_watcher.h"
+#include "kazlog.h"
+#include "kfs.h"
+
+namespace delimit {
+
+static const uint32_t WATCH_MASK = (
+    IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_CLOSE_WRITE |
+    IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK
+);
+
+// Git replaces HEAD by renaming HEAD.lock over it
+static const uint32_t HEAD_WATCH_MASK = IN_MOVED_TO | IN_CLOSE_WRITE | IN_ONLYDIR;
+
+static const std::chrono::milliseconds QUIET_PERIOD(100);
+static const std::chrono::milliseconds MAX_DELAY(1000);
+static const int FLUSH_CHECK_INTERVAL_MS = 50;
+static const int POLL_INTERVAL_SECONDS = 5;
+
+static std::string parent_directory(const std::string& path) {
+    auto slash = path.rfind('/');
+    if(slash == std::string::npos) {
+        return std::string();
+    }
+    return (slash == 0) ? "/" : path.substr(0, slash);
+}
+
+void WatchBatch::add_existing(const std::vector<std::string>& files) {
+    files_.insert(files.begin(), files.end());
+}
+
+void WatchBatch::record(const std::string& path, bool is_dir, bool exists, bool modified) {
+    auto it = pending_.find(path);
+    if(it == pending_.end()) {
+        // Modifications and deletions mean the path was there before this batch, creations only if it's a file we knew about
+        PendingChange change;
+        change.is_dir = is_dir;
+        change.existed_before = !exists || modified || (!is_dir && files_.count(path));
+        change.exists_now = exists;
+        change.replaced = change.existed_before && exists && !modified;
+        change.modified = modified;
+
+        pending_[path] = change;
+    } else {
+        PendingChange& change = it->second;
+
+        // Deleting what was there, or creating something in its place, replaces it
+        if(change.existed_before && !modified) {
+            change.replaced = true;
+        }
+        change.is_dir = is_dir;
+        change.exists_now = exists;
+        change.modified = change.modified || modified;
+    }
+}
+
+void WatchBatch::take(const std::string& root, WatchDelta& delta) {
+    /*
+     *  The map is sorted, so a directory always comes before its contents. Anything inside
+     *  a deleted directory is implied by the directory, so doesn't need reporting
+     */
+    std::unordered_set<std::string> deleted_directories;
+    auto inside_deleted_directory = [&](const std::string& path) -> bool {
+        for(auto parent = parent_directory(path); parent.length() > root.length(); parent = parent_directory(parent)) {
+            if(deleted_directories.count(parent)) {
+                return true;
+            }
+        }
+        return false;
+    };
+
+    for(auto& pair: pending_) {
+        const std::string& path = pair.first;
+        const PendingChange& change = pair.second;
+
+        if(!change.existed_before && !change.exists_now) {
+            // Came and went within the batch
+            continue;
+        }
+
+        if(change.existed_before && (!change.exists_now || change.replaced) && inside_deleted_directory(path)) {
+            continue;
+        }
+
+        if(change.is_dir) {
+            if(change.existed_before && (!change.exists_now || change.replaced)) {
+                delta.deleted_directories.push_back(path);
+                deleted_directories.insert(path);
+
+                std::string prefix = path + "/";
+                auto first = files_.lower_bound(prefix);
+                auto last = first;
+                while(last != files_.end() && last->compare(0, prefix.length(), prefix) == 0) {
+                    ++last;
+                }
+                files_.erase(first, last);
+            }
+
+            if(change.exists_now && (!change.existed_before || change.replaced)) {
+                delta.created_directories.push_back(path);
+            }
+        } else {
+            if(!change.existed_before) {
+                delta.created.push_back(path);
+                files_.insert(path);
+            } else if(!change.exists_now) {
+                delta.deleted.push_back(path);
+                files_.erase(path);
+            } else if(change.replaced || change.modified) {
+                delta.modified.push_back(path);
+                files_.insert(path);
+            }
+        }
+    }
+
+    pending_.clear();
+}
+
+void WatchBatch::clear() {
+    pending_.clear();
+    files_.clear();
+}
+
+ProjectWatcher::ProjectWatcher(const std::string& root, IgnoreTreePtr ignore_tree):
+    root_(root),
+    ignore_tree_(ignore_tree),
+    stopping_(false) {
+
+    while(root_.length() > 1 && root_.back() == '/') {
+        root_.pop_back();
+    }
+
+    if(!ignore_tree_) {
+        ignore_tree_ = std::make_shared<IgnoreTree>(root_);
+    }
+}
+
+ProjectWatcher::~ProjectWatcher() {
+    stop();
+}
+
+bool ProjectWatcher::start() {
+    if(fd_ != -1) {
+        return true;
+    }
+
+    fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if(fd_ == -1) {
+        L_ERROR(_F("Unable to initialize inotify: {0}").format(std::strerror(errno)));
+        return false;
+    }
+
+    stopping_ = false;
+
+    io_connection_ = Glib::signal_io().connect(
+        sigc::mem_fun(this, &ProjectWatcher::on_io), fd_, Glib::IO_IN | Glib::IO_HUP
+    );
+
+    poll_connection_ = Glib::signal_timeout().connect_seconds(
+        sigc::mem_fun(this, &ProjectWatcher::on_poll_timeout), POLL_INTERVAL_SECONDS
+    );
+
+    auto git_dir = kfs::path::join(root_, ".git");
+    if(kfs::path::is_dir(git_dir)) {
+        head_wd_ = inotify_add_watch(fd_, git_dir.c_str(), HEAD_WATCH_MASK);
+    }
+
+    // Registering thousands of watches takes a while, so don't block the main loop
+    initial_crawl_ = std::async(std::launch::async, std::bind(&ProjectWatcher::crawl, this));
+
+    return true;
+}
+
+void ProjectWatcher::stop() {
+    stopping_ = true;
+
+    if(initial_crawl_.valid()) {
+        initial_crawl_.wait();
+    }
+
+    io_connection_.disconnect();
+    flush_connection_.disconnect();
+    poll_connection_.disconnect();
+
+    if(fd_ != -1) {
+        ::close(fd_); // Removes all of the watches
+        fd_ = -1;
+    }
+
+    head_wd_ = -1;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    directories_by_wd_.clear();
+    wds_by_directory_.clear();
+    unwatched_.clear();
+    batch_.clear();
+}
+
+bool ProjectWatcher::is_degraded() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return !unwatched_.empty();
+}
+
+void ProjectWatcher::crawl() {
+    // The files which are found are the ones a rename can replace
+    std::vector<std::string> files;
+    add_watches(root_, &files);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    batch_.add_existing(files);
+}
+
+bool ProjectWatcher::add_watch(const std::string& directory) {
+    int wd = inotify_add_watch(fd_, directory.c_str(), WATCH_MASK);
+
+    if(wd == -1) {
+        if(errno == ENOSPC) {
+            struct stat st;
+            if(::stat(directory.c_str(), &st) == 0) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                unwatched_[directory] = st.st_mtime;
+
+                if(!warned_about_limit_) {
+                    warned_about_limit_ = true;
+                    L_WARN(
+                        "Ran out of inotify watches, some directories will be polled instead. "
+                        "Consider raising /proc/sys/fs/inotify/max_user_watches"
+                    );
+                }
+            }
+        }
+        // Anything else (e.g. the directory was removed already) is just skipped
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    directories_by_wd_[wd] = directory;
+    wds_by_directory_[directory] = wd;
+    return true;
+}
+
+void ProjectWatcher::add_watches(const std::string& directory, std::vector<std::string>* found_files) {
+    /*
+     *  Watches a directory and everything below it, skipping ignored paths. If found_files
+     *  is given, it's filled with the files that were found on the way down (used when a
+     *  directory appears, as its contents may have been created before we were watching).
+     *  Symlinks aren't followed, so we can't end up in a loop.
+     */
+    std::vector<std::string> stack;
+    stack.push_back(directory);
+
+    while(!stack.empty() && !stopping_) {
+        std::string current = stack.back();
+        stack.pop_back();
+
+        add_watch(current);
+
+        DIR* dir = ::opendir(current.c_str());
+        if(!dir) {
+            continue;
+        }
+
+        while(dirent* entry = ::readdir(dir)) {
+            if(std::strcmp(entry->d_name, ".") == 0 || std::strcmp(entry->d_name, "..") == 0) {
+                continue;
+            }
+
+            std::string path = current + "/" + entry->d_name;
+
+            bool is_dir = false;
+            if(entry->d_type == DT_UNKNOWN) {
+                struct stat st;
+                if(::lstat(path.c_str(), &st) == -1) {
+                    continue;
+                }
+                is_dir = S_ISDIR(st.st_mode);
+            } else {
+                is_dir = (entry->d_type == DT_DIR);
+            }
+
+            if(ignore_tree_->is_ignored(path, is_dir)) {
+                continue;
+            }
+
+            if(is_dir) {
+                stack.push_back(path);
+            } else if(found_files) {
+                found_files->push_back(path);
+            }
+        }
+
+        ::closedir(dir);
+    }
+}
+
+void ProjectWatcher::remove_watches(const std::string& directory) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    std::string prefix = directory + "/";
+    for(auto it = wds_by_directory_.begin(); it != wds_by_directory_.end();) {
+        if(it->first == directory || it->first.compare(0, prefix.length(), prefix) == 0) {
+            inotify_rm_watch(fd_, it->second);
+            directories_by_wd_.erase(it->second);
+            it = wds_by_directory_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    for(auto it = unwatched_.begin(); it != unwatched_.end();) {
+        if(it->first == directory || it->first.compare(0, prefix.length(), prefix) == 0) {
+            it = unwatched_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+bool ProjectWatcher::on_io(Glib::IOCondition condition) {
+    alignas(struct inotify_event) char buffer[64 * 1024];
+
+    while(true) {
+        ssize_t length = ::read(fd_, buffer, sizeof(buffer));
+        if(length <= 0) {
+            // EAGAIN means we've drained the queue
+            break;
+        }
+
+        for(char* ptr = buffer; ptr < buffer + length;) {
+            auto event = reinterpret_cast<const struct inotify_event*>(ptr);
+            ptr += sizeof(struct inotify_event) + event->len;
+
+            if(event->mask & IN_Q_OVERFLOW) {
+                overflowed_ = true;
+                note_event();
+                continue;
+            }
+
+            if(event->wd == head_wd_) {
+                if(event->len && std::strcmp(event->name, "HEAD") == 0) {
+                    head_changed_ = true;
+                    note_event();
+                }
+                continue;
+            }
+
+            std::string directory;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+
+                if(event->mask & IN_IGNORED) {
+                    // The kernel dropped the watch, e.g. because the directory is gone
+                    auto it = directories_by_wd_.find(event->wd);
+                    if(it != directories_by_wd_.end()) {
+                        auto other = wds_by_directory_.find(it->second);
+                        if(other != wds_by_directory_.end() && other->second == event->wd) {
+                            wds_by_directory_.erase(other);
+                        }
+                        directories_by_wd_.erase(it);
+                    }
+                    continue;
+                }
+
+                auto it = directories_by_wd_.find(event->wd);
+                if(it == directories_by_wd_.end()) {
+                    continue;
+                }
+                directory = it->second;
+            }
+
+            if(!event->len) {
+                // Events about the watched directory itself are reported by its parent
+                continue;
+            }
+
+            std::string name = event->name;
+            std::string path = directory + "/" + name;
+            bool is_dir = (event->mask & IN_ISDIR) != 0;
+
+            if(name == ".gitignore") {
+                ignore_tree_->invalidate(directory);
+                rescan_.push_back(directory);
+                note_event();
+            }
+
+            if(ignore_tree_->is_ignored(path, is_dir)) {
+                continue;
+            }
+
+            if(event->mask & (IN_CREATE | IN_MOVED_TO)) {
+                if(is_dir) {
+                    std::vector<std::string> found;
+                    add_watches(path, &found);
+                    record(path, true, true, false);
+
+                    for(auto& file: found) {
+                        record(file, false, true, false);
+                    }
+                } else {
+                    record(path, false, true, false);
+                }
+            } else if(event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                if(is_dir) {
+                    // A moved directory keeps its watches, but they'd report the old paths
+                    remove_watches(path);
+                }
+                record(path, is_dir, false, false);
+            } else if(event->mask & IN_CLOSE_WRITE) {
+                record(path, false, true, true);
+            }
+        }
+    }
+
+    return true;
+}
+
+void ProjectWatcher::note_event() {
+    auto now = Clock::now();
+
+    if(!flush_connection_.connected()) {
+        // This is the start of a new batch
+        first_event_ = now;
+    }
+    last_event_ = now;
+
+    schedule_flush();
+}
+
+void ProjectWatcher::record(const std::string& path, bool is_dir, bool exists, bool modified) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        batch_.record(path, is_dir, exists, modified);
+    }
+
+    note_event();
+}
+
+void ProjectWatcher::schedule_flush() {
+    if(flush_connection_.connected()) {
+        return;
+    }
+
+    flush_connection_ = Glib::signal_timeout().connect(
+        sigc::mem_fun(this, &ProjectWatcher::on_flush_timeout), FLUSH_CHECK_INTERVAL_MS
+    );
+}
+
+bool ProjectWatcher::on_flush_timeout() {
+    auto now = Clock::now();
+
+    // Keep waiting while events are still arriving, unless they've been arriving for too long
+    if(now - last_event_ < QUIET_PERIOD && now - first_event_ < MAX_DELAY) {
+        return true;
+    }
+
+    flush();
+    return false;
+}
+
+bool ProjectWatcher::on_poll_timeout() {
+    std::vector<std::pair<std::string, time_t>> unwatched;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if(unwatched_.empty()) {
+            return true;
+        }
+        unwatched.assign(unwatched_.begin(), unwatched_.end());
+    }
+
+    std::vector<std::string> changed;
+    for(auto& entry: unwatched) {
+        struct stat st;
+        if(::stat(entry.first.c_str(), &st) == -1) {
+            changed.push_back(entry.first);
+            continue;
+        }
+
+        if(st.st_mtime != entry.second) {
+            changed.push_back(entry.first);
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            unwatched_[entry.first] = st.st_mtime;
+        }
+    }
+
+    if(!changed.empty()) {
+        rescan_.insert(rescan_.end(), changed.begin(), changed.end());
+        note_event();
+    }
+
+    return true;
+}
+
+void ProjectWatcher::flush() {
+    WatchDelta delta;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        batch_.take(root_, delta);
+    }
+
+    std::sort(rescan_.begin(), rescan_.end());
+    rescan_.erase(std::unique(rescan_.begin(), rescan_.end()), rescan_.end());
+    delta.rescan_directories.swap(rescan_);
+
+    delta.head_changed = head_changed_;
+    delta.overflowed = overflowed_;
+
+    if(overflowed_ && (!initial_crawl_.valid() || initial_crawl_.wait_for(std::chrono::seconds(0)) == std::future_status::ready)) {
+        // We may have missed new directories, so walk the tree again. Existing watches are reused
+        initial_crawl_ = std::async(std::launch::async, std::bind(&ProjectWatcher::crawl, this));
+    }
+
+    head_changed_ = false;
+    overflowed_ = false;
+
+    if(!delta.empty()) {
+        L_DEBUG(_F("Project changed: {0} created, {1} deleted, {2} modified").format(
+            delta.created.size(), delta.deleted.size(), delta.modified.size()
+        ));
+        signal_changed_(delta);
+    }
+}
+
+}
@@ -0,0 +1,150 @@
+#ifndef PROJECT_WATCHER_H
+#define PROJECT_WATCHER_H
+
+#include <map>
+#include <set>
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <future>
+#include <unordered_map>
+#include <gtkmm.h>
+
+#include "gitignore.h"
+
+namespace delimit {
+
+/*
+ *  Everything that changed in a project since the last delta. Each path appears at
+ *  most once. Consumers should apply deletions before creations, a directory which
+ *  was deleted and recreated appears in both lists.
+ */
+struct WatchDelta {
+    std::vector<std::string> created;
+    std::vector<std::string> deleted;
+    std::vector<std::string> modified;
+
+    std::vector<std::string> created_directories;
+    std::vector<std::string> deleted_directories;
+
+    // Directories whose contents changed, but which we couldn't track individually
+    std::vector<std::string> rescan_directories;
+
+    bool head_changed = false; // The checked out branch or commit may have changed
+    bool overflowed = false; // Events were lost, everything should be rescanned
+
+    bool empty() const {
+        return created.empty() && deleted.empty() && modified.empty() &&
+            created_directories.empty() && deleted_directories.empty() &&
+            rescan_directories.empty() && !head_changed && !overflowed;
+    }
+};
+
+/*
+ *  The changes to paths since the last delta, merged so each path is reported once with
+ *  what happened to it overall. Something created where a file we knew about was (a
+ *  rename over it, as an atomic save does, or a delete then a create) is a modification
+ *  of that file. A path which came and went is left out.
+ */
+class WatchBatch {
+public:
+    /* Files which were found by crawling, rather than through an event */
+    void add_existing(const std::vector<std::string>& files);
+
+    /* modified is for writes, which mean the path existed before */
+    void record(const std::string& path, bool is_dir, bool exists, bool modified);
+
+    bool empty() const { return pending_.empty(); }
+
+    /* Adds everything recorded to the delta, and starts a new batch */
+    void take(const std::string& root, WatchDelta& delta);
+
+    void clear();
+
+private:
+    struct PendingChange {
+        bool is_dir;
+        bool existed_before;
+        bool exists_now;
+        bool replaced;
+        bool modified;
+    };
+
+    std::map<std::string, PendingChange> pending_;
+
+    // Every file we know is there, sorted so a deleted directory's files are together
+    std::set<std::string> files_;
+};
+
+/*
+ *  A single inotify instance watching every (non-ignored) directory in a project.
+ *  Events are read in the main loop and merged by path, a delta is only published once
+ *  things have been quiet for a moment (or a storm has gone on for too long) so that
+ *  something like a branch switch arrives as one update.
+ *
+ *  If the kernel's watch limit is reached, the directories we couldn't watch are polled
+ *  for mtime changes instead and reported as rescan_directories.
+ */
+class ProjectWatcher {
+public:
+    ProjectWatcher(const std::string& root, IgnoreTreePtr ignore_tree);
+    ~ProjectWatcher();
+
+    bool start();
+    void stop();
+
+    bool is_degraded() const;
+
+    sigc::signal<void, const WatchDelta&>& signal_changed() { return signal_changed_; }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    std::string root_;
+    IgnoreTreePtr ignore_tree_;
+
+    int fd_ = -1;
+    int head_wd_ = -1;
+
+    mutable std::mutex mutex_; // Protects the watch tables and the batch while the initial crawl runs
+    std::unordered_map<int, std::string> directories_by_wd_;
+    std::unordered_map<std::string, int> wds_by_directory_;
+
+    std::map<std::string, time_t> unwatched_;
+    bool warned_about_limit_ = false;
+
+    WatchBatch batch_;
+    std::vector<std::string> rescan_;
+    bool head_changed_ = false;
+    bool overflowed_ = false;
+    Clock::time_point first_event_;
+    Clock::time_point last_event_;
+
+    std::atomic<bool> stopping_;
+    std::future<void> initial_crawl_;
+    sigc::connection io_connection_;
+    sigc::connection flush_connection_;
+    sigc::connection poll_connection_;
+
+    sigc::signal<void, const WatchDelta&> signal_changed_;
+
+    void crawl();
+    void add_watches(const std::string& directory, std::vector<std::string>* found_files);
+    bool add_watch(const std::string& directory);
+    void remove_watches(const std::string& directory);
+
+    bool on_io(Glib::IOCondition condition);
+    bool on_flush_timeout();
+    bool on_poll_timeout();
+
+    void record(const std::string& path, bool is_dir, bool exists, bool modified);
+    void note_event();
+    void schedule_flush();
+    void flush();
+};
+
+}
+
+#endif // PROJECT_WATCHER_H
@@ -0,0 +1,517 @@
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <mutex>
+#include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "sigc_lambda.h"
+#include "subprocess.h"
+#include "kazlog.h"
+
+extern char** environ;
+
+namespace delimit {
+
+namespace {
+
+const int SYNC_POLL_INTERVAL_MS = 50;
+
+// What's searched when there's no PATH at all
+const char* const DEFAULT_PATH = "/usr/bin:/bin";
+
+void ignore_sigpipe() {
+    // Writing to a process which has stopped reading would otherwise kill us
+    static std::once_flag once;
+    std::call_once(once, []() { signal(SIGPIPE, SIG_IGN); });
+}
+
+void set_non_blocking(int fd) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+void close_fds(int* fds, int count) {
+    for(int i = 0; i < count; ++i) {
+        if(fds[i] != -1) {
+            ::close(fds[i]);
+        }
+    }
+}
+
+std::map<std::string, std::string> build_environment(const SubprocessOptions& options) {
+    std::map<std::string, std::string> result;
+
+    if(options.inherit_environment) {
+        for(char** entry = environ; *entry; ++entry) {
+            const char* equals = strchr(*entry, '=');
+            if(equals) {
+                result[std::string(*entry, equals - *entry)] = equals + 1;
+            }
+        }
+    }
+
+    for(auto& variable: options.environment) {
+        result[variable.first] = variable.second;
+    }
+
+    return result;
+}
+
+std::vector<char*> null_terminated(std::vector<std::string>& strings) {
+    std::vector<char*> result;
+    for(auto& str: strings) {
+        result.push_back(&str[0]);
+    }
+    result.push_back(nullptr);
+    return result;
+}
+
+std::string find_in_path(const std::string& name, const char* path_variable) {
+    std::string path = (path_variable) ? path_variable : DEFAULT_PATH;
+
+    auto is_program = [](const std::string& candidate) {
+        struct stat st;
+        return ::stat(candidate.c_str(), &st) == 0 && !S_ISDIR(st.st_mode) && access(candidate.c_str(), X_OK) == 0;
+    };
+
+    if(name.find('/') != std::string::npos) {
+        return is_program(name) ? name : std::string();
+    }
+
+    std::size_t start = 0;
+    while(start <= path.size()) {
+        auto end = path.find(':', start);
+        if(end == std::string::npos) {
+            end = path.size();
+        }
+
+        // An empty entry means the current directory
+        std::string directory = (end > start) ? path.substr(start, end - start) : ".";
+        std::string candidate = directory + "/" + name;
+        if(is_program(candidate)) {
+            return candidate;
+        }
+
+        start = end + 1;
+    }
+
+    return std::string();
+}
+
+}
+
+std::string find_program(const std::string& name) {
+    return find_in_path(name, getenv("PATH"));
+}
+
+Subprocess::Subprocess(const SubprocessOptions& options):
+    options_(options) {
+
+}
+
+Subprocess::~Subprocess() {
+    timeout_.disconnect();
+    child_watch_.disconnect();
+
+    close_pipe(output_[SUBPROCESS_STDOUT]);
+    close_pipe(output_[SUBPROCESS_STDERR]);
+    close_pipe(input_);
+
+    if(running()) {
+        kill_group();
+        waitpid(pid_, nullptr, 0); // Killed, so this won't be long
+    }
+}
+
+bool Subprocess::spawn() {
+    if(pid_ != -1) {
+        throw std::logic_error("A Subprocess can only be started once");
+    }
+
+    if(options_.argv.empty()) {
+        result_.error = "No command was given";
+        return false;
+    }
+
+    ignore_sigpipe();
+
+    auto environment = build_environment(options_);
+
+    auto path = environment.find("PATH");
+    std::string program = find_in_path(options_.argv[0], (path != environment.end()) ? path->second.c_str() : nullptr);
+    if(program.empty()) {
+        result_.error = _F("Unable to find {0}").format(options_.argv[0]);
+        return false;
+    }
+
+    int in[2] = {-1, -1};
+    int out[2] = {-1, -1};
+    int err[2] = {-1, -1};
+
+    if(pipe2(in, O_CLOEXEC) == -1 || pipe2(out, O_CLOEXEC) == -1 || pipe2(err, O_CLOEXEC) == -1) {
+        result_.error = std::strerror(errno);
+        close_fds(in, 2);
+        close_fds(out, 2);
+        close_fds(err, 2);
+        return false;
+    }
+
+    // dup2 clears close-on-exec on the copies, everything else of ours is closed by exec
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, in[0], STDIN_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, out[1], STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, err[1], STDERR_FILENO);
+
+    int error = 0;
+    if(!options_.cwd.empty()) {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 29))
+        error = posix_spawn_file_actions_addchdir_np(&actions, options_.cwd.c_str());
+#else
+        error = ENOSYS;
+#endif
+    }
+
+    // Its own process group, so killing it kills its children too. SIGPIPE is
+    // ignored here, which would be inherited
+    posix_spawnattr_t attributes;
+    posix_spawnattr_init(&attributes);
+    posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK);
+    posix_spawnattr_setpgroup(&attributes, 0);
+
+    sigset_t defaults, mask;
+    sigemptyset(&defaults);
+    sigaddset(&defaults, SIGPIPE);
+    sigemptyset(&mask);
+    posix_spawnattr_setsigdefault(&attributes, &defaults);
+    posix_spawnattr_setsigmask(&attributes, &mask);
+
+    std::vector<std::string> args = options_.argv;
+    std::vector<std::string> variables;
+    for(auto& variable: environment) {
+        variables.push_back(variable.first + "=" + variable.second);
+    }
+
+    auto argv = null_terminated(args);
+    auto envp = null_terminated(variables);
+
+    if(!error) {
+        error = posix_spawn(&pid_, program.c_str(), &actions, &attributes, argv.data(), envp.data());
+    }
+
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attributes);
+
+    ::close(in[0]);
+    ::close(out[1]);
+    ::close(err[1]);
+
+    if(error) {
+        ::close(in[1]);
+        ::close(out[0]);
+        ::close(err[0]);
+
+        pid_ = -1;
+        result_.error = _F("Unable to start {0}: {1}").format(options_.argv[0], std::strerror(error));
+        return false;
+    }
+
+    L_DEBUG(_F("Started {0} as {1}").format(program, pid_));
+
+    input_.fd = in[1];
+    output_[SUBPROCESS_STDOUT].fd = out[0];
+    output_[SUBPROCESS_STDERR].fd = err[0];
+
+    set_non_blocking(input_.fd);
+    set_non_blocking(out[0]);
+    set_non_blocking(err[0]);
+
+    result_.started = true;
+
+    if(!options_.input.empty()) {
+        to_write_.push_back(options_.input);
+    }
+
+    close_input_when_written_ = !options_.keep_input_open;
+    if(to_write_.empty() && close_input_when_written_) {
+        close_pipe(input_);
+    }
+
+    return true;
+}
+
+bool Subprocess::start() {
+    if(!spawn()) {
+        return false;
+    }
+
+    main_loop_ = true;
+
+    for(int i: {SUBPROCESS_STDOUT, SUBPROCESS_STDERR}) {
+        auto stream = SubprocessStream(i);
+        output_[i].connection = Glib::signal_io().connect([this, stream](Glib::IOCondition) -> bool {
+            read_output(stream);
+            return output_[stream].fd != -1;
+        }, output_[i].fd, Glib::IO_IN | Glib::IO_HUP | Glib::IO_ERR);
+    }
+
+    if(!to_write_.empty()) {
+        write(std::string());
+    }
+
+    child_watch_ = Glib::signal_child_watch().connect([this](GPid, int status) {
+        on_exit(status);
+    }, pid_);
+
+    if(options_.timeout_ms > 0) {
+        timeout_ = Glib::signal_timeout().connect(sigc::mem_fun(this, &Subprocess::on_timeout), options_.timeout_ms);
+    }
+
+    return true;
+}
+
+const SubprocessResult& Subprocess::run() {
+    if(!spawn()) {
+        return result_;
+    }
+
+    typedef std::chrono::steady_clock Clock;
+    auto deadline = Clock::now() + std::chrono::milliseconds(options_.timeout_ms);
+
+    while(true) {
+        int status = 0;
+        if(waitpid(pid_, &status, WNOHANG) == pid_) {
+            on_exit(status);
+            break;
+        }
+
+        std::vector<pollfd> fds;
+        for(auto& pipe: output_) {
+            if(pipe.fd != -1) {
+                fds.push_back(pollfd{pipe.fd, POLLIN, 0});
+            }
+        }
+
+        if(input_.fd != -1 && !to_write_.empty()) {
+            fds.push_back(pollfd{input_.fd, POLLOUT, 0});
+        }
+
+        int wait_ms = SYNC_POLL_INTERVAL_MS;
+        if(options_.timeout_ms > 0) {
+            auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now()).count();
+            if(remaining <= 0 && !result_.timed_out) {
+                result_.timed_out = true;
+                kill_group();
+            }
+            wait_ms = (result_.timed_out) ? 10 : std::max<int>(0, std::min<int>(wait_ms, remaining));
+        } else if(fds.empty()) {
+            // Everything's been read, all that's left is for it to exit
+            if(waitpid(pid_, &status, 0) == pid_) {
+                on_exit(status);
+                break;
+            }
+        }
+
+        if(poll(fds.data(), fds.size(), wait_ms) <= 0) {
+            continue;
+        }
+
+        for(auto& fd: fds) {
+            if(!fd.revents) {
+                continue;
+            }
+
+            if(fd.fd == input_.fd) {
+                write_input();
+            } else {
+                read_output((fd.fd == output_[SUBPROCESS_STDOUT].fd) ? SUBPROCESS_STDOUT : SUBPROCESS_STDERR);
+            }
+        }
+    }
+
+    return result_;
+}
+
+void Subprocess::write(const std::string& data) {
+    if(input_.fd == -1) {
+        L_ERROR("Tried to write to a process whose input is closed");
+        return;
+    }
+
+    if(!data.empty()) {
+        to_write_.push_back(data);
+    }
+
+    if(main_loop_ && !input_.connection.connected()) {
+        input_.connection = Glib::signal_io().connect([this](Glib::IOCondition) -> bool {
+            write_input();
+            return input_.fd != -1 && !to_write_.empty();
+        }, input_.fd, Glib::IO_OUT | Glib::IO_HUP | Glib::IO_ERR);
+    }
+}
+
+void Subprocess::close_input() {
+    close_input_when_written_ = true;
+    if(to_write_.empty()) {
+        close_pipe(input_);
+    }
+}
+
+void Subprocess::cancel() {
+    if(!running()) {
+        return;
+    }
+
+    result_.cancelled = true;
+    kill_group();
+
+    // Whatever is still in the pipes is dropped, so nothing more is emitted. The exit is
+    // still waited for, to reap it.
+    close_pipe(output_[SUBPROCESS_STDOUT]);
+    close_pipe(output_[SUBPROCESS_STDERR]);
+    close_pipe(input_);
+    to_write_.clear();
+    timeout_.disconnect();
+}
+
+void Subprocess::kill_group() {
+    if(running()) {
+        ::kill(-pid_, SIGKILL);
+    }
+}
+
+void Subprocess::read_output(SubprocessStream stream) {
+    Pipe& pipe = output_[stream];
+    std::string& all = (stream == SUBPROCESS_STDOUT) ? result_.out : result_.err;
+
+    char buffer[16384];
+
+    // A handler can cancel us, which closes the pipes
+    while(pipe.fd != -1) {
+        ssize_t count = ::read(pipe.fd, buffer, sizeof(buffer));
+
+        if(count > 0) {
+            if(options_.keep_output) {
+                all.append(buffer, count);
+            }
+            pipe.pending.append(buffer, count);
+
+            std::size_t start = 0;
+            std::size_t newline;
+            while(!result_.cancelled && (newline = pipe.pending.find('\n', start)) != std::string::npos) {
+                signal_line_(stream, pipe.pending.substr(start, newline - start));
+                start = newline + 1;
+            }
+            pipe.pending.erase(0, start);
+            continue;
+        } else if(count == -1 && errno == EINTR) {
+            continue;
+        } else if(count == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return;
+        }
+
+        // The end of the output, or an error which means the same
+        break;
+    }
+
+    if(!pipe.pending.empty() && !result_.cancelled) {
+        signal_line_(stream, pipe.pending);
+        pipe.pending.clear();
+    }
+
+    close_pipe(pipe);
+}
+
+void Subprocess::write_input() {
+    while(input_.fd != -1 && !to_write_.empty()) {
+        auto& data = to_write_.front();
+        ssize_t count = ::write(input_.fd, data.data(), data.size());
+
+        if(count > 0) {
+            data.erase(0, count);
+            if(data.empty()) {
+                to_write_.pop_front();
+            }
+            continue;
+        } else if(count == -1 && errno == EINTR) {
+            continue;
+        } else if(count == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return;
+        }
+
+        // It stopped reading
+        to_write_.clear();
+        close_pipe(input_);
+    }
+
+    if(to_write_.empty() && close_input_when_written_) {
+        close_pipe(input_);
+    }
+}
+
+void Subprocess::close_pipe(Pipe& pipe) {
+    pipe.connection.disconnect();
+
+    if(pipe.fd != -1) {
+        ::close(pipe.fd);
+        pipe.fd = -1;
+    }
+}
+
+void Subprocess::on_exit(int status) {
+    exited_ = true;
+
+    if(WIFEXITED(status)) {
+        result_.exit_status = WEXITSTATUS(status);
+    } else if(WIFSIGNALED(status)) {
+        result_.signal = WTERMSIG(status);
+    }
+
+    // Whatever it wrote before exiting is still in the pipes. Anything it started which
+    // kept them open doesn't get waited for.
+    for(auto stream: {SUBPROCESS_STDOUT, SUBPROCESS_STDERR}) {
+        if(output_[stream].fd != -1) {
+            read_output(stream);
+            if(!output_[stream].pending.empty() && !result_.cancelled) {
+                signal_line_(stream, output_[stream].pending);
+            }
+            output_[stream].pending.clear();
+            close_pipe(output_[stream]);
+        }
+    }
+
+    finish();
+}
+
+bool Subprocess::on_timeout() {
+    L_INFO(_F("{0} timed out, killing it").format(options_.argv[0]));
+
+    result_.timed_out = true;
+    kill_group();
+    return false;
+}
+
+void Subprocess::finish() {
+    if(finished_) {
+        return;
+    }
+
+    finished_ = true;
+
+    close_pipe(input_);
+    timeout_.disconnect();
+    child_watch_.disconnect();
+
+    // Last, a handler is allowed to destroy us
+    if(!result_.cancelled) {
+        signal_finished_(result_);
+    }
+}
+
+}
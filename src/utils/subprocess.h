@@ -0,0 +1,131 @@
+#ifndef SUBPROCESS_H
+#define SUBPROCESS_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <sys/types.h>
+#include <gtkmm.h>
+
+namespace delimit {
+
+struct SubprocessOptions {
+    std::vector<std::string> argv; // argv[0] is looked for on the PATH, nothing goes through a shell
+    std::string cwd; // Empty for ours
+
+    std::map<std::string, std::string> environment; // Set on top of ours
+    bool inherit_environment = true;
+
+    int timeout_ms = 0; // The process is killed after this long, 0 for never
+
+    std::string input; // Written to stdin, which is then closed
+    bool keep_input_open = false; // Leave stdin open for write() instead
+
+    bool keep_output = true; // Collect the output in the result, a long lived process only needs the lines
+};
+
+enum SubprocessStream {
+    SUBPROCESS_STDOUT,
+    SUBPROCESS_STDERR
+};
+
+struct SubprocessResult {
+    bool started = false;
+    std::string error; // Why it couldn't be started
+
+    int exit_status = -1; // -1 unless it exited normally
+    int signal = 0; // What killed it, if something did
+    bool timed_out = false;
+    bool cancelled = false;
+
+    std::string out;
+    std::string err;
+
+    bool success() const { return started && exit_status == 0; }
+};
+
+/*
+ *  A child process started with posix_spawn, talking to us over pipes.
+ *
+ *  start() hands the pipes to the main loop and returns straight away; output arrives a
+ *  line at a time through signal_line() as it's written, and signal_finished() is
+ *  emitted once the process has exited and its output has been read. run() does the
+ *  same without a main loop, blocking until the process is done.
+ *
+ *  The process is put in its own process group, so cancelling (or the timeout, or
+ *  destroying the Subprocess while it's running) kills anything it started as well.
+ *  No signal is emitted after cancel() or destruction.
+ */
+class Subprocess {
+public:
+    typedef std::shared_ptr<Subprocess> ptr;
+
+    Subprocess(const SubprocessOptions& options);
+    ~Subprocess();
+
+    /* Returns false (with result().error set) if the process couldn't be started */
+    bool start();
+
+    /* Starts the process and waits for it to finish */
+    const SubprocessResult& run();
+
+    /* Queues data for stdin, which must have been kept open */
+    void write(const std::string& data);
+    void close_input();
+
+    void cancel();
+
+    bool running() const { return pid_ > 0 && !exited_; }
+    pid_t pid() const { return pid_; }
+
+    const SubprocessResult& result() const { return result_; }
+
+    sigc::signal<void, SubprocessStream, const std::string&>& signal_line() { return signal_line_; }
+    sigc::signal<void, const SubprocessResult&>& signal_finished() { return signal_finished_; }
+
+private:
+    struct Pipe {
+        int fd = -1;
+        std::string pending; // Output since the last newline
+        sigc::connection connection;
+    };
+
+    SubprocessOptions options_;
+    SubprocessResult result_;
+
+    pid_t pid_ = -1;
+    bool exited_ = false;
+    bool finished_ = false;
+    bool main_loop_ = false;
+
+    Pipe output_[2]; // Indexed by SubprocessStream
+    Pipe input_;
+    std::deque<std::string> to_write_;
+    bool close_input_when_written_ = false;
+
+    sigc::connection child_watch_;
+    sigc::connection timeout_;
+
+    sigc::signal<void, SubprocessStream, const std::string&> signal_line_;
+    sigc::signal<void, const SubprocessResult&> signal_finished_;
+
+    bool spawn();
+    void kill_group();
+
+    void read_output(SubprocessStream stream);
+    void write_input();
+    void close_pipe(Pipe& pipe);
+
+    void on_exit(int status);
+    bool on_timeout();
+    void finish();
+};
+
+/* The full path of a program on the PATH, or an empty string. Spares running `which`. */
+std::string find_program(const std::string& name);
+
+}
+
+#endif // SUBPROCESS_H
@@ -44,7 +44,17 @@ public:
 
     }
 
+    unicode(unicode&& rhs):
+        string_(std::move(rhs.string_)) {
+
+    }
+
     unicode& operator=(const unicode& rhs);
+
+    unicode& operator=(unicode&& rhs) {
+        string_ = std::move(rhs.string_);
+        return *this;
+    }
     unicode(const char* encoded_string, const std::string& encoding="ascii");
 
     unicode(int32_t n, char32_t c);
@@ -166,6 +176,14 @@ public:
         return string_.rfind(what.string_);
     }
 
+    void insert(size_type pos, const unicode& what) {
+        string_.insert(pos, what.string_);
+    }
+
+    void erase(size_type pos, size_type count) {
+        string_.erase(pos, count);
+    }
+
     ustring::value_type& operator[](ustring::size_type pos) {
         return string_[pos];
     }
@@ -0,0 +1,22 @@
+#ifndef XXHASH_H
+#define XXHASH_H
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+namespace delimit {
+
+/*
+ *  XXH64, a fast non-cryptographic hash. Good for telling whether a file's
+ *  contents have changed, not for anything security related.
+ */
+uint64_t xxh64(const void* data, std::size_t length, uint64_t seed=0);
+
+inline uint64_t xxh64(const std::string& data, uint64_t seed=0) {
+    return xxh64(data.data(), data.length(), seed);
+}
+
+}
+
+#endif // XXHASH_H
@@ -5,6 +5,7 @@
 
 #include "utils/sigc_lambda.h"
 #include "autocomplete/provider.h"
+#include "autocomplete/datastore.h"
 #include "window.h"
 #include "application.h"
 #include "search/search_thread.h"
@@ -31,7 +32,7 @@ Window::Window():
     buffer_undo_(nullptr),
     main_paned_(nullptr),
     type_(WINDOW_TYPE_FILE),
-    info_(new ProjectInfo()){
+    project_(Project::attach()) {
 
     L_DEBUG("Creating window with empty buffer");
     load_settings();
@@ -55,41 +56,36 @@ Window::Window(const std::vector<Glib::RefPtr<Gio::File>>& files):
     buffer_save_(nullptr),
     buffer_undo_(nullptr),
     main_paned_(nullptr),
-    type_(WINDOW_TYPE_FILE),
-    info_(new ProjectInfo()){
+    type_(WINDOW_TYPE_FILE) {
 
     load_settings();
 
     file_tree_store_ = Gtk::TreeStore::create(file_tree_columns_);
 
+    bool is_folder = files.size() == 1 && files[0]->query_file_type() == Gio::FILE_TYPE_DIRECTORY;
+
+    /*
+     *  Attach before building the widgets, the first document needs the project's word index.
+     *  Crawling, indexing and watching are only started if no other window has this folder open.
+     */
+    project_ = Project::attach((is_folder) ? unicode(files[0]->get_path()) : unicode());
+
     build_widgets();
 
-    if(files.size() == 1 && files[0]->query_file_type() == Gio::FILE_TYPE_DIRECTORY) {
+    if(is_folder) {
         type_ = WINDOW_TYPE_FOLDER;
 
         auto recent_manager = Gtk::RecentManager::get_default();
         recent_manager->add_item(_u("file://{0}").format(files[0]->get_path()).encode());
 
-        rebuild_file_tree(files[0]->get_path());
         path_ = files[0]->get_path();
 
-        info_->recursive_populate(path_);
-        //awesome_bar_->repopulate_files();
+        project_changed_connection_ = project_->signal_changed().connect(
+            sigc::mem_fun(this, &Window::on_project_changed)
+        );
 
-        //Look for a .gitignore file in the directory
-        auto ignore_file = kfs::path::join(path_.encode(), ".gitignore");
-        L_DEBUG(_F("Checking for .gitignore at {0}...").format(ignore_file));
-        if(kfs::path::exists(ignore_file)) {
-            auto lines = read_file_lines(ignore_file);
-            for(auto line: lines) {
-                if(!line.strip().empty()) {
-                    L_DEBUG(_F("Adding ignore glob: '{0}', length: {1}").format(line.strip(), line.strip().length()));
-                    ignored_globs_.insert(line.strip());
-                }
-            }
-        } else {
-            L_DEBUG("not found.");
-        }
+        rebuild_file_tree(path_);
+        //awesome_bar_->repopulate_files();
 
     } else {
         type_ = WINDOW_TYPE_FILE;
@@ -105,6 +101,16 @@ Window::Window(const std::vector<Glib::RefPtr<Gio::File>>& files):
     header_bar_->set_title(_u("Delimit{0}").format((project_path().empty() ? "" : _u(" - ") + this->project_path())).encode());
 }
 
+Window::~Window() {
+    project_changed_connection_.disconnect();
+}
+
+void Window::index_document(const unicode& path) {
+    if(project_) {
+        project_->index_file(path);
+    }
+}
+
 void Window::show_awesome_bar(bool value) {
     if(value) {
         awesome_bar_->show();
@@ -732,23 +738,57 @@ void Window::update_error_panel(const ErrorList &errors) {
     displayed_errors_ = errors;
 }
 
-void Window::on_folder_changed(const Glib::RefPtr<Gio::File> &file, const Glib::RefPtr<Gio::File> &other, Gio::FileMonitorEvent event_type) {
-    L_DEBUG("Detected folder event: " + file->get_path());
+void Window::on_project_changed(const WatchDelta& delta) {
+    /*
+     *  Work out which of the folders in the tree need refreshing. Folders which haven't been
+     *  expanded yet will be read when they are, so they can be skipped.
+     */
+    std::set<unicode> to_walk;
 
-    if(event_type == Gio::FILE_MONITOR_EVENT_CHANGES_DONE_HINT || event_type == Gio::FILE_MONITOR_EVENT_DELETED || event_type == Gio::FILE_MONITOR_EVENT_CREATED) {
-        L_INFO("Detected folder change: " + file->get_path());
+    if(delta.overflowed) {
+        to_walk = walked_directories_;
+    } else {
+        auto add_parents = [&](const std::vector<std::string>& paths) {
+            for(auto& path: paths) {
+                to_walk.insert(kfs::path::dir_name(path));
+            }
+        };
+
+        add_parents(delta.created);
+        add_parents(delta.deleted);
+        add_parents(delta.created_directories);
+        add_parents(delta.deleted_directories);
+
+        for(auto& directory: delta.rescan_directories) {
+            unicode prefix = directory + "/";
+            for(auto& walked: walked_directories_) {
+                if(walked == directory || walked.starts_with(prefix)) {
+                    to_walk.insert(walked);
+                }
+            }
+        }
+    }
 
-        unicode folder_path = kfs::path::dir_name(file->get_path());
+    for(auto& folder: to_walk) {
+        if(!walked_directories_.count(folder)) {
+            continue;
+        }
 
-        auto it = tree_row_lookup_.find(folder_path);
-        if(it != tree_row_lookup_.end()) {
-            Gtk::TreeRow node = *(file_tree_store_->get_iter(it->second.get_path()));
-            dirwalk(folder_path, &node);
+        // Refreshing a parent may have removed this row already
+        auto it = tree_row_lookup_.find(folder);
+        if(it == tree_row_lookup_.end() || !it->second.is_valid()) {
+            continue;
         }
+
+        L_DEBUG("Refreshing folder: " + folder.encode());
+        Gtk::TreeRow node = *(file_tree_store_->get_iter(it->second.get_path()));
+        dirwalk(folder, &node);
     }
 
-    update_vcs_branch_in_tree();
-    L_DEBUG("VCS branch and file tree updated");
+    if(delta.head_changed || delta.overflowed) {
+        update_vcs_branch_in_tree();
+        L_DEBUG("VCS branch updated");
+    }
 }
 
 void Window::update_vcs_branch_in_tree() {
@@ -762,41 +802,42 @@ void Window::update_vcs_branch_in_tree() {
 
     unicode path = std::string(row.get_value(file_tree_columns_.full_path));
     if(kfs::path::exists(kfs::path::join(path.encode(), ".git"))) {
-        unicode result = call_command(
-            _u("git rev-parse --abbrev-ref HEAD"),
-            path
-        );
+        SubprocessOptions options;
+        options.argv = {"git", "rev-parse", "--abbrev-ref", "HEAD"};
+        options.cwd = path.encode();
+        options.timeout_ms = 10000;
+
+        // Replaces (and kills) one which is still running
+        vcs_branch_process_ = std::make_shared<Subprocess>(options);
+        vcs_branch_process_->signal_finished().connect([this, path](const SubprocessResult& result) {
+            unicode branch = unicode(result.out).strip();
+            if(!result.success() || branch.empty()) {
+                return;
+            }
+
+            // The tree could have been rebuilt while git was running
+            auto root = file_tree_store_->get_iter(Gtk::TreeStore::Path("0"));
+            if(!root) {
+                return;
+            }
+
+            const Gtk::TreeRow& row = *root;
+            if(unicode(std::string(row.get_value(file_tree_columns_.full_path))) != path) {
+                return;
+            }
 
-        if(!result.empty()) {
             unicode new_name = _u("{0} [{1}]").format(
                 kfs::path::split(path.encode()).second,
-                result.encode()
+                branch.encode()
             );
             row.set_value(file_tree_columns_.name, Glib::ustring(new_name.encode()));
-        }
-    }
-}
-
-void Window::watch_directory(const unicode& path) {
-    if(tree_monitors_.find(path) != tree_monitors_.end()) {
-        return;
-    }
-
-    //Handle updates to the directory
-    Glib::RefPtr<Gio::File> file = Gio::File::create_for_path(path.encode());
-    auto monitor = file->monitor_directory();
-    tree_monitors_[path] = monitor;
-    monitor->signal_changed().connect(sigc::mem_fun(this, &Window::on_folder_changed));
-}
+        });
 
-void Window::unwatch_directory(const unicode& path) {
-    if(tree_monitors_.find(path) == tree_monitors_.end()) {
-        return;
+        if(!vcs_branch_process_->start()) {
+            L_ERROR(vcs_branch_process_->result().error);
+            vcs_branch_process_.reset();
+        }
     }
-
-    Glib::RefPtr<Gio::FileMonitor> monitor = tree_monitors_.at(path);
-    monitor->cancel();
-    tree_monitors_.erase(path);
 }
 
 void Window::dirwalk(const unicode& path, const Gtk::TreeRow* node) {
@@ -808,7 +849,7 @@ void Window::dirwalk(const unicode& path, const Gtk::TreeRow* node) {
         return;
     }
 
-    watch_directory(path);
+    walked_directories_.insert(path);
 
     files = kfs::path::list_dir(kfs::path::real_path(path.encode()));
     std::sort(files.begin(), files.end());
@@ -885,32 +926,16 @@ void Window::dirwalk(const unicode& path, const Gtk::TreeRow* node) {
     for(unicode f: files) {
         if(f == "." || f == "..") continue;
 
-        if(f.starts_with(".") || f.ends_with(".pyc")) {
-            //Ignore hidden files and folders
-            continue;
-        }
-
         unicode full_name = kfs::path::join(path.encode(), f.encode());
+        bool is_folder = kfs::path::is_dir(kfs::path::real_path(full_name.encode()));
 
-        //We've found one of the existing children, so remove it from the list
-        existing_children.erase(std::remove(existing_children.begin(), existing_children.end(), full_name), existing_children.end());
-/*
-        bool ignore = false;
-        for(auto gl: ignored_globs_) {
-            if(glob::match(full_name, gl)) {
-                //Ignore this file/folder if it matches the ignored globs
-                ///// DISABLED UNTIL I FIGURE OUT WHAT BROKE ignore = true;
-                break;
-            }
-        }
-*/
-        bool ignore = false;
-        if(ignore) {
+        if(ignore_tree() && ignore_tree()->is_ignored(full_name.encode(), is_folder)) {
             L_DEBUG("Ignoring file as it's in .gitignore or similar: " + full_name.encode());
             continue;
         }
 
-        bool is_folder = kfs::path::is_dir(kfs::path::real_path(full_name.encode()));
+        //We've found one of the existing children, so remove it from the list
+        existing_children.erase(std::remove(existing_children.begin(), existing_children.end(), full_name), existing_children.end());
 
         auto image = Gtk::IconTheme::get_default()->load_icon(
             (is_folder) ? "folder" : "document-new",
@@ -959,7 +984,7 @@ void Window::dirwalk(const unicode& path, const Gtk::TreeRow* node) {
         L_DEBUG("Found file in need of removal: " + file.encode());
         file_tree_store_->erase(file_tree_store_->get_iter(tree_row_lookup_.at(file).get_path()));
         tree_row_lookup_.erase(file);
-        unwatch_directory(file);
+        walked_directories_.erase(file);
     }
 }
 
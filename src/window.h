@@ -8,6 +8,10 @@
 #include <memory>
 
 #include "utils/unicode.h"
+#include "utils/gitignore.h"
+#include "utils/project_watcher.h"
+#include "utils/subprocess.h"
+#include "project.h"
 
 #include <gtkmm.h>
 
@@ -235,6 +239,7 @@ public:
 
     Window();
     Window(const std::vector<Glib::RefPtr<Gio::File>>& files);
+    ~Window();
 
     void new_document();
     void open_document(const unicode& path);
@@ -252,6 +257,7 @@ public:
     bool toolbutton_save_clicked();
 
     unicode project_path() const { return path_; }
+    IgnoreTreePtr ignore_tree() const { return project_->ignore_tree(); }
 
     void clear_error_panel() { update_error_panel(ErrorList()); }
     void update_error_panel(const ErrorList& errors);
@@ -267,7 +273,14 @@ public:
 
     sigc::signal<void, DocumentView&>& signal_document_switched() { return signal_document_switched_; }
 
-    std::shared_ptr<ProjectInfo> info() { return info_; }
+    ProjectPtr project() const { return project_; }
+    std::shared_ptr<ProjectInfo> info() { return project_->info(); }
+
+    /* Words from every file indexed so far, for word completion */
+    WordIndexPtr word_index() { return project_->word_index(); }
+
+    /* Queues a file to be indexed in the background */
+    void index_document(const unicode& path);
 
     void set_tasks_visible(bool value=true);
     void set_task_active(uint32_t index);
@@ -298,8 +311,6 @@ private:
     void init_actions();
 
     void dirwalk(const unicode& path, const Gtk::TreeRow *node);
-    void watch_directory(const unicode& path);
-    void unwatch_directory(const unicode& path);
 
     bool on_tree_test_expand_row(const Gtk::TreeModel::iterator& iter, const Gtk::TreeModel::Path& path);
 
@@ -375,12 +386,13 @@ private:
     std::shared_ptr<FindBar> find_bar_;
     std::shared_ptr<AwesomeBar> awesome_bar_;
 
-    std::set<unicode> ignored_globs_; //For file tree
+    ProjectPtr project_; //Possibly shared with other windows on the same folder
+    sigc::connection project_changed_connection_;
 
-    std::map<unicode, Glib::RefPtr<Gio::FileMonitor> > tree_monitors_;
+    std::set<unicode> walked_directories_; //Folders in the tree which have had their contents listed
     std::map<unicode, Gtk::TreeRowReference> tree_row_lookup_;
 
-    void on_folder_changed(const Glib::RefPtr<Gio::File>& file, const Glib::RefPtr<Gio::File>& other, Gio::FileMonitorEvent event_type);
+    void on_project_changed(const WatchDelta& delta);
 
     Glib::RefPtr<Gtk::AccelGroup> accel_group_;
     Glib::RefPtr<Gtk::ActionGroup> action_group_;
@@ -392,8 +404,7 @@ private:
     sigc::signal<void, DocumentView&> signal_document_switched_;
 
     void update_vcs_branch_in_tree();
-
-    std::shared_ptr<ProjectInfo> info_;
+    Subprocess::ptr vcs_branch_process_;
 
     std::map<int32_t, unicode> displayed_errors_;
 };
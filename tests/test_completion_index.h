@@ -0,0 +1,166 @@
+#ifndef TEST_COMPLETION_INDEX_H
+#define TEST_COMPLETION_INDEX_H
+
+#include <kaztest/kaztest.h>
+#include "../src/autocomplete/completion_index.h"
+
+class RadixTrieTests : public TestCase {
+public:
+    void test_insert_and_erase() {
+        delimit::RadixTrie trie;
+
+        trie.insert("test");
+        trie.insert("team");
+        trie.insert("te");
+        trie.insert("test");
+
+        assert_equal(3, trie.size());
+        assert_equal(2, trie.count("test"));
+        assert_equal(1, trie.count("te"));
+        assert_equal(0, trie.count("t"));
+        assert_equal(0, trie.count("tests"));
+
+        assert_true(trie.erase("test"));
+        assert_equal(1, trie.count("test"));
+        assert_equal(3, trie.size());
+
+        assert_true(trie.erase("test"));
+        assert_equal(0, trie.count("test"));
+        assert_equal(2, trie.size());
+
+        assert_false(trie.erase("test"));
+        assert_false(trie.erase("tea"));
+
+        // Removing "te" has to leave "team" reachable once the nodes are merged
+        assert_true(trie.erase("te"));
+        assert_equal(1, trie.count("team"));
+        assert_equal(1, trie.size());
+    }
+
+    void test_prefix_matches_are_ranked() {
+        delimit::RadixTrie trie;
+
+        trie.insert("get_value");
+        trie.insert("getattr");
+        trie.insert("get", 3);
+        trie.insert("gets");
+        trie.insert("geta", 5);
+        trie.insert("other");
+
+        auto results = trie.prefix_matches("get", 4);
+        assert_equal(4, results.size());
+
+        // Shortest first, then the most common
+        assert_equal("get", results[0].text);
+        assert_equal("geta", results[1].text);
+        assert_equal("gets", results[2].text);
+        assert_equal("getattr", results[3].text);
+
+        assert_equal(0, trie.prefix_matches("x", 10).size());
+        assert_equal(2, trie.prefix_matches("geta", 10).size());
+    }
+
+    void test_fuzzy_matches() {
+        delimit::RadixTrie trie;
+
+        trie.insert("get_value");
+        trie.insert("getValue");
+        trie.insert("gravity");
+        trie.insert("value");
+
+        auto results = trie.fuzzy_matches("gv", 10);
+        assert_equal(3, results.size());
+
+        // Word starts beat matches in the middle of a word
+        assert_true(results[2].text == "gravity");
+
+        // Anchored on the first character, and case doesn't matter
+        assert_equal(0, trie.fuzzy_matches("al", 10).size());
+        assert_equal(1, trie.fuzzy_matches("VL", 10).size());
+        assert_equal("value", trie.fuzzy_matches("VL", 10)[0].text);
+    }
+
+    void test_frequent_matches() {
+        delimit::RadixTrie trie;
+
+        trie.insert("get", 2);
+        trie.insert("get_value", 9);
+        trie.insert("getattr", 5);
+        trie.insert("gets", 5);
+        trie.insert("other", 20);
+
+        auto results = trie.frequent_matches("get", 3);
+        assert_equal(3, results.size());
+
+        // Most common first, shorter first when the counts are the same
+        assert_equal("get_value", results[0].text);
+        assert_equal("gets", results[1].text);
+        assert_equal("getattr", results[2].text);
+
+        // Counts going down have to be seen by the ranking
+        trie.erase("get_value", 8);
+        assert_equal("gets", trie.frequent_matches("get", 1)[0].text);
+    }
+};
+
+class CompletionIndexTests : public TestCase {
+public:
+    void test_partitioned_by_parser() {
+        delimit::CompletionIndex index;
+
+        index.add("python", "self");
+        index.add("python", "select");
+        index.add("PLAIN", "selection");
+
+        auto results = index.complete("python", "sel", 10);
+        assert_equal(2, results.size());
+        assert_equal("self", results[0]);
+
+        assert_equal(1, index.complete("PLAIN", "sel", 10).size());
+        assert_equal(0, index.complete("javascript", "sel", 10).size());
+
+        index.remove("python", "self");
+        assert_equal(1, index.size("python"));
+    }
+
+    void test_fuzzy_fills_up_results() {
+        delimit::CompletionIndex index;
+
+        index.add("python", "get_value");
+        index.add("python", "gv");
+
+        auto results = index.complete("python", "gv", 10);
+        assert_equal(2, results.size());
+        assert_equal("gv", results[0]);
+        assert_equal("get_value", results[1]);
+
+        assert_equal(1, index.complete("python", "gv", 1).size());
+    }
+};
+
+class WordIndexTests : public TestCase {
+public:
+    void test_complete() {
+        delimit::WordIndex index;
+
+        index.add("value", 3);
+        index.add("valid", 5);
+        index.add("va");
+        index.add("vector");
+
+        auto results = index.complete("va", 10);
+        assert_equal(2, results.size());
+        assert_equal("valid", results[0]);
+        assert_equal("value", results[1]);
+
+        // Fuzzy matches fill up the rest
+        results = index.complete("vr", 10);
+        assert_equal(1, results.size());
+        assert_equal("vector", results[0]);
+
+        index.remove("valid", 5);
+        assert_equal("value", index.complete("va", 10)[0]);
+    }
+};
+
+#endif // TEST_COMPLETION_INDEX_H
@@ -0,0 +1,53 @@
+#ifndef TEST_CONTENT_TYPE_H
+#define TEST_CONTENT_TYPE_H
+
+#include <fstream>
+#include <kaztest/kaztest.h>
+#include "../src/utils/content_type.h"
+#include "../src/utils/kfs.h"
+
+class ContentTypeTests : public TestCase {
+public:
+    void set_up() {
+        TestCase::set_up();
+
+        root = kfs::path::join(kfs::temp_dir(), "content_type");
+        if(kfs::path::exists(root)) {
+            kfs::remove_dirs(root);
+        }
+        kfs::make_dirs(root);
+    }
+
+    void write_file(const std::string& name, const std::string& data) {
+        std::ofstream out(kfs::path::join(root, name).c_str(), std::ios::binary);
+        out << data;
+    }
+
+    void test_classify_by_name() {
+        assert_equal(delimit::CONTENT_CLASS_TEXT, delimit::classify_by_name("/a/b/module.py"));
+        assert_equal(delimit::CONTENT_CLASS_TEXT, delimit::classify_by_name("/a/b/HEADER.H"));
+        assert_equal(delimit::CONTENT_CLASS_BINARY, delimit::classify_by_name("/a/b/module.pyc"));
+        assert_equal(delimit::CONTENT_CLASS_UNKNOWN, delimit::classify_by_name("/a/b/Makefile"));
+        assert_equal(delimit::CONTENT_CLASS_UNKNOWN, delimit::classify_by_name("/a/b/thing.weird"));
+    }
+
+    void test_unknown_extensions_are_probed() {
+        write_file("Makefile", "all:\n\techo \xc3\xa9\n");
+        write_file("blob.weird", std::string("abc\0def", 7));
+        write_file("latin.weird", "caf\xe9\n");
+
+        auto& classifier = delimit::ContentClassifier::instance();
+        assert_true(classifier.is_text(kfs::path::join(root, "Makefile")));
+        assert_false(classifier.is_text(kfs::path::join(root, "blob.weird")));
+        assert_false(classifier.is_text(kfs::path::join(root, "latin.weird")));
+    }
+
+    void test_directories_are_not_text() {
+        assert_false(delimit::ContentClassifier::instance().is_text(root));
+    }
+
+private:
+    std::string root;
+};
+
+#endif // TEST_CONTENT_TYPE_H
@@ -0,0 +1,98 @@
+#ifndef TEST_CRAWL_SNAPSHOT_H
+#define TEST_CRAWL_SNAPSHOT_H
+
+#include <fstream>
+#include <algorithm>
+#include <kaztest/kaztest.h>
+#include "../src/utils/bfs.h"
+#include "../src/utils/crawl_snapshot.h"
+#include "../src/utils/kfs.h"
+
+class CrawlSnapshotTests : public TestCase {
+public:
+    void set_up() {
+        TestCase::set_up();
+
+        root = kfs::path::join(kfs::temp_dir(), "crawl_snapshot");
+        if(kfs::path::exists(root)) {
+            kfs::remove_dirs(root);
+        }
+        kfs::make_dirs(kfs::path::join(root, "src/nested"));
+
+        write_file("README.md", "Read me");
+        write_file("src/main.py", "print 1");
+        write_file("src/nested/util.py", "pass");
+    }
+
+    void write_file(const std::string& name, const std::string& data) {
+        std::ofstream out(kfs::path::join(root, name).c_str());
+        out << data;
+    }
+
+    std::vector<std::string> crawl(std::shared_ptr<delimit::CrawlSnapshot> previous, std::shared_ptr<delimit::CrawlSnapshot>* next=nullptr) {
+        BFS bfs(root, delimit::IgnoreTreePtr(), previous);
+
+        std::vector<std::string> result;
+        for(auto& file: bfs.run()) {
+            result.push_back(file.encode());
+        }
+        std::sort(result.begin(), result.end());
+
+        if(next) {
+            *next = bfs.snapshot();
+        }
+        return result;
+    }
+
+    void test_save_and_load() {
+        std::shared_ptr<delimit::CrawlSnapshot> snapshot;
+        auto files = crawl(nullptr, &snapshot);
+        assert_equal(3, files.size());
+
+        auto filename = kfs::path::join(kfs::temp_dir(), "crawl_snapshot.snapshot");
+        assert_true(snapshot->save(filename));
+
+        delimit::CrawlSnapshot loaded(root);
+        assert_true(loaded.load(filename));
+        assert_equal(snapshot->directory_count(), loaded.directory_count());
+
+        auto loaded_files = loaded.files();
+        std::sort(loaded_files.begin(), loaded_files.end());
+        assert_true(files == loaded_files);
+
+        // A snapshot for a different root is rejected
+        delimit::CrawlSnapshot other(kfs::path::join(root, "src"));
+        assert_false(other.load(filename));
+    }
+
+    void test_recrawl_matches_full_crawl() {
+        std::shared_ptr<delimit::CrawlSnapshot> snapshot;
+        crawl(nullptr, &snapshot);
+
+        write_file("src/nested/new.py", "pass");
+        kfs::remove(kfs::path::join(root, "README.md"));
+
+        auto incremental = crawl(snapshot);
+        auto full = crawl(nullptr);
+
+        assert_equal(3, incremental.size());
+        assert_true(incremental == full);
+    }
+
+    void test_unchanged_directories_are_reused() {
+        std::shared_ptr<delimit::CrawlSnapshot> snapshot;
+        crawl(nullptr, &snapshot);
+
+        // The snapshot is trusted for directories that haven't changed, so a file it
+        // knows about is reported even though we never looked at the directory again
+        snapshot->add_file(kfs::path::join(root, "src/nested"), "phantom.py");
+
+        auto files = crawl(snapshot);
+        assert_true(std::find(files.begin(), files.end(), kfs::path::join(root, "src/nested/phantom.py")) != files.end());
+    }
+
+private:
+    std::string root;
+};
+
+#endif // TEST_CRAWL_SNAPSHOT_H
@@ -0,0 +1,211 @@
+#ifndef TEST_DATASTORE_H
+#define TEST_DATASTORE_H
+
+#include <set>
+#include <sqlite3.h>
+#include <kaztest/kaztest.h>
+#include "../src/autocomplete/datastore.h"
+#include "../src/autocomplete/parsers/python.h"
+#include "../src/utils/kfs.h"
+
+class DatastoreTests : public TestCase {
+public:
+    void set_up() {
+        TestCase::set_up();
+
+        path = kfs::path::join(kfs::temp_dir(), "datastore_test.db");
+        other_path = kfs::path::join(kfs::temp_dir(), "datastore_test_other.db");
+        remove_databases();
+    }
+
+    void tear_down() {
+        remove_databases();
+        TestCase::tear_down();
+    }
+
+    void remove_databases() {
+        for(auto& database: {path, other_path}) {
+            for(auto suffix: {"", "-wal", "-shm"}) {
+                if(kfs::path::exists(database + suffix)) {
+                    kfs::remove(database + suffix);
+                }
+            }
+        }
+    }
+
+    void execute(const std::string& database, const std::vector<std::string>& statements) {
+        sqlite3* db = nullptr;
+        assert_equal(SQLITE_OK, sqlite3_open(database.c_str(), &db));
+        for(auto& sql: statements) {
+            assert_equal(SQLITE_OK, sqlite3_exec(db, sql.c_str(), 0, 0, 0));
+        }
+        sqlite3_close(db);
+    }
+
+    /* Every scope stored, with its file and parents, as one string each */
+    std::set<std::string> rows(const std::string& database) {
+        sqlite3* db = nullptr;
+        sqlite3_open(database.c_str(), &db);
+
+        sqlite3_stmt* stmt = nullptr;
+        sqlite3_prepare_v2(db,
+            "SELECT f.name, p.name, s.start_line, s.start_col, s.end_line, s.end_col, s.occurrences, pr.name, "
+            "(SELECT group_concat(name, ',') FROM (SELECT pp.name FROM scope_parent sp JOIN path pp ON pp.id = sp.path WHERE sp.scope = s.id ORDER BY sp.position)) "
+            "FROM scope s JOIN file f ON f.id = s.file JOIN path p ON p.id = s.path JOIN parser pr ON pr.id = s.parser",
+            -1, &stmt, 0
+        );
+
+        std::set<std::string> result;
+        while(sqlite3_step(stmt) == SQLITE_ROW) {
+            std::string row;
+            for(int i = 0; i < 9; ++i) {
+                auto text = sqlite3_column_text(stmt, i);
+                row += (text) ? (const char*) text : "";
+                row += "|";
+            }
+            result.insert(row);
+        }
+
+        sqlite3_finalize(stmt);
+        sqlite3_close(db);
+        return result;
+    }
+
+    int count(const std::string& database, const std::string& sql) {
+        sqlite3* db = nullptr;
+        sqlite3_open(database.c_str(), &db);
+
+        sqlite3_stmt* stmt = nullptr;
+        sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, 0);
+        int result = (sqlite3_step(stmt) == SQLITE_ROW) ? sqlite3_column_int(stmt, 0) : -1;
+
+        sqlite3_finalize(stmt);
+        sqlite3_close(db);
+        return result;
+    }
+
+    std::vector<std::string> v1_database() {
+        // The schema and some rows as the first release wrote them
+        return {
+            "CREATE TABLE version(version VARCHAR(32) PRIMARY KEY)",
+            "CREATE TABLE scope(id INTEGER PRIMARY KEY, filename VARCHAR(255) NOT NULL, path VARCHAR(1024) NOT NULL, start_line INTEGER NOT NULL, start_col INTEGER NOT NULL, end_line INTEGER NOT NULL, end_col INTEGER NOT NULL, parser VARCHAR(255) NOT NULL, UNIQUE(filename, path, start_line, end_line))",
+            "CREATE INDEX filename_idx ON scope(path)",
+            "CREATE TABLE scope_parent(id INTEGER PRIMARY KEY, path VARCHAR(1024), scope INTEGER, FOREIGN KEY(scope) REFERENCES scope(id))",
+            "INSERT INTO version VALUES ('1')",
+            "INSERT INTO scope VALUES (1, '/project/a.py', 'a.A', 1, 0, 5, 0, 'PYTHON')",
+            "INSERT INTO scope VALUES (2, '/project/a.py', 'a.A.f', 2, 4, 3, 0, 'PYTHON')",
+            "INSERT INTO scope VALUES (3, '/project/b.py', 'b.x', 1, 0, 1, 0, 'PYTHON')",
+            "INSERT INTO scope_parent VALUES (1, 'a.Base', 1)",
+            "INSERT INTO scope_parent VALUES (2, 'object', 1)",
+            "INSERT INTO scope_parent VALUES (3, 'instancemethod', 2)",
+        };
+    }
+
+    void test_migrate_from_v1() {
+        execute(path, v1_database());
+
+        std::set<std::string> expected = {
+            "/project/a.py|a.A|1|0|5|0|1|PYTHON|a.Base,object|",
+            "/project/a.py|a.A.f|2|4|3|0|1|PYTHON|instancemethod|",
+            "/project/b.py|b.x|1|0|1|0|1|PYTHON||",
+        };
+
+        {
+            delimit::Datastore datastore(path);
+            assert_equal(2, datastore.completion_index()->complete("PYTHON", "a.A", 10).size());
+
+            // Nothing on disk looks like this, so every file is indexed again
+            auto states = datastore.file_states("/project");
+            assert_equal(2, states.size());
+            assert_equal(-1, states["/project/a.py"].size);
+        }
+
+        assert_true(expected == rows(path));
+
+        // It's the current version now, so opening it again keeps the rows
+        {
+            delimit::Datastore datastore(path);
+        }
+        assert_true(expected == rows(path));
+    }
+
+    void test_only_v1_tables_are_migrated() {
+        auto statements = v1_database();
+        // Some development builds added this to version 1 without changing the version
+        statements.push_back("CREATE TABLE file(filename VARCHAR(1024) PRIMARY KEY, size INTEGER NOT NULL, mtime_sec INTEGER NOT NULL, mtime_nsec INTEGER NOT NULL, hash INTEGER NOT NULL)");
+        execute(path, statements);
+
+        {
+            delimit::Datastore datastore(path);
+            assert_equal(0, datastore.completion_index()->size("PYTHON"));
+        }
+
+        assert_true(rows(path).empty());
+    }
+
+    void test_apply_delta_matches_replace() {
+        using namespace delimit;
+
+        unicode text = ""
+"class A(object):\n"
+"    def f(self):\n"
+"        x = 1\n"
+"\n"
+"def g():\n"
+"    return 2\n"
+"y = []\n";
+
+        parser::PythonBuffer buffer("m");
+
+        Datastore edited(path);
+        edited.open_buffer("PYTHON", buffer.set_text(text).scopes.added, "/project/m.py");
+
+        auto apply = [&](const parser::BufferChange& change) {
+            edited.apply_scope_delta("PYTHON", change.scopes, "/project/m.py");
+        };
+
+        apply(buffer.insert(text.find("\ndef g"), "\n    z = {}"));
+        apply(buffer.insert(0, "import os\nclass B(A):\n    pass\n"));
+        apply(buffer.erase(buffer.text().find("def g"), 9)); // g's body joins the class before it
+        apply(buffer.insert(buffer.text().length(), "def h(a, b):\n    c = a\n"));
+        edited.flush();
+
+        Datastore fresh(other_path);
+        fresh.replace_scopes("PYTHON", parser::Python().parse(buffer.text(), "m").first, "/project/m.py");
+        fresh.flush();
+
+        assert_true(rows(other_path) == rows(path));
+        assert_equal(fresh.completion_index()->size("PYTHON"), edited.completion_index()->size("PYTHON"));
+    }
+
+    void test_moved_scopes_replace_clashing_ones() {
+        using namespace delimit;
+
+        Datastore datastore(path);
+        datastore.open_buffer("PYTHON", parser::Python().parse("class A(object):\n    pass\nx = 1\nx = 1\n", "m").first, "/project/m.py");
+
+        // The third line went without its scopes being removed, so m.x moves onto the other one
+        ScopeDelta delta;
+        delta.from_line = 4;
+        delta.line_shift = -1;
+        datastore.apply_scope_delta("PYTHON", delta, "/project/m.py");
+        datastore.flush();
+
+        assert_equal(1, count(path, "SELECT COUNT(*) FROM scope s JOIN path p ON p.id = s.path WHERE p.name = 'm.x'"));
+
+        // Nothing is left behind, in the tables or in the indexes
+        datastore.close_buffer("/project/m.py");
+        datastore.delete_scopes_by_filename("/project/m.py");
+        datastore.flush();
+
+        assert_equal(0, count(path, "SELECT COUNT(*) FROM scope_parent"));
+        assert_equal(0, datastore.completion_index()->size("PYTHON"));
+        assert_equal(0, datastore.word_index()->size());
+    }
+
+private:
+    std::string path;
+    std::string other_path;
+};
+
+#endif // TEST_DATASTORE_H
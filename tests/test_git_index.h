@@ -0,0 +1,164 @@
+#ifndef TEST_GIT_INDEX_H
+#define TEST_GIT_INDEX_H
+
+#include <fstream>
+#include <kaztest/kaztest.h>
+#include "../src/utils/git_index.h"
+#include "../src/utils/kfs.h"
+
+class GitIndexTests : public TestCase {
+public:
+    void set_up() {
+        TestCase::set_up();
+
+        root = kfs::path::join(kfs::temp_dir(), "git_index");
+        if(kfs::path::exists(root)) {
+            kfs::remove_dirs(root);
+        }
+        kfs::make_dirs(kfs::path::join(root, ".git"));
+    }
+
+    void test_missing_index() {
+        delimit::GitIndex index(root);
+        assert_false(index.load());
+        assert_true(index.tracked_files().empty());
+    }
+
+    void test_version_2() {
+        write_index(2, {
+            { "README.md", 0100644, 0 },
+            { "src/main.cpp", 0100644, 0 },
+            { "vendor/lib", 0160000, 0 } // A submodule
+        });
+
+        delimit::GitIndex index(root);
+        assert_true(index.load());
+        assert_equal(2, index.version());
+        assert_equal(3, index.entries().size());
+        assert_equal(12, index.entries()[1].size);
+
+        auto files = index.tracked_files();
+        assert_equal(2, files.size());
+        assert_equal(kfs::path::join(root, "README.md"), files[0]);
+        assert_equal(kfs::path::join(root, "src/main.cpp"), files[1]);
+    }
+
+    void test_version_3_skip_worktree() {
+        write_index(3, {
+            { "a.txt", 0100644, 0 },
+            { "b.txt", 0100644, 0x4000 },
+            { "c.txt", 0100644, 0 }
+        });
+
+        delimit::GitIndex index(root);
+        assert_true(index.load());
+
+        auto files = index.tracked_files();
+        assert_equal(2, files.size());
+        assert_equal(kfs::path::join(root, "c.txt"), files[1]);
+    }
+
+    void test_version_4_prefix_compression() {
+        write_index(4, {
+            { "src/autocomplete/base.cpp", 0100644, 0 },
+            { "src/autocomplete/base.h", 0100644, 0 },
+            { "src/window.cpp", 0100644, 0 }
+        });
+
+        delimit::GitIndex index(root);
+        assert_true(index.load());
+        assert_equal(4, index.version());
+
+        auto files = index.tracked_files();
+        assert_equal(3, files.size());
+        assert_equal(kfs::path::join(root, "src/autocomplete/base.h"), files[1]);
+        assert_equal(kfs::path::join(root, "src/window.cpp"), files[2]);
+    }
+
+    void test_truncated_index() {
+        write_index(2, { { "README.md", 0100644, 0 } }, 10);
+
+        delimit::GitIndex index(root);
+        assert_false(index.load());
+    }
+
+private:
+    struct TestEntry {
+        std::string path;
+        uint32_t mode;
+        uint16_t extended_flags;
+    };
+
+    std::string root;
+
+    static void put_u32(std::string& out, uint32_t value) {
+        out.push_back(char(value >> 24));
+        out.push_back(char(value >> 16));
+        out.push_back(char(value >> 8));
+        out.push_back(char(value));
+    }
+
+    static void put_u16(std::string& out, uint16_t value) {
+        out.push_back(char(value >> 8));
+        out.push_back(char(value));
+    }
+
+    void write_index(uint32_t version, const std::vector<TestEntry>& entries, std::size_t truncate=0) {
+        std::string data = "DIRC";
+        put_u32(data, version);
+        put_u32(data, entries.size());
+
+        std::string previous;
+        for(auto& entry: entries) {
+            std::size_t start = data.length();
+
+            for(int i = 0; i < 6; ++i) {
+                put_u32(data, 0); // ctime, mtime, dev, ino
+            }
+            put_u32(data, entry.mode);
+            put_u32(data, 1000);
+            put_u32(data, 1000);
+            put_u32(data, entry.path.length());
+            data.append(20, '\x01');
+
+            uint16_t flags = std::min<std::size_t>(entry.path.length(), 0xFFF);
+            if(entry.extended_flags) {
+                flags |= 0x4000;
+            }
+            put_u16(data, flags);
+
+            if(entry.extended_flags) {
+                put_u16(data, entry.extended_flags);
+            }
+
+            if(version == 4) {
+                std::size_t common = 0;
+                while(common < previous.length() && common < entry.path.length() && previous[common] == entry.path[common]) {
+                    ++common;
+                }
+
+                // Only single byte offsets are needed for these tests
+                data.push_back(char(previous.length() - common));
+                data.append(entry.path.substr(common));
+                data.push_back('\0');
+            } else {
+                data.append(entry.path);
+                std::size_t padded = (data.length() - start + 8) & ~std::size_t(7);
+                data.append(padded - (data.length() - start), '\0');
+            }
+
+            previous = entry.path;
+        }
+
+        data.append(20, '\0'); // Checksum, not verified
+
+        if(truncate) {
+            data.resize(data.length() - 20 - truncate);
+        }
+
+        std::ofstream out(kfs::path::join(root, ".git/index").c_str(), std::ios::binary);
+        out.write(data.c_str(), data.length());
+    }
+};
+
+#endif // TEST_GIT_INDEX_H
@@ -0,0 +1,80 @@
+#ifndef TEST_GITIGNORE_H
+#define TEST_GITIGNORE_H
+
+#include <fstream>
+#include <kaztest/kaztest.h>
+#include "../src/utils/gitignore.h"
+#include "../src/utils/kfs.h"
+
+class GitIgnoreTests : public TestCase {
+public:
+    void set_up() {
+        TestCase::set_up();
+
+        root = kfs::path::join(kfs::temp_dir(), "gitignore");
+        if(kfs::path::exists(root)) {
+            kfs::remove_dirs(root);
+        }
+        kfs::make_dirs(kfs::path::join(root, "src/vendor"));
+    }
+
+    void write_file(const std::string& name, const std::string& data) {
+        std::ofstream out(kfs::path::join(root, name).c_str());
+        out << data;
+    }
+
+    std::string path(const std::string& relative) {
+        return kfs::path::join(root, relative);
+    }
+
+    void test_glob_patterns() {
+        assert_true(delimit::GlobPattern("*.py").match("module.py"));
+        assert_false(delimit::GlobPattern("*.py").match("pkg/module.py"));
+        assert_true(delimit::GlobPattern("build/*.o").match("build/main.o"));
+        assert_true(delimit::GlobPattern("**/cache").match("cache"));
+        assert_true(delimit::GlobPattern("**/cache").match("a/b/cache"));
+        assert_true(delimit::GlobPattern("docs/**").match("docs/a/b.txt"));
+        assert_true(delimit::GlobPattern("a/**/z").match("a/z"));
+        assert_true(delimit::GlobPattern("a/**/z").match("a/b/c/z"));
+        assert_true(delimit::GlobPattern("file[0-9].txt").match("file7.txt"));
+        assert_false(delimit::GlobPattern("file[!0-9].txt").match("file7.txt"));
+        assert_true(delimit::GlobPattern("fo?").match("foo"));
+    }
+
+    void test_root_rules_and_defaults() {
+        write_file(".gitignore", "# Comment\nnode_modules/\n*.log\n/build\n!important.log\n");
+
+        delimit::IgnoreTree tree(root);
+
+        assert_true(tree.is_ignored(path("node_modules"), true));
+        assert_false(tree.is_ignored(path("node_modules"), false));
+        assert_true(tree.is_ignored(path("src/node_modules"), true));
+        assert_true(tree.is_ignored(path("debug.log"), false));
+        assert_false(tree.is_ignored(path("important.log"), false));
+        assert_true(tree.is_ignored(path("build"), true));
+        assert_false(tree.is_ignored(path("src/build"), true));
+
+        // Defaults
+        assert_true(tree.is_ignored(path(".git"), true));
+        assert_true(tree.is_ignored(path("src/module.pyc"), false));
+        assert_false(tree.is_ignored(path("src/module.py"), false));
+    }
+
+    void test_nested_ignore_files() {
+        write_file(".gitignore", "*.tmp\n");
+        write_file("src/.gitignore", "vendor\n!keep.tmp\n");
+
+        delimit::IgnoreTree tree(root);
+
+        assert_true(tree.is_ignored(path("src/vendor"), true));
+        assert_false(tree.is_ignored(path("vendor"), true));
+        assert_true(tree.is_ignored(path("other.tmp"), false));
+        assert_false(tree.is_ignored(path("src/keep.tmp"), false));
+        assert_true(tree.is_ignored(path("src/lose.tmp"), false));
+    }
+
+private:
+    std::string root;
+};
+
+#endif // TEST_GITIGNORE_H
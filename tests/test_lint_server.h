@@ -0,0 +1,69 @@
+#ifndef TEST_LINT_SERVER_H
+#define TEST_LINT_SERVER_H
+
+#include <kaztest/kaztest.h>
+#include "../src/linter/lint_server.h"
+#include "../src/utils/kfs.h"
+
+class LintServerTests : public TestCase {
+public:
+    void test_parse_reply() {
+        using namespace linter;
+
+        LintReply reply;
+        assert_true(parse_lint_reply(
+            "{\"id\": 7, \"errors\": [{\"line\": 1, \"message\": \"'os' imported but unused\"}, {\"line\": 3, \"message\": \"undefined name \\\"x\\\"\"}]}",
+            reply
+        ));
+
+        assert_equal(7, reply.id);
+        assert_true(reply.error.empty());
+        assert_equal(2, reply.errors.size());
+        assert_equal(_u("'os' imported but unused"), reply.errors[0]);
+        assert_equal(_u("undefined name \"x\""), reply.errors[2]);
+
+        assert_true(parse_lint_reply("{\"id\": 8, \"error\": \"pyflakes isn't installed\"}", reply));
+        assert_equal(8, reply.id);
+        assert_equal("pyflakes isn't installed", reply.error);
+        assert_true(reply.errors.empty());
+
+        assert_false(parse_lint_reply("Traceback (most recent call last):", reply));
+        assert_false(parse_lint_reply("{\"errors\": []}", reply));
+    }
+
+    void test_server_answers_each_request() {
+        using namespace linter;
+
+        auto script = kfs::path::join(kfs::path::dir_name(kfs::path::abs_path(__FILE__)), "../data/lint_server.py");
+
+        delimit::SubprocessOptions options;
+        options.argv = {"python3", script};
+        options.input = encode_lint_request(1, "a.py", "import os\n") +
+            encode_lint_request(2, "b \"quoted\".py", "s = \"caf\xc3\xa9\\t\"\n\tif True:\x01\n");
+
+        std::vector<LintReply> replies;
+
+        delimit::Subprocess process(options);
+        process.signal_line().connect([&](delimit::SubprocessStream stream, const std::string& line) {
+            LintReply reply;
+            if(stream == delimit::SUBPROCESS_STDOUT && parse_lint_reply(line, reply)) {
+                replies.push_back(reply);
+            }
+        });
+
+        assert_true(process.run().success());
+        assert_equal(2, replies.size());
+        assert_equal(1, replies[0].id);
+        assert_equal(2, replies[1].id);
+
+        if(replies[0].error.empty()) {
+            // pyflakes is installed, so the source made it through intact
+            assert_equal(1, replies[0].errors.size());
+            assert_equal(0, replies[0].errors.begin()->first);
+            assert_equal(1, replies[1].errors.size());
+            assert_equal(1, replies[1].errors.begin()->first);
+        }
+    }
+};
+
+#endif // TEST_LINT_SERVER_H
@@ -0,0 +1,43 @@
+#ifndef TEST_PLAIN_PARSER_H
+#define TEST_PLAIN_PARSER_H
+
+#include <kaztest/kaztest.h>
+#include "../src/autocomplete/parsers/plain.h"
+
+class PlainParsingTests : public TestCase {
+public:
+    void test_tokenize() {
+        delimit::parser::Plain parser;
+
+        auto words = parser.tokenize("self.value = some_function(x1, \"ab\")\r\n\tcafé+=[1]");
+
+        std::vector<unicode> expected = {"self", "value", "some_function", "x1", "ab", "café", "1"};
+        assert_equal(expected.size(), words.size());
+        for(std::size_t i = 0; i < expected.size(); ++i) {
+            assert_equal(expected[i], words[i]);
+        }
+
+        assert_true(parser.tokenize("").empty());
+        assert_true(parser.tokenize(" ()\n").empty());
+    }
+
+    void test_parse_counts_words() {
+        delimit::parser::Plain parser;
+
+        auto scopes = parser.parse("a b a\nc a b", "").first;
+
+        // Once per word, in the order they first appear
+        assert_equal(3, scopes.size());
+        assert_equal(_u("a"), scopes[0]->path());
+        assert_equal(3, scopes[0]->occurrences);
+        assert_equal(_u("b"), scopes[1]->path());
+        assert_equal(2, scopes[1]->occurrences);
+        assert_equal(_u("c"), scopes[2]->path());
+        assert_equal(1, scopes[2]->occurrences);
+
+        assert_equal(2, scopes[2]->end_line);
+        assert_equal(5, scopes[2]->end_col);
+    }
+};
+
+#endif // TEST_PLAIN_PARSER_H
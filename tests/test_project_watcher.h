@@ -0,0 +1,107 @@
+#ifndef TEST_PROJECT_WATCHER_H
+#define TEST_PROJECT_WATCHER_H
+
+#include <kaztest/kaztest.h>
+#include "../src/utils/project_watcher.h"
+
+class WatchBatchTests : public TestCase {
+public:
+    void set_up() {
+        TestCase::set_up();
+
+        batch = delimit::WatchBatch();
+        batch.add_existing({"/project/main.py", "/project/src/util.py", "/project/src/other.py"});
+    }
+
+    delimit::WatchDelta take() {
+        delimit::WatchDelta delta;
+        batch.take("/project", delta);
+        assert_true(batch.empty());
+        return delta;
+    }
+
+    void test_write_is_a_modification() {
+        batch.record("/project/main.py", false, true, true);
+        batch.record("/project/main.py", false, true, true);
+
+        auto delta = take();
+        assert_equal(1, delta.modified.size());
+        assert_equal("/project/main.py", delta.modified[0]);
+        assert_true(delta.created.empty());
+    }
+
+    void test_atomic_save_is_a_modification() {
+        // The temporary file is written, then renamed over the original
+        batch.record("/project/.main.py.swp", false, true, false);
+        batch.record("/project/.main.py.swp", false, true, true);
+        batch.record("/project/.main.py.swp", false, false, false);
+        batch.record("/project/main.py", false, true, false);
+
+        auto delta = take();
+        assert_equal(1, delta.modified.size());
+        assert_equal("/project/main.py", delta.modified[0]);
+        assert_true(delta.created.empty());
+        assert_true(delta.deleted.empty());
+    }
+
+    void test_delete_then_create_is_a_modification() {
+        batch.record("/project/src/util.py", false, false, false);
+        batch.record("/project/src/util.py", false, true, false);
+
+        auto delta = take();
+        assert_equal(1, delta.modified.size());
+        assert_equal("/project/src/util.py", delta.modified[0]);
+        assert_true(delta.created.empty());
+        assert_true(delta.deleted.empty());
+    }
+
+    void test_new_files_are_created() {
+        batch.record("/project/new.py", false, true, false);
+        batch.record("/project/new.py", false, true, true);
+
+        auto delta = take();
+        assert_equal(1, delta.created.size());
+        assert_equal("/project/new.py", delta.created[0]);
+        assert_true(delta.modified.empty());
+
+        // It's known about now, so saving over it is a modification
+        batch.record("/project/new.py", false, true, false);
+        delta = take();
+        assert_true(delta.created.empty());
+        assert_equal(1, delta.modified.size());
+    }
+
+    void test_file_which_came_and_went_is_left_out() {
+        batch.record("/project/tmp.py", false, true, false);
+        batch.record("/project/tmp.py", false, true, true);
+        batch.record("/project/tmp.py", false, false, false);
+
+        auto delta = take();
+        assert_true(delta.empty());
+    }
+
+    void test_deleted_directory_implies_its_contents() {
+        batch.record("/project/src/util.py", false, false, false);
+        batch.record("/project/src/other.py", false, false, false);
+        batch.record("/project/src", true, false, false);
+
+        auto delta = take();
+        assert_equal(1, delta.deleted_directories.size());
+        assert_equal("/project/src", delta.deleted_directories[0]);
+        assert_true(delta.deleted.empty());
+
+        // Its files have gone, so the same names again are new files
+        batch.record("/project/src", true, true, false);
+        batch.record("/project/src/util.py", false, true, false);
+
+        delta = take();
+        assert_equal(1, delta.created_directories.size());
+        assert_equal(1, delta.created.size());
+        assert_equal("/project/src/util.py", delta.created[0]);
+    }
+
+private:
+    delimit::WatchBatch batch;
+};
+
+#endif // TEST_PROJECT_WATCHER_H
@@ -0,0 +1,193 @@
+#ifndef TEST_PYTHON_HIGHLIGHTER_H
+#define TEST_PYTHON_HIGHLIGHTER_H
+
+#include <map>
+#include <kaztest/kaztest.h>
+#include "../src/highlight/python_highlighter.h"
+
+class PythonHighlighterTests : public TestCase {
+public:
+    typedef std::vector<delimit::highlight::Span> Spans;
+
+    Spans lex(const std::string& line, delimit::highlight::LineState state=delimit::highlight::LINE_CLEAN, delimit::highlight::LineState* next=nullptr) {
+        Spans spans;
+        auto result = delimit::highlight::lex_line(line.data(), line.data() + line.size(), state, spans);
+        if(next) {
+            *next = result;
+        }
+        return spans;
+    }
+
+    void assert_span(const delimit::highlight::Span& span, uint32_t begin, uint32_t end, delimit::highlight::Style style) {
+        assert_equal(begin, span.begin);
+        assert_equal(end, span.end);
+        assert_equal((int) style, (int) span.style);
+    }
+
+    /* Styles every line from scratch, which is what the highlighter must agree with */
+    std::vector<Spans> lex_all(const std::vector<std::string>& lines) {
+        std::vector<Spans> result;
+        auto state = delimit::highlight::LINE_CLEAN;
+        for(auto& line: lines) {
+            result.push_back(lex(line, state, &state));
+        }
+        return result;
+    }
+
+    void test_lex_line() {
+        using namespace delimit::highlight;
+
+        auto spans = lex("@app.route('/') # done");
+        assert_equal(3, spans.size());
+        assert_span(spans[0], 0, 10, STYLE_DECORATOR);
+        assert_span(spans[1], 11, 14, STYLE_STRING);
+        assert_span(spans[2], 16, 22, STYLE_COMMENT);
+
+        spans = lex("    def run(self, x=1.5e-3, y=None): return len(x.type) if x else r'\\''");
+        assert_equal(9, spans.size());
+        assert_span(spans[0], 4, 7, STYLE_KEYWORD);
+        assert_span(spans[1], 8, 11, STYLE_DEFINITION);
+        assert_span(spans[2], 20, 26, STYLE_NUMBER);
+        assert_span(spans[3], 30, 34, STYLE_CONSTANT);
+        assert_span(spans[4], 37, 43, STYLE_KEYWORD);
+        assert_span(spans[5], 44, 47, STYLE_BUILTIN); // Not type, it's an attribute
+        assert_span(spans[6], 56, 58, STYLE_KEYWORD);
+        assert_span(spans[7], 61, 65, STYLE_KEYWORD);
+        assert_span(spans[8], 66, 71, STYLE_STRING);
+
+        // A ä in a name doesn't make it anything else, offsets are in bytes
+        spans = lex("n\xc3\xa4me = 0x1F + 'caf\xc3\xa9'");
+        assert_equal(2, spans.size());
+        assert_span(spans[0], 8, 12, STYLE_NUMBER);
+        assert_span(spans[1], 15, 22, STYLE_STRING);
+    }
+
+    void test_strings_over_lines() {
+        using namespace delimit::highlight;
+
+        LineState state;
+        auto spans = lex("x = '''one ' '' \"\"\" ", LINE_CLEAN, &state);
+        assert_equal((int) LINE_IN_TRIPLE_SINGLE, (int) state);
+        assert_span(spans.back(), 4, 20, STYLE_STRING);
+
+        spans = lex("two \\''' + def", state, &state);
+        assert_equal((int) LINE_IN_TRIPLE_SINGLE, (int) state);
+        assert_equal(1, spans.size());
+
+        spans = lex("three''' + def", state, &state);
+        assert_equal((int) LINE_CLEAN, (int) state);
+        assert_span(spans[0], 0, 8, STYLE_STRING);
+        assert_span(spans[1], 11, 14, STYLE_KEYWORD);
+
+        lex("y = \"carried on \\", LINE_CLEAN, &state);
+        assert_equal((int) LINE_IN_DOUBLE, (int) state);
+        lex("here\" # and ended", state, &state);
+        assert_equal((int) LINE_CLEAN, (int) state);
+
+        // Without a backslash an unclosed string stops at the end of the line
+        lex("z = 'unclosed", LINE_CLEAN, &state);
+        assert_equal((int) LINE_CLEAN, (int) state);
+    }
+
+    void test_edits_restyle_lazily() {
+        using namespace delimit::highlight;
+
+        std::vector<std::string> lines;
+        for(int i = 0; i < 1000; ++i) {
+            lines.push_back((i % 10 == 0) ? "def f(a):" : "    return a + 1 # " + std::to_string(i));
+        }
+
+        std::map<int, Spans> styled;
+        int reads = 0;
+
+        auto read = [&](int line, std::string& text) { text = lines[line]; ++reads; };
+        auto style = [&](int line, const Spans& spans) { styled[line] = spans; };
+
+        PythonHighlighter highlighter(lines.size(), 16);
+
+        // Only what's asked for is styled, and only once
+        assert_equal(100, highlighter.highlight(900, 999, read, style));
+        assert_equal(100, styled.size());
+        assert_equal(0, highlighter.highlight(900, 999, read, style));
+
+        // Starting from a checkpoint just before, not the top
+        reads = 0;
+        highlighter.highlight(950, 960, read, style);
+        assert_true(reads < 11 + 16);
+
+        // An edit which leaves no string open costs lexing as far as the next checkpoint
+        lines[5] = "    return a # changed";
+        highlighter.edit(5, 0, 0);
+        reads = 0;
+        assert_equal(0, highlighter.highlight(900, 999, read, style));
+        assert_true(reads < 100 + 16 + 16);
+
+        // Opening a string changes every line after it, which are restyled when they're looked at
+        lines[5] = "    return '''";
+        highlighter.edit(5, 0, 0);
+        assert_equal(11, highlighter.highlight(0, 10, read, style));
+        assert_equal(100, highlighter.highlight(900, 999, read, style));
+
+        // Then a new line which closes it again
+        lines.insert(lines.begin() + 6, "'''");
+        highlighter.edit(5, 0, 1);
+        assert_equal(1001, highlighter.line_count());
+        assert_equal(6, highlighter.highlight(0, 10, read, style));
+
+        styled.clear();
+        assert_equal(1001 - 11, highlighter.highlight(0, 1000, read, style));
+
+        auto expected = lex_all(lines);
+        for(auto& entry: styled) {
+            assert_true(expected[entry.first] == entry.second);
+        }
+    }
+
+    void test_edits_match_a_fresh_lex() {
+        using namespace delimit::highlight;
+
+        const char* const snippets[] = {"'''", "\"\"\"", "x = 1", "'a\\", "def g():", "# '''", "\"", "\\"};
+
+        std::vector<std::string> lines(300, "class A(object): pass");
+        std::vector<Spans> styled(lines.size());
+
+        auto read = [&](int line, std::string& text) { text = lines[line]; };
+        auto style = [&](int line, const Spans& spans) { styled[line] = spans; };
+
+        PythonHighlighter highlighter(lines.size(), 8);
+        uint32_t seed = 1;
+        auto random = [&](uint32_t n) { seed = seed * 1103515245 + 12345; return (seed >> 8) % n; };
+
+        for(int i = 0; i < 500; ++i) {
+            int line = random(lines.size());
+
+            switch(random(3)) {
+                case 0:
+                    lines[line] += snippets[random(8)];
+                    highlighter.edit(line, 0, 0);
+                    break;
+                case 1:
+                    lines.insert(lines.begin() + line + 1, snippets[random(8)]);
+                    styled.insert(styled.begin() + line + 1, Spans());
+                    highlighter.edit(line, 0, 1);
+                    break;
+                default:
+                    if(line + 1 < (int) lines.size()) {
+                        lines[line] += lines[line + 1];
+                        lines.erase(lines.begin() + line + 1);
+                        styled.erase(styled.begin() + line + 1);
+                        highlighter.edit(line, 1, 0);
+                    }
+                    break;
+            }
+
+            int first = random(lines.size());
+            highlighter.highlight(first, first + 40, read, style);
+        }
+
+        highlighter.highlight(0, lines.size(), read, style);
+        assert_true(lex_all(lines) == styled);
+    }
+};
+
+#endif // TEST_PYTHON_HIGHLIGHTER_H
@@ -1,11 +1,193 @@
 #ifndef TEST_PYTHON_PARSER_H
 #define TEST_PYTHON_PARSER_H
 
+#include <set>
+#include <tuple>
+
 #include <kaztest/kaztest.h>
 #include "../src/autocomplete/parsers/python.h"
 
 class PythonParsingTests : public TestCase {
 public:
+    void assert_token(const delimit::parser::Token& token, delimit::parser::TokenType type, const unicode& str, int start_line, int start_col, int end_line, int end_col) {
+        assert_equal((int) type, (int) token.type);
+        assert_equal(str, token.str);
+        assert_equal(start_line, token.start_pos.first);
+        assert_equal(start_col, token.start_pos.second);
+        assert_equal(end_line, token.end_pos.first);
+        assert_equal(end_col, token.end_pos.second);
+    }
+
+    void test_tokenize_matches_tokenize_py() {
+        using namespace delimit::parser;
+
+        // The expected tokens are what CPython 2.7's tokenize.generate_tokens gives
+        unicode test_data = ""
+"def f(a, b=0x1fL):\n"
+"\tif a <> b:  # compare\n"
+"\t\treturn u\"x\\\"y\" + r'''raw\n"
+" text'''\n"
+"        x = [1.5e3j,\n"
+"   2]\n"
+"val = \"abc\\\n"
+" def\" \\\n"
+"  + 1\n";
+
+        Python parser;
+        auto tokens = parser.tokenize(test_data);
+
+        assert_equal(43, tokens.size());
+        assert_token(tokens[7], NUMBER, "0x1fL", 1, 11, 1, 16);
+        assert_token(tokens[10], NEWLINE, "\n", 1, 18, 1, 19);
+        assert_token(tokens[11], INDENT, "\t", 2, 0, 2, 1);
+        assert_token(tokens[14], OP, "<>", 2, 6, 2, 8);
+        assert_token(tokens[17], COMMENT, "# compare", 2, 13, 2, 22);
+        assert_token(tokens[19], INDENT, "\t\t", 3, 0, 3, 2);
+        assert_token(tokens[21], STRING, "u\"x\\\"y\"", 3, 9, 3, 16);
+        assert_token(tokens[23], STRING, "r'''raw\n text'''", 3, 19, 4, 8);
+
+        // Eight spaces line up with one tab
+        assert_token(tokens[25], DEDENT, "", 5, 8, 5, 8);
+        assert_token(tokens[29], NUMBER, "1.5e3j", 5, 13, 5, 19);
+        assert_token(tokens[31], NL, "\n", 5, 20, 5, 21);
+        assert_token(tokens[35], DEDENT, "", 7, 0, 7, 0);
+        assert_token(tokens[38], STRING, "\"abc\\\n def\"", 7, 6, 8, 5);
+
+        // The backslash continuation doesn't produce a token
+        assert_token(tokens[39], OP, "+", 9, 2, 9, 3);
+        assert_token(tokens[42], ENDMARKER, "", 10, 0, 10, 0);
+    }
+
+    void test_tokenize_errors() {
+        using namespace delimit::parser;
+
+        Python parser;
+
+        // An unterminated string is an error token for the quote (and the space before it)
+        auto tokens = parser.tokenize("x = 'abc\n");
+        assert_token(tokens[2], ERRORTOKEN, " ", 1, 3, 1, 4);
+        assert_token(tokens[3], ERRORTOKEN, "'", 1, 4, 1, 5);
+        assert_token(tokens[4], NAME, "abc", 1, 5, 1, 8);
+
+        // "0x" is a number then a name, as the regular expressions had it
+        tokens = parser.tokenize("0x\n");
+        assert_token(tokens[0], NUMBER, "0", 1, 0, 1, 1);
+        assert_token(tokens[1], NAME, "x", 1, 1, 1, 2);
+
+        // Running out of data inside a string or brackets is an error
+        for(auto data: {"x = '''abc\n", "x = (1,\n"}) {
+            bool raised = false;
+            try {
+                parser.tokenize(data);
+            } catch(std::logic_error& e) {
+                raised = true;
+            }
+            assert_true(raised);
+        }
+    }
+
+    void test_tokenizer_views() {
+        using namespace delimit::parser;
+
+        unicode data = "x **= f(a) <> b\n";
+        Tokenizer tokenizer(data);
+
+        std::vector<TokenView> tokens;
+        TokenView token;
+        while(tokenizer.next(token)) {
+            tokens.push_back(token);
+        }
+
+        assert_equal(10, tokens.size());
+        assert_true(tokenizer.equals(tokens[0], "x"));
+        assert_false(tokenizer.equals(tokens[0], "xy"));
+        assert_equal((int) OP, (int) tokens[1].type);
+        assert_equal((int) DOUBLESTAREQUAL, (int) tokens[1].exact_type);
+        assert_equal((int) LPAR, (int) tokens[3].exact_type);
+        assert_equal((int) RPAR, (int) tokens[5].exact_type);
+        assert_equal((int) NOTEQUAL, (int) tokens[6].exact_type);
+        assert_equal((int) NAME, (int) tokens[7].exact_type);
+        assert_equal(_u("<>"), tokenizer.str(tokens[6]));
+        assert_equal(11, tokens[6].offset);
+        assert_equal(2, tokens[6].length);
+        assert_equal((int) ENDMARKER, (int) tokens[9].type);
+    }
+
+    void test_parsing_functions() {
+        unicode test_data = ""
+"def f(a, b=[], *args, **kwargs):\n"
+"    c = 'x'\n";
+
+        delimit::parser::Python parser;
+        auto scopes = parser.parse(test_data, "m").first;
+
+        assert_equal(6, scopes.size());
+        assert_equal(_u("m.f"), scopes[0]->path());
+        assert_equal(_u("function"), scopes[0]->inherited_paths().at(0));
+        assert_equal(_u("m.f.a"), scopes[1]->path());
+        assert_true(scopes[1]->inherited_paths().empty());
+        assert_equal(_u("list"), scopes[2]->inherited_paths().at(0));
+        assert_equal(_u("m.f.args"), scopes[3]->path());
+        assert_equal(_u("tuple"), scopes[3]->inherited_paths().at(0));
+        assert_equal(_u("m.f.kwargs"), scopes[4]->path());
+        assert_equal(_u("dict"), scopes[4]->inherited_paths().at(0));
+        assert_equal(_u("m.f.c"), scopes[5]->path());
+        assert_equal(_u("str"), scopes[5]->inherited_paths().at(0));
+    }
+
+    void assert_range(const delimit::ScopePtr& scope, const unicode& path, int start_line, int start_col, int end_line, int end_col) {
+        assert_equal(path, scope->path());
+        assert_equal(start_line, scope->start_line);
+        assert_equal(start_col, scope->start_col);
+        assert_equal(end_line, scope->end_line);
+        assert_equal(end_col, scope->end_col);
+    }
+
+    void test_parsing_nested_scopes() {
+        using delimit::Scope;
+
+        unicode test_data = ""
+"class A(object):\n"
+"    i = 1\n"
+"    class B:\n"
+"        def f(self, x=1):\n"
+"            self.y = []\n"
+"            if x:\n"
+"                z = 2\n"
+"    def g(self): pass\n"
+"\n"
+"def h():\n"
+"    return dict(k=1)\n"
+"w = 3\n";
+
+        delimit::parser::Python parser;
+        auto scopes = parser.parse(test_data, "m").first;
+
+        assert_equal(12, scopes.size());
+        assert_range(scopes[0], "m.A", 1, 0, 10, 0);
+        assert_range(scopes[1], "m.A.i", 2, 6, 10, 0);
+        assert_range(scopes[2], "m.A.B", 3, 4, 8, 4);
+        assert_range(scopes[3], "m.A.B.f", 4, 11, 8, 4);
+        assert_equal(_u("instancemethod"), scopes[3]->inherited_paths().at(0));
+        assert_range(scopes[5], "m.A.B.f.x", 4, 11, 8, 4);
+        assert_equal((int) Scope::KIND_ARGUMENT, (int) scopes[5]->kind);
+
+        // Attributes of self belong to the class
+        assert_range(scopes[6], "m.A.B.y", 5, 19, 8, 4);
+        assert_equal(_u("list"), scopes[6]->inherited_paths().at(0));
+        assert_range(scopes[7], "m.A.B.f.z", 7, 18, 8, 4);
+
+        // A body on the same line as the colon ends with the line
+        assert_range(scopes[8], "m.A.g", 8, 7, 8, 22);
+        assert_equal((int) Scope::KIND_FUNCTION, (int) scopes[8]->kind);
+
+        // Keyword arguments aren't assignments, and the top level lasts until the end
+        assert_range(scopes[10], "m.h", 10, 3, 12, 0);
+        assert_equal(_u("function"), scopes[10]->inherited_paths().at(0));
+        assert_range(scopes[11], "m.w", 12, 2, 0, 0);
+        assert_equal((int) Scope::KIND_VARIABLE, (int) scopes[11]->kind);
+    }
+
     void test_parsing_classes() {
         unicode test_data = ""
 "class A(object):\n"
@@ -69,6 +251,195 @@ public:
         assert_equal("A.method.self", scopes.at(6)->path());
         assert_equal("A", scopes.at(6)->inherited_paths().at(0));*/
     }
+
+    void assert_same_as_fresh(const delimit::parser::PythonBuffer& buffer) {
+        using namespace delimit::parser;
+
+        Tokenizer tokenizer(buffer.text());
+        TokenView token;
+        std::size_t i = 0;
+
+        while(tokenizer.next(token)) {
+            auto& kept = buffer.tokens().at(i++);
+            assert_equal((int) token.exact_type, (int) kept.exact_type);
+            assert_equal(token.offset, kept.offset);
+            assert_equal(token.length, kept.length);
+            assert_equal(token.start_pos.first, kept.start_pos.first);
+            assert_equal(token.start_pos.second, kept.start_pos.second);
+        }
+        assert_equal(i, buffer.tokens().size());
+
+        auto fresh = Python().parse(buffer.text(), "m").first;
+        auto scopes = buffer.scopes();
+
+        assert_equal(fresh.size(), scopes.size());
+        for(std::size_t j = 0; j < fresh.size(); ++j) {
+            assert_equal(fresh[j]->path(), scopes[j]->path());
+            assert_equal(fresh[j]->start_line, scopes[j]->start_line);
+            assert_equal(fresh[j]->end_line, scopes[j]->end_line);
+        }
+    }
+
+    void test_buffer_edits() {
+        using namespace delimit::parser;
+
+        unicode test_data = ""
+"class A(object):\n"
+"    def f(self):\n"
+"        x = 1\n"
+"\n"
+"def g():\n"
+"    return '''a\n"
+"b'''\n"
+"y = []\n";
+
+        PythonBuffer buffer("m");
+        buffer.set_text(test_data);
+        assert_same_as_fresh(buffer);
+
+        buffer.insert(test_data.find("\ndef g"), "\n    z = {}");
+        assert_same_as_fresh(buffer);
+
+        // A string which is never closed swallows the rest of the file, until it's taken away
+        int quote = buffer.text().find("return") + 7;
+        buffer.insert(quote, "'''");
+        assert_true(buffer.has_error());
+        buffer.erase(quote, 3);
+        assert_false(buffer.has_error());
+        assert_same_as_fresh(buffer);
+
+        // An unclosed bracket doesn't tokenize, what came before it is kept
+        int bracket = buffer.text().find("[]");
+        buffer.erase(bracket + 1, 1);
+        assert_true(buffer.has_error());
+        buffer.insert(bracket + 1, "]");
+        assert_false(buffer.has_error());
+        assert_same_as_fresh(buffer);
+
+        buffer.erase(0, buffer.text().find("def g"));
+        assert_same_as_fresh(buffer);
+    }
+
+    void test_buffer_change() {
+        using namespace delimit::parser;
+
+        unicode test_data = ""
+"def f():\n"
+"    pass\n"
+"\n"
+"def g():\n"
+"    pass\n"
+"y = 2\n";
+
+        PythonBuffer buffer("m");
+        auto change = buffer.set_text(test_data);
+        assert_equal(3, change.scopes.added.size());
+        assert_true(change.scopes.removed.empty());
+
+        // A new line at the end of f only changes f, everything from g on moves down a line
+        change = buffer.insert(test_data.find("\ndef g"), "    z = 0\n");
+        assert_equal(3, change.first_line);
+        assert_equal(3, change.old_end_line);
+        assert_equal(4, change.new_end_line);
+        assert_equal(4, change.tokens.size()); // z, =, 0 and the NEWLINE
+
+        assert_equal(1, change.scopes.removed.size());
+        assert_equal(_u("m.f"), change.scopes.removed[0]->path());
+        assert_equal(2, change.scopes.added.size());
+        assert_equal(_u("m.f.z"), change.scopes.added[1]->path());
+        assert_equal(3, change.scopes.added[1]->start_line);
+        assert_equal(4, change.scopes.from_line);
+        assert_equal(1, change.scopes.line_shift);
+
+        auto scopes = buffer.scopes();
+        assert_equal(_u("m.y"), scopes.back()->path());
+        assert_equal(7, scopes.back()->start_line);
+    }
+
+    void test_buffer_resumes_at_top_level() {
+        using namespace delimit::parser;
+
+        // The NEWLINE after an error token is swallowed, so the builder is still inside the line
+        unicode test_data = "  v = '\\\n\nf()\nclass B:";
+
+        PythonBuffer buffer("m");
+        buffer.set_text(test_data.slice(0, 11));
+        for(int i = 11; i < (int) test_data.length(); i += 7) {
+            buffer.insert(i - 11, test_data.slice(i, std::min(i + 7, (int) test_data.length())));
+            assert_same_as_fresh(buffer);
+        }
+        buffer.erase(0, 11);
+        assert_same_as_fresh(buffer);
+
+        // Typing one character at a time resumes from every statement on the way. An
+        // unfinished string can't be parsed from scratch, so those steps are skipped
+        for(unicode text: {
+            _u("class B: p= 'abc\\\n\n=:y = {}\n    y = {}"),
+            _u("def y():class B:class B: p= 'abc\\\ny = {}\nclass B: p= 'abc\\\np")
+        }) {
+            PythonBuffer typed("m");
+            for(int i = 0; i < (int) text.length(); ++i) {
+                typed.insert(i, text.slice(i, i + 1));
+                if(!typed.has_error()) {
+                    assert_same_as_fresh(typed);
+                }
+            }
+        }
+    }
+
+    typedef std::multiset<std::tuple<unicode, int, int>> ScopeRows;
+
+    ScopeRows scope_rows(const std::vector<delimit::ScopePtr>& scopes) {
+        ScopeRows rows;
+        for(auto& scope: scopes) {
+            rows.insert(std::make_tuple(scope->path(), scope->start_line, scope->end_line));
+        }
+        return rows;
+    }
+
+    void test_buffer_scope_deltas() {
+        using namespace delimit::parser;
+
+        // Applying every delta the way the datastore does gives the scopes of the whole file
+        for(unicode text: {
+            _u("class A(object):\n    def f(self):\n        x = 1\n\ndef g():\n    return 2\ny = []\n"),
+            _u("  v = '\\\n\nf()\nclass B:"),
+            _u("class B: p= 'abc\\\n\n=:y = {}\n    y = {}"),
+            _u("def y():class B:class B: p= 'abc\\\ny = {}\nclass B: p= 'abc\\\np")
+        }) {
+            PythonBuffer buffer("m");
+            ScopeRows rows;
+
+            for(int i = 0; i < (int) text.length(); ++i) {
+                auto delta = buffer.insert(i, text.slice(i, i + 1)).scopes;
+
+                for(auto& scope: delta.removed) {
+                    auto it = rows.find(std::make_tuple(scope->path(), scope->start_line, scope->end_line));
+                    assert_true(it != rows.end());
+                    rows.erase(it);
+                }
+
+                ScopeRows moved;
+                for(auto& row: rows) {
+                    int start_line = std::get<1>(row), end_line = std::get<2>(row);
+                    moved.insert(std::make_tuple(
+                        std::get<0>(row),
+                        (start_line >= delta.from_line) ? start_line + delta.line_shift : start_line,
+                        (end_line >= delta.from_line) ? end_line + delta.line_shift : end_line
+                    ));
+                }
+                rows.swap(moved);
+
+                for(auto& scope: delta.added) {
+                    rows.insert(std::make_tuple(scope->path(), scope->start_line, scope->end_line));
+                }
+
+                if(!buffer.has_error()) {
+                    assert_true(rows == scope_rows(Python().parse(buffer.text(), "m").first));
+                }
+            }
+        }
+    }
 };
 
 #endif // TEST_PYTHON_PARSER_H
@@ -0,0 +1,93 @@
+#ifndef TEST_SCOPE_TREE_H
+#define TEST_SCOPE_TREE_H
+
+#include <algorithm>
+#include <kaztest/kaztest.h>
+#include "../src/autocomplete/scope_tree.h"
+
+class ScopeTreeTests : public TestCase {
+public:
+    delimit::ScopeRange range(const std::string& path, int start_line, int start_col, int end_line, int end_col) {
+        delimit::ScopeRange result;
+        result.path = path;
+        result.start_line = start_line;
+        result.start_col = start_col;
+        result.end_line = end_line;
+        result.end_col = end_col;
+        return result;
+    }
+
+    delimit::ScopeTree build() {
+        /*
+         *  1  class A:
+         *  2      x = 1
+         *  3      def method(self):
+         *  4          y = 2
+         *  5
+         *  6  def function():
+         *  7      z = 3
+         */
+        return delimit::ScopeTree({
+            range("mod.function", 6, 0, 7, 9),
+            range("mod.A", 1, 0, 5, 0),
+            range("mod.A.x", 2, 4, 2, 9),
+            range("mod.A.method", 3, 4, 5, 0),
+            range("mod.A.method.self", 3, 15, 3, 19),
+            range("mod.A.method.y", 4, 8, 4, 13),
+            range("mod.function.z", 7, 4, 7, 9)
+        });
+    }
+
+    void test_innermost() {
+        auto tree = build();
+
+        assert_equal("mod.A.method", tree.innermost(4, 2)->path);
+        assert_equal("mod.A.method.y", tree.innermost(4, 10)->path);
+        assert_equal("mod.A", tree.innermost(2, 0)->path);
+        assert_equal("mod.function", tree.innermost(6, 5)->path);
+        assert_true(tree.innermost(0, 0) == nullptr);
+        assert_true(tree.innermost(8, 0) == nullptr);
+
+        // After a nested scope has closed we're back in its parent
+        assert_equal("mod.A", tree.innermost(2, 10)->path);
+    }
+
+    void test_enclosing() {
+        auto tree = build();
+
+        auto scopes = tree.enclosing(4, 10);
+        assert_equal(3, scopes.size());
+        assert_equal("mod.A.method.y", scopes[0]->path);
+        assert_equal("mod.A.method", scopes[1]->path);
+        assert_equal("mod.A", scopes[2]->path);
+    }
+
+    void test_visible_names() {
+        auto tree = build();
+
+        auto names = tree.visible_names(4, 2);
+
+        // Innermost first, then the enclosing class, then the module level
+        assert_equal("self", names[0]);
+        assert_equal("y", names[1]);
+        assert_true(std::find(names.begin(), names.end(), "x") != names.end());
+        assert_true(std::find(names.begin(), names.end(), "function") != names.end());
+        assert_true(std::find(names.begin(), names.end(), "z") == names.end());
+
+        auto module_names = tree.visible_names(0, 0);
+        assert_equal(2, module_names.size());
+    }
+
+    void test_invalid_ranges_cover_their_start() {
+        delimit::ScopeTree tree({
+            range("a", 1, 0, 0, 0),
+            range("b", 2, 0, 10, 0)
+        });
+
+        assert_equal("a", tree.innermost(1, 0)->path);
+        assert_true(tree.innermost(1, 1) == nullptr);
+        assert_equal("b", tree.innermost(3, 0)->path);
+    }
+};
+
+#endif // TEST_SCOPE_TREE_H
@@ -0,0 +1,137 @@
+#ifndef TEST_SUBPROCESS_H
+#define TEST_SUBPROCESS_H
+
+#include <chrono>
+#include <kaztest/kaztest.h>
+#include "../src/utils/subprocess.h"
+
+class SubprocessTests : public TestCase {
+public:
+    delimit::SubprocessOptions sh(const std::string& script) {
+        // The shell is the program under test here, nothing else goes through one
+        delimit::SubprocessOptions options;
+        options.argv = {"sh", "-c", script};
+        return options;
+    }
+
+    void test_output_and_exit_status() {
+        using namespace delimit;
+
+        Subprocess process(sh("echo one; echo two >&2; printf 'three\\nfour'; exit 3"));
+
+        std::vector<std::string> out, err;
+        process.signal_line().connect([&](SubprocessStream stream, const std::string& line) {
+            ((stream == SUBPROCESS_STDOUT) ? out : err).push_back(line);
+        });
+
+        bool finished = false;
+        process.signal_finished().connect([&](const SubprocessResult&) { finished = true; });
+
+        auto& result = process.run();
+
+        assert_true(result.started);
+        assert_true(finished);
+        assert_equal(3, result.exit_status);
+        assert_false(result.success());
+        assert_equal("one\nthree\nfour", result.out);
+        assert_equal("two\n", result.err);
+
+        assert_equal(3, out.size());
+        assert_equal("four", out[2]); // Without a newline, but still a line
+        assert_equal(1, err.size());
+    }
+
+    void test_arguments_cwd_and_environment() {
+        using namespace delimit;
+
+        SubprocessOptions options;
+        options.argv = {"sh", "-c", "pwd; echo \"$1\"; echo \"$DELIMIT_TEST\"", "sh", "two words; $HOME"};
+        options.cwd = "/";
+        options.environment["DELIMIT_TEST"] = "set";
+
+        Subprocess process(options);
+        assert_equal("/\ntwo words; $HOME\nset\n", process.run().out);
+    }
+
+    void test_input() {
+        using namespace delimit;
+
+        auto options = sh("tr a-z A-Z");
+        options.input = "shout\n";
+
+        Subprocess process(options);
+        assert_equal("SHOUT\n", process.run().out);
+    }
+
+    void test_timeout_kills_the_process_group() {
+        using namespace delimit;
+
+        auto options = sh("sleep 10 & sleep 10; echo never");
+        options.timeout_ms = 100;
+
+        auto start = std::chrono::steady_clock::now();
+
+        Subprocess process(options);
+        auto& result = process.run();
+
+        assert_true(result.timed_out);
+        assert_equal(9, result.signal);
+        assert_equal("", result.out);
+        assert_true(std::chrono::steady_clock::now() - start < std::chrono::seconds(5));
+    }
+
+    void test_no_lines_after_cancel() {
+        using namespace delimit;
+
+        // Both lines arrive in one read, the second is already waiting when the first is handled
+        Subprocess process(sh("printf 'one\\ntwo\\n'; echo three >&2; sleep 10"));
+
+        int lines = 0;
+        process.signal_line().connect([&](SubprocessStream, const std::string&) {
+            ++lines;
+            process.cancel();
+        });
+
+        bool finished = false;
+        process.signal_finished().connect([&](const SubprocessResult&) { finished = true; });
+
+        auto start = std::chrono::steady_clock::now();
+        auto& result = process.run();
+
+        assert_true(result.cancelled);
+        assert_equal(1, lines);
+        assert_false(finished);
+        assert_true(std::chrono::steady_clock::now() - start < std::chrono::seconds(5));
+    }
+
+    void test_missing_program() {
+        using namespace delimit;
+
+        SubprocessOptions options;
+        options.argv = {"delimit-no-such-program"};
+
+        Subprocess process(options);
+        assert_false(process.start());
+        assert_false(process.result().started);
+        assert_false(process.result().error.empty());
+
+        // Without a PATH the usual places are looked in, as the shell would
+        auto no_path = sh("exit 0");
+        no_path.inherit_environment = false;
+        Subprocess without_path(no_path);
+        assert_true(without_path.run().success());
+
+        SubprocessOptions no_directory;
+        no_directory.argv = {"true"};
+        no_directory.cwd = "/delimit-no-such-directory";
+
+        Subprocess nowhere(no_directory);
+        assert_false(nowhere.start());
+        assert_false(nowhere.result().error.empty());
+
+        assert_equal("", delimit::find_program("delimit-no-such-program"));
+        assert_false(delimit::find_program("sh").empty());
+    }
+};
+
+#endif // TEST_SUBPROCESS_H
@@ -0,0 +1,85 @@
+#ifndef TEST_SYMBOLS_H
+#define TEST_SYMBOLS_H
+
+#include <kaztest/kaztest.h>
+#include "../src/symbols/extractors.h"
+
+class SymbolExtractorTests : public TestCase {
+public:
+    void assert_symbol(const delimit::Symbol& symbol, const unicode& name, delimit::SymbolType type, int line_number) {
+        assert_equal(name, symbol.name);
+        assert_equal((int) type, (int) symbol.type);
+        assert_equal(line_number, symbol.line_number);
+    }
+
+    void test_javascript() {
+        using namespace delimit;
+
+        std::string data = ""
+"const API = '/api', re = /[}{'\"]/g;\n"
+"function load(url) {\n"
+"    var inner = `${url}\n"
+"    {`;\n"
+"    return fetch(url).then(function done(r) { return r / 2; });\n"
+"}\n"
+"/* class Commented {} */\n"
+"class View extends Base {\n"
+"    constructor(el) { super(el); this.class = 1; }\n"
+"    static *items() { yield 1; }\n"
+"    handler = () => { if(x) {} };\n"
+"}\n";
+
+        auto symbols = javascript_symbols("a.js", data);
+
+        assert_equal(6, symbols.size());
+        assert_symbol(symbols[0], "API", VARIABLE, 0);
+        assert_symbol(symbols[1], "load", FUNCTION, 1);
+        assert_symbol(symbols[2], "done", FUNCTION, 4);
+        assert_symbol(symbols[3], "View", CLASS, 7);
+        assert_symbol(symbols[4], "constructor", METHOD, 8);
+        assert_symbol(symbols[5], "items", METHOD, 9);
+    }
+
+    void test_c_family() {
+        using namespace delimit;
+
+        std::string data = ""
+"#define MAX(a, b) ((a) > (b) ? (a) : (b))\n"
+"#define LIMIT 10\n"
+"struct point;\n"
+"namespace app {\n"
+"template<typename T, class U=std::vector<T>>\n"
+"class Widget : public Base<T>, private Other {\n"
+"public:\n"
+"    Widget(int x): x_{x}, y_(0) {}\n"
+"    virtual ~Widget() = default;\n"
+"    bool operator==(const Widget& rhs) const;\n"
+"    int x_ = compute(1);\n"
+"    enum class Kind : int { A, B };\n"
+"};\n"
+"static int helper(int a, /* ) */ char b);\n"
+"void Widget::draw() const {\n"
+"    if(x_) { struct inner { void f() {} }; }\n"
+"}\n"
+"}\n"
+"extern \"C\" {\n"
+"int c_api(void) { return 0; }\n"
+"}\n";
+
+        auto symbols = c_symbols("a.cpp", data);
+
+        assert_equal(10, symbols.size());
+        assert_symbol(symbols[0], "MAX", FUNCTION, 0);
+        assert_symbol(symbols[1], "LIMIT", VARIABLE, 1);
+        assert_symbol(symbols[2], "app", NAMESPACE, 3);
+        assert_symbol(symbols[3], "Widget", CLASS, 5);
+        assert_symbol(symbols[4], "Widget", METHOD, 7);
+        assert_symbol(symbols[5], "~Widget", METHOD, 8);
+        assert_symbol(symbols[6], "operator==", METHOD, 9);
+        assert_symbol(symbols[7], "Kind", CLASS, 11);
+        assert_symbol(symbols[8], "draw", METHOD, 14);
+        assert_symbol(symbols[9], "c_api", FUNCTION, 19);
+    }
+};
+
+#endif // TEST_SYMBOLS_H
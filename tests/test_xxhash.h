@@ -0,0 +1,32 @@
+#ifndef TEST_XXHASH_H
+#define TEST_XXHASH_H
+
+#include <kaztest/kaztest.h>
+#include "../src/utils/xxhash.h"
+
+class XXHashTests : public TestCase {
+public:
+    void test_known_values() {
+        assert_true(delimit::xxh64("") == 0xef46db3751d8e999ULL);
+        assert_true(delimit::xxh64("a") == 0xd24ec4f1a98c6e5bULL);
+        assert_true(delimit::xxh64("abc") == 0x44bc2cf5ad770999ULL);
+        assert_true(delimit::xxh64(std::string("abc"), 1) == 0xbea9ca8199328908ULL);
+        assert_true(delimit::xxh64("The quick brown fox jumps over the lazy dog") == 0x0b242d361fda71bcULL);
+    }
+
+    void test_long_input() {
+        // Long enough to go through the four lane loop
+        std::string data;
+        for(int i = 0; i < 512; ++i) {
+            data.push_back(char(i % 256));
+        }
+
+        assert_true(delimit::xxh64(data) == 0x7b3bfcaac0348ac0ULL);
+
+        // Alignment shouldn't matter
+        std::string shifted = "x" + data;
+        assert_true(delimit::xxh64(shifted.data() + 1, data.length()) == 0x7b3bfcaac0348ac0ULL);
+    }
+};
+
+#endif // TEST_XXHASH_H